@@ -23,6 +23,8 @@
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "hw/hw.h"
 #include "hw/pci/msi.h"
@@ -30,6 +32,7 @@
 #include "hw/s390x/adapter.h"
 #include "exec/gdbstub.h"
 #include "sysemu/kvm_int.h"
+#include "sysemu/kvm_dirty_range.h"
 #include "sysemu/cpus.h"
 #include "qemu/bswap.h"
 #include "exec/memory.h"
@@ -52,6 +55,14 @@
  */
 #define PAGE_SIZE getpagesize()
 
+/* Only architectures with dirty ring support define it */
+#ifndef KVM_DIRTY_LOG_PAGE_OFFSET
+#define KVM_DIRTY_LOG_PAGE_OFFSET 0
+#endif
+
+/* How often the reaper thread collects the dirty rings */
+#define KVM_DIRTY_RING_REAP_INTERVAL_US 100000
+
 //#define DEBUG_KVM
 
 #ifdef DEBUG_KVM
@@ -67,6 +78,7 @@
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
     int kvm_fd;
+    uint32_t kvm_fetch_index;
     QLIST_ENTRY(KVMParkedVcpu) node;
 };
 
@@ -104,6 +116,14 @@ struct KVMState
 #endif
     KVMMemoryListener memory_listener;
     QLIST_HEAD(, KVMParkedVcpu) kvm_parked_vcpus;
+    /* the memory listener of each address space, indexed by as_id */
+    KVMMemoryListener **as_listeners;
+    int nr_as;
+
+    /* entries in the dirty ring of each vCPU, 0 if the bitmap is used */
+    uint32_t kvm_dirty_ring_size;
+    uint64_t kvm_dirty_ring_bytes;
+    QemuThread kvm_dirty_ring_reaper;
 
     /* memory encryption */
     void *memcrypt_handle;
@@ -129,6 +149,8 @@ bool kvm_ioeventfd_any_length_allowed;
 bool kvm_msi_use_devid;
 static bool kvm_immediate_exit;
 
+static uint64_t kvm_dirty_ring_reap(KVMState *s);
+
 static const KVMCapabilityInfo kvm_required_capabilites[] = {
     KVM_CAP_INFO(USER_MEMORY),
     KVM_CAP_INFO(DESTROY_MEMORY_REGION_WORKS),
@@ -301,15 +323,27 @@ int kvm_destroy_vcpu(CPUState *cpu)
         goto err;
     }
 
+    if (cpu->kvm_dirty_gfns) {
+        /* The ring is kept with the parked vCPU, but empty it first */
+        kvm_dirty_ring_reap(s);
+        ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (ret < 0) {
+            goto err;
+        }
+        cpu->kvm_dirty_gfns = NULL;
+    }
+
     vcpu = g_malloc0(sizeof(*vcpu));
     vcpu->vcpu_id = kvm_arch_vcpu_id(cpu);
     vcpu->kvm_fd = cpu->kvm_fd;
+    vcpu->kvm_fetch_index = cpu->kvm_fetch_index;
     QLIST_INSERT_HEAD(&kvm_state->kvm_parked_vcpus, vcpu, node);
 err:
     return ret;
 }
 
-static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
+static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id,
+                        uint32_t *fetch_index)
 {
     struct KVMParkedVcpu *cpu;
 
@@ -319,11 +353,14 @@ static int kvm_get_vcpu(KVMState *s, unsigned long vcpu_id)
 
             QLIST_REMOVE(cpu, node);
             kvm_fd = cpu->kvm_fd;
+            /* The kernel resumes filling the dirty ring where it stopped */
+            *fetch_index = cpu->kvm_fetch_index;
             g_free(cpu);
             return kvm_fd;
         }
     }
 
+    *fetch_index = 0;
     return kvm_vm_ioctl(s, KVM_CREATE_VCPU, (void *)vcpu_id);
 }
 
@@ -335,7 +372,7 @@ int kvm_init_vcpu(CPUState *cpu)
 
     DPRINTF("kvm_init_vcpu\n");
 
-    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu));
+    ret = kvm_get_vcpu(s, kvm_arch_vcpu_id(cpu), &cpu->kvm_fetch_index);
     if (ret < 0) {
         DPRINTF("kvm_create_vcpu failed\n");
         goto err;
@@ -365,6 +402,19 @@ int kvm_init_vcpu(CPUState *cpu)
             (void *)cpu->kvm_run + s->coalesced_mmio * PAGE_SIZE;
     }
 
+    if (s->kvm_dirty_ring_size) {
+        cpu->kvm_dirty_gfns = mmap(NULL, s->kvm_dirty_ring_bytes,
+                                   PROT_READ | PROT_WRITE, MAP_SHARED,
+                                   cpu->kvm_fd,
+                                   PAGE_SIZE * KVM_DIRTY_LOG_PAGE_OFFSET);
+        if (cpu->kvm_dirty_gfns == MAP_FAILED) {
+            cpu->kvm_dirty_gfns = NULL;
+            ret = -errno;
+            DPRINTF("mmap'ing vcpu dirty ring failed\n");
+            goto err;
+        }
+    }
+
     ret = kvm_arch_init_vcpu(cpu);
 err:
     return ret;
@@ -527,6 +577,164 @@ static int kvm_physical_sync_dirty_bitmap(KVMMemoryListener *kml,
     return 0;
 }
 
+/*
+ * With the dirty ring, each vCPU pushes the guest frames it dirties into a
+ * ring shared with QEMU, instead of setting a bit in the bitmap of the
+ * memslot.  Collecting the rings only touches the pages that were
+ * dirtied, and marks them in ram_list.dirty_memory right away.
+ */
+static uint64_t kvm_dirty_ring_slot_pages(void *opaque, uint32_t as_id,
+                                          uint32_t slot_id)
+{
+    KVMState *s = opaque;
+
+    if (!s->as_listeners[as_id]) {
+        return 0;
+    }
+    return s->as_listeners[as_id]->slots[slot_id].memory_size /
+           qemu_real_host_page_size;
+}
+
+/*
+ * Ring entries land in ram_list.dirty_memory like those of the dirty
+ * bitmap, so every consumer sees them the same way.  This only saves the
+ * KVM_GET_DIRTY_LOG copies: migration still walks its whole bitmap when
+ * it syncs.
+ */
+static void kvm_dirty_ring_set_dirty(void *opaque, uint32_t as_id,
+                                     uint32_t slot_id, uint64_t start,
+                                     uint64_t npages)
+{
+    KVMState *s = opaque;
+    KVMSlot *mem = &s->as_listeners[as_id]->slots[slot_id];
+
+    cpu_physical_memory_set_dirty_range(
+        mem->ram_start_offset + start * qemu_real_host_page_size,
+        npages * qemu_real_host_page_size,
+        tcg_enabled() ? DIRTY_CLIENTS_ALL : DIRTY_CLIENTS_NOCODE);
+}
+
+static const KVMDirtyRangeOps kvm_dirty_ring_range_ops = {
+    .slot_pages = kvm_dirty_ring_slot_pages,
+    .set_dirty = kvm_dirty_ring_set_dirty,
+};
+
+static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu,
+                                        KVMDirtyRange *range)
+{
+    struct kvm_dirty_gfn *gfns = cpu->kvm_dirty_gfns;
+    uint32_t mask = s->kvm_dirty_ring_size - 1;
+    uint32_t count = 0;
+
+    while (true) {
+        struct kvm_dirty_gfn *cur = &gfns[cpu->kvm_fetch_index & mask];
+
+        /* Read the flags before the rest of the entry */
+        if (!(atomic_load_acquire(&cur->flags) & KVM_DIRTY_GFN_F_DIRTY)) {
+            break;
+        }
+        kvm_dirty_range_add(range, cur->slot, cur->offset);
+        /* Let the kernel reuse the entry on the next KVM_RESET_DIRTY_RINGS */
+        atomic_store_release(&cur->flags, KVM_DIRTY_GFN_F_RESET);
+        cpu->kvm_fetch_index++;
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * kvm_dirty_ring_reap: collect the dirty rings of all vCPUs
+ *
+ * Must be called with the iothread lock held, which also protects the
+ * memslots against changes.  Pages that a running vCPU dirtied may still
+ * be buffered by the processor; see kvm_log_sync_global().
+ *
+ * Returns the number of collected entries.
+ */
+static uint64_t kvm_dirty_ring_reap(KVMState *s)
+{
+    KVMDirtyRange range;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t total = 0;
+    CPUState *cpu;
+    int ret;
+
+    kvm_dirty_range_init(&range, &kvm_dirty_ring_range_ops, s, s->nr_as,
+                         s->nr_slots);
+    CPU_FOREACH(cpu) {
+        if (cpu->kvm_dirty_gfns) {
+            total += kvm_dirty_ring_reap_one(s, cpu, &range);
+        }
+    }
+    kvm_dirty_range_flush(&range);
+
+    if (total) {
+        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+        if (ret < 0) {
+            error_report("KVM_RESET_DIRTY_RINGS failed: %s", strerror(-ret));
+            abort();
+        }
+    }
+
+    trace_kvm_dirty_ring_reap(total,
+                              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    return total;
+}
+
+static void *kvm_dirty_ring_reaper_thread(void *opaque)
+{
+    KVMState *s = opaque;
+
+    rcu_register_thread();
+
+    /* Collect the rings in the background, so that they seldom fill up */
+    while (true) {
+        g_usleep(KVM_DIRTY_RING_REAP_INTERVAL_US);
+
+        qemu_mutex_lock_iothread();
+        kvm_dirty_ring_reap(s);
+        qemu_mutex_unlock_iothread();
+    }
+
+    return NULL;
+}
+
+static int kvm_dirty_ring_init(KVMState *s, MachineState *ms)
+{
+    uint32_t ring_size = machine_kvm_dirty_ring_size(ms);
+    uint64_t ring_bytes = (uint64_t)ring_size * sizeof(struct kvm_dirty_gfn);
+    int ret;
+
+    if (!ring_size) {
+        return 0;
+    }
+
+    ret = kvm_vm_check_extension(s, KVM_CAP_DIRTY_LOG_RING);
+    if (ret <= 0) {
+        warn_report("KVM does not support the dirty ring, "
+                    "using the dirty bitmap");
+        return 0;
+    }
+    if (ring_bytes > ret) {
+        error_report("kvm-dirty-ring-size %" PRIu32 " is too large, "
+                     "the maximum is %zu", ring_size,
+                     ret / sizeof(struct kvm_dirty_gfn));
+        return -EINVAL;
+    }
+
+    ret = kvm_vm_enable_cap(s, KVM_CAP_DIRTY_LOG_RING, 0, ring_bytes);
+    if (ret) {
+        error_report("Enabling the KVM dirty ring of %" PRIu32
+                     " entries failed: %s", ring_size, strerror(-ret));
+        return ret;
+    }
+
+    s->kvm_dirty_ring_size = ring_size;
+    s->kvm_dirty_ring_bytes = ring_bytes;
+    return 0;
+}
+
 static void kvm_coalesce_mmio_region(MemoryListener *listener,
                                      MemoryRegionSection *secion,
                                      hwaddr start, hwaddr size)
@@ -750,7 +958,11 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             return;
         }
         if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-            kvm_physical_sync_dirty_bitmap(kml, section);
+            if (kvm_state->kvm_dirty_ring_size) {
+                kvm_dirty_ring_reap(kvm_state);
+            } else {
+                kvm_physical_sync_dirty_bitmap(kml, section);
+            }
         }
 
         /* unregister the slot */
@@ -769,6 +981,9 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     mem->memory_size = size;
     mem->start_addr = start_addr;
     mem->ram = ram;
+    mem->ram_start_offset = memory_region_get_ram_addr(mr) +
+                            section->offset_within_region +
+                            (start_addr - section->offset_within_address_space);
     mem->flags = kvm_mem_flags(mr);
 
     err = kvm_set_user_memory_region(kml, mem);
@@ -809,6 +1024,21 @@ static void kvm_log_sync(MemoryListener *listener,
     }
 }
 
+static void do_kvm_dirty_ring_kick(CPUState *cpu, run_on_cpu_data arg)
+{
+}
+
+static void kvm_log_sync_global(MemoryListener *listener)
+{
+    CPUState *cpu;
+
+    /* Exit all vCPUs, so that the pages they logged reach the rings */
+    CPU_FOREACH(cpu) {
+        run_on_cpu(cpu, do_kvm_dirty_ring_kick, RUN_ON_CPU_NULL);
+    }
+    kvm_dirty_ring_reap(kvm_state);
+}
+
 static void kvm_mem_ioeventfd_add(MemoryListener *listener,
                                   MemoryRegionSection *section,
                                   bool match_data, uint64_t data,
@@ -894,9 +1124,18 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
     kml->listener.log_stop = kvm_log_stop;
-    kml->listener.log_sync = kvm_log_sync;
+    if (!s->kvm_dirty_ring_size) {
+        kml->listener.log_sync = kvm_log_sync;
+    } else if (as_id == 0) {
+        /* One sync collects the rings for all address spaces */
+        kml->listener.log_sync_global = kvm_log_sync_global;
+    }
     kml->listener.priority = 10;
 
+    if (as_id < s->nr_as) {
+        s->as_listeners[as_id] = kml;
+    }
+
     memory_listener_register(&kml->listener, as);
 }
 
@@ -1583,6 +1822,18 @@ static int kvm_init(MachineState *ms)
 
     s->vmfd = ret;
 
+    s->nr_as = kvm_check_extension(s, KVM_CAP_MULTI_ADDRESS_SPACE);
+    if (s->nr_as <= 1) {
+        s->nr_as = 1;
+    }
+    s->as_listeners = g_new0(KVMMemoryListener *, s->nr_as);
+
+    /* Must be done before creating the vCPUs */
+    ret = kvm_dirty_ring_init(s, ms);
+    if (ret < 0) {
+        goto err;
+    }
+
     /* check the vcpu limits */
     soft_vcpus_limit = kvm_recommended_vcpus(s);
     hard_vcpus_limit = kvm_max_vcpus(s);
@@ -1696,6 +1947,12 @@ static int kvm_init(MachineState *ms)
     memory_listener_register(&kvm_io_listener,
                              &address_space_io);
 
+    if (s->kvm_dirty_ring_size) {
+        qemu_thread_create(&s->kvm_dirty_ring_reaper, "kvm-reaper",
+                           kvm_dirty_ring_reaper_thread, s,
+                           QEMU_THREAD_DETACHED);
+    }
+
     s->many_ioeventfds = kvm_check_many_ioeventfds();
 
     s->sync_mmu = !!kvm_vm_check_extension(kvm_state, KVM_CAP_SYNC_MMU);
@@ -1711,6 +1968,7 @@ err:
         close(s->fd);
     }
     g_free(s->memory_listener.slots);
+    g_free(s->as_listeners);
 
     return ret;
 }
@@ -2001,6 +2259,14 @@ int kvm_cpu_exec(CPUState *cpu)
         case KVM_EXIT_INTERNAL_ERROR:
             ret = kvm_handle_internal_error(cpu, run);
             break;
+        case KVM_EXIT_DIRTY_RING_FULL:
+            /* The vCPU cannot dirty more pages until its ring is collected */
+            trace_kvm_dirty_ring_full(cpu->cpu_index);
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_reap(kvm_state);
+            qemu_mutex_unlock_iothread();
+            ret = 0;
+            break;
         case KVM_EXIT_SYSTEM_EVENT:
             switch (run->system_event.type) {
             case KVM_SYSTEM_EVENT_SHUTDOWN:
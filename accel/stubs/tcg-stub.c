@@ -16,6 +16,9 @@
 #include "tcg/tcg.h"
 #include "exec/cpu-common.h"
 #include "exec/exec-all.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qerror.h"
+#include "qapi/qapi-commands-misc.h"
 
 void tb_flush(CPUState *cpu)
 {
@@ -28,3 +31,10 @@ void tb_unlock(void)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
 }
+
+TBProfileInfoList *qmp_query_tb_profile(bool has_max, int64_t max,
+                                        Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "query-tb-profile");
+    return NULL;
+}
@@ -376,6 +376,39 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
     tb_next->jmp_list_first = (uintptr_t)tb | n;
 }
 
+/*
+ * Retranslate a cold TB that has been entered tb_hot_threshold times.
+ * The cold copy is invalidated so that it drops out of the hash tables
+ * and the TBs chained to it are unlinked, and a translation with the
+ * TCG optimizer replaces it.
+ *
+ * Returns with tb_lock held.
+ */
+static TranslationBlock *tb_tier_up(CPUState *cpu, target_ulong pc,
+                                    target_ulong cs_base, uint32_t flags,
+                                    uint32_t cf_mask)
+{
+    TranslationBlock *tb;
+
+    mmap_lock();
+    tb_lock();
+
+    /* Another vCPU may have tiered up this TB while we took the locks */
+    tb = tb_htable_lookup(cpu, pc, cs_base, flags, cf_mask);
+    if (tb && (tb->cflags & CF_COLD)) {
+        tb_phys_invalidate(tb, -1);
+        tb = NULL;
+    }
+    if (likely(tb == NULL)) {
+        tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
+        tb_ctx.tb_tier_up_count++;
+    }
+
+    mmap_unlock();
+    atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    return tb;
+}
+
 static inline TranslationBlock *tb_find(CPUState *cpu,
                                         TranslationBlock *last_tb,
                                         int tb_exit, uint32_t cf_mask)
@@ -387,27 +420,45 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
     if (tb == NULL) {
-        /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
-         * taken outside tb_lock. As system emulation is currently
-         * single threaded the locks are NOPs.
-         */
-        mmap_lock();
-        tb_lock();
-        acquired_tb_lock = true;
+        uint32_t cflags = cf_mask | (tb_hot_threshold ? CF_COLD : 0);
+
+#ifdef CONFIG_SOFTMMU
+        if (qemu_tcg_mttcg_enabled()) {
+            /* Translate outside tb_lock so that other vCPUs faulting in
+             * new code at the same time are not serialized behind us.
+             */
+            tb = tb_gen_code_parallel(cpu, pc, cs_base, flags, cflags);
+        } else
+#endif
+        {
+            /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
+             * taken outside tb_lock. As system emulation is currently
+             * single threaded the locks are NOPs.
+             */
+            mmap_lock();
+            tb_lock();
 
-        /* There's a chance that our desired tb has been translated while
-         * taking the locks so we check again inside the lock.
-         */
-        tb = tb_htable_lookup(cpu, pc, cs_base, flags, cf_mask);
-        if (likely(tb == NULL)) {
-            /* if no translated code available, then translate it now */
-            tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
+            /* There's a chance that our desired tb has been translated while
+             * taking the locks so we check again inside the lock.
+             */
+            tb = tb_htable_lookup(cpu, pc, cs_base, flags, cf_mask);
+            if (likely(tb == NULL)) {
+                /* if no translated code available, then translate it now */
+                tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
+            }
+
+            mmap_unlock();
         }
+        acquired_tb_lock = true;
 
-        mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     }
+    if (unlikely(tb_cflags(tb) & CF_COLD) &&
+        atomic_read(&tb->exec_count) <= 0 && !acquired_tb_lock) {
+        tb = tb_tier_up(cpu, pc, cs_base, flags, cf_mask);
+        acquired_tb_lock = true;
+    }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
      * system emulation. So it's not safe to make a direct jump to a TB
@@ -423,7 +474,10 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
             tb_lock();
             acquired_tb_lock = true;
         }
-        if (!(tb->cflags & CF_INVALID)) {
+        /* Neither end may be invalid: an invalidated TB is no longer on
+         * the jump lists that are walked when its code is recycled.
+         */
+        if (!(tb->cflags & CF_INVALID) && !(last_tb->cflags & CF_INVALID)) {
             tb_add_jump(last_tb, tb_exit, tb);
         }
     }
@@ -644,6 +698,15 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
         return;
     }
 
+    if ((tb_cflags(tb) & CF_COLD) && atomic_read(&tb->exec_count) <= 0 &&
+        (!use_icount || cpu->icount_decr.u16.low >= tb->icount)) {
+        /* The TB is due to be retranslated, which tb_find() will do.
+         * gen_tb_start() leaves before storing the icount decrement, so
+         * the budget still covers the TB unless it also ran out.
+         */
+        return;
+    }
+
     /* Instruction counter expired.  */
     assert(use_icount);
 #ifndef CONFIG_USER_ONLY
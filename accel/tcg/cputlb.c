@@ -25,10 +25,12 @@
 #include "exec/address-spaces.h"
 #include "exec/cpu_ldst.h"
 #include "exec/cputlb.h"
+#include "exec/tb-hash.h"
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "exec/log.h"
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
@@ -105,6 +107,246 @@ size_t tlb_flush_count(void)
     return count;
 }
 
+#define tlb_stat_inc(env, field) \
+    atomic_set(&(env)->tlb_stats.field, (env)->tlb_stats.field + 1)
+
+void tlb_dump_stats(FILE *f, fprintf_function cpu_fprintf)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        size_t miss = atomic_read(&env->tlb_stats.miss);
+        size_t victim_hit = atomic_read(&env->tlb_stats.victim_hit);
+        int mmu_idx;
+
+        cpu_fprintf(f, "TLB vCPU %-3d        misses %zu, victim hits %zu "
+                    "(%zu%%), fills %zu\n", cpu->cpu_index, miss, victim_hit,
+                    miss ? victim_hit * 100 / miss : 0, miss - victim_hit);
+        cpu_fprintf(f, "                    flushes %zu, page flushes %zu, "
+                    "range flushes %zu, asid flushes %zu, resizes %zu\n",
+                    atomic_read(&env->tlb_flush_count),
+                    atomic_read(&env->tlb_stats.flush_page),
+                    atomic_read(&env->tlb_stats.flush_range),
+                    atomic_read(&env->tlb_stats.flush_asid),
+                    atomic_read(&env->tlb_stats.resize));
+        cpu_fprintf(f, "                    asid switches %zu\n",
+                    atomic_read(&env->tlb_stats.asid_switch));
+        cpu_fprintf(f, "                    entries");
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            cpu_fprintf(f, " %zu", tlb_n_entries(env, mmu_idx));
+        }
+        cpu_fprintf(f, "\n");
+    }
+}
+
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 &&
+           te->addr_code == -1;
+}
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+
+/* Length of the window over which TLB usage is observed before shrinking */
+#define TLB_WINDOW_NS (100 * SCALE_MS)
+
+static inline void tlb_table_lock(CPUArchState *env)
+{
+    qemu_spin_lock(&env->tlb_lock);
+}
+
+static inline void tlb_table_unlock(CPUArchState *env)
+{
+    qemu_spin_unlock(&env->tlb_lock);
+}
+
+static inline void tlb_n_used_entries_inc(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_desc[mmu_idx].n_used_entries++;
+}
+
+static inline void tlb_n_used_entries_dec(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_desc[mmu_idx].n_used_entries--;
+}
+
+static inline void tlb_n_evictions_inc(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_desc[mmu_idx].n_evictions++;
+}
+
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
+                             size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+}
+
+/* Allocate the tables of @mmu_idx with @new_size entries, falling back
+ * to smaller sizes if memory is tight.
+ */
+static void tlb_mmu_alloc(CPUArchState *env, int mmu_idx, size_t new_size)
+{
+    for (;;) {
+        env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+        env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+        if (env->tlb_table[mmu_idx] && env->iotlb[mmu_idx]) {
+            break;
+        }
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        if (new_size == (1 << CPU_TLB_DYN_MIN_BITS)) {
+            error_report("%s: cannot allocate TLB: %s", __func__,
+                         strerror(errno));
+            abort();
+        }
+        new_size = MAX(new_size >> 1, 1 << CPU_TLB_DYN_MIN_BITS);
+    }
+    env->tlb_mask[mmu_idx] = (new_size - 1) << CPU_TLB_ENTRY_BITS;
+}
+
+/*
+ * tlb_mmu_resize_locked: resize the TLB of @mmu_idx if needed
+ *
+ * Called on every full flush of @mmu_idx, with tlb_lock held.  Two things
+ * are looked at: the highest number of entries that were in use at a
+ * flush during the current window, and how many live entries were
+ * evicted since the last flush, which tells conflict and capacity misses
+ * apart from the compulsory ones that follow every flush.
+ *
+ * - If more than 70% of the entries were in use, or more than half of
+ *   the table's worth of live entries got evicted, the TLB is too small
+ *   for the working set and its size is doubled.
+ * - If less than 30% was in use for a whole window without much eviction,
+ *   it shrinks to the smallest power of two that would be at most 70% full.
+ *
+ * The asymmetry makes growing fast and shrinking lazy, so that a guest
+ * that flushes often (e.g. on every context switch) does not see its TLB
+ * shrink just because it was sampled right after a flush.
+ */
+static void tlb_mmu_resize_locked(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    int64_t now = get_clock_realtime();
+    bool window_expired = now > desc->window_begin_ns + TLB_WINDOW_NS;
+    size_t rate;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70 || desc->n_evictions > old_size / 2) {
+        new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < 30 && window_expired &&
+               desc->n_evictions < old_size / 16) {
+        size_t ceil = pow2ceil(desc->window_max_entries);
+        size_t expected_rate = desc->window_max_entries * 100 / ceil;
+
+        /* Avoid an undersized TLB that would have to grow right back */
+        if (expected_rate > 70) {
+            ceil *= 2;
+        }
+        new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+    tlb_mmu_alloc(env, mmu_idx, new_size);
+    tlb_window_reset(desc, now, 0);
+    tlb_stat_inc(env, resize);
+}
+
+static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_global_idxmap &= ~(1 << mmu_idx);
+    tlb_mmu_resize_locked(env, mmu_idx);
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    env->tlb_desc[mmu_idx].n_used_entries = 0;
+    env->tlb_desc[mmu_idx].n_evictions = 0;
+}
+
+void tlb_init(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int64_t now = get_clock_realtime();
+    int mmu_idx;
+
+    qemu_spin_init(&env->tlb_lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &env->tlb_desc[mmu_idx];
+
+        tlb_window_reset(desc, now, 0);
+        tlb_mmu_alloc(env, mmu_idx, 1 << CPU_TLB_DYN_DEFAULT_BITS);
+        memset(env->tlb_table[mmu_idx], -1,
+               tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+        desc->n_used_entries = 0;
+        desc->n_evictions = 0;
+    }
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        env->tlb_table[mmu_idx] = NULL;
+        env->iotlb[mmu_idx] = NULL;
+    }
+}
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
+static inline void tlb_table_lock(CPUArchState *env)
+{
+}
+
+static inline void tlb_table_unlock(CPUArchState *env)
+{
+}
+
+static inline void tlb_n_used_entries_inc(CPUArchState *env, int mmu_idx)
+{
+}
+
+static inline void tlb_n_used_entries_dec(CPUArchState *env, int mmu_idx)
+{
+}
+
+static inline void tlb_n_evictions_inc(CPUArchState *env, int mmu_idx)
+{
+}
+
+static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_global_idxmap &= ~(1 << mmu_idx);
+    memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
+}
+
+void tlb_init(CPUState *cpu)
+{
+}
+
+void tlb_destroy(CPUState *cpu)
+{
+}
+
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* This is OK because CPU architectures generally permit an
  * implementation to drop entries from the TLB at any time, so
  * flushing more entries than required is only an efficiency issue,
@@ -113,6 +355,7 @@ size_t tlb_flush_count(void)
 static void tlb_flush_nocheck(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
     /* The QOM tests will trigger tlb_flushes without setting up TCG
      * so we bug out here in that case.
@@ -127,7 +370,11 @@ static void tlb_flush_nocheck(CPUState *cpu)
 
     tb_lock();
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
+    tlb_table_lock(env);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_one_mmuidx_locked(env, mmu_idx);
+    }
+    tlb_table_unlock(env);
     memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
     cpu_tb_jmp_cache_clear(cpu);
 
@@ -189,7 +436,9 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
         if (test_bit(mmu_idx, &mmu_idx_bitmask)) {
             tlb_debug("%d\n", mmu_idx);
 
-            memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
+            tlb_table_lock(env);
+            tlb_flush_one_mmuidx_locked(env, mmu_idx);
+            tlb_table_unlock(env);
             memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
         }
     }
@@ -245,7 +494,8 @@ void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
 
 
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+/* Returns true if the entry was for @addr and has been invalidated */
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -254,6 +504,16 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
+static inline void tlb_flush_main_entry(CPUArchState *env, int mmu_idx,
+                                        target_ulong addr)
+{
+    if (tlb_flush_entry(tlb_entry(env, mmu_idx, addr), addr)) {
+        tlb_n_used_entries_dec(env, mmu_idx);
     }
 }
 
@@ -261,7 +521,6 @@ static void tlb_flush_page_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
     target_ulong addr = (target_ulong) data.target_ptr;
-    int i;
     int mmu_idx;
 
     assert_cpu_is_self(cpu);
@@ -279,9 +538,9 @@ static void tlb_flush_page_async_work(CPUState *cpu, run_on_cpu_data data)
     }
 
     addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    tlb_stat_inc(env, flush_page);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_main_entry(env, mmu_idx, addr);
     }
 
     /* check whether there are entries that need to be flushed in the vtlb */
@@ -319,18 +578,18 @@ static void tlb_flush_page_by_mmuidx_async_work(CPUState *cpu,
     target_ulong addr_and_mmuidx = (target_ulong) data.target_ptr;
     target_ulong addr = addr_and_mmuidx & TARGET_PAGE_MASK;
     unsigned long mmu_idx_bitmap = addr_and_mmuidx & ALL_MMUIDX_BITS;
-    int page = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     int mmu_idx;
     int i;
 
     assert_cpu_is_self(cpu);
 
-    tlb_debug("page:%d addr:"TARGET_FMT_lx" mmu_idx:0x%lx\n",
-              page, addr, mmu_idx_bitmap);
+    tlb_debug("addr:"TARGET_FMT_lx" mmu_idx:0x%lx\n",
+              addr, mmu_idx_bitmap);
 
+    tlb_stat_inc(env, flush_page);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         if (test_bit(mmu_idx, &mmu_idx_bitmap)) {
-            tlb_flush_entry(&env->tlb_table[mmu_idx][page], addr);
+            tlb_flush_main_entry(env, mmu_idx, addr);
 
             /* check whether there are vltb entries that need to be flushed */
             for (i = 0; i < CPU_VTLB_SIZE; i++) {
@@ -434,6 +693,356 @@ void tlb_flush_page_all_cpus_synced(CPUState *src,
     async_safe_run_on_cpu(src, fn, RUN_ON_CPU_TARGET_PTR(addr));
 }
 
+/*
+ * Range flushes
+ *
+ * The range does not fit in run_on_cpu_data together with the MMU
+ * index bitmap, so each vCPU is handed its own copy of a
+ * TLBFlushRangeData which the work function frees.
+ */
+typedef struct TLBFlushRangeData {
+    target_ulong addr;
+    target_ulong len;
+    uint16_t idxmap;
+} TLBFlushRangeData;
+
+/* Does the TLB comparator @tlb_addr map a page in [addr, addr + len)? */
+static inline bool tlb_hit_range(target_ulong tlb_addr, target_ulong addr,
+                                 target_ulong len)
+{
+    return !(tlb_addr & TLB_INVALID_MASK) &&
+           (tlb_addr & TARGET_PAGE_MASK) - addr < len;
+}
+
+/* Returns true if the entry was in the range and has been invalidated */
+static bool tlb_flush_entry_range(CPUTLBEntry *tlb_entry, target_ulong addr,
+                                  target_ulong len)
+{
+    if (tlb_hit_range(tlb_entry->addr_read, addr, len) ||
+        tlb_hit_range(tlb_entry->addr_write, addr, len) ||
+        tlb_hit_range(tlb_entry->addr_code, addr, len)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
+static void tlb_flush_range_one_mmuidx(CPUArchState *env, int mmu_idx,
+                                       target_ulong addr, target_ulong len)
+{
+    size_t n = tlb_n_entries(env, mmu_idx);
+    target_ulong npages = len >> TARGET_PAGE_BITS;
+    size_t i;
+
+    if (npages >= n) {
+        /* Every page of the range maps to some entry; walk the table once */
+        for (i = 0; i < n; i++) {
+            if (tlb_flush_entry_range(&env->tlb_table[mmu_idx][i],
+                                      addr, len)) {
+                tlb_n_used_entries_dec(env, mmu_idx);
+            }
+        }
+    } else {
+        for (i = 0; i < npages; i++) {
+            tlb_flush_main_entry(env, mmu_idx,
+                                 addr + ((target_ulong)i << TARGET_PAGE_BITS));
+        }
+    }
+
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        tlb_flush_entry_range(&env->tlb_v_table[mmu_idx][i], addr, len);
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
+                                              TLBFlushRangeData d)
+{
+    CPUArchState *env = cpu->env_ptr;
+    unsigned long mmu_idx_bitmap = d.idxmap;
+    target_ulong npages = d.len >> TARGET_PAGE_BITS;
+    target_ulong i;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("addr:" TARGET_FMT_lx " len:" TARGET_FMT_lx " mmu_idx:0x%lx\n",
+              d.addr, d.len, mmu_idx_bitmap);
+
+    /* Check if we need to flush due to large pages.  */
+    if (env->tlb_flush_addr != (target_ulong)-1 &&
+        (env->tlb_flush_addr - d.addr < d.len ||
+         d.addr - env->tlb_flush_addr <= ~env->tlb_flush_mask)) {
+        tlb_debug("forced full flush ("
+                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+                  env->tlb_flush_addr, env->tlb_flush_mask);
+
+        tlb_flush_by_mmuidx_async_work(cpu,
+                                       RUN_ON_CPU_HOST_INT(mmu_idx_bitmap));
+        return;
+    }
+
+    tlb_stat_inc(env, flush_range);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (test_bit(mmu_idx, &mmu_idx_bitmap)) {
+            tlb_flush_range_one_mmuidx(env, mmu_idx, d.addr, d.len);
+        }
+    }
+
+    /* Each page clears two jump cache pages, see tb_flush_jmp_cache */
+    if (npages >= TB_JMP_CACHE_SIZE / TB_JMP_PAGE_SIZE / 2) {
+        cpu_tb_jmp_cache_clear(cpu);
+    } else {
+        for (i = 0; i < npages; i++) {
+            tb_flush_jmp_cache(cpu, d.addr + (i << TARGET_PAGE_BITS));
+        }
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
+                                              run_on_cpu_data data)
+{
+    TLBFlushRangeData *d = data.host_ptr;
+
+    tlb_flush_range_by_mmuidx_async_0(cpu, *d);
+    g_free(d);
+}
+
+/* Round the range out to whole pages; returns false if it is empty */
+static bool tlb_flush_range_prepare(TLBFlushRangeData *d, target_ulong addr,
+                                    target_ulong len, uint16_t idxmap)
+{
+    if (len == 0) {
+        return false;
+    }
+    d->addr = addr & TARGET_PAGE_MASK;
+    d->len = ((addr + len - 1) | ~TARGET_PAGE_MASK) - d->addr + 1;
+    d->idxmap = idxmap;
+    return true;
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+
+    tlb_debug("addr:" TARGET_FMT_lx " len:" TARGET_FMT_lx " mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        return;
+    }
+    if (d.len == 0) {
+        /* The range wrapped around and covers the whole address space */
+        tlb_flush_by_mmuidx(cpu, idxmap);
+    } else if (!qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_range_by_mmuidx_async_1,
+                         RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+    } else {
+        tlb_flush_range_by_mmuidx_async_0(cpu, d);
+    }
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+    CPUState *dst_cpu;
+
+    tlb_debug("addr:" TARGET_FMT_lx " len:" TARGET_FMT_lx " mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        return;
+    }
+    if (d.len == 0) {
+        tlb_flush_by_mmuidx_all_cpus(src_cpu, idxmap);
+        return;
+    }
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+    tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+}
+
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap)
+{
+    TLBFlushRangeData d;
+    CPUState *dst_cpu;
+
+    tlb_debug("addr:" TARGET_FMT_lx " len:" TARGET_FMT_lx " mmu_idx:%" PRIx16
+              "\n", addr, len, idxmap);
+
+    if (!tlb_flush_range_prepare(&d, addr, len, idxmap)) {
+        return;
+    }
+    if (d.len == 0) {
+        tlb_flush_by_mmuidx_all_cpus_synced(src_cpu, idxmap);
+        return;
+    }
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            async_run_on_cpu(dst_cpu, tlb_flush_range_by_mmuidx_async_1,
+                             RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+        }
+    }
+    async_safe_run_on_cpu(src_cpu, tlb_flush_range_by_mmuidx_async_1,
+                          RUN_ON_CPU_HOST_PTR(g_memdup(&d, sizeof(d))));
+}
+
+/*
+ * Address space identifiers
+ *
+ * Every translation remembers in its iotlb entry the ASID that was current
+ * for its MMU index when it was added, or TLB_ASID_GLOBAL if the target
+ * passed PAGE_GLOBAL.  Switching ASID with tlb_set_asid_for_mmuidx drops
+ * the non-global translations of the old one, so the TLB only ever holds
+ * global translations and those of the current ASID.  Flushing a
+ * non-current ASID is therefore free, and flushing the current one keeps
+ * the global translations (typically the guest kernel) around.
+ */
+
+/* Drop all non-global translations of @mmu_idx */
+static void tlb_flush_nonglobal_one_mmuidx(CPUArchState *env, int mmu_idx)
+{
+    size_t n = tlb_n_entries(env, mmu_idx);
+    size_t i;
+
+    if (!(env->tlb_global_idxmap & (1 << mmu_idx))) {
+        /* Nothing to keep, a plain flush is cheaper than the walk */
+        tlb_table_lock(env);
+        tlb_flush_one_mmuidx_locked(env, mmu_idx);
+        tlb_table_unlock(env);
+        memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        CPUTLBEntry *te = &env->tlb_table[mmu_idx][i];
+
+        if (env->iotlb[mmu_idx][i].asid != TLB_ASID_GLOBAL &&
+            !tlb_entry_is_empty(te)) {
+            memset(te, -1, sizeof(*te));
+            tlb_n_used_entries_dec(env, mmu_idx);
+        }
+    }
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        if (env->iotlb_v[mmu_idx][i].asid != TLB_ASID_GLOBAL) {
+            memset(&env->tlb_v_table[mmu_idx][i], -1, sizeof(CPUTLBEntry));
+        }
+    }
+}
+
+static void tlb_flush_asid_by_mmuidx_async_work(CPUState *cpu,
+                                                run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    uint32_t asid = data.host_int >> NB_MMU_MODES;
+    unsigned long mmu_idx_bitmap = data.host_int & ALL_MMUIDX_BITS;
+    bool flushed = false;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    tlb_debug("asid:%" PRIu32 " mmu_idx:0x%lx\n", asid, mmu_idx_bitmap);
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (test_bit(mmu_idx, &mmu_idx_bitmap) &&
+            env->tlb_asid[mmu_idx] == asid) {
+            tlb_flush_nonglobal_one_mmuidx(env, mmu_idx);
+            flushed = true;
+        }
+    }
+
+    if (flushed) {
+        tlb_stat_inc(env, flush_asid);
+        cpu_tb_jmp_cache_clear(cpu);
+    }
+}
+
+static run_on_cpu_data tlb_asid_data(uint32_t asid, uint16_t idxmap)
+{
+    /* The ASID has to fit above the MMU index bitmap in a host int */
+    g_assert(asid <= (INT_MAX >> NB_MMU_MODES));
+    return RUN_ON_CPU_HOST_INT(asid << NB_MMU_MODES | idxmap);
+}
+
+void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint32_t asid, uint16_t idxmap)
+{
+    run_on_cpu_data data = tlb_asid_data(asid, idxmap);
+
+    tlb_debug("asid:%" PRIu32 " mmu_idx:%" PRIx16 "\n", asid, idxmap);
+
+    if (!qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_asid_by_mmuidx_async_work, data);
+    } else {
+        tlb_flush_asid_by_mmuidx_async_work(cpu, data);
+    }
+}
+
+void tlb_flush_asid_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                              uint32_t asid, uint16_t idxmap)
+{
+    const run_on_cpu_func fn = tlb_flush_asid_by_mmuidx_async_work;
+    run_on_cpu_data data = tlb_asid_data(asid, idxmap);
+
+    tlb_debug("asid:%" PRIu32 " mmu_idx:%" PRIx16 "\n", asid, idxmap);
+
+    flush_all_helper(src_cpu, fn, data);
+    async_safe_run_on_cpu(src_cpu, fn, data);
+}
+
+static void tlb_set_asid_for_mmuidx_async_work(CPUState *cpu,
+                                               run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    uint32_t asid = data.host_int >> NB_MMU_MODES;
+    unsigned long mmu_idx_bitmap = data.host_int & ALL_MMUIDX_BITS;
+    bool flushed = false;
+    int mmu_idx;
+
+    assert_cpu_is_self(cpu);
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (test_bit(mmu_idx, &mmu_idx_bitmap) &&
+            env->tlb_asid[mmu_idx] != asid) {
+            tlb_flush_nonglobal_one_mmuidx(env, mmu_idx);
+            env->tlb_asid[mmu_idx] = asid;
+            flushed = true;
+        }
+    }
+
+    if (flushed) {
+        tlb_stat_inc(env, asid_switch);
+        cpu_tb_jmp_cache_clear(cpu);
+    }
+}
+
+void tlb_set_asid_for_mmuidx(CPUState *cpu, uint32_t asid, uint16_t idxmap)
+{
+    run_on_cpu_data data = tlb_asid_data(asid, idxmap);
+
+    tlb_debug("asid:%" PRIu32 " mmu_idx:%" PRIx16 "\n", asid, idxmap);
+
+    if (cpu->created && !qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_set_asid_for_mmuidx_async_work, data);
+    } else {
+        tlb_set_asid_for_mmuidx_async_work(cpu, data);
+    }
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -534,10 +1143,12 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     int mmu_idx;
 
     env = cpu->env_ptr;
+    tlb_table_lock(env);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        size_t n = tlb_n_entries(env, mmu_idx);
         unsigned int i;
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                   start1, length);
         }
@@ -547,6 +1158,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                   start1, length);
         }
     }
+    tlb_table_unlock(env);
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -561,15 +1173,13 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
     assert_cpu_is_self(cpu);
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(tlb_entry(env, mmu_idx, vaddr), vaddr);
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
@@ -653,8 +1263,13 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+    if (tlb_entry_is_empty(te)) {
+        tlb_n_used_entries_inc(env, mmu_idx);
+    } else {
+        tlb_n_evictions_inc(env, mmu_idx);
+    }
     /* do not discard the translation in te, evict it into a victim tlb */
     tv = &env->tlb_v_table[mmu_idx][vidx];
 
@@ -666,6 +1281,12 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     /* refill the tlb */
     env->iotlb[mmu_idx][index].addr = iotlb - vaddr;
     env->iotlb[mmu_idx][index].attrs = attrs;
+    if (prot & PAGE_GLOBAL) {
+        env->iotlb[mmu_idx][index].asid = TLB_ASID_GLOBAL;
+        env->tlb_global_idxmap |= 1 << mmu_idx;
+    } else {
+        env->iotlb[mmu_idx][index].asid = env->tlb_asid[mmu_idx];
+    }
 
     /* Now calculate the new entry */
     tn.addend = addend - vaddr;
@@ -835,6 +1456,8 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
                            size_t elt_ofs, target_ulong page)
 {
     size_t vidx;
+
+    tlb_stat_inc(env, miss);
     for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
         CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
         target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
@@ -846,6 +1469,10 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             copy_tlb_helper(&tmptlb, tlb, false);
             copy_tlb_helper(tlb, vtlb, true);
             copy_tlb_helper(vtlb, &tmptlb, true);
+            if (tlb_entry_is_empty(&tmptlb)) {
+                tlb_n_used_entries_inc(env, mmu_idx);
+            }
+            tlb_stat_inc(env, victim_hit);
 
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
@@ -875,8 +1502,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
     CPUIOTLBEntry *iotlbentry;
     hwaddr physaddr;
 
-    index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env, true);
+    index = tlb_index(env, mmu_idx, addr);
     if (unlikely(env->tlb_table[mmu_idx][index].addr_code !=
                  (addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK)))) {
         if (!VICTIM_TLB_HIT(addr_read, addr)) {
@@ -931,7 +1558,7 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
 void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
                  uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
 
     if ((addr & TARGET_PAGE_MASK)
@@ -951,7 +1578,7 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
                                NotDirtyInfo *ndi)
 {
     size_t mmu_idx = get_mmuidx(oi);
-    size_t index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    size_t index = tlb_index(env, mmu_idx, addr);
     CPUTLBEntry *tlbe = &env->tlb_table[mmu_idx][index];
     target_ulong tlb_addr = tlbe->addr_write;
     TCGMemOp mop = get_memop(oi);
@@ -47,6 +47,8 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-misc.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -156,6 +158,9 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+unsigned int tb_hot_threshold;
+/* Sample one TB execution out of this many per vCPU; 0 disables */
+unsigned int tb_profile_period;
 
 /* translation block context */
 static __thread int have_tb_lock;
@@ -813,14 +818,14 @@ void tcg_exec_init(unsigned long tb_size)
  * Allocate a new translation block. Flush the translation buffer if
  * too many translation blocks or too much generated code.
  *
- * Called with tb_lock held.
+ * Called with tb_lock held, or from tb_gen_code_parallel(): the TB comes
+ * from the calling thread's own region and stays private until linked.
+ * tb_gen_code() and tb_link_new() check the lock instead.
  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
     TranslationBlock *tb;
 
-    assert_tb_locked();
-
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(tb == NULL)) {
         return NULL;
@@ -887,17 +892,18 @@ static gboolean tb_host_size_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
-/* flush all the translation blocks */
-static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
+static void tb_account_pause(int64_t *total, int64_t *max, int64_t start)
 {
-    tb_lock();
+    int64_t pause = get_clock() - start;
 
-    /* If it is already been done on request of another CPU,
-     * just retry.
-     */
-    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
-        goto done;
-    }
+    *total += pause;
+    *max = MAX(*max, pause);
+}
+
+/* flush all the translation blocks; called with tb_lock held */
+static void tb_flush_locked(void)
+{
+    CPUState *cpu;
 
     if (DEBUG_TB_FLUSH_GATE) {
         size_t nb_tbs = g_tree_nnodes(tb_ctx.tb_tree);
@@ -923,6 +929,23 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     atomic_mb_set(&tb_ctx.tb_flush_count, tb_ctx.tb_flush_count + 1);
+}
+
+static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    int64_t start = get_clock();
+
+    tb_lock();
+
+    /* If it is already been done on request of another CPU,
+     * just retry.
+     */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+        goto done;
+    }
+    tb_flush_locked();
+    tb_account_pause(&tb_ctx.tb_flush_pause, &tb_ctx.tb_flush_pause_max,
+                     start);
 
 done:
     tb_unlock();
@@ -937,6 +960,106 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+struct tb_evict_data {
+    const void *start;
+    const void *end;
+    GPtrArray *tbs;
+};
+
+static gboolean tb_evict_collect(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    struct tb_evict_data *d = data;
+
+    /* The tree is sorted by host address, so we can stop at the end */
+    if ((void *)tb->tc.ptr >= d->end) {
+        return true;
+    }
+    if ((void *)tb->tc.ptr >= d->start) {
+        g_ptr_array_add(d->tbs, tb);
+    }
+    return false;
+}
+
+static inline void tb_remove_from_jmp_list(TranslationBlock *tb, int n);
+static inline void tb_jmp_unlink(TranslationBlock *tb);
+
+/* Remove every TB whose code lies in [start, end); called with tb_lock held */
+static void tb_evict_range(void *start, void *end)
+{
+    struct tb_evict_data d = {
+        .start = start,
+        .end = end,
+        .tbs = g_ptr_array_new(),
+    };
+    guint i;
+
+    g_tree_foreach(tb_ctx.tb_tree, tb_evict_collect, &d);
+    for (i = 0; i < d.tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(d.tbs, i);
+
+        /* Unlinks the TB from the hash table, the page lists and the
+         * jump caches.  For a TB that was already invalidated this returns
+         * early, before touching the jump lists, so unlink those here:
+         * they must not point into the region once it is reused.
+         */
+        tb_phys_invalidate(tb, -1);
+        tb_remove_from_jmp_list(tb, 0);
+        tb_remove_from_jmp_list(tb, 1);
+        tb_jmp_unlink(tb);
+        tb_remove(tb);
+    }
+    tb_ctx.tb_evict_tb_count += d.tbs->len;
+    g_ptr_array_free(d.tbs, true);
+}
+
+/* The number of flushes and evictions done so far; either one retires a
+ * request to make room in the code buffer.
+ */
+static unsigned tb_evict_gen(void)
+{
+    return atomic_read(&tb_ctx.tb_flush_count) +
+           atomic_read(&tb_ctx.tb_evict_count);
+}
+
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data gen)
+{
+    int64_t start = get_clock();
+    void *region_start, *region_end;
+
+    tb_lock();
+
+    /* Somebody else made room already; just retry */
+    if (tb_evict_gen() != gen.host_int) {
+        goto done;
+    }
+
+    if (!tcg_region_evict_oldest(&region_start, &region_end)) {
+        /* Every region is in use by some TCG thread */
+        tb_flush_locked();
+        tb_account_pause(&tb_ctx.tb_flush_pause, &tb_ctx.tb_flush_pause_max,
+                         start);
+        goto done;
+    }
+    tb_evict_range(region_start, region_end);
+    atomic_mb_set(&tb_ctx.tb_evict_count, tb_ctx.tb_evict_count + 1);
+    tb_account_pause(&tb_ctx.tb_evict_pause, &tb_ctx.tb_evict_pause_max,
+                     start);
+
+done:
+    tb_unlock();
+}
+
+/* Make room in the code buffer by recycling its oldest region.  The vCPUs
+ * are stopped while the TBs in that region are unlinked, but only those
+ * TBs are lost.
+ */
+static void tb_evict(CPUState *cpu)
+{
+    async_safe_run_on_cpu(cpu, do_tb_evict,
+                          RUN_ON_CPU_HOST_INT(tb_evict_gen()));
+}
+
 /*
  * Formerly ifdef DEBUG_TB_CHECK. These debug functions are user-mode-only,
  * so in order to prevent bit rot we compile them unconditionally in user-mode,
@@ -1240,30 +1363,73 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
 #endif
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+/* Reset the jump state of a freshly generated TB and make it visible
+ * through the hash table, the page lists and the TB tree.
+ *
+ * Called with tb_lock held, and mmap_lock for user-mode emulation.
+ */
+static void tb_link_new(CPUState *cpu, TranslationBlock *tb,
+                        tb_page_addr_t phys_pc)
 {
     CPUArchState *env = cpu->env_ptr;
-    TranslationBlock *tb;
-    tb_page_addr_t phys_pc, phys_page2;
+    tb_page_addr_t phys_page2;
     target_ulong virt_page2;
+
+    assert_tb_locked();
+
+    /* init jump list */
+    assert(((uintptr_t)tb & 3) == 0);
+    tb->jmp_list_first = (uintptr_t)tb | 2;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+
+    /* init original jump addresses wich has been set during tcg_gen_code() */
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+
+    /* check next page if needed */
+    virt_page2 = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+    phys_page2 = -1;
+    if ((tb->pc & TARGET_PAGE_MASK) != virt_page2) {
+        phys_page2 = get_page_addr_code(env, virt_page2);
+    }
+    /* As long as consistency of the TB stuff is provided by tb_lock in user
+     * mode and is implicit in single-threaded softmmu emulation, no explicit
+     * memory barrier is required before tb_link_page() makes the TB visible
+     * through the physical hash table and physical page list.
+     */
+    tb_link_page(tb, phys_pc, phys_page2);
+    g_tree_insert(tb_ctx.tb_tree, &tb->tc, tb);
+}
+
+/* Translate the guest code at @pc into the calling thread's TCG context.
+ * The resulting TB is not yet visible to anybody else; tb_link_new() does
+ * that.  Nothing here touches state shared with other vCPUs except the
+ * code region allocator, which is already thread-safe.
+ */
+static TranslationBlock *tb_translate(CPUState *cpu,
+                                      target_ulong pc, target_ulong cs_base,
+                                      uint32_t flags, int cflags)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size;
+    int64_t gen_start = tb_profile_period ? get_clock() : 0;
 #ifdef CONFIG_PROFILER
     TCGProfile *prof = &tcg_ctx->prof;
     int64_t ti;
 #endif
-    assert_memory_lock();
-
-    phys_pc = get_page_addr_code(env, pc);
 
  buffer_overflow:
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* the code buffer is full; recycle part of it */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -1277,6 +1443,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = tb_hot_threshold;
+    tb->prof_execs = 0;
+    tb->prof_gen_ns = 0;
     tcg_ctx->tb_cflags = cflags;
 
 #ifdef CONFIG_PROFILER
@@ -1369,36 +1538,73 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
 
-    /* init jump list */
-    assert(((uintptr_t)tb & 3) == 0);
-    tb->jmp_list_first = (uintptr_t)tb | 2;
-    tb->jmp_list_next[0] = (uintptr_t)NULL;
-    tb->jmp_list_next[1] = (uintptr_t)NULL;
-
-    /* init original jump addresses wich has been set during tcg_gen_code() */
-    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 0);
-    }
-    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
-        tb_reset_jump(tb, 1);
+    if (tb_profile_period) {
+        tb->prof_gen_ns = get_clock() - gen_start;
     }
+    return tb;
+}
 
-    /* check next page if needed */
-    virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
-    phys_page2 = -1;
-    if ((pc & TARGET_PAGE_MASK) != virt_page2) {
-        phys_page2 = get_page_addr_code(env, virt_page2);
-    }
-    /* As long as consistency of the TB stuff is provided by tb_lock in user
-     * mode and is implicit in single-threaded softmmu emulation, no explicit
-     * memory barrier is required before tb_link_page() makes the TB visible
-     * through the physical hash table and physical page list.
-     */
-    tb_link_page(tb, phys_pc, phys_page2);
-    g_tree_insert(tb_ctx.tb_tree, &tb->tc, tb);
+/* Called with tb_lock held, and mmap_lock for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+
+    assert_memory_lock();
+    assert_tb_locked();
+
+    phys_pc = get_page_addr_code(env, pc);
+
+    tb = tb_translate(cpu, pc, cs_base, flags, cflags);
+    tb_link_new(cpu, tb, phys_pc);
     return tb;
 }
 
+#ifdef CONFIG_SOFTMMU
+/* Like tb_gen_code(), but translate without holding tb_lock.
+ *
+ * With MTTCG every vCPU thread owns a TCG context and allocates from its
+ * own code region, so the expensive part of translation -- decoding the
+ * guest code and generating host code -- does not need to exclude other
+ * vCPUs.  tb_lock is only taken once the code is ready, to publish it.
+ * If another vCPU published the same block in the meantime, our copy is
+ * thrown away and its space handed back to the region.
+ *
+ * A guest write to the code while it is being translated is not seen,
+ * as in tb_gen_code() when the page holds no TB yet and is not protected.
+ *
+ * Called without tb_lock; returns with tb_lock held.
+ */
+TranslationBlock *tb_gen_code_parallel(CPUState *cpu,
+                                       target_ulong pc, target_ulong cs_base,
+                                       uint32_t flags, int cflags)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb, *existing_tb;
+    tb_page_addr_t phys_pc;
+
+    assert_tb_unlocked();
+
+    phys_pc = get_page_addr_code(env, pc);
+    tb = tb_translate(cpu, pc, cs_base, flags, cflags);
+
+    tb_lock();
+    existing_tb = tb_htable_lookup(cpu, pc, cs_base, flags,
+                                   cflags & CF_HASH_MASK);
+    if (unlikely(existing_tb)) {
+        /* Nobody can have seen @tb yet, so its space can be reused */
+        atomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+        tb_ctx.tb_parallel_discard_count++;
+        return existing_tb;
+    }
+    tb_link_new(cpu, tb, phys_pc);
+    return tb;
+}
+#endif
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1927,10 +2133,32 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     qht_statistics_destroy(&hst);
 
     cpu_fprintf(f, "\nStatistics:\n");
-    cpu_fprintf(f, "TB flush count      %u\n",
-                atomic_read(&tb_ctx.tb_flush_count));
+    cpu_fprintf(f, "TB flush count      %u (pause avg %" PRId64
+                " max %" PRId64 " us)\n",
+                atomic_read(&tb_ctx.tb_flush_count),
+                tb_ctx.tb_flush_count ?
+                tb_ctx.tb_flush_pause / tb_ctx.tb_flush_count / SCALE_US : 0,
+                tb_ctx.tb_flush_pause_max / SCALE_US);
+    cpu_fprintf(f, "TB region evictions %u (%zu TBs, pause avg %" PRId64
+                " max %" PRId64 " us)\n",
+                atomic_read(&tb_ctx.tb_evict_count),
+                tb_ctx.tb_evict_tb_count,
+                tb_ctx.tb_evict_count ?
+                tb_ctx.tb_evict_pause / tb_ctx.tb_evict_count / SCALE_US : 0,
+                tb_ctx.tb_evict_pause_max / SCALE_US);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_ctx.tb_phys_invalidate_count);
+    if (tb_hot_threshold) {
+        cpu_fprintf(f, "TB tier-up count    %u (threshold %u)\n",
+                    tb_ctx.tb_tier_up_count, tb_hot_threshold);
+    }
+#ifdef CONFIG_SOFTMMU
+    if (qemu_tcg_mttcg_enabled()) {
+        cpu_fprintf(f, "TB translation races %u\n",
+                    tb_ctx.tb_parallel_discard_count);
+    }
+#endif
     cpu_fprintf(f, "TLB flush count     %zu\n", tlb_flush_count());
+    tlb_dump_stats(f, cpu_fprintf);
     tcg_dump_info(f, cpu_fprintf);
 
     tb_unlock();
@@ -1941,6 +2169,79 @@ void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_op_count(f, cpu_fprintf);
 }
 
+static uint64_t tb_profile_cost(const TranslationBlock *tb)
+{
+    return tb->prof_execs * tb->icount;
+}
+
+static gboolean tb_profile_collect(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    GPtrArray *tbs = data;
+
+    if (!(tb->cflags & CF_INVALID) && tb->prof_execs) {
+        g_ptr_array_add(tbs, tb);
+    }
+    return false;
+}
+
+static gint tb_profile_cmp(gconstpointer a, gconstpointer b)
+{
+    uint64_t cost_a = tb_profile_cost(*(TranslationBlock * const *)a);
+    uint64_t cost_b = tb_profile_cost(*(TranslationBlock * const *)b);
+
+    return cost_a < cost_b ? 1 : cost_a > cost_b ? -1 : 0;
+}
+
+TBProfileInfoList *qmp_query_tb_profile(bool has_max, int64_t max,
+                                        Error **errp)
+{
+    TBProfileInfoList *head = NULL, **tail = &head;
+    GPtrArray *tbs;
+    guint i;
+
+    if (!tcg_enabled()) {
+        error_setg(errp, "TB profiling is only available with accel=tcg");
+        return NULL;
+    }
+    if (!tb_profile_period) {
+        error_setg(errp, "TB profiling is not enabled, "
+                   "start with -accel tcg,tb-profile=N");
+        return NULL;
+    }
+    if (has_max && max < 0) {
+        error_setg(errp, "Parameter 'max' must not be negative");
+        return NULL;
+    }
+
+    tbs = g_ptr_array_new();
+    tb_lock();
+    g_tree_foreach(tb_ctx.tb_tree, tb_profile_collect, tbs);
+    g_ptr_array_sort(tbs, tb_profile_cmp);
+
+    for (i = 0; i < tbs->len && (!has_max || i < max); i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+        TBProfileInfoList *entry = g_new0(TBProfileInfoList, 1);
+        TBProfileInfo *info = g_new0(TBProfileInfo, 1);
+
+        info->pc = tb->pc;
+        info->guest_size = tb->size;
+        info->icount = tb->icount;
+        info->host_size = tb->tc.size;
+        info->exec_count = tb->prof_execs;
+        info->translate_ns = tb->prof_gen_ns;
+        info->cost = tb_profile_cost(tb);
+
+        entry->value = info;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    tb_unlock();
+
+    g_ptr_array_free(tbs, true);
+    return head;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
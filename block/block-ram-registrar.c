@@ -0,0 +1,86 @@
+/*
+ * BlockBackend RAM Registrar
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/block-ram-registrar.h"
+#include "exec/cpu-common.h"
+
+static void blk_ram_register(BlockBackend *blk, void *host, size_t size)
+{
+    AioContext *ctx = blk_get_aio_context(blk);
+
+    aio_context_acquire(ctx);
+    blk_register_buf(blk, host, size);
+    aio_context_release(ctx);
+}
+
+static void blk_ram_unregister(BlockBackend *blk, void *host)
+{
+    AioContext *ctx = blk_get_aio_context(blk);
+
+    aio_context_acquire(ctx);
+    blk_unregister_buf(blk, host);
+    aio_context_release(ctx);
+}
+
+static void ram_block_added(RAMBlockNotifier *n, void *host, size_t size)
+{
+    BlockRAMRegistrar *r = container_of(n, BlockRAMRegistrar, notifier);
+
+    blk_ram_register(r->blk, host, size);
+}
+
+static void ram_block_removed(RAMBlockNotifier *n, void *host, size_t size)
+{
+    BlockRAMRegistrar *r = container_of(n, BlockRAMRegistrar, notifier);
+
+    if (host) {
+        blk_ram_unregister(r->blk, host);
+    }
+}
+
+static int ram_block_register_existing(const char *block_name,
+                                       void *host_addr, ram_addr_t offset,
+                                       ram_addr_t length, void *opaque)
+{
+    BlockRAMRegistrar *r = opaque;
+
+    if (host_addr) {
+        blk_ram_register(r->blk, host_addr, length);
+    }
+    return 0;
+}
+
+static int ram_block_unregister_existing(const char *block_name,
+                                         void *host_addr, ram_addr_t offset,
+                                         ram_addr_t length, void *opaque)
+{
+    BlockRAMRegistrar *r = opaque;
+
+    if (host_addr) {
+        blk_ram_unregister(r->blk, host_addr);
+    }
+    return 0;
+}
+
+void blk_ram_registrar_init(BlockRAMRegistrar *r, BlockBackend *blk)
+{
+    r->blk = blk;
+    r->notifier = (RAMBlockNotifier) {
+        .ram_block_added = ram_block_added,
+        .ram_block_removed = ram_block_removed,
+    };
+    ram_block_notifier_add(&r->notifier);
+    qemu_ram_foreach_block(ram_block_register_existing, r);
+}
+
+void blk_ram_registrar_destroy(BlockRAMRegistrar *r)
+{
+    ram_block_notifier_remove(&r->notifier);
+    qemu_ram_foreach_block(ram_block_unregister_existing, r);
+}
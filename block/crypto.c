@@ -30,11 +30,26 @@
 #include "qapi/error.h"
 #include "qemu/option.h"
 #include "block/crypto.h"
+#include "block/thread-pool.h"
+
+/*
+ * Encryption of requests larger than BLOCK_CRYPTO_TASK_SIZE is split into
+ * tasks of that size, run in the thread pool; at most
+ * BLOCK_CRYPTO_MAX_THREADS of them are in flight per image.  Smaller
+ * requests are handled inline in the AioContext, which needs a cipher
+ * of its own.
+ */
+#define BLOCK_CRYPTO_TASK_SIZE (64 * 1024)
+#define BLOCK_CRYPTO_MAX_THREADS 8
+#define BLOCK_CRYPTO_MAX_CIPHERS (BLOCK_CRYPTO_MAX_THREADS + 1)
 
 typedef struct BlockCrypto BlockCrypto;
 
 struct BlockCrypto {
     QCryptoBlock *block;
+
+    int nb_threads;
+    CoQueue thread_task_queue;
 };
 
 
@@ -305,6 +320,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
+                                       BLOCK_CRYPTO_MAX_CIPHERS,
                                        errp);
 
     if (!crypto->block) {
@@ -313,6 +329,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
     }
 
     bs->encrypted = true;
+    qemu_co_queue_init(&crypto->thread_task_queue);
 
     ret = 0;
  cleanup:
@@ -397,6 +414,117 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+typedef struct BlockCryptoRequest {
+    Coroutine *co;
+    int in_flight;
+    int ret;
+} BlockCryptoRequest;
+
+typedef struct BlockCryptoTask {
+    BlockDriverState *bs;
+    BlockCryptoRequest *req;
+    uint64_t offset;
+    uint8_t *buf;
+    uint64_t bytes;
+    bool encrypt;
+} BlockCryptoTask;
+
+static int block_crypto_task_func(void *opaque)
+{
+    BlockCryptoTask *task = opaque;
+    BlockCrypto *crypto = task->bs->opaque;
+    int ret;
+
+    if (task->encrypt) {
+        ret = qcrypto_block_encrypt(crypto->block, task->offset,
+                                    task->buf, task->bytes, NULL);
+    } else {
+        ret = qcrypto_block_decrypt(crypto->block, task->offset,
+                                    task->buf, task->bytes, NULL);
+    }
+
+    return ret < 0 ? -EIO : 0;
+}
+
+static void coroutine_fn block_crypto_task_entry(void *opaque)
+{
+    BlockCryptoTask *task = opaque;
+    BlockCryptoRequest *req = task->req;
+    BlockCrypto *crypto = task->bs->opaque;
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(task->bs));
+    int ret;
+
+    while (crypto->nb_threads >= BLOCK_CRYPTO_MAX_THREADS) {
+        qemu_co_queue_wait(&crypto->thread_task_queue, NULL);
+    }
+    crypto->nb_threads++;
+    ret = thread_pool_submit_co(pool, block_crypto_task_func, task);
+    crypto->nb_threads--;
+    qemu_co_queue_next(&crypto->thread_task_queue);
+
+    if (ret < 0 && !req->ret) {
+        req->ret = ret;
+    }
+    if (--req->in_flight == 0) {
+        aio_co_wake(req->co);
+    }
+}
+
+/*
+ * Encrypt or decrypt @bytes of @buf in place, @offset being the offset of
+ * the data in the guest-visible payload.
+ */
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, uint64_t offset,
+                       uint8_t *buf, uint64_t bytes, bool encrypt)
+{
+    BlockCryptoRequest req = {
+        .co = qemu_coroutine_self(),
+    };
+    BlockCryptoTask tasks[DIV_ROUND_UP(BLOCK_CRYPTO_MAX_IO_SIZE,
+                                       BLOCK_CRYPTO_TASK_SIZE)];
+    uint64_t done;
+    int i = 0;
+
+    assert(bytes <= BLOCK_CRYPTO_MAX_IO_SIZE);
+
+    if (bytes <= BLOCK_CRYPTO_TASK_SIZE) {
+        BlockCryptoTask task = {
+            .bs = bs,
+            .offset = offset,
+            .buf = buf,
+            .bytes = bytes,
+            .encrypt = encrypt,
+        };
+        return block_crypto_task_func(&task);
+    }
+
+    /* Keep a reference for ourselves until all tasks have been started */
+    req.in_flight = 1;
+    for (done = 0; done < bytes; done += BLOCK_CRYPTO_TASK_SIZE, i++) {
+        Coroutine *co;
+
+        tasks[i] = (BlockCryptoTask) {
+            .bs = bs,
+            .req = &req,
+            .offset = offset + done,
+            .buf = buf + done,
+            .bytes = MIN(bytes - done, BLOCK_CRYPTO_TASK_SIZE),
+            .encrypt = encrypt,
+        };
+        req.in_flight++;
+        co = qemu_coroutine_create(block_crypto_task_entry, &tasks[i]);
+        qemu_coroutine_enter(co);
+    }
+
+    req.in_flight--;
+    while (req.in_flight > 0) {
+        qemu_coroutine_yield();
+    }
+
+    return req.ret;
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -440,9 +568,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done,
+                                     cipher_data, cur_bytes, false);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -496,9 +624,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encdec(bs, offset + bytes_done,
+                                     cipher_data, cur_bytes, true);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -41,6 +41,29 @@
 static int coroutine_fn bdrv_co_do_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags);
 
+/*
+ * Padding and copy-on-read buffers only live for the duration of a
+ * request, so they are recycled through the AioContext instead of being
+ * allocated for every unaligned request.
+ */
+static void *bdrv_bounce_buf_get(BlockDriverState *bs, size_t size)
+{
+    return aio_bounce_buf_get(bdrv_get_aio_context(bs), size,
+                              bdrv_opt_mem_align(bs));
+}
+
+static void *bdrv_try_bounce_buf_get(BlockDriverState *bs, size_t size)
+{
+    return aio_bounce_buf_try_get(bdrv_get_aio_context(bs), size,
+                                  bdrv_opt_mem_align(bs));
+}
+
+static void bdrv_bounce_buf_put(BlockDriverState *bs, void *buf, size_t size)
+{
+    aio_bounce_buf_put(bdrv_get_aio_context(bs), buf, size,
+                       bdrv_opt_mem_align(bs));
+}
+
 void bdrv_parent_drained_begin(BlockDriverState *bs, BdrvChild *ignore)
 {
     BdrvChild *c, *next;
@@ -489,7 +512,7 @@ static void tracked_request_end(BdrvTrackedRequest *req)
     }
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
-    QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->bs->tracked_requests, &req->node);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
@@ -512,28 +535,46 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
         .serialising    = false,
         .overlap_offset = offset,
         .overlap_bytes  = bytes,
+        .node.start     = offset,
+        .node.end       = offset + bytes,
     };
 
     qemu_co_queue_init(&req->wait_queue);
 
     qemu_co_mutex_lock(&bs->reqs_lock);
-    QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    interval_tree_insert(&bs->tracked_requests, &req->node);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
-static void mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
+static void coroutine_fn mark_request_serialising(BdrvTrackedRequest *req,
+                                                  uint64_t align)
 {
+    BlockDriverState *bs = req->bs;
     int64_t overlap_offset = req->offset & ~(align - 1);
     unsigned int overlap_bytes = ROUND_UP(req->offset + req->bytes, align)
                                - overlap_offset;
 
     if (!req->serialising) {
-        atomic_inc(&req->bs->serialising_in_flight);
+        atomic_inc(&bs->serialising_in_flight);
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    overlap_offset = MIN(req->overlap_offset, overlap_offset);
+    overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset == req->overlap_offset &&
+        overlap_bytes == req->overlap_bytes) {
+        return;
+    }
+
+    /* The tree is keyed on the overlap range, so move the node */
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    interval_tree_remove(&bs->tracked_requests, &req->node);
+    req->overlap_offset = overlap_offset;
+    req->overlap_bytes = overlap_bytes;
+    req->node.start = overlap_offset;
+    req->node.end = overlap_offset + overlap_bytes;
+    interval_tree_insert(&bs->tracked_requests, &req->node);
+    qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
 /**
@@ -569,20 +610,6 @@ static int bdrv_get_cluster_size(BlockDriverState *bs)
     }
 }
 
-static bool tracked_request_overlaps(BdrvTrackedRequest *req,
-                                     int64_t offset, unsigned int bytes)
-{
-    /*        aaaa   bbbb */
-    if (offset >= req->overlap_offset + req->overlap_bytes) {
-        return false;
-    }
-    /* bbbb   aaaa        */
-    if (req->overlap_offset >= offset + bytes) {
-        return false;
-    }
-    return true;
-}
-
 void bdrv_inc_in_flight(BlockDriverState *bs)
 {
     atomic_inc(&bs->in_flight);
@@ -599,48 +626,60 @@ void bdrv_dec_in_flight(BlockDriverState *bs)
     bdrv_wakeup(bs);
 }
 
+/*
+ * Called for every tracked request that overlaps @opaque; returns true if
+ * the caller has to wait for it.
+ */
+static bool tracked_request_conflicts(IntervalTreeNode *node, void *opaque)
+{
+    BdrvTrackedRequest *self = opaque;
+    BdrvTrackedRequest *req = container_of(node, BdrvTrackedRequest, node);
+
+    if (req == self || (!req->serialising && !self->serialising)) {
+        return false;
+    }
+
+    /* Hitting this means there was a reentrant request, for
+     * example, a block driver issuing nested requests.  This must
+     * never happen since it means deadlock.
+     */
+    assert(qemu_coroutine_self() != req->co);
+
+    /* If the request is already (indirectly) waiting for us, or
+     * will wait for us as soon as it wakes up, then just go on
+     * (instead of producing a deadlock in the former case). */
+    return !req->waiting_for;
+}
+
 static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
 {
     BlockDriverState *bs = self->bs;
+    IntervalTreeNode *node;
     BdrvTrackedRequest *req;
-    bool retry;
     bool waited = false;
 
     if (!atomic_read(&bs->serialising_in_flight)) {
         return false;
     }
 
-    do {
-        retry = false;
-        qemu_co_mutex_lock(&bs->reqs_lock);
-        QLIST_FOREACH(req, &bs->tracked_requests, list) {
-            if (req == self || (!req->serialising && !self->serialising)) {
-                continue;
-            }
-            if (tracked_request_overlaps(req, self->overlap_offset,
-                                         self->overlap_bytes))
-            {
-                /* Hitting this means there was a reentrant request, for
-                 * example, a block driver issuing nested requests.  This must
-                 * never happen since it means deadlock.
-                 */
-                assert(qemu_coroutine_self() != req->co);
-
-                /* If the request is already (indirectly) waiting for us, or
-                 * will wait for us as soon as it wakes up, then just go on
-                 * (instead of producing a deadlock in the former case). */
-                if (!req->waiting_for) {
-                    self->waiting_for = req;
-                    qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
-                    self->waiting_for = NULL;
-                    retry = true;
-                    waited = true;
-                    break;
-                }
-            }
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    for (;;) {
+        node = interval_tree_find_overlap(&bs->tracked_requests,
+                                          self->overlap_offset,
+                                          self->overlap_offset +
+                                          self->overlap_bytes,
+                                          tracked_request_conflicts, self);
+        if (!node) {
+            break;
         }
-        qemu_co_mutex_unlock(&bs->reqs_lock);
-    } while (retry);
+
+        req = container_of(node, BdrvTrackedRequest, node);
+        self->waiting_for = req;
+        qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
+        self->waiting_for = NULL;
+        waited = true;
+    }
+    qemu_co_mutex_unlock(&bs->reqs_lock);
 
     return waited;
 }
@@ -1039,6 +1078,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
      * where anything might happen inside guest memory.
      */
     void *bounce_buffer;
+    size_t bounce_size;
 
     BlockDriver *drv = bs->drv;
     struct iovec iov;
@@ -1075,9 +1115,8 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
     trace_bdrv_co_do_copy_on_readv(bs, offset, bytes,
                                    cluster_offset, cluster_bytes);
 
-    bounce_buffer = qemu_try_blockalign(bs,
-                                        MIN(MIN(max_transfer, cluster_bytes),
-                                            MAX_BOUNCE_BUFFER));
+    bounce_size = MIN(MIN(max_transfer, cluster_bytes), MAX_BOUNCE_BUFFER);
+    bounce_buffer = bdrv_try_bounce_buf_get(bs, bounce_size);
     if (bounce_buffer == NULL) {
         ret = -ENOMEM;
         goto err;
@@ -1156,7 +1195,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
     ret = 0;
 
 err:
-    qemu_vfree(bounce_buffer);
+    bdrv_bounce_buf_put(bs, bounce_buffer, bounce_size);
     return ret;
 }
 
@@ -1298,7 +1337,7 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
 
     /* Align read if necessary by padding qiov */
     if (offset & (align - 1)) {
-        head_buf = qemu_blockalign(bs, align);
+        head_buf = bdrv_bounce_buf_get(bs, align);
         qemu_iovec_init(&local_qiov, qiov->niov + 2);
         qemu_iovec_add(&local_qiov, head_buf, offset & (align - 1));
         qemu_iovec_concat(&local_qiov, qiov, 0, qiov->size);
@@ -1314,7 +1353,7 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
             qemu_iovec_concat(&local_qiov, qiov, 0, qiov->size);
             use_local_qiov = true;
         }
-        tail_buf = qemu_blockalign(bs, align);
+        tail_buf = bdrv_bounce_buf_get(bs, align);
         qemu_iovec_add(&local_qiov, tail_buf,
                        align - ((offset + bytes) & (align - 1)));
 
@@ -1330,8 +1369,8 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
 
     if (use_local_qiov) {
         qemu_iovec_destroy(&local_qiov);
-        qemu_vfree(head_buf);
-        qemu_vfree(tail_buf);
+        bdrv_bounce_buf_put(bs, head_buf, align);
+        bdrv_bounce_buf_put(bs, tail_buf, align);
     }
 
     return ret;
@@ -1587,7 +1626,7 @@ static int coroutine_fn bdrv_co_do_zero_pwritev(BdrvChild *child,
 
     assert(flags & BDRV_REQ_ZERO_WRITE);
     if (head_padding_bytes || tail_padding_bytes) {
-        buf = qemu_blockalign(bs, align);
+        buf = bdrv_bounce_buf_get(bs, align);
         iov = (struct iovec) {
             .iov_base   = buf,
             .iov_len    = align,
@@ -1651,7 +1690,7 @@ static int coroutine_fn bdrv_co_do_zero_pwritev(BdrvChild *child,
                                    &local_qiov, flags & ~BDRV_REQ_ZERO_WRITE);
     }
 fail:
-    qemu_vfree(buf);
+    bdrv_bounce_buf_put(bs, buf, align);
     return ret;
 
 }
@@ -1707,7 +1746,7 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
         mark_request_serialising(&req, align);
         wait_serialising_requests(&req);
 
-        head_buf = qemu_blockalign(bs, align);
+        head_buf = bdrv_bounce_buf_get(bs, align);
         head_iov = (struct iovec) {
             .iov_base   = head_buf,
             .iov_len    = align,
@@ -1749,7 +1788,7 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
         waited = wait_serialising_requests(&req);
         assert(!waited || !use_local_qiov);
 
-        tail_buf = qemu_blockalign(bs, align);
+        tail_buf = bdrv_bounce_buf_get(bs, align);
         tail_iov = (struct iovec) {
             .iov_base   = tail_buf,
             .iov_len    = align,
@@ -1785,8 +1824,8 @@ fail:
     if (use_local_qiov) {
         qemu_iovec_destroy(&local_qiov);
     }
-    qemu_vfree(head_buf);
-    qemu_vfree(tail_buf);
+    bdrv_bounce_buf_put(bs, head_buf, align);
+    bdrv_bounce_buf_put(bs, tail_buf, align);
 out:
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
@@ -0,0 +1,551 @@
+/*
+ * Linux io_uring support.
+ *
+ * Unlike linux-aio.c, io_uring handles buffered I/O and fdatasync
+ * asynchronously, so it does not require cache.direct=on.  Submission and
+ * completion rings are shared by all the files used from one AioContext.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/coroutine.h"
+#include "qapi/error.h"
+#include "trace.h"
+
+#include <liburing.h>
+
+/* Ring size (per-AioContext) */
+#define MAX_ENTRIES 128
+
+/* The kernel limits each fixed buffer to 1 GiB */
+#define MAX_FIXED_BUF_SIZE (1ULL << 30)
+
+typedef struct LuringAIOCB {
+    Coroutine *co;
+    struct io_uring_sqe sqeq;
+    ssize_t ret;
+    QEMUIOVector *qiov;
+    bool is_read;
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+
+    /*
+     * Buffered reads may return a short read even before EOF; the rest of
+     * the request is then resubmitted using this vector.
+     */
+    int total_read;
+    QEMUIOVector resubmit_qiov;
+} LuringAIOCB;
+
+typedef struct LuringBuf {
+    void *host;
+    size_t size;
+    unsigned int refcnt;
+} LuringBuf;
+
+typedef struct LuringQueue {
+    int plugged;
+    unsigned int in_queue;
+    unsigned int in_flight;
+    bool blocked;
+    QSIMPLEQ_HEAD(, LuringAIOCB) submit_queue;
+} LuringQueue;
+
+struct LuringState {
+    AioContext *aio_context;
+
+    struct io_uring ring;
+
+    /* io queue for submit at batch.  Protected by AioContext lock. */
+    LuringQueue io_q;
+
+    /* I/O completion processing.  Only runs in I/O thread.  */
+    QEMUBH *completion_bh;
+
+    /* Memory registered with luring_register_buf() (LuringBuf), and the
+     * chunks it is split into for the kernel's fixed buffer table (struct
+     * iovec).  A request's buf_index is an index into fixed_iov.  Protected
+     * by AioContext lock.
+     */
+    GArray *bufs;
+    GArray *fixed_iov;
+};
+
+/**
+ * luring_resubmit:
+ *
+ * Queues a request again, e.g. after a short read.  It is submitted
+ * together with the next batch.
+ */
+static void luring_resubmit(LuringState *s, LuringAIOCB *luringcb)
+{
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+}
+
+/**
+ * luring_resubmit_short_read:
+ *
+ * Buffered reads can complete with fewer bytes than requested well before
+ * EOF, for example when only part of the range is in the page cache.  Read
+ * the remaining part instead of treating it as EOF.
+ */
+static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
+                                       int nread)
+{
+    QEMUIOVector *resubmit_qiov;
+    size_t remaining;
+
+    luringcb->total_read += nread;
+    remaining = luringcb->qiov->size - luringcb->total_read;
+
+    resubmit_qiov = &luringcb->resubmit_qiov;
+    if (resubmit_qiov->iov == NULL) {
+        qemu_iovec_init(resubmit_qiov, luringcb->qiov->niov);
+    } else {
+        qemu_iovec_reset(resubmit_qiov);
+    }
+    qemu_iovec_concat(resubmit_qiov, luringcb->qiov, luringcb->total_read,
+                      remaining);
+
+    io_uring_prep_readv(&luringcb->sqeq, luringcb->sqeq.fd,
+                        resubmit_qiov->iov, resubmit_qiov->niov,
+                        luringcb->sqeq.off + nread);
+    io_uring_sqe_set_data(&luringcb->sqeq, luringcb);
+
+    luring_resubmit(s, luringcb);
+}
+
+/*
+ * Completes a request and wakes up the coroutine that submitted it.
+ */
+static void luring_process_completion(LuringState *s, LuringAIOCB *luringcb,
+                                      int ret)
+{
+    QEMUIOVector *qiov = luringcb->qiov;
+
+    trace_luring_process_completion(s, luringcb, ret);
+
+    if (qiov) {
+        size_t total_bytes = luringcb->total_read + MAX(ret, 0);
+
+        if (ret < 0) {
+            /* keep the error */
+        } else if (total_bytes == qiov->size) {
+            ret = 0;
+        } else if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                return;
+            }
+            /* Only a zero-byte read means EOF; pad with zeros. */
+            qemu_iovec_memset(qiov, total_bytes, 0, qiov->size - total_bytes);
+            ret = 0;
+        } else {
+            ret = -ENOSPC;
+        }
+    } else if (ret > 0) {
+        ret = 0;
+    }
+
+    if (luringcb->resubmit_qiov.iov != NULL) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+
+    luringcb->ret = ret;
+
+    /* If the coroutine is already entered it must be in ioq_submit() and
+     * will notice luringcb->ret has been filled in when it eventually runs
+     * later.  Coroutines cannot be entered recursively so avoid doing
+     * that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
+/**
+ * luring_process_completions:
+ * @s: AIO state
+ *
+ * Fetches completed I/O requests and invokes their callbacks.
+ *
+ * Each completion is consumed from the ring before its callback runs, so
+ * a callback may invoke aio_poll() and reenter this function safely.  The
+ * BH is scheduled so that a nested event loop also sees the completions
+ * that are still pending here, and canceled once the ring is empty unless
+ * a short read was queued again and needs submitting.
+ */
+static void luring_process_completions(LuringState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    /* Reschedule so nested event loops see currently pending completions */
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0 && cqe) {
+        LuringAIOCB *luringcb = io_uring_cqe_get_data(cqe);
+        int ret = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+
+        /* Change counters one-by-one because we can be nested. */
+        s->io_q.in_flight--;
+        luring_process_completion(s, luringcb, ret);
+    }
+
+    if (s->io_q.in_queue == 0 || s->io_q.plugged) {
+        qemu_bh_cancel(s->completion_bh);
+    }
+}
+
+/**
+ * luring_use_fixed_buf:
+ *
+ * Turns a single-buffer readv/writev into a read/write on a fixed buffer
+ * if the buffer lies in registered memory, so that the kernel need not
+ * pin and map the pages for this request.  This is done as the sqe is
+ * placed in the ring, so that buf_index always refers to the table that
+ * is registered at submission time.
+ */
+static void luring_use_fixed_buf(LuringState *s, struct io_uring_sqe *sqe)
+{
+    const struct iovec *iov;
+    uintptr_t start, end;
+    unsigned int i;
+
+    if ((sqe->opcode != IORING_OP_READV && sqe->opcode != IORING_OP_WRITEV) ||
+        sqe->len != 1) {
+        return;
+    }
+
+    iov = (const struct iovec *)(uintptr_t)sqe->addr;
+    start = (uintptr_t)iov->iov_base;
+    end = start + iov->iov_len;
+    for (i = 0; i < s->fixed_iov->len; i++) {
+        struct iovec *fixed = &g_array_index(s->fixed_iov, struct iovec, i);
+        uintptr_t fixed_start = (uintptr_t)fixed->iov_base;
+
+        if (start >= fixed_start && end <= fixed_start + fixed->iov_len) {
+            sqe->opcode = sqe->opcode == IORING_OP_READV ?
+                          IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = start;
+            sqe->len = iov->iov_len;
+            sqe->buf_index = i;
+            return;
+        }
+    }
+}
+
+static int ioq_submit(LuringState *s)
+{
+    int ret = 0;
+    LuringAIOCB *luringcb, *luringcb_next;
+
+    while (s->io_q.in_queue > 0) {
+        /*
+         * Try to fetch sqes from the ring for requests waiting in
+         * the overflow queue
+         */
+        QSIMPLEQ_FOREACH_SAFE(luringcb, &s->io_q.submit_queue, next,
+                              luringcb_next) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+
+            if (!sqe) {
+                break;
+            }
+            /* Prep sqe for submission */
+            *sqe = luringcb->sqeq;
+            luring_use_fixed_buf(s, sqe);
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        }
+        ret = io_uring_submit(&s->ring);
+        trace_luring_io_uring_submit(s, ret);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            /* Out of resources; whatever was not submitted stays queued */
+            break;
+        }
+        s->io_q.in_flight += ret;
+        s->io_q.in_queue  -= ret;
+    }
+    s->io_q.blocked = (s->io_q.in_queue > 0);
+
+    if (s->io_q.in_flight) {
+        /* We can try to complete something just right away if there are
+         * still requests in-flight. */
+        luring_process_completions(s);
+    } else if (s->io_q.blocked) {
+        /* No completion will come to restart the queue; retry from
+         * the event loop.
+         */
+        qemu_bh_schedule(s->completion_bh);
+    }
+    return ret;
+}
+
+static void luring_process_completions_and_submit(LuringState *s)
+{
+    luring_process_completions(s);
+
+    aio_context_acquire(s->aio_context);
+    if (!s->io_q.plugged && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
+static void qemu_luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static void qemu_luring_completion_cb(void *opaque)
+{
+    LuringState *s = opaque;
+
+    luring_process_completions_and_submit(s);
+}
+
+static bool qemu_luring_poll_cb(void *opaque)
+{
+    LuringState *s = opaque;
+    struct io_uring_cqe *cqe;
+
+    if (io_uring_peek_cqe(&s->ring, &cqe) != 0 || !cqe) {
+        return false;
+    }
+
+    luring_process_completions_and_submit(s);
+    return true;
+}
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->submit_queue);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+}
+
+void luring_io_plug(BlockDriverState *bs, LuringState *s)
+{
+    trace_luring_io_plug(s);
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, LuringState *s)
+{
+    assert(s->io_q.plugged);
+    trace_luring_io_unplug(s, s->io_q.blocked, s->io_q.plugged,
+                           s->io_q.in_queue, s->io_q.in_flight);
+    if (--s->io_q.plugged == 0 &&
+        !s->io_q.blocked && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+}
+
+/**
+ * luring_do_submit:
+ * @fd: file descriptor for I/O
+ * @luringcb: AIO control block
+ * @s: AIO state
+ * @offset: offset for request
+ * @type: type of request
+ *
+ * Fetches sqes from ring, adds to pending queue and preps them
+ */
+static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
+                            uint64_t offset, int type)
+{
+    struct io_uring_sqe *sqes = &luringcb->sqeq;
+
+    switch (type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                             luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_READ:
+        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                            luringcb->qiov->niov, offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        /* Same as qemu_fdatasync() in the thread pool */
+        io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
+        break;
+    default:
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return -EIO;
+    }
+    io_uring_sqe_set_data(sqes, luringcb);
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
+    s->io_q.in_queue++;
+    trace_luring_do_submit(s, s->io_q.blocked, s->io_q.plugged,
+                           s->io_q.in_queue, s->io_q.in_flight);
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged ||
+         s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+    return 0;
+}
+
+int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s,
+                                  int fd, uint64_t offset,
+                                  QEMUIOVector *qiov, int type)
+{
+    int ret;
+    LuringAIOCB luringcb = {
+        .co         = qemu_coroutine_self(),
+        .ret        = -EINPROGRESS,
+        .qiov       = qiov,
+        .is_read    = (type == QEMU_AIO_READ),
+    };
+
+    trace_luring_co_submit(bs, s, &luringcb, fd, offset,
+                           qiov ? qiov->size : 0, type);
+    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (luringcb.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return luringcb.ret;
+}
+
+/*
+ * Registers the current set of buffers with the ring.  The kernel waits for
+ * in-flight requests before replacing the table.  If registration fails,
+ * for example because of RLIMIT_MEMLOCK, requests use vectored I/O.
+ */
+static void luring_update_fixed_bufs(LuringState *s)
+{
+    unsigned int i;
+    int ret;
+
+    if (s->fixed_iov->len) {
+        io_uring_unregister_buffers(&s->ring);
+        g_array_set_size(s->fixed_iov, 0);
+    }
+
+    for (i = 0; i < s->bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(s->bufs, LuringBuf, i);
+        size_t offset;
+
+        for (offset = 0; offset < buf->size; offset += MAX_FIXED_BUF_SIZE) {
+            struct iovec iov = {
+                .iov_base = buf->host + offset,
+                .iov_len = MIN(buf->size - offset, MAX_FIXED_BUF_SIZE),
+            };
+            g_array_append_val(s->fixed_iov, iov);
+        }
+    }
+    if (!s->fixed_iov->len) {
+        return;
+    }
+
+    ret = io_uring_register_buffers(&s->ring,
+                                    (struct iovec *)s->fixed_iov->data,
+                                    s->fixed_iov->len);
+    trace_luring_register_buffers(s, s->fixed_iov->len, ret);
+    if (ret < 0) {
+        g_array_set_size(s->fixed_iov, 0);
+    }
+}
+
+void luring_register_buf(LuringState *s, void *host, size_t size)
+{
+    LuringBuf new_buf = {
+        .host = host,
+        .size = size,
+        .refcnt = 1,
+    };
+    unsigned int i;
+
+    for (i = 0; i < s->bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(s->bufs, LuringBuf, i);
+        if (buf->host == host) {
+            buf->refcnt++;
+            return;
+        }
+    }
+    g_array_append_val(s->bufs, new_buf);
+    luring_update_fixed_bufs(s);
+}
+
+void luring_unregister_buf(LuringState *s, void *host)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->bufs->len; i++) {
+        LuringBuf *buf = &g_array_index(s->bufs, LuringBuf, i);
+        if (buf->host == host) {
+            if (--buf->refcnt == 0) {
+                g_array_remove_index(s->bufs, i);
+                luring_update_fixed_bufs(s);
+            }
+            return;
+        }
+    }
+}
+
+void luring_detach_aio_context(LuringState *s, AioContext *old_context)
+{
+    aio_set_fd_handler(old_context, s->ring.ring_fd, false,
+                       NULL, NULL, NULL, s);
+    qemu_bh_delete(s->completion_bh);
+    s->aio_context = NULL;
+}
+
+void luring_attach_aio_context(LuringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, qemu_luring_completion_bh, s);
+    aio_set_fd_handler(s->aio_context, s->ring.ring_fd, false,
+                       qemu_luring_completion_cb, NULL,
+                       qemu_luring_poll_cb, s);
+}
+
+LuringState *luring_init(Error **errp)
+{
+    int rc;
+    LuringState *s = g_new0(LuringState, 1);
+    struct io_uring *ring = &s->ring;
+
+    trace_luring_init_state(s, sizeof(*s));
+
+    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        g_free(s);
+        return NULL;
+    }
+
+    ioq_init(&s->io_q);
+    s->bufs = g_array_new(false, false, sizeof(LuringBuf));
+    s->fixed_iov = g_array_new(false, false, sizeof(struct iovec));
+    return s;
+}
+
+void luring_cleanup(LuringState *s)
+{
+    io_uring_queue_exit(&s->ring);
+    g_array_free(s->bufs, true);
+    g_array_free(s->fixed_iov, true);
+    trace_luring_cleanup_state(s);
+    g_free(s);
+}
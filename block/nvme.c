@@ -44,6 +44,7 @@ typedef struct {
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
+    uint32_t *result; /* if non-NULL, receives dword 0 of the completion */
     bool busy;
 } NVMeRequest;
 
@@ -96,6 +97,8 @@ typedef struct {
      */
     NVMeQueuePair **queues;
     int nr_queues;
+    /* I/O queue to submit the next request on, in [1, nr_queues) */
+    int next_ioq;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -115,6 +118,9 @@ typedef struct {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_NUM_QUEUES "num-queues"
+#define NVME_BLOCK_OPT_IRQ_COALESCING_THRESHOLD "irq-coalescing-threshold"
+#define NVME_BLOCK_OPT_IRQ_COALESCING_TIME "irq-coalescing-time"
 
 static QemuOptsList runtime_opts = {
     .name = "nvme",
@@ -130,6 +136,22 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_NUM_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
+        {
+            .name = NVME_BLOCK_OPT_IRQ_COALESCING_THRESHOLD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Completions to aggregate per interrupt (1-256)",
+        },
+        {
+            .name = NVME_BLOCK_OPT_IRQ_COALESCING_TIME,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum interrupt delay in 100 microsecond units "
+                    "(0-255)",
+        },
         { /* end of list */ }
     },
 };
@@ -330,8 +352,12 @@ static bool nvme_process_completion(BDRVNVMeState *s, NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         preq->busy = false;
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, nvme_translate_error(c));
         qemu_mutex_lock(&q->lock);
@@ -392,8 +418,8 @@ static void nvme_cmd_sync_cb(void *opaque, int ret)
     *pret = ret;
 }
 
-static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
-                         NvmeCmd *cmd)
+static int nvme_cmd_sync_result(BlockDriverState *bs, NVMeQueuePair *q,
+                                NvmeCmd *cmd, uint32_t *result)
 {
     NVMeRequest *req;
     BDRVNVMeState *s = bs->opaque;
@@ -402,12 +428,19 @@ static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(s, q, req, cmd, nvme_cmd_sync_cb, &ret);
 
     BDRV_POLL_WHILE(bs, ret == -EINPROGRESS);
     return ret;
 }
 
+static int nvme_cmd_sync(BlockDriverState *bs, NVMeQueuePair *q,
+                         NvmeCmd *cmd)
+{
+    return nvme_cmd_sync_result(bs, q, cmd, NULL);
+}
+
 static void nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
@@ -474,6 +507,17 @@ static bool nvme_poll_queues(BDRVNVMeState *s)
 
     for (i = 0; i < s->nr_queues; i++) {
         NVMeQueuePair *q = s->queues[i];
+        const NvmeCqe *c = (NvmeCqe *)&q->cq.queue[q->cq.head *
+                                                   NVME_CQ_ENTRY_BYTES];
+
+        /* Peek at the completion queue without taking the lock; this keeps
+         * the poll handler cheap when several queues are idle.
+         */
+        if (!atomic_read(&q->inflight) || !atomic_read(&c->cid) ||
+            (le16_to_cpu(atomic_read(&c->status)) & 0x1) == q->cq_phase) {
+            continue;
+        }
+
         qemu_mutex_lock(&q->lock);
         while (nvme_process_completion(s, q)) {
             /* Keep polling */
@@ -535,6 +579,75 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     return true;
 }
 
+/* Create up to @num_queues I/O queue pairs, as many as the controller
+ * grants.
+ */
+static bool nvme_add_io_queues(BlockDriverState *bs, int num_queues,
+                               Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    uint32_t result = 0;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32((num_queues - 1) | ((num_queues - 1) << 16)),
+    };
+    int i;
+
+    if (num_queues > 1) {
+        if (nvme_cmd_sync_result(bs, s->queues[0], &cmd, &result)) {
+            error_setg(errp, "Failed to set the number of queues");
+            return false;
+        }
+        /* Both counts are zero-based */
+        num_queues = MIN(num_queues, (result & 0xFFFF) + 1);
+        num_queues = MIN(num_queues, (result >> 16) + 1);
+        trace_nvme_io_queues(s, num_queues);
+    }
+
+    for (i = 0; i < num_queues; i++) {
+        if (!nvme_add_io_queue(bs, errp)) {
+            return false;
+        }
+    }
+    s->next_ioq = 1;
+    return true;
+}
+
+static int nvme_set_irq_coalescing(BlockDriverState *bs, int threshold,
+                                   int time, Error **errp)
+{
+    BDRVNVMeState *s = bs->opaque;
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_INTERRUPT_COALESCING),
+        .cdw11 = cpu_to_le32((threshold - 1) | (time << 8)),
+    };
+    int ret;
+
+    ret = nvme_cmd_sync(bs, s->queues[0], &cmd);
+    if (ret) {
+        error_setg_errno(errp, -ret, "Failed to configure interrupt "
+                         "coalescing");
+    }
+    return ret;
+}
+
+/* Pick the I/O queue for a new request.  Spreading requests over several
+ * queue pairs allows more than one queue's worth of commands in flight.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    NVMeQueuePair *q;
+
+    assert(s->nr_queues > 1);
+    q = s->queues[s->next_ioq];
+    if (++s->next_ioq == s->nr_queues) {
+        s->next_ioq = 1;
+    }
+    return q;
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -547,7 +660,7 @@ static bool nvme_poll_cb(void *opaque)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     int num_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     int ret;
@@ -653,7 +766,7 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
+    if (!nvme_add_io_queues(bs, num_queues, errp)) {
         ret = -EIO;
         goto fail_handler;
     }
@@ -752,6 +865,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    int64_t num_queues, irq_threshold, irq_time;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -765,11 +879,38 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    num_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NUM_QUEUES, 1);
+    irq_threshold = qemu_opt_get_number(opts,
+                                        NVME_BLOCK_OPT_IRQ_COALESCING_THRESHOLD,
+                                        0);
+    irq_time = qemu_opt_get_number(opts, NVME_BLOCK_OPT_IRQ_COALESCING_TIME,
+                                   0);
     qemu_opts_del(opts);
+
+    if (num_queues < 1 || num_queues > 0xFFFF) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_NUM_QUEUES "' must be between "
+                   "1 and 65535");
+        return -EINVAL;
+    }
+    if (irq_threshold < 0 || irq_threshold > 256 ||
+        irq_time < 0 || irq_time > 255 ||
+        (irq_time && !irq_threshold)) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IRQ_COALESCING_THRESHOLD "' must "
+                   "be between 1 and 256 and '"
+                   NVME_BLOCK_OPT_IRQ_COALESCING_TIME "' between 0 and 255");
+        return -EINVAL;
+    }
+
+    ret = nvme_init(bs, device, namespace, num_queues, errp);
     if (ret) {
         goto fail;
     }
+    if (irq_threshold) {
+        ret = nvme_set_irq_coalescing(bs, irq_threshold, irq_time, errp);
+        if (ret) {
+            goto fail;
+        }
+    }
     if (flags & BDRV_O_NOCACHE) {
         if (!s->write_cache_supported) {
             error_setg(errp,
@@ -927,7 +1068,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12 = (((bytes >> BDRV_SECTOR_BITS) - 1) & 0xFFFF) |
                        (flags & BDRV_REQ_FUA ? 1 << 30 : 0);
@@ -944,7 +1085,6 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
     };
 
     trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
-    assert(s->nr_queues > 1);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1041,7 +1181,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[1];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1052,7 +1192,7 @@ static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
         .ret = -EINPROGRESS,
     };
 
-    assert(s->nr_queues > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(s, ioq, req, &cmd, nvme_rw_cb, &data);
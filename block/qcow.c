@@ -210,7 +210,7 @@ static int qcow_open(BlockDriverState *bs, QDict *options, int flags,
                 cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
             }
             s->crypto = qcrypto_block_open(crypto_opts, "encrypt.",
-                                           NULL, NULL, cflags, errp);
+                                           NULL, NULL, cflags, 1, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1004,6 +1004,26 @@ qcow_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
     uint8_t *buf, *out_buf;
     uint64_t cluster_offset;
 
+    if (bytes > s->cluster_size && !(offset & (s->cluster_size - 1))) {
+        /* Compress one cluster at a time */
+        QEMUIOVector local_qiov;
+        uint64_t done = 0;
+
+        qemu_iovec_init(&local_qiov, qiov->niov);
+        ret = 0;
+        while (done < bytes && ret >= 0) {
+            uint64_t n = MIN(bytes - done, s->cluster_size);
+
+            qemu_iovec_reset(&local_qiov);
+            qemu_iovec_concat(&local_qiov, qiov, done, n);
+            ret = qcow_co_pwritev_compressed(bs, offset + done, n,
+                                             &local_qiov);
+            done += n;
+        }
+        qemu_iovec_destroy(&local_qiov);
+        return ret;
+    }
+
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes != s->cluster_size) {
         if (bytes > s->cluster_size ||
@@ -26,7 +26,6 @@
 #include "block/block_int.h"
 #include "sysemu/block-backend.h"
 #include "qemu/module.h"
-#include <zlib.h>
 #include "block/qcow2.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
@@ -289,7 +288,7 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, errp);
+                                           bs, cflags, 1, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
@@ -917,7 +916,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         }
     }
 
-    r->l2_slice_size = l2_cache_entry_size / sizeof(uint64_t);
+    r->l2_slice_size = l2_cache_entry_size / l2_entry_size(s);
     r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size,
                                            l2_cache_entry_size);
     r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size,
@@ -1130,6 +1129,17 @@ static int qcow2_update_options(BlockDriverState *bs, QDict *options,
     return ret;
 }
 
+/* Forget all decompressed clusters; called before any write */
+static void qcow2_decompressed_cache_invalidate(BDRVQcow2State *s)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_DECOMPRESSED_CACHE_SIZE; i++) {
+        s->decompressed[i].offset = -1;
+    }
+    s->decompressed_generation++;
+}
+
 /* Called with s->lock held.  */
 static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
                                       int flags, Error **errp)
@@ -1267,6 +1277,17 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         }
     }
 
+    s->subclusters_per_cluster =
+        has_subclusters(s) ? QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER : 1;
+    s->subcluster_size = s->cluster_size / s->subclusters_per_cluster;
+    s->subcluster_bits = ctz32(s->subcluster_size);
+
+    if (s->subcluster_size < (1 << MIN_CLUSTER_BITS)) {
+        error_setg(errp, "Unsupported subcluster size: %d", s->subcluster_size);
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* Check support for various header values */
     if (header.refcount_order > 6) {
         error_setg(errp, "Reference count entry width too large; may not "
@@ -1307,7 +1328,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         bs->encrypted = true;
     }
 
-    s->l2_bits = s->cluster_bits - 3; /* L2 is always one cluster */
+    /* L2 is always one cluster */
+    s->l2_bits = s->cluster_bits - ctz32(l2_entry_size(s));
     s->l2_size = 1 << s->l2_bits;
     /* 2^(s->refcount_order - 3) is the refcount width in bytes */
     s->refcount_block_bits = s->cluster_bits - (s->refcount_order - 3);
@@ -1399,7 +1421,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         goto fail;
     }
 
-    s->cluster_cache_offset = -1;
+    qcow2_decompressed_cache_invalidate(s);
+    qemu_co_queue_init(&s->thread_task_queue);
     s->flags = flags;
 
     ret = qcow2_refcount_init(bs);
@@ -1430,7 +1453,7 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
                 cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
-                                           NULL, NULL, cflags, errp);
+                                           NULL, NULL, cflags, 1, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1600,7 +1623,7 @@ static void qcow2_refresh_limits(BlockDriverState *bs, Error **errp)
         /* Encryption works on a sector granularity */
         bs->bl.request_alignment = BDRV_SECTOR_SIZE;
     }
-    bs->bl.pwrite_zeroes_alignment = s->cluster_size;
+    bs->bl.pwrite_zeroes_alignment = s->subcluster_size;
     bs->bl.pdiscard_alignment = s->cluster_size;
 }
 
@@ -1725,21 +1748,135 @@ static int coroutine_fn qcow2_co_block_status(BlockDriverState *bs,
 
     *pnum = bytes;
 
-    if (cluster_offset != 0 && ret != QCOW2_CLUSTER_COMPRESSED &&
-        !s->crypto) {
+    if ((ret == QCOW2_SUBCLUSTER_NORMAL ||
+         ret == QCOW2_SUBCLUSTER_ZERO_ALLOC) && !s->crypto) {
         index_in_cluster = offset & (s->cluster_size - 1);
         *map = cluster_offset | index_in_cluster;
         *file = bs->file->bs;
         status |= BDRV_BLOCK_OFFSET_VALID;
     }
-    if (ret == QCOW2_CLUSTER_ZERO_PLAIN || ret == QCOW2_CLUSTER_ZERO_ALLOC) {
+    if (ret == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
+        ret == QCOW2_SUBCLUSTER_ZERO_ALLOC) {
         status |= BDRV_BLOCK_ZERO;
-    } else if (ret != QCOW2_CLUSTER_UNALLOCATED) {
+    } else if (ret != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+               ret != QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC) {
         status |= BDRV_BLOCK_DATA;
     }
     return status;
 }
 
+static Qcow2DecompressedCluster *
+qcow2_decompressed_cache_lookup(BDRVQcow2State *s, uint64_t coffset)
+{
+    int i;
+
+    for (i = 0; i < QCOW2_DECOMPRESSED_CACHE_SIZE; i++) {
+        Qcow2DecompressedCluster *dc = &s->decompressed[i];
+        if (dc->offset == coffset) {
+            dc->lru_counter = ++s->decompressed_lru_counter;
+            return dc;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Store @data as the contents of the compressed cluster at @coffset,
+ * replacing the least recently used entry.  Returns the buffer that was
+ * replaced (possibly NULL), which the caller must free.
+ */
+static uint8_t *qcow2_decompressed_cache_insert(BDRVQcow2State *s,
+                                                uint64_t coffset,
+                                                uint8_t *data)
+{
+    Qcow2DecompressedCluster *dc = &s->decompressed[0];
+    uint8_t *old;
+    int i;
+
+    for (i = 1; i < QCOW2_DECOMPRESSED_CACHE_SIZE; i++) {
+        Qcow2DecompressedCluster *t = &s->decompressed[i];
+        if (dc->offset == -1) {
+            break;
+        }
+        if (t->offset == -1 || t->lru_counter < dc->lru_counter) {
+            dc = t;
+        }
+    }
+
+    old = dc->data;
+    dc->data = data;
+    dc->offset = coffset;
+    dc->lru_counter = ++s->decompressed_lru_counter;
+    return old;
+}
+
+/*
+ * Read @bytes at @offset from the compressed cluster described by
+ * @cluster_descriptor.  Called without s->lock: the compressed data is read
+ * and inflated in the thread pool while other requests proceed.
+ */
+static coroutine_fn int
+qcow2_co_preadv_compressed(BlockDriverState *bs, uint64_t cluster_descriptor,
+                           uint64_t offset, uint64_t bytes,
+                           QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret, csize, nb_csectors;
+    uint64_t coffset, generation;
+    uint8_t *buf, *out_buf;
+    struct iovec iov;
+    QEMUIOVector local_qiov;
+    Qcow2DecompressedCluster *dc;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+
+    coffset = cluster_descriptor & s->cluster_offset_mask;
+    nb_csectors = ((cluster_descriptor >> s->csize_shift) & s->csize_mask) + 1;
+    csize = nb_csectors * 512 - (coffset & 511);
+
+    dc = qcow2_decompressed_cache_lookup(s, coffset);
+    if (dc) {
+        qemu_iovec_from_buf(qiov, 0, dc->data + offset_in_cluster, bytes);
+        return 0;
+    }
+
+    buf = g_try_malloc(csize);
+    if (!buf) {
+        return -ENOMEM;
+    }
+    iov.iov_base = buf;
+    iov.iov_len = csize;
+    qemu_iovec_init_external(&local_qiov, &iov, 1);
+
+    out_buf = g_malloc(s->cluster_size);
+    generation = s->decompressed_generation;
+
+    BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_preadv(bs->file, coffset, csize, &local_qiov, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
+        ret = -EIO;
+        goto fail;
+    }
+
+    qemu_iovec_from_buf(qiov, 0, out_buf + offset_in_cluster, bytes);
+
+    /* Another request may have cached the same cluster meanwhile */
+    if (generation == s->decompressed_generation &&
+        !qcow2_decompressed_cache_lookup(s, coffset)) {
+        out_buf = qcow2_decompressed_cache_insert(s, coffset, out_buf);
+    }
+    ret = 0;
+
+fail:
+    g_free(out_buf);
+    g_free(buf);
+
+    return ret;
+}
+
 static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                                         uint64_t bytes, QEMUIOVector *qiov,
                                         int flags)
@@ -1777,7 +1914,8 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
         qemu_iovec_concat(&hd_qiov, qiov, bytes_done, cur_bytes);
 
         switch (ret) {
-        case QCOW2_CLUSTER_UNALLOCATED:
+        case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
 
             if (bs->backing) {
                 BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
@@ -1794,24 +1932,22 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             }
             break;
 
-        case QCOW2_CLUSTER_ZERO_PLAIN:
-        case QCOW2_CLUSTER_ZERO_ALLOC:
+        case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+        case QCOW2_SUBCLUSTER_ZERO_ALLOC:
             qemu_iovec_memset(&hd_qiov, 0, 0, cur_bytes);
             break;
 
-        case QCOW2_CLUSTER_COMPRESSED:
-            /* add AIO support for compressed blocks ? */
-            ret = qcow2_decompress_cluster(bs, cluster_offset);
+        case QCOW2_SUBCLUSTER_COMPRESSED:
+            qemu_co_mutex_unlock(&s->lock);
+            ret = qcow2_co_preadv_compressed(bs, cluster_offset,
+                                             offset, cur_bytes, &hd_qiov);
+            qemu_co_mutex_lock(&s->lock);
             if (ret < 0) {
                 goto fail;
             }
-
-            qemu_iovec_from_buf(&hd_qiov, 0,
-                                s->cluster_cache + offset_in_cluster,
-                                cur_bytes);
             break;
 
-        case QCOW2_CLUSTER_NORMAL:
+        case QCOW2_SUBCLUSTER_NORMAL:
             if ((cluster_offset & 511) != 0) {
                 ret = -EIO;
                 goto fail;
@@ -1944,7 +2080,7 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    s->cluster_cache_offset = -1; /* disable compressed cache */
+    qcow2_decompressed_cache_invalidate(s);
 
     qemu_co_mutex_lock(&s->lock);
 
@@ -2114,6 +2250,8 @@ static int qcow2_inactivate(BlockDriverState *bs)
 static void qcow2_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
+    int i;
+
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
@@ -2135,8 +2273,10 @@ static void qcow2_close(BlockDriverState *bs)
     g_free(s->image_backing_file);
     g_free(s->image_backing_format);
 
-    g_free(s->cluster_cache);
-    qemu_vfree(s->cluster_data);
+    for (i = 0; i < QCOW2_DECOMPRESSED_CACHE_SIZE; i++) {
+        g_free(s->decompressed[i].data);
+        s->decompressed[i].data = NULL;
+    }
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
 }
@@ -2335,6 +2475,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_CORRUPT_BITNR,
                 .name = "corrupt bit",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
+                .name = "extended L2 entries",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
@@ -2653,28 +2798,31 @@ int64_t qcow2_refcount_metadata_size(int64_t clusters, size_t cluster_size,
  * @total_size: virtual disk size in bytes
  * @cluster_size: cluster size in bytes
  * @refcount_order: refcount bits power-of-2 exponent
+ * @extended_l2: true if the image has extended L2 entries
  *
  * Returns: Total number of bytes required for the fully allocated image
  * (including metadata).
  */
 static int64_t qcow2_calc_prealloc_size(int64_t total_size,
                                         size_t cluster_size,
-                                        int refcount_order)
+                                        int refcount_order,
+                                        bool extended_l2)
 {
     int64_t meta_size = 0;
     uint64_t nl1e, nl2e;
     int64_t aligned_total_size = ROUND_UP(total_size, cluster_size);
+    size_t l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
 
     /* header: 1 cluster */
     meta_size += cluster_size;
 
     /* total size of L2 tables */
     nl2e = aligned_total_size / cluster_size;
-    nl2e = ROUND_UP(nl2e, cluster_size / sizeof(uint64_t));
-    meta_size += nl2e * sizeof(uint64_t);
+    nl2e = ROUND_UP(nl2e, cluster_size / l2e_size);
+    meta_size += nl2e * l2e_size;
 
     /* total size of L1 tables */
-    nl1e = nl2e * sizeof(uint64_t) / cluster_size;
+    nl1e = nl2e * l2e_size / cluster_size;
     nl1e = ROUND_UP(nl1e, cluster_size / sizeof(uint64_t));
     meta_size += nl1e * sizeof(uint64_t);
 
@@ -2822,6 +2970,26 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         goto out;
     }
 
+    if (!qcow2_opts->has_extended_l2) {
+        qcow2_opts->extended_l2 = false;
+    }
+    if (qcow2_opts->extended_l2) {
+        if (version < 3) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "compatibility level 1.1 and above (use version=v3 or "
+                       "greater)");
+            ret = -EINVAL;
+            goto out;
+        }
+        if (cluster_size < QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER * 512) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "cluster sizes of at least %d bytes",
+                       QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER * 512);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
     if (!qcow2_opts->has_preallocation) {
         qcow2_opts->preallocation = PREALLOC_MODE_OFF;
     }
@@ -2889,7 +3057,7 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
     {
         int64_t prealloc_size =
             qcow2_calc_prealloc_size(qcow2_opts->size, cluster_size,
-                                     refcount_order);
+                                     refcount_order, qcow2_opts->extended_l2);
 
         ret = blk_truncate(blk, prealloc_size, qcow2_opts->preallocation, errp);
         if (ret < 0) {
@@ -2921,6 +3089,11 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
             cpu_to_be64(QCOW2_COMPAT_LAZY_REFCOUNTS);
     }
 
+    if (qcow2_opts->extended_l2) {
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_EXTL2);
+    }
+
     ret = blk_pwrite(blk, 0, header, cluster_size, 0);
     g_free(header);
     if (ret < 0) {
@@ -3093,6 +3266,7 @@ static int coroutine_fn qcow2_co_create_opts(const char *filename, QemuOpts *opt
         { BLOCK_OPT_BACKING_FILE,       "backing-file" },
         { BLOCK_OPT_BACKING_FMT,        "backing-fmt" },
         { BLOCK_OPT_CLUSTER_SIZE,       "cluster-size" },
+        { BLOCK_OPT_EXTL2,              "extended-l2" },
         { BLOCK_OPT_LAZY_REFCOUNTS,     "lazy-refcounts" },
         { BLOCK_OPT_REFCOUNT_BITS,      "refcount-bits" },
         { BLOCK_OPT_ENCRYPT,            BLOCK_OPT_ENCRYPT_FORMAT },
@@ -3183,8 +3357,8 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
-    uint32_t head = offset % s->cluster_size;
-    uint32_t tail = (offset + bytes) % s->cluster_size;
+    uint32_t head = offset_into_subcluster(s, offset);
+    uint32_t tail = offset_into_subcluster(s, offset + bytes);
 
     trace_qcow2_pwrite_zeroes_start_req(qemu_coroutine_self(), offset, bytes);
     if (offset + bytes == bs->total_sectors * BDRV_SECTOR_SIZE) {
@@ -3195,26 +3369,26 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
         uint64_t off;
         unsigned int nr;
 
-        assert(head + bytes <= s->cluster_size);
+        assert(head + bytes <= s->subcluster_size);
 
-        /* check whether remainder of cluster already reads as zero */
+        /* check whether remainder of subcluster already reads as zero */
         if (!(is_zero(bs, offset - head, head) &&
               is_zero(bs, offset + bytes,
-                      tail ? s->cluster_size - tail : 0))) {
+                      tail ? s->subcluster_size - tail : 0))) {
             return -ENOTSUP;
         }
 
         qemu_co_mutex_lock(&s->lock);
         /* We can have new write after previous check */
-        offset = QEMU_ALIGN_DOWN(offset, s->cluster_size);
-        bytes = s->cluster_size;
-        nr = s->cluster_size;
+        offset = QEMU_ALIGN_DOWN(offset, s->subcluster_size);
+        bytes = s->subcluster_size;
+        nr = s->subcluster_size;
         ret = qcow2_get_cluster_offset(bs, offset, &nr, &off);
-        if (ret != QCOW2_CLUSTER_UNALLOCATED &&
-            ret != QCOW2_CLUSTER_ZERO_PLAIN &&
-            ret != QCOW2_CLUSTER_ZERO_ALLOC) {
+        if (ret != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+            ret != QCOW2_SUBCLUSTER_ZERO_PLAIN &&
+            ret != QCOW2_SUBCLUSTER_ZERO_ALLOC) {
             qemu_co_mutex_unlock(&s->lock);
-            return -ENOTSUP;
+            return ret < 0 ? ret : -ENOTSUP;
         }
     } else {
         qemu_co_mutex_lock(&s->lock);
@@ -3223,7 +3397,7 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     trace_qcow2_pwrite_zeroes(qemu_coroutine_self(), offset, bytes);
 
     /* Whatever is left can use real zero clusters */
-    ret = qcow2_cluster_zeroize(bs, offset, bytes, flags);
+    ret = qcow2_subcluster_zeroize(bs, offset, bytes, flags);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -3392,7 +3566,7 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
          *  preallocation. All that matters is that we will not have to allocate
          *  new refcount structures for them.) */
         nb_new_l2_tables = DIV_ROUND_UP(nb_new_data_clusters,
-                                        s->cluster_size / sizeof(uint64_t));
+                                        s->cluster_size / l2_entry_size(s));
         /* The cluster range may not be aligned to L2 boundaries, so add one L2
          * table for a potential head/tail */
         nb_new_l2_tables++;
@@ -3489,39 +3663,19 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset,
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
 static coroutine_fn int
-qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
-                            uint64_t bytes, QEMUIOVector *qiov)
+qcow2_co_pwritev_compressed_cluster(BlockDriverState *bs, uint64_t offset,
+                                    uint64_t bytes, QEMUIOVector *qiov)
 {
     BDRVQcow2State *s = bs->opaque;
     QEMUIOVector hd_qiov;
     struct iovec iov;
-    z_stream strm;
-    int ret, out_len;
+    int ret;
+    ssize_t out_len;
     uint8_t *buf, *out_buf;
     int64_t cluster_offset;
 
-    if (bytes == 0) {
-        /* align end of file to a sector boundary to ease reading with
-           sector based I/Os */
-        cluster_offset = bdrv_getlength(bs->file->bs);
-        if (cluster_offset < 0) {
-            return cluster_offset;
-        }
-        return bdrv_truncate(bs->file, cluster_offset, PREALLOC_MODE_OFF, NULL);
-    }
-
-    if (offset_into_cluster(s, offset)) {
-        return -EINVAL;
-    }
-
     buf = qemu_blockalign(bs, s->cluster_size);
     if (bytes != s->cluster_size) {
-        if (bytes > s->cluster_size ||
-            offset + bytes != bs->total_sectors << BDRV_SECTOR_BITS)
-        {
-            qemu_vfree(buf);
-            return -EINVAL;
-        }
         /* Zero-pad last write if image size is not cluster aligned */
         memset(buf + bytes, 0, s->cluster_size - bytes);
     }
@@ -3529,41 +3683,22 @@ qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
 
     out_buf = g_malloc(s->cluster_size);
 
-    /* best compression, small window, no zlib header */
-    memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
-                       Z_DEFLATED, -12,
-                       9, Z_DEFAULT_STRATEGY);
-    if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
-    }
-
-    strm.avail_in = s->cluster_size;
-    strm.next_in = (uint8_t *)buf;
-    strm.avail_out = s->cluster_size;
-    strm.next_out = out_buf;
-
-    ret = deflate(&strm, Z_FINISH);
-    if (ret != Z_STREAM_END && ret != Z_OK) {
-        deflateEnd(&strm);
-        ret = -EINVAL;
-        goto fail;
-    }
-    out_len = strm.next_out - out_buf;
-
-    deflateEnd(&strm);
-
-    if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
+                                buf, s->cluster_size);
+    if (out_len == -ENOMEM) {
         /* could not compress: write normal cluster */
         ret = qcow2_co_pwritev(bs, offset, bytes, qiov, 0);
         if (ret < 0) {
             goto fail;
         }
         goto success;
+    } else if (out_len < 0) {
+        ret = -EINVAL;
+        goto fail;
     }
 
     qemu_co_mutex_lock(&s->lock);
+    qcow2_decompressed_cache_invalidate(s);
     cluster_offset =
         qcow2_alloc_compressed_cluster_offset(bs, offset, out_len);
     if (!cluster_offset) {
@@ -3598,6 +3733,118 @@ fail:
     return ret;
 }
 
+typedef struct Qcow2CompressedWrite {
+    BlockDriverState *bs;
+    QEMUIOVector *qiov;
+    Coroutine *waiting;
+    int in_flight;
+    int ret;
+} Qcow2CompressedWrite;
+
+typedef struct Qcow2CompressedWriteCluster {
+    Qcow2CompressedWrite *write;
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t qiov_offset;
+} Qcow2CompressedWriteCluster;
+
+static void coroutine_fn qcow2_compressed_write_entry(void *opaque)
+{
+    Qcow2CompressedWriteCluster *cl = opaque;
+    Qcow2CompressedWrite *w = cl->write;
+    QEMUIOVector local_qiov;
+    int ret;
+
+    qemu_iovec_init(&local_qiov, w->qiov->niov);
+    qemu_iovec_concat(&local_qiov, w->qiov, cl->qiov_offset, cl->bytes);
+    ret = qcow2_co_pwritev_compressed_cluster(w->bs, cl->offset, cl->bytes,
+                                              &local_qiov);
+    qemu_iovec_destroy(&local_qiov);
+    g_free(cl);
+
+    if (ret < 0 && w->ret == 0) {
+        w->ret = ret;
+    }
+    w->in_flight--;
+    if (w->waiting) {
+        Coroutine *co = w->waiting;
+        w->waiting = NULL;
+        aio_co_wake(co);
+    }
+}
+
+static void coroutine_fn qcow2_compressed_write_wait(Qcow2CompressedWrite *w,
+                                                     int max_in_flight)
+{
+    while (w->in_flight > max_in_flight) {
+        w->waiting = qemu_coroutine_self();
+        qemu_coroutine_yield();
+    }
+}
+
+/*
+ * Each cluster of the request is compressed and written by a coroutine of
+ * its own, so that up to QCOW2_MAX_THREADS clusters are compressed in
+ * parallel.  Clusters are allocated in the order their compression
+ * finishes.
+ */
+static coroutine_fn int
+qcow2_co_pwritev_compressed(BlockDriverState *bs, uint64_t offset,
+                            uint64_t bytes, QEMUIOVector *qiov)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedWrite w = {
+        .bs = bs,
+        .qiov = qiov,
+    };
+    uint64_t qiov_offset = 0;
+    int64_t len;
+
+    if (bytes == 0) {
+        /* align end of file to a sector boundary to ease reading with
+           sector based I/Os */
+        len = bdrv_getlength(bs->file->bs);
+        if (len < 0) {
+            return len;
+        }
+        return bdrv_truncate(bs->file, len, PREALLOC_MODE_OFF, NULL);
+    }
+
+    if (offset_into_cluster(s, offset)) {
+        return -EINVAL;
+    }
+
+    /* Only the last cluster of the image may be written partially */
+    if (offset_into_cluster(s, bytes) &&
+        offset + bytes != bs->total_sectors << BDRV_SECTOR_BITS) {
+        return -EINVAL;
+    }
+
+    while (bytes && w.ret == 0) {
+        Qcow2CompressedWriteCluster *cl = g_new(Qcow2CompressedWriteCluster, 1);
+        Coroutine *co;
+
+        *cl = (Qcow2CompressedWriteCluster) {
+            .write = &w,
+            .offset = offset,
+            .bytes = MIN(bytes, s->cluster_size),
+            .qiov_offset = qiov_offset,
+        };
+        offset += cl->bytes;
+        qiov_offset += cl->bytes;
+        bytes -= cl->bytes;
+
+        w.in_flight++;
+        co = qemu_coroutine_create(qcow2_compressed_write_entry, cl);
+        qemu_coroutine_enter(co);
+
+        qcow2_compressed_write_wait(&w, QCOW2_MAX_THREADS - 1);
+    }
+    qcow2_compressed_write_wait(&w, 0);
+
+    return w.ret;
+}
+
 static int make_completely_empty(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -3812,10 +4059,12 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     uint64_t refcount_bits;
     uint64_t l2_tables;
     size_t cluster_size;
+    size_t l2e_size;
     int version;
     char *optstr;
     PreallocMode prealloc;
     bool has_backing_file;
+    bool extended_l2;
 
     /* Parse image creation options */
     cluster_size = qcow2_opt_get_cluster_size_del(opts, &local_err);
@@ -3833,6 +4082,22 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
         goto err;
     }
 
+    extended_l2 = qemu_opt_get_bool_del(opts, BLOCK_OPT_EXTL2, false);
+    if (extended_l2 && version < 3) {
+        error_setg(&local_err, "Extended L2 entries are only supported with "
+                   "compatibility level 1.1 and above (use compat=1.1 or "
+                   "greater)");
+        goto err;
+    }
+    if (extended_l2 &&
+        cluster_size < QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER * 512) {
+        error_setg(&local_err, "Extended L2 entries are only supported with "
+                   "cluster sizes of at least %d bytes",
+                   QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER * 512);
+        goto err;
+    }
+    l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
+
     optstr = qemu_opt_get_del(opts, BLOCK_OPT_PREALLOC);
     prealloc = qapi_enum_parse(&PreallocMode_lookup, optstr,
                                PREALLOC_MODE_OFF, &local_err);
@@ -3850,7 +4115,7 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
 
     /* Check that virtual disk size is valid */
     l2_tables = DIV_ROUND_UP(virtual_size / cluster_size,
-                             cluster_size / sizeof(uint64_t));
+                             cluster_size / l2e_size);
     if (l2_tables * sizeof(uint64_t) > QCOW_MAX_L1_SIZE) {
         error_setg(&local_err, "The image size is too large "
                                "(try using a larger cluster size)");
@@ -3915,7 +4180,7 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     info = g_new(BlockMeasureInfo, 1);
     info->fully_allocated =
         qcow2_calc_prealloc_size(virtual_size, cluster_size,
-                                 ctz32(refcount_bits));
+                                 ctz32(refcount_bits), extended_l2);
 
     /* Remove data clusters that are not required.  This overestimates the
      * required size because metadata needed for the fully allocated file is
@@ -3938,6 +4203,22 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    BlockStatsSpecificQcow2 *qstats = g_new0(BlockStatsSpecificQcow2, 1);
+
+    qstats->l2_cache = g_new0(Qcow2CacheStats, 1);
+    qstats->refcount_cache = g_new0(Qcow2CacheStats, 1);
+    qcow2_cache_get_stats(s->l2_table_cache, qstats->l2_cache);
+    qcow2_cache_get_stats(s->refcount_block_cache, qstats->refcount_cache);
+
+    stats->type = BLOCK_STATS_SPECIFIC_KIND_QCOW2;
+    stats->u.qcow2.data = qstats;
+    return stats;
+}
+
 static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -3968,6 +4249,8 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
                                   QCOW2_INCOMPAT_CORRUPT,
             .has_corrupt        = true,
             .refcount_bits      = s->refcount_bits,
+            .extended_l2        = has_subclusters(s),
+            .has_extended_l2    = true,
         };
     } else {
         /* if this assertion fails, this probably means a new version was
@@ -4046,6 +4329,11 @@ static int qcow2_downgrade(BlockDriverState *bs, int target_version,
         return -ENOTSUP;
     }
 
+    if (has_subclusters(s)) {
+        error_report("compat=0.10 does not support extended L2 entries");
+        return -ENOTSUP;
+    }
+
     /* clear incompatible features */
     if (s->incompatible_features & QCOW2_INCOMPAT_DIRTY) {
         ret = qcow2_mark_clean(bs);
@@ -4227,6 +4515,12 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
                 error_report("Changing the cluster size is not supported");
                 return -ENOTSUP;
             }
+        } else if (!strcmp(desc->name, BLOCK_OPT_EXTL2)) {
+            if (qemu_opt_get_bool(opts, BLOCK_OPT_EXTL2, has_subclusters(s)) !=
+                has_subclusters(s)) {
+                error_report("Changing extended L2 entries is not supported");
+                return -ENOTSUP;
+            }
         } else if (!strcmp(desc->name, BLOCK_OPT_LAZY_REFCOUNTS)) {
             lazy_refcounts = qemu_opt_get_bool(opts, BLOCK_OPT_LAZY_REFCOUNTS,
                                                lazy_refcounts);
@@ -4456,6 +4750,11 @@ static QemuOptsList qcow2_create_opts = {
             .help = "qcow2 cluster size",
             .def_value_str = stringify(DEFAULT_CLUSTER_SIZE)
         },
+        {
+            .name = BLOCK_OPT_EXTL2,
+            .type = QEMU_OPT_BOOL,
+            .help = "Extended L2 tables",
+        },
         {
             .name = BLOCK_OPT_PREALLOC,
             .type = QEMU_OPT_STRING,
@@ -4512,6 +4811,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -198,6 +198,9 @@ static bool default_mttcg_enabled(void)
 void qemu_tcg_configure(QemuOpts *opts, Error **errp)
 {
     const char *t = qemu_opt_get(opts, "thread");
+#ifdef CONFIG_TCG
+    uint64_t threshold, period;
+#endif
     if (t) {
         if (strcmp(t, "multi") == 0) {
             if (TCG_OVERSIZED_GUEST) {
@@ -224,6 +227,29 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+#ifdef CONFIG_TCG
+    /* TB entry counts are int32_t, see TranslationBlock.exec_count */
+    threshold = qemu_opt_get_number(opts, "hot-threshold", 0);
+    tb_hot_threshold = MIN(threshold, INT32_MAX);
+    period = qemu_opt_get_number(opts, "tb-profile", 0);
+    if (period > INT32_MAX) {
+        error_setg(errp, "Invalid 'tb-profile' setting %" PRIu64, period);
+    } else {
+        tb_profile_period = period;
+    }
+
+    t = qemu_opt_get(opts, "regalloc");
+    if (t) {
+        if (strcmp(t, "ebb") == 0) {
+            tcg_regalloc_ebb = true;
+        } else if (strcmp(t, "bb") == 0) {
+            tcg_regalloc_ebb = false;
+        } else {
+            error_setg(errp, "Invalid 'regalloc' setting %s", t);
+        }
+    }
+#endif
 }
 
 /* The current number of executed instructions is based on what we
@@ -28,6 +28,11 @@ typedef struct QCryptoCipherBuiltinAESContext QCryptoCipherBuiltinAESContext;
 struct QCryptoCipherBuiltinAESContext {
     AES_KEY enc;
     AES_KEY dec;
+#ifdef CONFIG_AESNI_OPT
+    /* Round keys in the byte order used by AESENC and AESDEC */
+    uint8_t aesni_enc[AES_MAXNR + 1][AES_BLOCK_SIZE];
+    uint8_t aesni_dec[AES_MAXNR + 1][AES_BLOCK_SIZE];
+#endif
 };
 typedef struct QCryptoCipherBuiltinAES QCryptoCipherBuiltinAES;
 struct QCryptoCipherBuiltinAES {
@@ -74,13 +79,137 @@ static void qcrypto_cipher_free_aes(QCryptoCipher *cipher)
 }
 
 
-static void qcrypto_cipher_aes_ecb_encrypt(AES_KEY *key,
-                                           const void *in,
-                                           void *out,
-                                           size_t len)
+#ifdef CONFIG_AESNI_OPT
+#include "qemu/bswap.h"
+#include "qemu/cpuid.h"
+
+#pragma GCC push_options
+#pragma GCC target("aes,sse2")
+#include <wmmintrin.h>
+
+/*
+ * Number of blocks in flight in the AES-NI loops.  AESENC has a latency
+ * of several cycles but can start every cycle, so independent blocks
+ * are interleaved to keep the unit busy.
+ */
+#define AESNI_PARALLEL_BLOCKS 8
+
+static bool have_aesni;
+
+static void __attribute__((constructor)) qcrypto_cipher_aesni_init(void)
+{
+    unsigned a, b, c, d;
+
+    if (__get_cpuid_max(0, NULL) >= 1) {
+        __cpuid(1, a, b, c, d);
+        have_aesni = (c & bit_AES) && (d & bit_SSE2);
+    }
+}
+
+static void qcrypto_cipher_aesni_setkey(QCryptoCipherBuiltinAESContext *ctx)
+{
+    int nr = ctx->enc.rounds;
+    int i, j;
+
+    if (!have_aesni) {
+        return;
+    }
+
+    for (i = 0; i <= nr; i++) {
+        for (j = 0; j < 4; j++) {
+            stl_be_p(&ctx->aesni_enc[i][j * 4], ctx->enc.rd_key[i * 4 + j]);
+        }
+    }
+
+    /* The equivalent inverse cipher uses InvMixColumns'd round keys */
+    memcpy(ctx->aesni_dec[0], ctx->aesni_enc[nr], AES_BLOCK_SIZE);
+    for (i = 1; i < nr; i++) {
+        __m128i k = _mm_loadu_si128((__m128i *)ctx->aesni_enc[nr - i]);
+        _mm_storeu_si128((__m128i *)ctx->aesni_dec[i], _mm_aesimc_si128(k));
+    }
+    memcpy(ctx->aesni_dec[nr], ctx->aesni_enc[0], AES_BLOCK_SIZE);
+}
+
+/* Process @nblocks full blocks, returning the number of bytes consumed */
+static size_t
+qcrypto_cipher_aesni_ecb(const QCryptoCipherBuiltinAESContext *ctx,
+                         const uint8_t *in, uint8_t *out,
+                         size_t nblocks, bool encrypt)
+{
+    const uint8_t (*rk)[AES_BLOCK_SIZE] =
+        encrypt ? ctx->aesni_enc : ctx->aesni_dec;
+    int nr = ctx->enc.rounds;
+    __m128i k[AES_MAXNR + 1];
+    __m128i b[AESNI_PARALLEL_BLOCKS];
+    size_t done = 0;
+    int i, r;
+
+    for (r = 0; r <= nr; r++) {
+        k[r] = _mm_loadu_si128((__m128i *)rk[r]);
+    }
+
+    while (done < nblocks) {
+        int n = MIN(nblocks - done, AESNI_PARALLEL_BLOCKS);
+
+        for (i = 0; i < n; i++) {
+            b[i] = _mm_loadu_si128((__m128i *)(in + i * AES_BLOCK_SIZE));
+            b[i] = _mm_xor_si128(b[i], k[0]);
+        }
+        if (encrypt) {
+            for (r = 1; r < nr; r++) {
+                for (i = 0; i < n; i++) {
+                    b[i] = _mm_aesenc_si128(b[i], k[r]);
+                }
+            }
+            for (i = 0; i < n; i++) {
+                b[i] = _mm_aesenclast_si128(b[i], k[nr]);
+            }
+        } else {
+            for (r = 1; r < nr; r++) {
+                for (i = 0; i < n; i++) {
+                    b[i] = _mm_aesdec_si128(b[i], k[r]);
+                }
+            }
+            for (i = 0; i < n; i++) {
+                b[i] = _mm_aesdeclast_si128(b[i], k[nr]);
+            }
+        }
+        for (i = 0; i < n; i++) {
+            _mm_storeu_si128((__m128i *)(out + i * AES_BLOCK_SIZE), b[i]);
+        }
+
+        in += n * AES_BLOCK_SIZE;
+        out += n * AES_BLOCK_SIZE;
+        done += n;
+    }
+
+    return done * AES_BLOCK_SIZE;
+}
+
+#pragma GCC pop_options
+#endif /* CONFIG_AESNI_OPT */
+
+
+static void
+qcrypto_cipher_aes_ecb_encrypt(const QCryptoCipherBuiltinAESContext *ctx,
+                               const void *in,
+                               void *out,
+                               size_t len)
 {
     const uint8_t *inptr = in;
     uint8_t *outptr = out;
+    AES_KEY *key = (AES_KEY *)&ctx->enc;
+
+#ifdef CONFIG_AESNI_OPT
+    if (have_aesni) {
+        size_t done = qcrypto_cipher_aesni_ecb(ctx, inptr, outptr,
+                                               len / AES_BLOCK_SIZE, true);
+        inptr += done;
+        outptr += done;
+        len -= done;
+    }
+#endif
+
     while (len) {
         if (len > AES_BLOCK_SIZE) {
             AES_encrypt(inptr, outptr, key);
@@ -100,13 +229,26 @@ static void qcrypto_cipher_aes_ecb_encrypt(AES_KEY *key,
 }
 
 
-static void qcrypto_cipher_aes_ecb_decrypt(AES_KEY *key,
-                                           const void *in,
-                                           void *out,
-                                           size_t len)
+static void
+qcrypto_cipher_aes_ecb_decrypt(const QCryptoCipherBuiltinAESContext *ctx,
+                               const void *in,
+                               void *out,
+                               size_t len)
 {
     const uint8_t *inptr = in;
     uint8_t *outptr = out;
+    AES_KEY *key = (AES_KEY *)&ctx->dec;
+
+#ifdef CONFIG_AESNI_OPT
+    if (have_aesni) {
+        size_t done = qcrypto_cipher_aesni_ecb(ctx, inptr, outptr,
+                                               len / AES_BLOCK_SIZE, false);
+        inptr += done;
+        outptr += done;
+        len -= done;
+    }
+#endif
+
     while (len) {
         if (len > AES_BLOCK_SIZE) {
             AES_decrypt(inptr, outptr, key);
@@ -131,10 +273,7 @@ static void qcrypto_cipher_aes_xts_encrypt(const void *ctx,
                                            uint8_t *dst,
                                            const uint8_t *src)
 {
-    const QCryptoCipherBuiltinAESContext *aesctx = ctx;
-
-    qcrypto_cipher_aes_ecb_encrypt((AES_KEY *)&aesctx->enc,
-                                   src, dst, length);
+    qcrypto_cipher_aes_ecb_encrypt(ctx, src, dst, length);
 }
 
 
@@ -143,10 +282,7 @@ static void qcrypto_cipher_aes_xts_decrypt(const void *ctx,
                                            uint8_t *dst,
                                            const uint8_t *src)
 {
-    const QCryptoCipherBuiltinAESContext *aesctx = ctx;
-
-    qcrypto_cipher_aes_ecb_decrypt((AES_KEY *)&aesctx->dec,
-                                   src, dst, length);
+    qcrypto_cipher_aes_ecb_decrypt(ctx, src, dst, length);
 }
 
 
@@ -160,7 +296,7 @@ static int qcrypto_cipher_encrypt_aes(QCryptoCipher *cipher,
 
     switch (cipher->mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
-        qcrypto_cipher_aes_ecb_encrypt(&ctxt->state.aes.key.enc,
+        qcrypto_cipher_aes_ecb_encrypt(&ctxt->state.aes.key,
                                        in, out, len);
         break;
     case QCRYPTO_CIPHER_MODE_CBC:
@@ -194,7 +330,7 @@ static int qcrypto_cipher_decrypt_aes(QCryptoCipher *cipher,
 
     switch (cipher->mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
-        qcrypto_cipher_aes_ecb_decrypt(&ctxt->state.aes.key.dec,
+        qcrypto_cipher_aes_ecb_decrypt(&ctxt->state.aes.key,
                                        in, out, len);
         break;
     case QCRYPTO_CIPHER_MODE_CBC:
@@ -287,6 +423,11 @@ qcrypto_cipher_init_aes(QCryptoCipherMode mode,
         }
     }
 
+#ifdef CONFIG_AESNI_OPT
+    qcrypto_cipher_aesni_setkey(&ctxt->state.aes.key);
+    qcrypto_cipher_aesni_setkey(&ctxt->state.aes.key_tweak);
+#endif
+
     ctxt->blocksize = AES_BLOCK_SIZE;
     ctxt->free = qcrypto_cipher_free_aes;
     ctxt->setiv = qcrypto_cipher_setiv_aes;
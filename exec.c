@@ -761,6 +761,10 @@ void cpu_exec_unrealizefn(CPUState *cpu)
 
     cpu_list_remove(cpu);
 
+#ifndef CONFIG_USER_ONLY
+    tlb_destroy(cpu);
+#endif
+
     if (cc->vmsd != NULL) {
         vmstate_unregister(NULL, cc->vmsd, cpu);
     }
@@ -808,6 +812,8 @@ void cpu_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
 #ifndef CONFIG_USER_ONLY
+    tlb_init(cpu);
+
     if (qdev_get_vmsd(DEVICE(cpu)) == NULL) {
         vmstate_register(NULL, cpu->cpu_index, &vmstate_cpu_common, cpu);
     }
@@ -3295,6 +3301,13 @@ void cpu_flush_icache_range(hwaddr start, int len)
                                            start, NULL, len, FLUSH_CACHE);
 }
 
+/* address_space_map() bounces accesses to memory that cannot be accessed
+ * directly, such as MMIO.  Several mappings can be bounced at the same
+ * time, each using one slot of at most a page; a slot's buffer is kept
+ * once allocated.
+ */
+#define BOUNCE_BUFFER_SLOTS 16
+
 typedef struct {
     MemoryRegion *mr;
     void *buffer;
@@ -3303,7 +3316,51 @@ typedef struct {
     bool in_use;
 } BounceBuffer;
 
-static BounceBuffer bounce;
+static BounceBuffer bounce[BOUNCE_BUFFER_SLOTS];
+
+static BounceBuffer *bounce_buffer_get(void)
+{
+    BounceBuffer *b;
+    int i;
+
+    for (i = 0; i < BOUNCE_BUFFER_SLOTS; i++) {
+        b = &bounce[i];
+        if (atomic_read(&b->in_use) || atomic_xchg(&b->in_use, true)) {
+            continue;
+        }
+        if (!b->buffer) {
+            atomic_set(&b->buffer,
+                       qemu_memalign(TARGET_PAGE_SIZE, TARGET_PAGE_SIZE));
+        }
+        return b;
+    }
+    return NULL;
+}
+
+static BounceBuffer *bounce_buffer_find(void *buffer)
+{
+    int i;
+
+    for (i = 0; i < BOUNCE_BUFFER_SLOTS; i++) {
+        if (atomic_read(&bounce[i].buffer) == buffer) {
+            assert(atomic_read(&bounce[i].in_use));
+            return &bounce[i];
+        }
+    }
+    return NULL;
+}
+
+static bool bounce_buffer_available(void)
+{
+    int i;
+
+    for (i = 0; i < BOUNCE_BUFFER_SLOTS; i++) {
+        if (!atomic_read(&bounce[i].in_use)) {
+            return true;
+        }
+    }
+    return false;
+}
 
 typedef struct MapClient {
     QEMUBH *bh;
@@ -3338,7 +3395,7 @@ void cpu_register_map_client(QEMUBH *bh)
     qemu_mutex_lock(&map_client_list_lock);
     client->bh = bh;
     QLIST_INSERT_HEAD(&map_client_list, client, link);
-    if (!atomic_read(&bounce.in_use)) {
+    if (bounce_buffer_available()) {
         cpu_notify_map_clients_locked();
     }
     qemu_mutex_unlock(&map_client_list_lock);
@@ -3471,26 +3528,27 @@ void *address_space_map(AddressSpace *as,
     mr = flatview_translate(fv, addr, &xlat, &l, is_write);
 
     if (!memory_access_is_direct(mr, is_write)) {
-        if (atomic_xchg(&bounce.in_use, true)) {
+        BounceBuffer *b = bounce_buffer_get();
+
+        if (!b) {
             rcu_read_unlock();
             return NULL;
         }
         /* Avoid unbounded allocations */
         l = MIN(l, TARGET_PAGE_SIZE);
-        bounce.buffer = qemu_memalign(TARGET_PAGE_SIZE, l);
-        bounce.addr = addr;
-        bounce.len = l;
+        b->addr = addr;
+        b->len = l;
 
         memory_region_ref(mr);
-        bounce.mr = mr;
+        b->mr = mr;
         if (!is_write) {
             flatview_read(fv, addr, MEMTXATTRS_UNSPECIFIED,
-                               bounce.buffer, l);
+                               b->buffer, l);
         }
 
         rcu_read_unlock();
         *plen = l;
-        return bounce.buffer;
+        return b->buffer;
     }
 
 
@@ -3510,7 +3568,9 @@ void *address_space_map(AddressSpace *as,
 void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
                          int is_write, hwaddr access_len)
 {
-    if (buffer != bounce.buffer) {
+    BounceBuffer *b = bounce_buffer_find(buffer);
+
+    if (!b) {
         MemoryRegion *mr;
         ram_addr_t addr1;
 
@@ -3526,13 +3586,12 @@ void address_space_unmap(AddressSpace *as, void *buffer, hwaddr len,
         return;
     }
     if (is_write) {
-        address_space_write(as, bounce.addr, MEMTXATTRS_UNSPECIFIED,
-                            bounce.buffer, access_len);
+        address_space_write(as, b->addr, MEMTXATTRS_UNSPECIFIED,
+                            b->buffer, access_len);
     }
-    qemu_vfree(bounce.buffer);
-    bounce.buffer = NULL;
-    memory_region_unref(bounce.mr);
-    atomic_mb_set(&bounce.in_use, false);
+    memory_region_unref(b->mr);
+    b->mr = NULL;
+    atomic_mb_set(&b->in_use, false);
     cpu_notify_map_clients();
 }
 
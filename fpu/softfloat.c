@@ -83,6 +83,8 @@ this code that are retained.
  * target-dependent and needs the TARGET_* macros.
  */
 #include "qemu/osdep.h"
+#include <math.h>
+#include <float.h>
 #include "qemu/bitops.h"
 #include "fpu/softfloat.h"
 
@@ -722,6 +724,269 @@ static FloatParts addsub_floats(FloatParts a, FloatParts b, bool subtract,
     g_assert_not_reached();
 }
 
+/*
+ * Hardfloat fast path
+ *
+ * When the rounding mode is round-to-nearest-even and the inexact flag
+ * is already raised, the only flags an operation on zero or normal
+ * inputs can raise besides inexact are overflow and underflow.  If the
+ * host result is also finite and not tiny, it is therefore bit-identical
+ * to the softfloat result, including flags, and we can use the host FPU.
+ * Everything else (NaNs, infinities, denormals, other rounding modes,
+ * results that may have overflowed or underflowed) goes the slow way.
+ *
+ * This requires that the host evaluates float and double arithmetic in
+ * their own precision (no x87 excess precision), with the default
+ * round-to-nearest mode, which QEMU never changes.
+ */
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && !defined(__FAST_MATH__)
+# define QEMU_HARDFLOAT 1
+#else
+# define QEMU_HARDFLOAT 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool can_use_fpu(const float_status *s)
+{
+    return QEMU_HARDFLOAT
+        && likely(s->float_exception_flags & float_flag_inexact)
+        && s->float_rounding_mode == float_round_nearest_even;
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    uint32_t exp = float32_val(a) & 0x7f800000;
+
+    return float32_is_zero(a) || (exp != 0 && exp != 0x7f800000);
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    uint64_t exp = float64_val(a) & LIT64(0x7ff0000000000000);
+
+    return float64_is_zero(a) || (exp != 0 && exp != LIT64(0x7ff0000000000000));
+}
+
+/* Accept a host result R that is finite and normal, or an exact zero.
+ * The minimum normal itself is rejected: a result that rounded up to it
+ * was tiny before rounding, and only softfloat knows whether that has to
+ * raise underflow.
+ */
+static inline bool f32_result_ok(float r, bool zero_is_exact)
+{
+    if (likely(fabsf(r) > FLT_MIN)) {
+        return !isinf(r);
+    }
+    return r == 0 && zero_is_exact;
+}
+
+static inline bool f64_result_ok(double r, bool zero_is_exact)
+{
+    if (likely(fabs(r) > DBL_MIN)) {
+        return !isinf(r);
+    }
+    return r == 0 && zero_is_exact;
+}
+
+static bool f32_hard_addsub(float32 a, float32 b, bool subtract,
+                            float32 *res, float_status *s)
+{
+    union_float32 ua, ub, ur;
+
+    if (!can_use_fpu(s)
+        || !float32_is_zero_or_normal(a) || !float32_is_zero_or_normal(b)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = subtract ? ua.h - ub.h : ua.h + ub.h;
+    /* The sum of two normals is zero only if it is exactly zero.  */
+    if (!f32_result_ok(ur.h, true)) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f64_hard_addsub(float64 a, float64 b, bool subtract,
+                            float64 *res, float_status *s)
+{
+    union_float64 ua, ub, ur;
+
+    if (!can_use_fpu(s)
+        || !float64_is_zero_or_normal(a) || !float64_is_zero_or_normal(b)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = subtract ? ua.h - ub.h : ua.h + ub.h;
+    if (!f64_result_ok(ur.h, true)) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f32_hard_mul(float32 a, float32 b, float32 *res, float_status *s)
+{
+    union_float32 ua, ub, ur;
+
+    if (!can_use_fpu(s)
+        || !float32_is_zero_or_normal(a) || !float32_is_zero_or_normal(b)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = ua.h * ub.h;
+    if (!f32_result_ok(ur.h, float32_is_zero(a) || float32_is_zero(b))) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f64_hard_mul(float64 a, float64 b, float64 *res, float_status *s)
+{
+    union_float64 ua, ub, ur;
+
+    if (!can_use_fpu(s)
+        || !float64_is_zero_or_normal(a) || !float64_is_zero_or_normal(b)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = ua.h * ub.h;
+    if (!f64_result_ok(ur.h, float64_is_zero(a) || float64_is_zero(b))) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f32_hard_div(float32 a, float32 b, float32 *res, float_status *s)
+{
+    union_float32 ua, ub, ur;
+
+    /* Division by zero raises divbyzero.  */
+    if (!can_use_fpu(s) || !float32_is_zero_or_normal(a)
+        || !float32_is_zero_or_normal(b) || float32_is_zero(b)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = ua.h / ub.h;
+    if (!f32_result_ok(ur.h, float32_is_zero(a))) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f64_hard_div(float64 a, float64 b, float64 *res, float_status *s)
+{
+    union_float64 ua, ub, ur;
+
+    if (!can_use_fpu(s) || !float64_is_zero_or_normal(a)
+        || !float64_is_zero_or_normal(b) || float64_is_zero(b)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    ur.h = ua.h / ub.h;
+    if (!f64_result_ok(ur.h, float64_is_zero(a))) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f32_hard_muladd(float32 a, float32 b, float32 c, int flags,
+                            float32 *res, float_status *s)
+{
+    union_float32 ua, ub, uc, ur;
+    bool prod_zero;
+
+    if (!can_use_fpu(s) || flags
+        || !float32_is_zero_or_normal(a) || !float32_is_zero_or_normal(b)
+        || !float32_is_zero_or_normal(c)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    uc.s = c;
+    ur.h = fmaf(ua.h, ub.h, uc.h);
+    /* A zero result from a non-zero product may have underflowed.  */
+    prod_zero = float32_is_zero(a) || float32_is_zero(b);
+    if (!f32_result_ok(ur.h, prod_zero && float32_is_zero(c))) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f64_hard_muladd(float64 a, float64 b, float64 c, int flags,
+                            float64 *res, float_status *s)
+{
+    union_float64 ua, ub, uc, ur;
+    bool prod_zero;
+
+    if (!can_use_fpu(s) || flags
+        || !float64_is_zero_or_normal(a) || !float64_is_zero_or_normal(b)
+        || !float64_is_zero_or_normal(c)) {
+        return false;
+    }
+    ua.s = a;
+    ub.s = b;
+    uc.s = c;
+    ur.h = fma(ua.h, ub.h, uc.h);
+    prod_zero = float64_is_zero(a) || float64_is_zero(b);
+    if (!f64_result_ok(ur.h, prod_zero && float64_is_zero(c))) {
+        return false;
+    }
+    *res = ur.s;
+    return true;
+}
+
+static bool f32_hard_sqrt(float32 a, float32 *res, float_status *s)
+{
+    union_float32 ua, ur;
+
+    /* The square root of a normal is always normal.  Negative inputs
+       other than -0 raise invalid.  */
+    if (!can_use_fpu(s) || !float32_is_zero_or_normal(a)
+        || (float32_is_neg(a) && !float32_is_zero(a))) {
+        return false;
+    }
+    ua.s = a;
+    ur.h = sqrtf(ua.h);
+    *res = ur.s;
+    return true;
+}
+
+static bool f64_hard_sqrt(float64 a, float64 *res, float_status *s)
+{
+    union_float64 ua, ur;
+
+    if (!can_use_fpu(s) || !float64_is_zero_or_normal(a)
+        || (float64_is_neg(a) && !float64_is_zero(a))) {
+        return false;
+    }
+    ua.s = a;
+    ur.h = sqrt(ua.h);
+    *res = ur.s;
+    return true;
+}
+
 /*
  * Returns the result of adding or subtracting the floating-point
  * values `a' and `b'. The operation is performed according to the
@@ -741,9 +1006,15 @@ float16  __attribute__((flatten)) float16_add(float16 a, float16 b,
 float32 __attribute__((flatten)) float32_add(float32 a, float32 b,
                                              float_status *status)
 {
-    FloatParts pa = float32_unpack_canonical(a, status);
-    FloatParts pb = float32_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, false, status);
+    FloatParts pa, pb, pr;
+    float32 r;
+
+    if (f32_hard_addsub(a, b, false, &r, status)) {
+        return r;
+    }
+    pa = float32_unpack_canonical(a, status);
+    pb = float32_unpack_canonical(b, status);
+    pr = addsub_floats(pa, pb, false, status);
 
     return float32_round_pack_canonical(pr, status);
 }
@@ -751,9 +1022,15 @@ float32 __attribute__((flatten)) float32_add(float32 a, float32 b,
 float64 __attribute__((flatten)) float64_add(float64 a, float64 b,
                                              float_status *status)
 {
-    FloatParts pa = float64_unpack_canonical(a, status);
-    FloatParts pb = float64_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, false, status);
+    FloatParts pa, pb, pr;
+    float64 r;
+
+    if (f64_hard_addsub(a, b, false, &r, status)) {
+        return r;
+    }
+    pa = float64_unpack_canonical(a, status);
+    pb = float64_unpack_canonical(b, status);
+    pr = addsub_floats(pa, pb, false, status);
 
     return float64_round_pack_canonical(pr, status);
 }
@@ -771,9 +1048,15 @@ float16 __attribute__((flatten)) float16_sub(float16 a, float16 b,
 float32 __attribute__((flatten)) float32_sub(float32 a, float32 b,
                                              float_status *status)
 {
-    FloatParts pa = float32_unpack_canonical(a, status);
-    FloatParts pb = float32_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, true, status);
+    FloatParts pa, pb, pr;
+    float32 r;
+
+    if (f32_hard_addsub(a, b, true, &r, status)) {
+        return r;
+    }
+    pa = float32_unpack_canonical(a, status);
+    pb = float32_unpack_canonical(b, status);
+    pr = addsub_floats(pa, pb, true, status);
 
     return float32_round_pack_canonical(pr, status);
 }
@@ -781,9 +1064,15 @@ float32 __attribute__((flatten)) float32_sub(float32 a, float32 b,
 float64 __attribute__((flatten)) float64_sub(float64 a, float64 b,
                                              float_status *status)
 {
-    FloatParts pa = float64_unpack_canonical(a, status);
-    FloatParts pb = float64_unpack_canonical(b, status);
-    FloatParts pr = addsub_floats(pa, pb, true, status);
+    FloatParts pa, pb, pr;
+    float64 r;
+
+    if (f64_hard_addsub(a, b, true, &r, status)) {
+        return r;
+    }
+    pa = float64_unpack_canonical(a, status);
+    pb = float64_unpack_canonical(b, status);
+    pr = addsub_floats(pa, pb, true, status);
 
     return float64_round_pack_canonical(pr, status);
 }
@@ -852,9 +1141,15 @@ float16 __attribute__((flatten)) float16_mul(float16 a, float16 b,
 float32 __attribute__((flatten)) float32_mul(float32 a, float32 b,
                                              float_status *status)
 {
-    FloatParts pa = float32_unpack_canonical(a, status);
-    FloatParts pb = float32_unpack_canonical(b, status);
-    FloatParts pr = mul_floats(pa, pb, status);
+    FloatParts pa, pb, pr;
+    float32 r;
+
+    if (f32_hard_mul(a, b, &r, status)) {
+        return r;
+    }
+    pa = float32_unpack_canonical(a, status);
+    pb = float32_unpack_canonical(b, status);
+    pr = mul_floats(pa, pb, status);
 
     return float32_round_pack_canonical(pr, status);
 }
@@ -862,9 +1157,15 @@ float32 __attribute__((flatten)) float32_mul(float32 a, float32 b,
 float64 __attribute__((flatten)) float64_mul(float64 a, float64 b,
                                              float_status *status)
 {
-    FloatParts pa = float64_unpack_canonical(a, status);
-    FloatParts pb = float64_unpack_canonical(b, status);
-    FloatParts pr = mul_floats(pa, pb, status);
+    FloatParts pa, pb, pr;
+    float64 r;
+
+    if (f64_hard_mul(a, b, &r, status)) {
+        return r;
+    }
+    pa = float64_unpack_canonical(a, status);
+    pb = float64_unpack_canonical(b, status);
+    pr = mul_floats(pa, pb, status);
 
     return float64_round_pack_canonical(pr, status);
 }
@@ -1087,10 +1388,16 @@ float16 __attribute__((flatten)) float16_muladd(float16 a, float16 b, float16 c,
 float32 __attribute__((flatten)) float32_muladd(float32 a, float32 b, float32 c,
                                                 int flags, float_status *status)
 {
-    FloatParts pa = float32_unpack_canonical(a, status);
-    FloatParts pb = float32_unpack_canonical(b, status);
-    FloatParts pc = float32_unpack_canonical(c, status);
-    FloatParts pr = muladd_floats(pa, pb, pc, flags, status);
+    FloatParts pa, pb, pc, pr;
+    float32 r;
+
+    if (f32_hard_muladd(a, b, c, flags, &r, status)) {
+        return r;
+    }
+    pa = float32_unpack_canonical(a, status);
+    pb = float32_unpack_canonical(b, status);
+    pc = float32_unpack_canonical(c, status);
+    pr = muladd_floats(pa, pb, pc, flags, status);
 
     return float32_round_pack_canonical(pr, status);
 }
@@ -1098,10 +1405,16 @@ float32 __attribute__((flatten)) float32_muladd(float32 a, float32 b, float32 c,
 float64 __attribute__((flatten)) float64_muladd(float64 a, float64 b, float64 c,
                                                 int flags, float_status *status)
 {
-    FloatParts pa = float64_unpack_canonical(a, status);
-    FloatParts pb = float64_unpack_canonical(b, status);
-    FloatParts pc = float64_unpack_canonical(c, status);
-    FloatParts pr = muladd_floats(pa, pb, pc, flags, status);
+    FloatParts pa, pb, pc, pr;
+    float64 r;
+
+    if (f64_hard_muladd(a, b, c, flags, &r, status)) {
+        return r;
+    }
+    pa = float64_unpack_canonical(a, status);
+    pb = float64_unpack_canonical(b, status);
+    pc = float64_unpack_canonical(c, status);
+    pr = muladd_floats(pa, pb, pc, flags, status);
 
     return float64_round_pack_canonical(pr, status);
 }
@@ -1178,18 +1491,30 @@ float16 float16_div(float16 a, float16 b, float_status *status)
 
 float32 float32_div(float32 a, float32 b, float_status *status)
 {
-    FloatParts pa = float32_unpack_canonical(a, status);
-    FloatParts pb = float32_unpack_canonical(b, status);
-    FloatParts pr = div_floats(pa, pb, status);
+    FloatParts pa, pb, pr;
+    float32 r;
+
+    if (f32_hard_div(a, b, &r, status)) {
+        return r;
+    }
+    pa = float32_unpack_canonical(a, status);
+    pb = float32_unpack_canonical(b, status);
+    pr = div_floats(pa, pb, status);
 
     return float32_round_pack_canonical(pr, status);
 }
 
 float64 float64_div(float64 a, float64 b, float_status *status)
 {
-    FloatParts pa = float64_unpack_canonical(a, status);
-    FloatParts pb = float64_unpack_canonical(b, status);
-    FloatParts pr = div_floats(pa, pb, status);
+    FloatParts pa, pb, pr;
+    float64 r;
+
+    if (f64_hard_div(a, b, &r, status)) {
+        return r;
+    }
+    pa = float64_unpack_canonical(a, status);
+    pb = float64_unpack_canonical(b, status);
+    pr = div_floats(pa, pb, status);
 
     return float64_round_pack_canonical(pr, status);
 }
@@ -1983,15 +2308,27 @@ float16 __attribute__((flatten)) float16_sqrt(float16 a, float_status *status)
 
 float32 __attribute__((flatten)) float32_sqrt(float32 a, float_status *status)
 {
-    FloatParts pa = float32_unpack_canonical(a, status);
-    FloatParts pr = sqrt_float(pa, status, &float32_params);
+    FloatParts pa, pr;
+    float32 r;
+
+    if (f32_hard_sqrt(a, &r, status)) {
+        return r;
+    }
+    pa = float32_unpack_canonical(a, status);
+    pr = sqrt_float(pa, status, &float32_params);
     return float32_round_pack_canonical(pr, status);
 }
 
 float64 __attribute__((flatten)) float64_sqrt(float64 a, float_status *status)
 {
-    FloatParts pa = float64_unpack_canonical(a, status);
-    FloatParts pr = sqrt_float(pa, status, &float64_params);
+    FloatParts pa, pr;
+    float64 r;
+
+    if (f64_hard_sqrt(a, &r, status)) {
+        return r;
+    }
+    pa = float64_unpack_canonical(a, status);
+    pr = sqrt_float(pa, status, &float64_params);
     return float64_round_pack_canonical(pr, status);
 }
 
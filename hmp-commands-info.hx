@@ -293,6 +293,23 @@ STEXI
 @item info opcount
 @findex info opcount
 Show dynamic compiler opcode counters
+ETEXI
+
+#if defined(CONFIG_TCG)
+    {
+        .name       = "tb-profile",
+        .args_type  = "max:i?",
+        .params     = "[max]",
+        .help       = "show the most expensive translation blocks",
+        .cmd        = hmp_info_tb_profile,
+    },
+#endif
+
+STEXI
+@item info tb-profile [@var{max}]
+@findex info tb-profile
+Show the @var{max} (default 20) translation blocks with the highest sampled
+execution cost. Requires @option{-accel tcg,tb-profile=n}.
 ETEXI
 
     {
@@ -38,6 +38,7 @@
 #include "qapi/qapi-commands-run-state.h"
 #include "qapi/qapi-commands-tpm.h"
 #include "qapi/qapi-commands-ui.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qerror.h"
 #include "qapi/string-input-visitor.h"
@@ -243,6 +244,14 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, "postcopy request count: %" PRIu64 "\n",
                            info->ram->postcopy_requests);
         }
+        if (info->ram->dirty_sync_count) {
+            monitor_printf(mon, "dirty sync time: log %" PRIu64
+                           " us, bitmap %" PRIu64 " us, longest chunk %"
+                           PRIu64 " us\n",
+                           info->ram->dirty_sync_log_time,
+                           info->ram->dirty_sync_bitmap_time,
+                           info->ram->dirty_sync_chunk_max_time);
+        }
     }
 
     if (info->has_disk) {
@@ -267,6 +276,12 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->xbzrle_cache->cache_miss_rate);
         monitor_printf(mon, "xbzrle overflow : %" PRIu64 "\n",
                        info->xbzrle_cache->overflow);
+        monitor_printf(mon, "xbzrle cache hit: %" PRIu64 "\n",
+                       info->xbzrle_cache->cache_hit);
+        monitor_printf(mon, "xbzrle cache hit rate: %0.2f\n",
+                       info->xbzrle_cache->cache_hit_rate);
+        monitor_printf(mon, "xbzrle encoding rate: %0.2f\n",
+                       info->xbzrle_cache->encoding_rate);
     }
 
     if (info->has_cpu_throttle_percentage) {
@@ -352,6 +367,15 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "%s: %u\n",
             MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_PAGE_COUNT),
             params->x_multifd_page_count);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION),
+            MultiFDCompression_str(params->x_multifd_compression));
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_ZLIB_LEVEL),
+            params->x_multifd_zlib_level);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_X_MULTIFD_ZSTD_LEVEL),
+            params->x_multifd_zstd_level);
         monitor_printf(mon, "%s: %" PRIu64 "\n",
             MigrationParameter_str(MIGRATION_PARAMETER_XBZRLE_CACHE_SIZE),
             params->xbzrle_cache_size);
@@ -1642,6 +1666,19 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         }
         p->xbzrle_cache_size = cache_size;
         break;
+    case MIGRATION_PARAMETER_X_MULTIFD_COMPRESSION:
+        p->has_x_multifd_compression = true;
+        visit_type_MultiFDCompression(v, param, &p->x_multifd_compression,
+                                      &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_ZLIB_LEVEL:
+        p->has_x_multifd_zlib_level = true;
+        visit_type_int(v, param, &p->x_multifd_zlib_level, &err);
+        break;
+    case MIGRATION_PARAMETER_X_MULTIFD_ZSTD_LEVEL:
+        p->has_x_multifd_zstd_level = true;
+        visit_type_int(v, param, &p->x_multifd_zstd_level, &err);
+        break;
     default:
         assert(0);
     }
@@ -2465,6 +2502,35 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     qapi_free_IOThreadInfoList(info_list);
 }
 
+void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    int64_t max = qdict_get_try_int(qdict, "max", 20);
+    TBProfileInfoList *info_list, *info;
+    Error *err = NULL;
+
+    info_list = qmp_query_tb_profile(true, max, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %6s %5s %6s %14s %10s %16s\n",
+                   "pc", "size", "insns", "host", "execs", "xlate-ns",
+                   "cost");
+    for (info = info_list; info; info = info->next) {
+        TBProfileInfo *value = info->value;
+
+        monitor_printf(mon, "0x%016" PRIx64 " %6" PRId64 " %5" PRId64
+                       " %6" PRId64 " %14" PRIu64 " %10" PRId64
+                       " %16" PRIu64 "\n",
+                       value->pc, value->guest_size, value->icount,
+                       value->host_size, value->exec_count,
+                       value->translate_ns, value->cost);
+    }
+
+    qapi_free_TBProfileInfoList(info_list);
+}
+
 void hmp_qom_list(Monitor *mon, const QDict *qdict)
 {
     const char *path = qdict_get_try_str(qdict, "path");
@@ -26,6 +26,17 @@
 #include "hw/virtio/virtio-bus.h"
 #include "qom/object_interfaces.h"
 
+/* Per-virtqueue state */
+typedef struct VirtIOBlockDataPlaneVq {
+    VirtIOBlockDataPlane *s;
+    unsigned index;
+    AioContext *ctx;                /* iothread that serves the virtqueue */
+
+    /* Requests completed in another context, pushed by @bh in @ctx */
+    QEMUBH *bh;
+    QSLIST_HEAD(, VirtIOBlockReq) done;
+} VirtIOBlockDataPlaneVq;
+
 struct VirtIOBlockDataPlane {
     bool starting;
     bool stopping;
@@ -43,13 +54,29 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /* With num-iothreads, each virtqueue is processed in its own
+     * iothread while the BlockBackend stays in @ctx.  Only that iothread
+     * touches the virtqueue: requests are popped, parsed and completed
+     * there, and @ctx is only taken to submit them to the block layer.
+     */
+    IOThread **vq_iothreads;
+    VirtIOBlockDataPlaneVq *vqs;
 };
 
+static unsigned vq_iothread_counter;
+
 /* Raise an interrupt to signal guest, if necessary */
 void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
 {
-    if (s->batch_notifications) {
-        set_bit(virtio_get_queue_index(vq), s->batch_notify_vqs);
+    if (s->vqs[virtio_get_queue_index(vq)].ctx != s->ctx) {
+        /* We are in the virtqueue's iothread, which owns its state */
+        virtio_notify_irqfd(s->vdev, vq);
+    } else if (s->batch_notifications) {
+        unsigned i = virtio_get_queue_index(vq);
+
+        /* Virtqueues served by other iothreads may complete concurrently */
+        atomic_or(&s->batch_notify_vqs[BIT_WORD(i)], BIT_MASK(i));
         qemu_bh_schedule(s->bh);
     } else {
         virtio_notify_irqfd(s->vdev, vq);
@@ -60,14 +87,11 @@ static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
     unsigned nvqs = s->conf->num_queues;
-    unsigned long bitmap[BITS_TO_LONGS(nvqs)];
     unsigned j;
 
-    memcpy(bitmap, s->batch_notify_vqs, sizeof(bitmap));
-    memset(s->batch_notify_vqs, 0, sizeof(bitmap));
-
+    aio_context_acquire(s->ctx);
     for (j = 0; j < nvqs; j += BITS_PER_LONG) {
-        unsigned long bits = bitmap[j];
+        unsigned long bits = atomic_xchg(&s->batch_notify_vqs[BIT_WORD(j)], 0);
 
         while (bits != 0) {
             unsigned i = j + ctzl(bits);
@@ -78,6 +102,50 @@ static void notify_guest_bh(void *opaque)
             bits &= bits - 1; /* clear right-most bit */
         }
     }
+    aio_context_release(s->ctx);
+}
+
+/* Push the requests that were completed for @opaque in other contexts */
+static void virtio_blk_data_plane_vq_done_bh(void *opaque)
+{
+    VirtIOBlockDataPlaneVq *dvq = opaque;
+    VirtIOBlockDataPlane *s = dvq->s;
+    VirtQueue *vq = virtio_get_queue(s->vdev, dvq->index);
+    QSLIST_HEAD(, VirtIOBlockReq) done;
+    VirtIOBlockReq *req, *next;
+    unsigned n = 0;
+
+    aio_context_acquire(dvq->ctx);
+    QSLIST_MOVE_ATOMIC(&done, &dvq->done);
+    QSLIST_FOREACH_SAFE(req, &done, done_next, next) {
+        virtqueue_push(vq, &req->elem, req->in_len);
+        g_free(req);
+        n++;
+    }
+    if (n) {
+        trace_virtio_blk_data_plane_vq_done(s, dvq->index, n,
+                                            qemu_get_current_aio_context(),
+                                            s->ctx);
+        virtio_notify_irqfd(s->vdev, vq);
+    }
+    aio_context_release(dvq->ctx);
+}
+
+/* Hand @req over to the iothread of its virtqueue, unless we are in that
+ * iothread already.  Returns true if it was handed over; the iothread then
+ * pushes it to the guest and frees it.
+ */
+bool virtio_blk_data_plane_complete(VirtIOBlockDataPlane *s,
+                                    VirtIOBlockReq *req)
+{
+    VirtIOBlockDataPlaneVq *dvq = &s->vqs[virtio_get_queue_index(req->vq)];
+
+    if (dvq->ctx == s->ctx || dvq->ctx == qemu_get_current_aio_context()) {
+        return false;
+    }
+    QSLIST_INSERT_HEAD_ATOMIC(&dvq->done, req, done_next);
+    qemu_bh_schedule(dvq->bh);
+    return true;
 }
 
 /* Context: QEMU global mutex held */
@@ -88,9 +156,23 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
+    if (conf->num_iothreads) {
+        if (!conf->iothread) {
+            error_setg(errp, "num-iothreads requires the iothread property");
+            return false;
+        }
+        if (conf->num_iothreads > conf->num_queues) {
+            error_setg(errp, "num-iothreads (%" PRIu16 ") must not exceed "
+                       "num-queues (%" PRIu16 ")",
+                       conf->num_iothreads, conf->num_queues);
+            return false;
+        }
+    }
+
     if (conf->iothread) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
@@ -130,6 +212,33 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
 
+    s->vqs = g_new0(VirtIOBlockDataPlaneVq, conf->num_queues);
+    s->vq_iothreads = g_new0(IOThread *, conf->num_iothreads);
+    for (i = 0; i < conf->num_iothreads; i++) {
+        char *id = g_strdup_printf("virtio-blk-vq-iothread-%u",
+                                   vq_iothread_counter++);
+
+        s->vq_iothreads[i] = iothread_create(id, errp);
+        g_free(id);
+        if (!s->vq_iothreads[i]) {
+            virtio_blk_data_plane_destroy(s);
+            return false;
+        }
+    }
+    for (i = 0; i < conf->num_queues; i++) {
+        VirtIOBlockDataPlaneVq *dvq = &s->vqs[i];
+
+        dvq->s = s;
+        dvq->index = i;
+        dvq->ctx = conf->num_iothreads ?
+            iothread_get_aio_context(s->vq_iothreads[i % conf->num_iothreads]) :
+            s->ctx;
+        if (dvq->ctx != s->ctx) {
+            dvq->bh = aio_bh_new(dvq->ctx, virtio_blk_data_plane_vq_done_bh,
+                                 dvq);
+        }
+    }
+
     *dataplane = s;
 
     return true;
@@ -139,6 +248,7 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
 void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 {
     VirtIOBlock *vblk;
+    unsigned i;
 
     if (!s) {
         return;
@@ -146,6 +256,18 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
+    for (i = 0; i < s->conf->num_queues; i++) {
+        if (s->vqs[i].bh) {
+            qemu_bh_delete(s->vqs[i].bh);
+        }
+    }
+    for (i = 0; i < s->conf->num_iothreads; i++) {
+        if (s->vq_iothreads[i]) {
+            iothread_destroy(s->vq_iothreads[i]);
+        }
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vqs);
     g_free(s->batch_notify_vqs);
     qemu_bh_delete(s->bh);
     if (s->iothread) {
@@ -223,14 +345,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx,
+        aio_context_acquire(s->vqs[i].ctx);
+        virtio_queue_aio_set_host_notifier_handler(vq, s->vqs[i].ctx,
                 virtio_blk_data_plane_handle_output);
+        aio_context_release(s->vqs[i].ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_guest_notifiers:
@@ -240,19 +362,23 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/* Stop notifications for new requests from guest on the virtqueues that
+ * are served by the current iothread.
  *
  * Context: BH in IOThread
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_set_host_notifier_handler(vq, s->ctx, NULL);
+        if (s->vqs[i].ctx == ctx) {
+            virtio_queue_aio_set_host_notifier_handler(vq, ctx, NULL);
+        }
     }
 }
 
@@ -279,6 +405,17 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    /* The virtqueue iothreads take s->ctx to submit requests, so quiesce
+     * them before acquiring it.
+     */
+    for (i = 0; i < s->conf->num_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->vq_iothreads[i]);
+
+        aio_context_acquire(ctx);
+        aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+        aio_context_release(ctx);
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
@@ -287,6 +424,13 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
 
     aio_context_release(s->ctx);
 
+    /* Push what the drain completed, in case the BHs have not run yet */
+    for (i = 0; i < nvqs; i++) {
+        if (s->vqs[i].bh) {
+            virtio_blk_data_plane_vq_done_bh(&s->vqs[i]);
+        }
+    }
+
     for (i = 0; i < nvqs; i++) {
         virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
         virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
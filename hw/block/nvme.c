@@ -704,6 +704,11 @@ static uint16_t nvme_get_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         result = cpu_to_le32((n->num_queues - 2) | ((n->num_queues - 2) << 16));
         trace_nvme_getfeat_numq(result);
         break;
+    case NVME_INTERRUPT_COALESCING:
+        result = cpu_to_le32(n->features.int_coalescing);
+        trace_nvme_getfeat_intc(NVME_INTC_THR(n->features.int_coalescing) + 1,
+                                NVME_INTC_TIME(n->features.int_coalescing));
+        break;
     default:
         trace_nvme_err_invalid_getfeat(dw10);
         return NVME_INVALID_FIELD | NVME_DNR;
@@ -729,6 +734,13 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         req->cqe.result =
             cpu_to_le32((n->num_queues - 2) | ((n->num_queues - 2) << 16));
         break;
+    case NVME_INTERRUPT_COALESCING:
+        /* The setting is only a hint; interrupts are already batched by
+         * the completion timer, so just remember it for Get Features.
+         */
+        n->features.int_coalescing = dw11 & 0xFFFF;
+        trace_nvme_setfeat_intc(NVME_INTC_THR(dw11) + 1, NVME_INTC_TIME(dw11));
+        break;
     default:
         trace_nvme_err_invalid_setfeat(dw10);
         return NVME_INVALID_FIELD | NVME_DNR;
@@ -45,20 +45,27 @@ static void virtio_blk_free_request(VirtIOBlockReq *req)
     g_free(req);
 }
 
+/* Complete @req and free it */
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    bool dataplane = s->dataplane_started && !s->dataplane_disabled;
 
     trace_virtio_blk_req_complete(vdev, req, status);
 
     stb_p(&req->in->status, status);
+    if (dataplane && virtio_blk_data_plane_complete(s->dataplane, req)) {
+        /* The virtqueue's own iothread pushes and frees it */
+        return;
+    }
     virtqueue_push(req->vq, &req->elem, req->in_len);
-    if (s->dataplane_started && !s->dataplane_disabled) {
+    if (dataplane) {
         virtio_blk_data_plane_notify(s->dataplane, req->vq);
     } else {
         virtio_notify(vdev, req->vq);
     }
+    virtio_blk_free_request(req);
 }
 
 static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
@@ -75,9 +82,8 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
         req->next = s->rq;
         s->rq = req;
     } else if (action == BLOCK_ERROR_ACTION_REPORT) {
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
         block_acct_failed(blk_get_stats(s->blk), &req->acct);
-        virtio_blk_free_request(req);
+        virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
     }
 
     blk_error_action(s->blk, action, is_read, error);
@@ -119,9 +125,8 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
             }
         }
 
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(req->dev->blk), &req->acct);
-        virtio_blk_free_request(req);
+        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     }
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
 }
@@ -138,9 +143,8 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
         }
     }
 
-    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     block_acct_done(blk_get_stats(req->dev->blk), &req->acct);
-    virtio_blk_free_request(req);
+    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
 
 out:
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
@@ -192,7 +196,6 @@ static void virtio_blk_ioctl_complete(void *opaque, int status)
 out:
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     virtio_blk_req_complete(req, status);
-    virtio_blk_free_request(req);
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
     g_free(ioctl_req);
 }
@@ -325,7 +328,6 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
     status = virtio_blk_handle_scsi_req(req);
     if (status != -EINPROGRESS) {
         virtio_blk_req_complete(req, status);
-        virtio_blk_free_request(req);
     }
 }
 
@@ -538,10 +540,9 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
         if (!virtio_blk_sect_range_ok(req->dev, req->sector_num,
                                       req->qiov.size)) {
-            virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             block_acct_invalid(blk_get_stats(req->dev->blk),
                                is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
-            virtio_blk_free_request(req);
+            virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             return 0;
         }
 
@@ -582,46 +583,74 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                               VIRTIO_BLK_ID_BYTES));
         iov_from_buf(in_iov, in_num, 0, serial, size);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        virtio_blk_free_request(req);
         break;
     }
     default:
         virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-        virtio_blk_free_request(req);
     }
     return 0;
 }
 
+/*
+ * Pop up to @max requests.  This only touches the virtqueue, which with
+ * num-iothreads belongs to the current iothread rather than to the
+ * BlockBackend's AioContext, so it runs without that context's lock.
+ */
+static unsigned virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                        VirtIOBlockReq **reqs, unsigned max)
+{
+    unsigned n;
+
+    for (n = 0; n < max; n++) {
+        reqs[n] = virtio_blk_get_request(s, vq);
+        if (!reqs[n]) {
+            break;
+        }
+    }
+    return n;
+}
+
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    AioContext *ctx = blk_get_aio_context(s->blk);
+    VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
     MultiReqBuffer mrb = {};
     bool progress = false;
-
-    aio_context_acquire(blk_get_aio_context(s->blk));
-    blk_io_plug(s->blk);
+    bool broken = false;
+    unsigned i, n;
 
     do {
         virtio_queue_set_notification(vq, 0);
 
-        while ((req = virtio_blk_get_request(s, vq))) {
+        while (!broken &&
+               (n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
-                break;
+
+            /* The context is only held to hand the batch to the block layer */
+            aio_context_acquire(ctx);
+            blk_io_plug(s->blk);
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    broken = true;
+                    break;
+                }
+            }
+            if (mrb.num_reqs) {
+                virtio_blk_submit_multireq(s->blk, &mrb);
+            }
+            blk_io_unplug(s->blk);
+            aio_context_release(ctx);
+
+            /* The rest of the batch is lost, like the rest of the ring */
+            for (; i < n; i++) {
+                virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                virtio_blk_free_request(reqs[i]);
             }
         }
 
         virtio_queue_set_notification(vq, 1);
-    } while (!virtio_queue_empty(vq));
+    } while (!broken && !virtio_queue_empty(vq));
 
-    if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s->blk, &mrb);
-    }
-
-    blk_io_unplug(s->blk);
-    aio_context_release(blk_get_aio_context(s->blk));
     return progress;
 }
 
@@ -978,6 +1007,7 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     blk_set_guest_block_size(s->blk, s->conf.conf.logical_block_size);
 
     blk_iostatus_enable(s->blk);
+    blk_ram_registrar_init(&s->blk_ram_registrar, s->blk);
 }
 
 static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
@@ -985,6 +1015,7 @@ static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
 
+    blk_ram_registrar_destroy(&s->blk_ram_registrar);
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
     qemu_del_vm_change_state_handler(s->change);
@@ -1026,6 +1057,7 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 128),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_UINT16("num-iothreads", VirtIOBlock, conf.num_iothreads, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -50,6 +50,15 @@ typedef void IOHandler(void *opaque);
 struct Coroutine;
 struct ThreadPool;
 struct LinuxAioState;
+struct LuringState;
+
+/* Bounce buffer pool: power-of-two size classes from 512 bytes to 64 KiB */
+#define AIO_BOUNCE_MIN_SHIFT  9
+#define AIO_BOUNCE_MAX_SHIFT  16
+#define AIO_BOUNCE_MAX_SIZE   (1 << AIO_BOUNCE_MAX_SHIFT)
+#define AIO_BOUNCE_CLASSES    (AIO_BOUNCE_MAX_SHIFT - AIO_BOUNCE_MIN_SHIFT + 1)
+/* Free buffers kept per size class */
+#define AIO_BOUNCE_MAX_FREE   16
 
 struct AioContext {
     GSource source;
@@ -123,6 +132,20 @@ struct AioContext {
      */
     struct LinuxAioState *linux_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    /* State for Linux io_uring.  Uses aio_context_acquire/release for
+     * locking.
+     */
+    struct LuringState *linux_io_uring;
+#endif
+
+    /* Free bounce buffers, one list per power-of-two size class.  A free
+     * buffer holds the pointer to the next one in its first bytes.
+     * Protected by bounce_lock.
+     */
+    QemuMutex bounce_lock;
+    void *bounce_free[AIO_BOUNCE_CLASSES];
+    unsigned int bounce_nr_free[AIO_BOUNCE_CLASSES];
 
     /* TimerLists for calling timers - one per clock type.  Has its own
      * locking.
@@ -384,6 +407,37 @@ struct ThreadPool *aio_get_thread_pool(AioContext *ctx);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Setup the LuringState bound to this AioContext */
+struct LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+
+/* Return the LuringState bound to this AioContext */
+struct LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/**
+ * aio_bounce_buf_get:
+ * @ctx: the AioContext
+ * @size: size of the buffer in bytes
+ * @align: required alignment, a power of two
+ *
+ * Return a buffer for a short-lived copy of I/O data, such as the padding
+ * of an unaligned request.  Buffers of up to AIO_BOUNCE_MAX_SIZE bytes are
+ * recycled by @ctx instead of being allocated every time.  Aborts if out of
+ * memory.
+ */
+void *aio_bounce_buf_get(AioContext *ctx, size_t size, size_t align);
+
+/* Like aio_bounce_buf_get(), but return NULL if out of memory */
+void *aio_bounce_buf_try_get(AioContext *ctx, size_t size, size_t align);
+
+/**
+ * aio_bounce_buf_put:
+ * @ctx: the AioContext that @buf was taken from
+ * @buf: a buffer returned by aio_bounce_buf_get(), or NULL
+ * @size: @size passed to aio_bounce_buf_get()
+ * @align: @align passed to aio_bounce_buf_get()
+ */
+void aio_bounce_buf_put(AioContext *ctx, void *buf, size_t size, size_t align);
+
 /**
  * aio_timer_new:
  * @ctx: the aio context
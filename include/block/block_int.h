@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/main-loop.h"
 #include "qemu/throttle.h"
@@ -56,6 +57,7 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_EXTL2             "extended_l2"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -75,7 +77,8 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_offset;
     unsigned int overlap_bytes;
 
-    QLIST_ENTRY(BdrvTrackedRequest) list;
+    /* Covers [overlap_offset, overlap_offset + overlap_bytes) */
+    IntervalTreeNode node;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -280,6 +283,7 @@ struct BlockDriver {
                                   Error **errp);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs);
+    BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
 
     int coroutine_fn (*bdrv_save_vmstate)(BlockDriverState *bs,
                                           QEMUIOVector *qiov,
@@ -742,7 +746,7 @@ struct BlockDriverState {
 
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
-    QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    IntervalTree tracked_requests;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
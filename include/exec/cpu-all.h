@@ -252,6 +252,9 @@ extern intptr_t qemu_host_page_mask;
 /* Invalidate the TLB entry immediately, helpful for s390x
  * Low-Address-Protection. Used with PAGE_WRITE in tlb_set_page_with_attrs() */
 #define PAGE_WRITE_INV 0x0040
+/* The translation does not depend on the current address space and
+ * survives tlb_flush_asid_by_mmuidx().  Used in tlb_set_page_with_attrs() */
+#define PAGE_GLOBAL    0x0080
 #if defined(CONFIG_BSD) && defined(CONFIG_USER_ONLY)
 /* FIXME: Code that sets/uses this is broken and needs to go away.  */
 #define PAGE_RESERVED  0x0020
@@ -24,6 +24,7 @@
 #endif
 
 #include "qemu/host-utils.h"
+#include "qemu/thread.h"
 #include "qemu/queue.h"
 #ifdef CONFIG_TCG
 #include "tcg-target.h"
@@ -66,6 +67,25 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* The TLB of each MMU mode is allocated separately and resized at flush
+ * time between 2^CPU_TLB_DYN_MIN_BITS and 2^CPU_TLB_DYN_MAX_BITS entries,
+ * see tlb_mmu_resize_locked().  Generated code reads the current size
+ * from env->tlb_mask[] and the table from env->tlb_table[].
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+
+# if HOST_LONG_BITS == 32
+/* Make sure we do not require a double-word shift for the TLB load */
+#  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+# else
+#  define CPU_TLB_DYN_MAX_BITS \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+# endif
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -98,6 +118,8 @@ typedef uint64_t target_ulong;
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
        bit TARGET_PAGE_BITS-1..4  : Nonzero for accesses that should not
@@ -129,15 +151,64 @@ QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 typedef struct CPUIOTLBEntry {
     hwaddr addr;
     MemTxAttrs attrs;
+    /* Address space the translation belongs to, see tlb_set_asid_for_mmuidx.
+     * Kept here rather than in CPUTLBEntry because generated code never
+     * needs to compare it.
+     */
+    uint32_t asid;
 } CPUIOTLBEntry;
 
+/* asid of translations created with PAGE_GLOBAL */
+#define TLB_ASID_GLOBAL UINT32_MAX
+
+/* Per-vCPU TLB statistics, only updated by the owning vCPU */
+typedef struct CPUTLBStats {
+    size_t miss;        /* lookups that missed the main TLB */
+    size_t victim_hit;  /* ... and were satisfied by the victim TLB */
+    size_t flush_page;  /* single page flushes */
+    size_t flush_range; /* page range flushes */
+    size_t flush_asid;  /* flushes of one address space */
+    size_t asid_switch; /* changes of the current address space */
+    size_t resize;      /* dynamic TLB resizes */
+} CPUTLBStats;
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+typedef struct CPUTLBDesc {
+    /* Start of the current resize window and the highest number of
+     * entries that were in use at a flush during that window.
+     */
+    int64_t window_begin_ns;
+    size_t window_max_entries;
+    size_t n_used_entries;
+    /* Live entries replaced by a refill since the last full flush */
+    size_t n_evictions;
+} CPUTLBDesc;
+
+#define CPU_COMMON_TLB_TABLES                                           \
+    /* serializes resizing against tlb_reset_dirty() */                 \
+    QemuSpin tlb_lock;                                                  \
+    CPUTLBDesc tlb_desc[NB_MMU_MODES];                                  \
+    /* (entries - 1) << CPU_TLB_ENTRY_BITS, read by generated code */   \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];
+#else
+#define CPU_COMMON_TLB_TABLES                                           \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    CPU_COMMON_TLB_TABLES                                               \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
-    CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
     size_t tlb_flush_count;                                             \
+    CPUTLBStats tlb_stats;                                              \
+    /* current address space of each MMU mode */                        \
+    uint32_t tlb_asid[NB_MMU_MODES];                                    \
+    /* MMU modes that may hold PAGE_GLOBAL translations */              \
+    uint16_t tlb_global_idxmap;                                         \
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
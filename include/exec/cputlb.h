@@ -24,5 +24,6 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 size_t tlb_flush_count(void);
+void tlb_dump_stats(FILE *f, fprintf_function cpu_fprintf);
 #endif
 #endif
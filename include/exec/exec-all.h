@@ -64,6 +64,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+#ifdef CONFIG_SOFTMMU
+TranslationBlock *tb_gen_code_parallel(CPUState *cpu,
+                                       target_ulong pc, target_ulong cs_base,
+                                       uint32_t flags, int cflags);
+#endif
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -96,6 +101,16 @@ void cpu_address_space_init(CPUState *cpu, int asidx,
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 /* cputlb.c */
+/**
+ * tlb_init - initialize a CPU's TLB
+ * @cpu: CPU whose TLB should be initialized
+ */
+void tlb_init(CPUState *cpu);
+/**
+ * tlb_destroy - destroy a CPU's TLB
+ * @cpu: CPU whose TLB should be destroyed
+ */
+void tlb_destroy(CPUState *cpu);
 /**
  * tlb_flush_page:
  * @cpu: CPU whose TLB should be flushed
@@ -218,13 +233,97 @@ void tlb_flush_by_mmuidx_all_cpus(CPUState *cpu, uint16_t idxmap);
  * depend on when the guests translation ends the TB.
  */
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu, uint16_t idxmap);
+/**
+ * tlb_flush_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ *
+ * Flush all pages overlapping [@addr, @addr + @len) from the TLB of the
+ * specified CPU, for all MMU indexes.  This is cheaper than a loop of
+ * tlb_flush_page for large ranges and than tlb_flush for small ones.
+ */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
+/**
+ * tlb_flush_range_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush all pages overlapping [@addr, @addr + @len) from the TLB of the
+ * specified CPU, for the specified MMU indexes.
+ */
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus:
+ * @cpu: Originating CPU of the flush
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Like tlb_flush_range_by_mmuidx, but for the TLBs of all CPUs.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu, target_ulong addr,
+                                        target_ulong len, uint16_t idxmap);
+/**
+ * tlb_flush_range_by_mmuidx_all_cpus_synced:
+ * @cpu: Originating CPU of the flush
+ * @addr: virtual address of the start of the range
+ * @len: length of the range in bytes
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Like tlb_flush_range_by_mmuidx_all_cpus except the source vCPUs work
+ * is scheduled as safe work meaning all flushes will be complete once
+ * the source vCPUs safe work is complete.
+ */
+void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                               target_ulong addr,
+                                               target_ulong len,
+                                               uint16_t idxmap);
+/**
+ * tlb_set_asid_for_mmuidx:
+ * @cpu: CPU whose address space identifier changes
+ * @asid: new address space identifier
+ * @idxmap: bitmap of MMU indexes
+ *
+ * Make @asid the address space of the specified MMU indexes.  New TLB
+ * entries that are not PAGE_GLOBAL are tagged with it.  Entries of the
+ * previous address space are dropped, global ones are kept.
+ */
+void tlb_set_asid_for_mmuidx(CPUState *cpu, uint32_t asid, uint16_t idxmap);
+/**
+ * tlb_flush_asid_by_mmuidx:
+ * @cpu: CPU whose TLB should be flushed
+ * @asid: address space identifier to flush
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Flush the entries of address space @asid from the TLB of the specified
+ * CPU, for the specified MMU indexes.  Entries added with PAGE_GLOBAL are
+ * kept.  Only the current address space of each MMU index is ever cached,
+ * so flushing any other one does nothing.
+ */
+void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint32_t asid, uint16_t idxmap);
+/**
+ * tlb_flush_asid_by_mmuidx_all_cpus_synced:
+ * @cpu: Originating CPU of the flush
+ * @asid: address space identifier to flush
+ * @idxmap: bitmap of MMU indexes to flush
+ *
+ * Like tlb_flush_asid_by_mmuidx, but for the TLBs of all CPUs; the source
+ * vCPUs work is scheduled as safe work.
+ */
+void tlb_flush_asid_by_mmuidx_all_cpus_synced(CPUState *cpu, uint32_t asid,
+                                              uint16_t idxmap);
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
  * @vaddr: virtual address of page to add entry for
  * @paddr: physical address of the page
  * @attrs: memory transaction attributes
- * @prot: access permissions (PAGE_READ/PAGE_WRITE/PAGE_EXEC bits)
+ * @prot: access permissions (PAGE_READ/PAGE_WRITE/PAGE_EXEC bits),
+ *        plus PAGE_GLOBAL if the mapping is shared by all address spaces
  * @mmu_idx: MMU index to insert TLB entry for
  * @size: size of the page in bytes
  *
@@ -256,6 +355,12 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
                  uintptr_t retaddr);
 #else
+static inline void tlb_init(CPUState *cpu)
+{
+}
+static inline void tlb_destroy(CPUState *cpu)
+{
+}
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
@@ -300,6 +405,39 @@ static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *cpu,
                                                        uint16_t idxmap)
 {
 }
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus(CPUState *cpu,
+                                                      target_ulong addr,
+                                                      target_ulong len,
+                                                      uint16_t idxmap)
+{
+}
+static inline void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                             target_ulong addr,
+                                                             target_ulong len,
+                                                             uint16_t idxmap)
+{
+}
+static inline void tlb_set_asid_for_mmuidx(CPUState *cpu, uint32_t asid,
+                                           uint16_t idxmap)
+{
+}
+static inline void tlb_flush_asid_by_mmuidx(CPUState *cpu, uint32_t asid,
+                                            uint16_t idxmap)
+{
+}
+static inline void tlb_flush_asid_by_mmuidx_all_cpus_synced(CPUState *cpu,
+                                                            uint32_t asid,
+                                                            uint16_t idxmap)
+{
+}
 static inline void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
 {
 }
@@ -343,6 +481,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Setters need tb_lock */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_COLD        0x00100000 /* First-tier TB, see tb_hot_threshold */
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
     (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL)
@@ -384,10 +523,32 @@ struct TranslationBlock {
      */
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_list_first;
+
+    /* Entries left before a CF_COLD TB is retranslated.  The TB's own
+     * prologue decrements it, so chained entries are counted too.  The
+     * decrement is not atomic: under MTTCG, concurrent entries may be
+     * counted once, which only delays the retranslation a little.
+     */
+    int32_t exec_count;
+
+    /* Sampled profile, only maintained when tb_profile_period is set.
+     * prof_execs is an estimate of the number of times the TB was
+     * entered, updated by the code that gen_tb_start() emits;
+     * prof_gen_ns is the time it took to translate it.
+     */
+    uint64_t prof_execs;
+    int64_t prof_gen_ns;
 };
 
 extern bool parallel_cpus;
 
+/* Number of entries after which a CF_COLD TB, which was translated
+ * without the TCG optimizer, is retranslated with it.  Zero disables
+ * the cold tier altogether.
+ */
+extern unsigned int tb_hot_threshold;
+extern unsigned int tb_profile_period;
+
 /* Hide the atomic_read to make code a little easier on the eyes */
 static inline uint32_t tb_cflags(const TranslationBlock *tb)
 {
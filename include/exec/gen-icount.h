@@ -35,12 +35,67 @@ static inline void gen_tb_start(TranslationBlock *tb)
 
     tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx->exitreq_label);
 
+    if (tb_cflags(tb) & CF_COLD) {
+        /* Count down the entries into the TB, whether they come from
+         * tb_find(), a chained goto_tb or lookup_and_goto_ptr, and leave
+         * before executing it once it is due to be retranslated.  This
+         * must come before the icount store below, so that leaving does
+         * not charge the TB's instructions to the budget.  See
+         * TranslationBlock.exec_count for why the update need not be
+         * atomic.
+         */
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+        TCGv_i32 left = tcg_temp_new_i32();
+
+        tcg_gen_ld_i32(left, ptr, 0);
+        tcg_gen_subi_i32(left, left, 1);
+        tcg_gen_st_i32(left, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_LE, left, 0, tcg_ctx->exitreq_label);
+        tcg_temp_free_i32(left);
+        tcg_temp_free_ptr(ptr);
+    }
+
     if (tb_cflags(tb) & CF_USE_ICOUNT) {
         tcg_gen_st16_i32(count, cpu_env,
                          -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
     }
 
     tcg_temp_free_i32(count);
+
+    if (tb_profile_period) {
+        /* Charge one in tb_profile_period entries into a TB to it.  Done
+         * here rather than in cpu_tb_exec(), so that goto_tb chaining and
+         * lookup_and_goto_ptr are seen too.  The countdown is per vCPU, and
+         * the update of prof_execs is not atomic: a lost sample only makes
+         * the estimate slightly low.
+         */
+        TCGLabel *skip = gen_new_label();
+        TCGv_i32 ticks = tcg_temp_new_i32();
+        TCGv_ptr ptr;
+        TCGv_i64 execs;
+
+        tcg_gen_ld_i32(ticks, cpu_env,
+                       -ENV_OFFSET + offsetof(CPUState, tb_profile_ticks));
+        tcg_gen_subi_i32(ticks, ticks, 1);
+        tcg_gen_st_i32(ticks, cpu_env,
+                       -ENV_OFFSET + offsetof(CPUState, tb_profile_ticks));
+        tcg_gen_brcondi_i32(TCG_COND_GT, ticks, 0, skip);
+
+        tcg_gen_movi_i32(ticks, tb_profile_period);
+        tcg_gen_st_i32(ticks, cpu_env,
+                       -ENV_OFFSET + offsetof(CPUState, tb_profile_ticks));
+        tcg_temp_free_i32(ticks);
+
+        ptr = tcg_const_ptr(&tb->prof_execs);
+        execs = tcg_temp_new_i64();
+        tcg_gen_ld_i64(execs, ptr, 0);
+        tcg_gen_addi_i64(execs, execs, tb_profile_period);
+        tcg_gen_st_i64(execs, ptr, 0);
+        tcg_temp_free_i64(execs);
+        tcg_temp_free_ptr(ptr);
+
+        gen_set_label(skip);
+    }
 }
 
 static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
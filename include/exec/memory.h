@@ -291,6 +291,10 @@ struct MemoryListener {
     void (*log_stop)(MemoryListener *listener, MemoryRegionSection *section,
                      int old, int new);
     void (*log_sync)(MemoryListener *listener, MemoryRegionSection *section);
+    /* Used instead of log_sync when the dirty log can only be synced
+     * as a whole, e.g. with the KVM dirty ring.
+     */
+    void (*log_sync_global)(MemoryListener *listener);
     void (*log_global_start)(MemoryListener *listener);
     void (*log_global_stop)(MemoryListener *listener);
     void (*eventfd_add)(MemoryListener *listener, MemoryRegionSection *section,
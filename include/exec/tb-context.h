@@ -38,7 +38,16 @@ struct TBContext {
 
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
+    size_t tb_evict_tb_count;
+    /* time spent with the vCPUs stopped, in ns */
+    int64_t tb_flush_pause;
+    int64_t tb_flush_pause_max;
+    int64_t tb_evict_pause;
+    int64_t tb_evict_pause_max;
     int tb_phys_invalidate_count;
+    unsigned tb_tier_up_count;
+    unsigned tb_parallel_discard_count;
 };
 
 extern TBContext tb_ctx;
@@ -18,6 +18,7 @@
 #include "hw/virtio/virtio.h"
 #include "hw/block/block.h"
 #include "sysemu/iothread.h"
+#include "sysemu/block-ram-registrar.h"
 #include "sysemu/block-backend.h"
 
 #define TYPE_VIRTIO_BLK "virtio-blk-device"
@@ -40,6 +41,7 @@ struct VirtIOBlkConf
     uint32_t request_merging;
     uint16_t num_queues;
     uint16_t queue_size;
+    uint16_t num_iothreads;
 };
 
 struct VirtIOBlockDataPlane;
@@ -57,6 +59,7 @@ typedef struct VirtIOBlock {
     bool dataplane_disabled;
     bool dataplane_started;
     struct VirtIOBlockDataPlane *dataplane;
+    BlockRAMRegistrar blk_ram_registrar;
 } VirtIOBlock;
 
 typedef struct VirtIOBlockReq {
@@ -70,6 +73,7 @@ typedef struct VirtIOBlockReq {
     size_t in_len;
     struct VirtIOBlockReq *next;
     struct VirtIOBlockReq *mr_next;
+    QSLIST_ENTRY(VirtIOBlockReq) done_next;
     BlockAcctCookie acct;
 } VirtIOBlockReq;
 
@@ -0,0 +1,87 @@
+/*
+ * Interval tree
+ *
+ * An intrusive, augmented AVL tree of half-open intervals [start, end).
+ * Every node caches the largest end offset found in its subtree, so that
+ * all intervals overlapping a given range can be enumerated in
+ * O(log n + k) time, k being the number of matches.
+ *
+ * The tree does no locking of its own; callers serialise all accesses.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+typedef struct IntervalTreeNode IntervalTreeNode;
+
+struct IntervalTreeNode {
+    /* Must not be changed while the node is in a tree.  */
+    uint64_t start;
+    uint64_t end;
+
+    /* private: */
+    IntervalTreeNode *left;
+    IntervalTreeNode *right;
+    uint64_t subtree_end;
+    int height;
+};
+
+typedef struct IntervalTree {
+    IntervalTreeNode *root;
+} IntervalTree;
+
+/*
+ * Callback for interval_tree_find_overlap().  Return true to stop the
+ * search at @node.
+ */
+typedef bool IntervalTreeFunc(IntervalTreeNode *node, void *opaque);
+
+static inline void interval_tree_init(IntervalTree *tree)
+{
+    tree->root = NULL;
+}
+
+static inline bool interval_tree_is_empty(IntervalTree *tree)
+{
+    return tree->root == NULL;
+}
+
+/**
+ * interval_tree_insert:
+ * @tree: the tree
+ * @node: a node that is not in any tree, with @start and @end set
+ *
+ * Several nodes may describe the same interval.
+ */
+void interval_tree_insert(IntervalTree *tree, IntervalTreeNode *node);
+
+/**
+ * interval_tree_remove:
+ * @tree: the tree
+ * @node: a node that is currently in @tree
+ */
+void interval_tree_remove(IntervalTree *tree, IntervalTreeNode *node);
+
+/**
+ * interval_tree_find_overlap:
+ * @tree: the tree
+ * @start: start of the range to look up
+ * @end: end of the range to look up (exclusive)
+ * @func: called for each node overlapping [@start, @end)
+ * @opaque: passed to @func
+ *
+ * Nodes are visited in ascending order of their start offset.  The tree
+ * must not be modified by @func.
+ *
+ * Returns: the node for which @func returned true, or NULL if there is
+ * none.
+ */
+IntervalTreeNode *interval_tree_find_overlap(IntervalTree *tree,
+                                             uint64_t start, uint64_t end,
+                                             IntervalTreeFunc *func,
+                                             void *opaque);
+
+#endif
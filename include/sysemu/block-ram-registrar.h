@@ -0,0 +1,26 @@
+/*
+ * BlockBackend RAM Registrar
+ *
+ * Registers guest RAM with a BlockBackend through blk_register_buf(), so
+ * that drivers which can pre-register memory with the host (such as
+ * io_uring fixed buffers or VFIO mappings) do so for all of guest RAM,
+ * including RAM blocks that are added later.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_RAM_REGISTRAR_H
+#define BLOCK_RAM_REGISTRAR_H
+
+#include "exec/ramlist.h"
+
+typedef struct {
+    BlockBackend *blk;
+    RAMBlockNotifier notifier;
+} BlockRAMRegistrar;
+
+void blk_ram_registrar_init(BlockRAMRegistrar *r, BlockBackend *blk);
+void blk_ram_registrar_destroy(BlockRAMRegistrar *r);
+
+#endif /* BLOCK_RAM_REGISTRAR_H */
@@ -0,0 +1,94 @@
+/*
+ * Coalescing of KVM dirty ring entries
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Each entry of a dirty ring names a single page, as a memslot and a page
+ * offset in it.  Pages that follow each other in the rings are marked
+ * dirty as one range.  This does not depend on KVM, so that it can be
+ * tested on its own.
+ */
+
+#ifndef QEMU_KVM_DIRTY_RANGE_H
+#define QEMU_KVM_DIRTY_RANGE_H
+
+typedef struct KVMDirtyRangeOps {
+    /*
+     * Returns the number of pages in memslot @slot_id of address space
+     * @as_id, or 0 if there is no such memslot.
+     */
+    uint64_t (*slot_pages)(void *opaque, uint32_t as_id, uint32_t slot_id);
+    /* Marks @npages pages dirty, starting at page @start of the memslot */
+    void (*set_dirty)(void *opaque, uint32_t as_id, uint32_t slot_id,
+                      uint64_t start, uint64_t npages);
+} KVMDirtyRangeOps;
+
+typedef struct KVMDirtyRange {
+    const KVMDirtyRangeOps *ops;
+    void *opaque;
+    uint32_t nr_as;
+    uint32_t nr_slots;
+
+    /* The pending range */
+    uint32_t as_id;
+    uint32_t slot_id;
+    uint64_t start;
+    uint64_t npages;
+} KVMDirtyRange;
+
+static inline void kvm_dirty_range_init(KVMDirtyRange *range,
+                                        const KVMDirtyRangeOps *ops,
+                                        void *opaque, uint32_t nr_as,
+                                        uint32_t nr_slots)
+{
+    *range = (KVMDirtyRange) {
+        .ops = ops,
+        .opaque = opaque,
+        .nr_as = nr_as,
+        .nr_slots = nr_slots,
+    };
+}
+
+static inline void kvm_dirty_range_flush(KVMDirtyRange *range)
+{
+    if (range->npages) {
+        range->ops->set_dirty(range->opaque, range->as_id, range->slot_id,
+                              range->start, range->npages);
+        range->npages = 0;
+    }
+}
+
+/*
+ * kvm_dirty_range_add: add one ring entry to the pending range
+ *
+ * @slot is the address space in its upper 16 bits and the memslot in the
+ * lower 16 bits, as in struct kvm_dirty_gfn.  Entries for memslots that
+ * do not exist, or for pages past their end, are dropped: the memslot was
+ * removed or shrunk since the page was dirtied.
+ */
+static inline void kvm_dirty_range_add(KVMDirtyRange *range, uint32_t slot,
+                                       uint64_t offset)
+{
+    uint32_t as_id = slot >> 16;
+    uint32_t slot_id = slot & 0xffff;
+
+    if (as_id >= range->nr_as || slot_id >= range->nr_slots ||
+        offset >= range->ops->slot_pages(range->opaque, as_id, slot_id)) {
+        return;
+    }
+
+    if (range->npages && range->as_id == as_id &&
+        range->slot_id == slot_id &&
+        range->start + range->npages == offset) {
+        range->npages++;
+        return;
+    }
+    kvm_dirty_range_flush(range);
+    range->as_id = as_id;
+    range->slot_id = slot_id;
+    range->start = offset;
+    range->npages = 1;
+}
+
+#endif
@@ -18,6 +18,8 @@ typedef struct KVMSlot
     hwaddr start_addr;
     ram_addr_t memory_size;
     void *ram;
+    /* ram_addr_t of the first page, for the dirty ring */
+    ram_addr_t ram_start_offset;
     int slot;
     int flags;
 } KVMSlot;
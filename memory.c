@@ -1964,6 +1964,11 @@ static void memory_region_sync_dirty_bitmap(MemoryRegion *mr)
      * address space once.
      */
     QTAILQ_FOREACH(listener, &memory_listeners, link) {
+        if (listener->log_sync_global) {
+            /* Whatever @mr is, there is nothing finer than a global sync */
+            listener->log_sync_global(listener);
+            continue;
+        }
         if (!listener->log_sync) {
             continue;
         }
@@ -81,6 +81,11 @@
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY 200
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
 #define DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT 16
+#define DEFAULT_MIGRATE_MULTIFD_COMPRESSION MULTIFD_COMPRESSION_NONE
+/* 0: means nocompress, 1: best speed, ... 9: best compress ratio */
+#define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
+/* 1: best speed, ... 20: best compress ratio (zstd goes up to 22) */
+#define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
 
 static NotifierList migration_state_notifiers =
     NOTIFIER_LIST_INITIALIZER(migration_state_notifiers);
@@ -436,10 +441,19 @@ void migration_ioc_process_incoming(QIOChannel *ioc)
     MigrationIncomingState *mis = migration_incoming_get_current();
 
     if (!mis->from_src_file) {
+        /* The first connection is the main migration stream */
         QEMUFile *f = qemu_fopen_channel_input(ioc);
-        migration_fd_process_incoming(f);
+        migration_incoming_setup(f);
+        if (!migrate_use_multifd()) {
+            migration_incoming_process();
+        }
+        return;
+    }
+
+    if (migrate_use_multifd() && multifd_recv_new_channel(ioc)) {
+        /* All multifd channels are there, the stream can be loaded */
+        migration_incoming_process();
     }
-    /* We still only have a single channel.  Nothing to do here yet */
 }
 
 /**
@@ -450,7 +464,9 @@ void migration_ioc_process_incoming(QIOChannel *ioc)
  */
 bool migration_has_all_channels(void)
 {
-    return true;
+    MigrationIncomingState *mis = migration_incoming_get_current();
+
+    return mis->from_src_file && multifd_recv_all_channels_created();
 }
 
 /*
@@ -543,6 +559,12 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->x_multifd_channels = s->parameters.x_multifd_channels;
     params->has_x_multifd_page_count = true;
     params->x_multifd_page_count = s->parameters.x_multifd_page_count;
+    params->has_x_multifd_compression = true;
+    params->x_multifd_compression = s->parameters.x_multifd_compression;
+    params->has_x_multifd_zlib_level = true;
+    params->x_multifd_zlib_level = s->parameters.x_multifd_zlib_level;
+    params->has_x_multifd_zstd_level = true;
+    params->x_multifd_zstd_level = s->parameters.x_multifd_zstd_level;
     params->has_xbzrle_cache_size = true;
     params->xbzrle_cache_size = s->parameters.xbzrle_cache_size;
 
@@ -585,6 +607,10 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->dirty_sync_count = ram_counters.dirty_sync_count;
     info->ram->postcopy_requests = ram_counters.postcopy_requests;
     info->ram->page_size = qemu_target_page_size();
+    info->ram->dirty_sync_log_time = ram_counters.dirty_sync_log_time;
+    info->ram->dirty_sync_bitmap_time = ram_counters.dirty_sync_bitmap_time;
+    info->ram->dirty_sync_chunk_max_time =
+        ram_counters.dirty_sync_chunk_max_time;
 
     if (migrate_use_xbzrle()) {
         info->has_xbzrle_cache = true;
@@ -595,6 +621,9 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         info->xbzrle_cache->cache_miss = xbzrle_counters.cache_miss;
         info->xbzrle_cache->cache_miss_rate = xbzrle_counters.cache_miss_rate;
         info->xbzrle_cache->overflow = xbzrle_counters.overflow;
+        info->xbzrle_cache->cache_hit = xbzrle_counters.cache_hit;
+        info->xbzrle_cache->cache_hit_rate = xbzrle_counters.cache_hit_rate;
+        info->xbzrle_cache->encoding_rate = xbzrle_counters.encoding_rate;
     }
 
     if (cpu_throttle_active()) {
@@ -725,6 +754,16 @@ static bool migrate_caps_check(bool *cap_list,
             return false;
         }
 
+        if (cap_list[MIGRATION_CAPABILITY_X_MULTIFD]) {
+            /* Pages arriving on the multifd channels are written directly
+             * into guest memory, which cannot be done atomically once the
+             * destination is running.
+             */
+            error_setg(errp, "Postcopy is not currently compatible "
+                       "with multifd");
+            return false;
+        }
+
         /* This check is reasonably expensive, so only when it's being
          * set the first time, also it's only the destination that needs
          * special support.
@@ -839,6 +878,29 @@ static bool migrate_params_check(MigrationParameters *params, Error **errp)
                    "is invalid, it should be in the range of 1 to 10000");
         return false;
     }
+#ifndef CONFIG_ZSTD
+    if (params->has_x_multifd_compression &&
+        params->x_multifd_compression == MULTIFD_COMPRESSION_ZSTD) {
+        error_setg(errp, "QEMU compiled without zstd support");
+        return false;
+    }
+#endif
+    if (params->has_x_multifd_zlib_level &&
+        (params->x_multifd_zlib_level < 0 ||
+         params->x_multifd_zlib_level > 9)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "multifd_zlib_level",
+                   "is invalid, it should be in the range of 0 to 9");
+        return false;
+    }
+    if (params->has_x_multifd_zstd_level &&
+        (params->x_multifd_zstd_level < 1 ||
+         params->x_multifd_zstd_level > 20)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "multifd_zstd_level",
+                   "is invalid, it should be in the range of 1 to 20");
+        return false;
+    }
 
     if (params->has_xbzrle_cache_size &&
         (params->xbzrle_cache_size < qemu_target_page_size() ||
@@ -911,6 +973,15 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_x_multifd_page_count) {
         dest->x_multifd_page_count = params->x_multifd_page_count;
     }
+    if (params->has_x_multifd_compression) {
+        dest->x_multifd_compression = params->x_multifd_compression;
+    }
+    if (params->has_x_multifd_zlib_level) {
+        dest->x_multifd_zlib_level = params->x_multifd_zlib_level;
+    }
+    if (params->has_x_multifd_zstd_level) {
+        dest->x_multifd_zstd_level = params->x_multifd_zstd_level;
+    }
     if (params->has_xbzrle_cache_size) {
         dest->xbzrle_cache_size = params->xbzrle_cache_size;
     }
@@ -982,6 +1053,15 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_x_multifd_page_count) {
         s->parameters.x_multifd_page_count = params->x_multifd_page_count;
     }
+    if (params->has_x_multifd_compression) {
+        s->parameters.x_multifd_compression = params->x_multifd_compression;
+    }
+    if (params->has_x_multifd_zlib_level) {
+        s->parameters.x_multifd_zlib_level = params->x_multifd_zlib_level;
+    }
+    if (params->has_x_multifd_zstd_level) {
+        s->parameters.x_multifd_zstd_level = params->x_multifd_zstd_level;
+    }
     if (params->has_xbzrle_cache_size) {
         s->parameters.xbzrle_cache_size = params->xbzrle_cache_size;
         xbzrle_cache_resize(params->xbzrle_cache_size, errp);
@@ -1114,6 +1194,7 @@ static void migrate_fd_cleanup(void *opaque)
         if (multifd_save_cleanup(&local_err) != 0) {
             error_report_err(local_err);
         }
+        socket_send_channel_cleanup();
         qemu_fclose(s->to_dst_file);
         s->to_dst_file = NULL;
     }
@@ -1399,6 +1480,8 @@ void qmp_migrate(const char *uri, bool has_blk, bool blk,
     }
 
     migrate_init(s);
+    /* Forget the address of a previous socket migration */
+    socket_send_channel_cleanup();
 
     if (strstart(uri, "tcp:", &p)) {
         tcp_start_outgoing_migration(s, p, &local_err);
@@ -1611,6 +1694,33 @@ int migrate_multifd_page_count(void)
     return s->parameters.x_multifd_page_count;
 }
 
+MultiFDCompression migrate_multifd_compression(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_compression;
+}
+
+int migrate_multifd_zlib_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_zlib_level;
+}
+
+int migrate_multifd_zstd_level(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->parameters.x_multifd_zstd_level;
+}
+
 int migrate_use_xbzrle(void)
 {
     MigrationState *s;
@@ -2505,6 +2615,15 @@ static Property migration_properties[] = {
     DEFINE_PROP_UINT32("x-multifd-page-count", MigrationState,
                       parameters.x_multifd_page_count,
                       DEFAULT_MIGRATE_MULTIFD_PAGE_COUNT),
+    DEFINE_PROP_MULTIFD_COMPRESSION("x-multifd-compression", MigrationState,
+                      parameters.x_multifd_compression,
+                      DEFAULT_MIGRATE_MULTIFD_COMPRESSION),
+    DEFINE_PROP_UINT8("x-multifd-zlib-level", MigrationState,
+                      parameters.x_multifd_zlib_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL),
+    DEFINE_PROP_UINT8("x-multifd-zstd-level", MigrationState,
+                      parameters.x_multifd_zstd_level,
+                      DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL),
     DEFINE_PROP_SIZE("xbzrle-cache-size", MigrationState,
                       parameters.xbzrle_cache_size,
                       DEFAULT_MIGRATE_XBZRLE_CACHE_SIZE),
@@ -2572,6 +2691,9 @@ static void migration_instance_init(Object *obj)
     params->has_x_multifd_channels = true;
     params->has_x_multifd_page_count = true;
     params->has_xbzrle_cache_size = true;
+    params->has_x_multifd_compression = true;
+    params->has_x_multifd_zlib_level = true;
+    params->has_x_multifd_zstd_level = true;
 }
 
 /*
@@ -0,0 +1,326 @@
+/*
+ * Streaming compression for the multifd channels
+ *
+ * Unlike the compression threads, which compress every page on its own,
+ * each multifd channel keeps one zlib or zstd stream for the whole
+ * migration.  Every packet is flushed, but the history of the stream is
+ * preserved, so that a page can be encoded against the pages that the
+ * channel sent before it.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+#include "qapi/error.h"
+#include "multifd-compress.h"
+
+struct MultiFDCompressor {
+    MultiFDCompression method;
+    bool compress;
+    z_stream zs;
+#ifdef CONFIG_ZSTD
+    ZSTD_CStream *zcs;
+    ZSTD_DStream *zds;
+#endif
+};
+
+MultiFDCompressor *multifd_compressor_new(MultiFDCompression method,
+                                          bool compress, int level,
+                                          Error **errp)
+{
+    MultiFDCompressor *c = g_new0(MultiFDCompressor, 1);
+    int ret;
+
+    c->method = method;
+    c->compress = compress;
+
+    switch (method) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        if (compress) {
+            ret = deflateInit(&c->zs, level);
+        } else {
+            ret = inflateInit(&c->zs);
+        }
+        if (ret != Z_OK) {
+            error_setg(errp, "multifd: zlib initialization failed: %s",
+                       c->zs.msg ? c->zs.msg : "unknown error");
+            g_free(c);
+            return NULL;
+        }
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD: {
+        size_t zret;
+
+        if (compress) {
+            c->zcs = ZSTD_createCStream();
+            zret = c->zcs ? ZSTD_initCStream(c->zcs, level) : 0;
+        } else {
+            c->zds = ZSTD_createDStream();
+            zret = c->zds ? ZSTD_initDStream(c->zds) : 0;
+        }
+        if (!c->zcs && !c->zds) {
+            error_setg(errp, "multifd: could not create zstd stream");
+            g_free(c);
+            return NULL;
+        }
+        if (ZSTD_isError(zret)) {
+            error_setg(errp, "multifd: zstd initialization failed: %s",
+                       ZSTD_getErrorName(zret));
+            multifd_compressor_free(c);
+            return NULL;
+        }
+        break;
+    }
+#endif
+    default:
+        error_setg(errp, "multifd: compression method %s is not supported",
+                   MultiFDCompression_str(method));
+        g_free(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void multifd_compressor_free(MultiFDCompressor *c)
+{
+    if (!c) {
+        return;
+    }
+
+    switch (c->method) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        if (c->compress) {
+            deflateEnd(&c->zs);
+        } else {
+            inflateEnd(&c->zs);
+        }
+        break;
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        ZSTD_freeCStream(c->zcs);
+        ZSTD_freeDStream(c->zds);
+        break;
+#endif
+    default:
+        break;
+    }
+    g_free(c);
+}
+
+size_t multifd_compress_bound(MultiFDCompression method, size_t len)
+{
+    switch (method) {
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        /* Each flush may add an empty block */
+        return ZSTD_compressBound(len) + 64;
+#endif
+    default:
+        /* compressBound() is for a complete stream; add room for the flush */
+        return compressBound(len) + 64;
+    }
+}
+
+static ssize_t multifd_zlib_compress(MultiFDCompressor *c,
+                                     const struct iovec *iov,
+                                     unsigned int niov, uint8_t *out,
+                                     size_t out_len, Error **errp)
+{
+    z_stream *zs = &c->zs;
+    unsigned int i;
+    int ret;
+
+    zs->next_out = out;
+    zs->avail_out = out_len;
+    for (i = 0; i < niov; i++) {
+        int flush = i == niov - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+
+        /* next_in is not const in old zlib versions */
+        zs->next_in = iov[i].iov_base;
+        zs->avail_in = iov[i].iov_len;
+
+        /*
+         * The output buffer comes from multifd_compress_bound(), so
+         * running out of room is an error.  For the flush, deflate() only
+         * knows it is done if some room is left.
+         */
+        do {
+            ret = deflate(zs, flush);
+        } while (ret == Z_OK && zs->avail_in && zs->avail_out);
+        if (ret == Z_OK && flush == Z_SYNC_FLUSH && !zs->avail_out) {
+            ret = Z_BUF_ERROR;
+        }
+        if (ret != Z_OK || zs->avail_in) {
+            error_setg(errp, "multifd: zlib compression failed (%d)", ret);
+            return -1;
+        }
+    }
+
+    return out_len - zs->avail_out;
+}
+
+static int multifd_zlib_decompress(MultiFDCompressor *c, const uint8_t *in,
+                                   size_t in_len, const struct iovec *iov,
+                                   unsigned int niov, Error **errp)
+{
+    z_stream *zs = &c->zs;
+    unsigned int i;
+    int ret;
+
+    zs->next_in = (uint8_t *)in;
+    zs->avail_in = in_len;
+    for (i = 0; i < niov; i++) {
+        bool last = i == niov - 1;
+
+        zs->next_out = iov[i].iov_base;
+        zs->avail_out = iov[i].iov_len;
+
+        /*
+         * Fill the element.  The last one also has to consume the end of
+         * the flushed block, or the next packet would not start at a
+         * block boundary.
+         */
+        do {
+            ret = inflate(zs, last ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        } while (ret == Z_OK && zs->avail_in && (zs->avail_out || last));
+        if (ret == Z_BUF_ERROR && !zs->avail_out) {
+            /* no progress possible, but the element is full */
+            ret = Z_OK;
+        }
+        if (ret != Z_OK || zs->avail_out) {
+            error_setg(errp, "multifd: zlib decompression failed (%d)", ret);
+            return -1;
+        }
+    }
+    if (zs->avail_in) {
+        error_setg(errp, "multifd: %u bytes left after zlib decompression",
+                   zs->avail_in);
+        return -1;
+    }
+
+    return 0;
+}
+
+#ifdef CONFIG_ZSTD
+static ssize_t multifd_zstd_compress(MultiFDCompressor *c,
+                                     const struct iovec *iov,
+                                     unsigned int niov, uint8_t *out,
+                                     size_t out_len, Error **errp)
+{
+    ZSTD_outBuffer zout = { out, out_len, 0 };
+    unsigned int i;
+    size_t ret;
+
+    for (i = 0; i < niov; i++) {
+        ZSTD_EndDirective mode = i == niov - 1 ? ZSTD_e_flush
+                                               : ZSTD_e_continue;
+        ZSTD_inBuffer zin = { iov[i].iov_base, iov[i].iov_len, 0 };
+
+        /* With ZSTD_e_flush, a non-zero return means data is left over */
+        do {
+            ret = ZSTD_compressStream2(c->zcs, &zout, &zin, mode);
+        } while (!ZSTD_isError(ret) && zout.pos < zout.size &&
+                 (zin.pos < zin.size || (mode == ZSTD_e_flush && ret)));
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd: zstd compression failed: %s",
+                       ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (zin.pos < zin.size || (mode == ZSTD_e_flush && ret)) {
+            error_setg(errp, "multifd: zstd output buffer too small");
+            return -1;
+        }
+    }
+
+    return zout.pos;
+}
+
+static int multifd_zstd_decompress(MultiFDCompressor *c, const uint8_t *in,
+                                   size_t in_len, const struct iovec *iov,
+                                   unsigned int niov, Error **errp)
+{
+    ZSTD_inBuffer zin = { in, in_len, 0 };
+    unsigned int i;
+    size_t ret;
+
+    for (i = 0; i < niov; i++) {
+        ZSTD_outBuffer zout = { iov[i].iov_base, iov[i].iov_len, 0 };
+
+        do {
+            ret = ZSTD_decompressStream(c->zds, &zout, &zin);
+        } while (!ZSTD_isError(ret) && zout.pos < zout.size &&
+                 zin.pos < zin.size);
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd: zstd decompression failed: %s",
+                       ZSTD_getErrorName(ret));
+            return -1;
+        }
+        if (zout.pos < zout.size) {
+            error_setg(errp, "multifd: zstd packet is truncated");
+            return -1;
+        }
+    }
+
+    /* Consume what is left of the flushed block, if anything */
+    while (zin.pos < zin.size) {
+        ZSTD_outBuffer zout = { NULL, 0, 0 };
+        size_t pos = zin.pos;
+
+        ret = ZSTD_decompressStream(c->zds, &zout, &zin);
+        if (ZSTD_isError(ret) || zin.pos == pos) {
+            break;
+        }
+    }
+    if (zin.pos < zin.size) {
+        error_setg(errp, "multifd: %zu bytes left after zstd decompression",
+                   zin.size - zin.pos);
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+ssize_t multifd_compress(MultiFDCompressor *c, const struct iovec *iov,
+                         unsigned int niov, uint8_t *out, size_t out_len,
+                         Error **errp)
+{
+    assert(c->compress);
+
+    switch (c->method) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        return multifd_zlib_compress(c, iov, niov, out, out_len, errp);
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        return multifd_zstd_compress(c, iov, niov, out, out_len, errp);
+#endif
+    default:
+        g_assert_not_reached();
+    }
+}
+
+int multifd_decompress(MultiFDCompressor *c, const uint8_t *in,
+                       size_t in_len, const struct iovec *iov,
+                       unsigned int niov, Error **errp)
+{
+    assert(!c->compress);
+
+    switch (c->method) {
+    case MULTIFD_COMPRESSION_ZLIB:
+        return multifd_zlib_decompress(c, in, in_len, iov, niov, errp);
+#ifdef CONFIG_ZSTD
+    case MULTIFD_COMPRESSION_ZSTD:
+        return multifd_zstd_decompress(c, in, in_len, iov, niov, errp);
+#endif
+    default:
+        g_assert_not_reached();
+    }
+}
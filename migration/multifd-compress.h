@@ -0,0 +1,79 @@
+/*
+ * Streaming compression for the multifd channels
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_MULTIFD_COMPRESS_H
+#define QEMU_MIGRATION_MULTIFD_COMPRESS_H
+
+#include "qapi/qapi-types-migration.h"
+
+typedef struct MultiFDCompressor MultiFDCompressor;
+
+/**
+ * multifd_compressor_new:
+ * @method: compression method, not MULTIFD_COMPRESSION_NONE
+ * @compress: true for the sending side, false for the receiving side
+ * @level: compression level, only used when @compress is true
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Create the compression or decompression stream of one channel.  The
+ * stream is kept from one packet to the next, so that the data already
+ * sent on the channel serves as dictionary for the next packets.
+ *
+ * Returns: the new stream, or NULL on error
+ */
+MultiFDCompressor *multifd_compressor_new(MultiFDCompression method,
+                                          bool compress, int level,
+                                          Error **errp);
+
+void multifd_compressor_free(MultiFDCompressor *c);
+
+/**
+ * multifd_compress_bound:
+ * @method: compression method
+ * @len: number of bytes given to one multifd_compress() call
+ *
+ * Returns: the size of an output buffer that is large enough for
+ * multifd_compress()
+ */
+size_t multifd_compress_bound(MultiFDCompression method, size_t len);
+
+/**
+ * multifd_compress:
+ * @c: a stream created with @compress set to true
+ * @iov: the data to compress
+ * @niov: number of elements of @iov
+ * @out: output buffer
+ * @out_len: size of @out
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Compress the data and flush the stream, so that the output can be
+ * decompressed without waiting for the next call.
+ *
+ * Returns: the number of bytes written to @out, or -1 on error
+ */
+ssize_t multifd_compress(MultiFDCompressor *c, const struct iovec *iov,
+                         unsigned int niov, uint8_t *out, size_t out_len,
+                         Error **errp);
+
+/**
+ * multifd_decompress:
+ * @c: a stream created with @compress set to false
+ * @in: the output of one multifd_compress() call on the other side
+ * @in_len: size of @in
+ * @iov: where to put the decompressed data
+ * @niov: number of elements of @iov
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * The data must fill @iov exactly.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int multifd_decompress(MultiFDCompressor *c, const uint8_t *in,
+                       size_t in_len, const struct iovec *iov,
+                       unsigned int niov, Error **errp);
+
+#endif
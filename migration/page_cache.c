@@ -1,6 +1,7 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is set-associative: a hash of the page address selects a set
+ * of CACHE_WAYS entries, any of which can hold the page.
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -31,11 +32,15 @@
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/* number of entries that can hold a given page */
+#define CACHE_WAYS 8
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
     uint64_t it_addr;
     uint64_t it_age;
+    uint64_t it_hits;
     uint8_t *it_data;
 };
 
@@ -44,6 +49,9 @@ struct PageCache {
     size_t page_size;
     size_t max_num_items;
     size_t num_items;
+    size_t num_ways;
+    size_t num_sets;
+    unsigned int set_bits;
 };
 
 PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
@@ -75,8 +83,12 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     cache->page_size = page_size;
     cache->num_items = 0;
     cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
+    cache->set_bits = ctz64(cache->num_sets);
 
-    DPRINTF("Setting cache buckets to %" PRId64 "\n", cache->max_num_items);
+    DPRINTF("Setting cache buckets to %zu sets of %zu\n",
+            cache->num_sets, cache->num_ways);
 
     /* We prefer not to abort if there is no memory */
     cache->page_cache = g_try_malloc((cache->max_num_items) *
@@ -91,6 +103,7 @@ PageCache *cache_init(int64_t new_size, size_t page_size, Error **errp)
     for (i = 0; i < cache->max_num_items; i++) {
         cache->page_cache[i].it_data = NULL;
         cache->page_cache[i].it_age = 0;
+        cache->page_cache[i].it_hits = 0;
         cache->page_cache[i].it_addr = -1;
     }
 
@@ -113,28 +126,45 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
-{
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
-}
-
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+/*
+ * Consecutive pages go to consecutive sets.  The higher bits of the page
+ * number are folded in so that RAMBlocks starting at large power-of-two
+ * offsets do not all compete for the same sets.
+ */
+static CacheItem *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
+    uint64_t page = address / cache->page_size;
+    size_t set;
 
     g_assert(cache);
     g_assert(cache->page_cache);
 
-    pos = cache_get_cache_pos(cache, addr);
+    if (cache->set_bits) {
+        page ^= page >> cache->set_bits;
+    }
+    set = page & (cache->num_sets - 1);
 
-    return &cache->page_cache[pos];
+    return &cache->page_cache[set * cache->num_ways];
+}
+
+static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set[i].it_addr == addr) {
+            return &set[i];
+        }
+    }
+    return NULL;
 }
 
 uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    CacheItem *it = cache_get_by_addr(cache, addr);
+
+    return it ? it->it_data : NULL;
 }
 
 bool cache_is_cached(const PageCache *cache, uint64_t addr,
@@ -144,14 +174,40 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
 
     it = cache_get_by_addr(cache, addr);
 
-    if (it->it_addr == addr) {
+    if (it) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
+        it->it_hits++;
         return true;
     }
     return false;
 }
 
+/*
+ * Pick the entry of the set that receives @addr: a free one if any,
+ * otherwise the least recently used one, preferring the entry with the
+ * fewest hits among equally old ones.
+ */
+static CacheItem *cache_get_victim(const PageCache *cache, uint64_t addr)
+{
+    CacheItem *set = cache_get_set(cache, addr);
+    CacheItem *victim = &set[0];
+    size_t i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        CacheItem *it = &set[i];
+
+        if (!it->it_data) {
+            return it;
+        }
+        if (it->it_age < victim->it_age ||
+            (it->it_age == victim->it_age && it->it_hits < victim->it_hits)) {
+            victim = it;
+        }
+    }
+    return victim;
+}
+
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age)
 {
@@ -160,11 +216,15 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
 
     /* actual update of entry */
     it = cache_get_by_addr(cache, addr);
+    if (!it) {
+        it = cache_get_victim(cache, addr);
 
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+        if (it->it_data &&
+            it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* the cache page is fresh, don't replace it */
+            return -1;
+        }
+        it->it_hits = 0;
     }
     /* allocate page */
     if (!it->it_data) {
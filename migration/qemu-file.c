@@ -612,6 +612,15 @@ void qemu_file_reset_rate_limit(QEMUFile *f)
     f->bytes_xfer = 0;
 }
 
+/*
+ * Count bytes that were sent to the destination without going through
+ * this QEMUFile, e.g. on the multifd channels, against its rate limit.
+ */
+void qemu_file_update_transfer(QEMUFile *f, int64_t len)
+{
+    f->bytes_xfer += len;
+}
+
 void qemu_put_be16(QEMUFile *f, unsigned int v)
 {
     qemu_put_byte(f, v >> 8);
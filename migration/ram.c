@@ -51,6 +51,8 @@
 #include "qemu/rcu_queue.h"
 #include "migration/colo.h"
 #include "migration/block.h"
+#include "socket.h"
+#include "multifd-compress.h"
 
 /***********************************************************/
 /* ram save/restore */
@@ -219,12 +221,39 @@ struct RAMState {
     uint64_t num_dirty_pages_period;
     /* xbzrle misses since the beginning of the period */
     uint64_t xbzrle_cache_miss_prev;
+    /* xbzrle hits since the beginning of the period */
+    uint64_t xbzrle_cache_hit_prev;
+    /* xbzrle pages and bytes sent since the beginning of the period */
+    uint64_t xbzrle_pages_prev;
+    uint64_t xbzrle_bytes_prev;
     /* number of iterations at the beginning of period */
     uint64_t iterations_prev;
     /* Iterations since start */
     uint64_t iterations;
     /* number of dirty bits in the bitmap */
     uint64_t migration_dirty_pages;
+    /* these variables are used for the chunked bitmap sync */
+    /* a sync pass has started and not reached the last block */
+    bool bitmap_sync_active;
+    /* next block and offset in it to sync */
+    RAMBlock *bitmap_sync_block;
+    ram_addr_t bitmap_sync_offset;
+    /* ram version that bitmap_sync_block belongs to */
+    uint32_t bitmap_sync_version;
+    /* pages in all blocks at the start of the pass */
+    uint64_t bitmap_sync_total_pages;
+    /* pages scanned, and new dirty bits found, since the start of the pass */
+    uint64_t bitmap_sync_pages;
+    uint64_t bitmap_sync_new_dirty;
+    uint64_t bitmap_sync_real_dirty;
+    /* new dirty bits found by the last complete pass */
+    uint64_t bitmap_sync_prev_new_dirty;
+    /* start of this pass and of the previous one, in ns */
+    int64_t bitmap_sync_start_time;
+    int64_t bitmap_sync_prev_start_time;
+    /* time spent in the chunks of this pass and in the longest one, in ns */
+    int64_t bitmap_sync_time;
+    int64_t bitmap_sync_max_chunk_time;
     /* protects modification of the bitmap */
     QemuMutex bitmap_mutex;
     /* The RAMBlock used in the last src_page_requests */
@@ -394,31 +423,160 @@ static void compress_threads_save_setup(void)
 
 /* Multiple fd's */
 
+#define MULTIFD_MAGIC 0x11223344U
+#define MULTIFD_VERSION 1
+
+/* The sender waits for the receiver to catch up after this packet */
+#define MULTIFD_FLAG_SYNC (1 << 0)
+
+/* Compression of the pages, as a MultiFDCompression value */
+#define MULTIFD_FLAG_COMPRESSION_SHIFT 1
+#define MULTIFD_FLAG_COMPRESSION_MASK (3 << MULTIFD_FLAG_COMPRESSION_SHIFT)
+
+/* Largest packet accepted, in pages; matches x-multifd-page-count */
+#define MULTIFD_MAX_PAGES 10000
+
+/* Sent once on each channel, right after it is connected */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t id;
+    uint8_t unused1[7];     /* Reserved for future use */
+    uint64_t unused2[4];    /* Reserved for future use */
+} QEMU_PACKED MultiFDInit_t;
+
+/*
+ * Header of each packet.  It is followed by @used big endian offsets
+ * into @ramblock, then by @data_size bytes holding the @used pages,
+ * compressed or not depending on @flags.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t used;
+    uint32_t data_size;
+    uint32_t unused;        /* Reserved for future use */
+    uint64_t packet_num;
+    char ramblock[256];
+} QEMU_PACKED MultiFDPacket_t;
+
+typedef struct {
+    /* number of used pages */
+    uint32_t used;
+    /* number of allocated pages */
+    uint32_t allocated;
+    /* all pages belong to this block */
+    RAMBlock *block;
+    /* offset of each page inside @block */
+    uint64_t *offset;
+    /* pointer to each page */
+    struct iovec *iov;
+} MultiFDPages_t;
+
 struct MultiFDSendParams {
+    /* these fields are not changed once the thread is created */
     uint8_t id;
     char *name;
     QemuThread thread;
+    QIOChannel *c;
+    /* header and offsets of the packet being sent */
+    MultiFDPacket_t packet;
+    uint64_t *offset;
+    /* packet header, offsets and pages, for a single writev */
+    struct iovec *iov;
+    /* compression stream of the channel, NULL if pages are sent as is */
+    MultiFDCompressor *comp;
+    uint8_t *zbuf;
+    size_t zbuf_len;
+    /* the main thread posts it when it has a job for the thread */
     QemuSemaphore sem;
+    /* protects the fields below */
     QemuMutex mutex;
+    /* the thread has been created */
+    bool running;
+    /* the channel has been set up and can take jobs */
+    bool ready;
+    /* should this thread finish */
     bool quit;
+    /* a batch of pages has been handed to the thread and not sent yet */
+    bool pending_job;
+    /* the main thread asked for a sync packet */
+    bool pending_sync;
+    /* pages to send; owned by the thread while @pending_job is set */
+    MultiFDPages_t *pages;
+    uint64_t packet_num;
+    /* bytes written and not yet added to ram_counters.transferred */
+    uint64_t bytes_sent;
+    uint64_t num_packets;
+    uint64_t num_pages;
 };
 typedef struct MultiFDSendParams MultiFDSendParams;
 
 struct {
     MultiFDSendParams *params;
-    /* number of created threads */
-    int count;
+    /* pages queued by the migration thread for the next packet */
+    MultiFDPages_t *pages;
+    /* posted once for each channel that becomes ready for a job */
+    QemuSemaphore channels_ready;
+    /* posted by each channel once it has sent its sync packet */
+    QemuSemaphore sem_sync;
+    /* global number of generated packets */
+    uint64_t packet_num;
 } *multifd_send_state;
 
-static void terminate_multifd_send_threads(Error *errp)
+static MultiFDPages_t *multifd_pages_init(uint32_t size)
+{
+    MultiFDPages_t *pages = g_new0(MultiFDPages_t, 1);
+
+    pages->allocated = size;
+    pages->offset = g_new0(uint64_t, size);
+    pages->iov = g_new0(struct iovec, size);
+
+    return pages;
+}
+
+static void multifd_pages_clear(MultiFDPages_t *pages)
+{
+    g_free(pages->offset);
+    g_free(pages->iov);
+    g_free(pages);
+}
+
+/*
+ * Stop using channel @p after an error.  The migration is marked as
+ * failed, and the migration thread is woken up in case it waits for
+ * this channel.
+ */
+static void multifd_send_set_error(MultiFDSendParams *p, Error *err)
+{
+    MigrationState *s = migrate_get_current();
+
+    error_prepend(&err, "multifd channel %d: ", p->id);
+    migrate_set_error(s, err);
+    qemu_file_set_error(s->to_dst_file, -EIO);
+    error_free(err);
+
+    qemu_mutex_lock(&p->mutex);
+    p->quit = true;
+    qemu_mutex_unlock(&p->mutex);
+
+    qemu_sem_post(&multifd_send_state->channels_ready);
+    qemu_sem_post(&multifd_send_state->sem_sync);
+}
+
+static void multifd_send_terminate_threads(void)
 {
     int i;
 
-    for (i = 0; i < multifd_send_state->count; i++) {
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
+        if (p->c) {
+            qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        }
         qemu_sem_post(&p->sem);
         qemu_mutex_unlock(&p->mutex);
     }
@@ -429,55 +587,421 @@ int multifd_save_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_send_state) {
         return 0;
     }
-    terminate_multifd_send_threads(NULL);
-    for (i = 0; i < multifd_send_state->count; i++) {
+    multifd_send_terminate_threads();
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
-        qemu_thread_join(&p->thread);
+        if (p->running) {
+            qemu_thread_join(&p->thread);
+        }
+        if (p->c) {
+            object_unref(OBJECT(p->c));
+            p->c = NULL;
+        }
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
         g_free(p->name);
         p->name = NULL;
+        multifd_pages_clear(p->pages);
+        p->pages = NULL;
+        g_free(p->offset);
+        p->offset = NULL;
+        g_free(p->iov);
+        p->iov = NULL;
+        multifd_compressor_free(p->comp);
+        p->comp = NULL;
+        g_free(p->zbuf);
+        p->zbuf = NULL;
     }
+    qemu_sem_destroy(&multifd_send_state->channels_ready);
+    qemu_sem_destroy(&multifd_send_state->sem_sync);
     g_free(multifd_send_state->params);
     multifd_send_state->params = NULL;
+    multifd_pages_clear(multifd_send_state->pages);
+    multifd_send_state->pages = NULL;
     g_free(multifd_send_state);
     multifd_send_state = NULL;
     return ret;
 }
 
+/*
+ * Add what a channel sent since the last call to the migration counters
+ * and to the main stream, so that the bandwidth estimate and the rate
+ * limit see the pages that went over the channels.  Called with
+ * p->mutex held, from the migration thread.
+ */
+static void multifd_account_sent(MultiFDSendParams *p)
+{
+    QEMUFile *f = ram_state->f;
+
+    ram_counters.transferred += p->bytes_sent;
+    qemu_update_position(f, p->bytes_sent);
+    qemu_file_update_transfer(f, p->bytes_sent);
+    p->bytes_sent = 0;
+}
+
+/**
+ * multifd_send_pages: hand the queued pages to an idle channel
+ *
+ * Waits for a channel to become idle if they are all busy.
+ *
+ * Returns 1 on success, -1 if no usable channel is left.
+ */
+static int multifd_send_pages(void)
+{
+    static int next_channel;
+    int n = migrate_multifd_channels();
+    MultiFDSendParams *p = NULL;
+    MultiFDPages_t *pages = multifd_send_state->pages;
+    int i;
+
+    qemu_sem_wait(&multifd_send_state->channels_ready);
+    for (i = 0; i < n; i++) {
+        p = &multifd_send_state->params[(next_channel + i) % n];
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->ready && !p->quit && !p->pending_job) {
+            break;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+    if (i == n) {
+        /* Only channels that failed posted channels_ready */
+        return -1;
+    }
+    next_channel = (next_channel + i + 1) % n;
+
+    /* The size of compressed packets is only known once they are sent */
+    multifd_account_sent(p);
+    p->pending_job = true;
+    p->packet_num = multifd_send_state->packet_num++;
+    multifd_send_state->pages = p->pages;
+    p->pages = pages;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&p->sem);
+
+    return 1;
+}
+
+/**
+ * multifd_queue_page: add a page to the next multifd packet
+ *
+ * The packet is handed to a channel once it is full, or when the
+ * next page belongs to another RAMBlock.
+ *
+ * Returns 1 on success, -1 on error.
+ */
+static int multifd_queue_page(RAMBlock *block, ram_addr_t offset)
+{
+    MultiFDPages_t *pages = multifd_send_state->pages;
+
+    if (!pages->block) {
+        pages->block = block;
+    }
+
+    if (pages->block == block) {
+        pages->offset[pages->used] = offset;
+        pages->iov[pages->used].iov_base = block->host + offset;
+        pages->iov[pages->used].iov_len = TARGET_PAGE_SIZE;
+        pages->used++;
+
+        if (pages->used < pages->allocated) {
+            return 1;
+        }
+        return multifd_send_pages();
+    }
+
+    if (multifd_send_pages() < 0) {
+        return -1;
+    }
+    return multifd_queue_page(block, offset);
+}
+
+/**
+ * multifd_send_sync_main: wait until every queued page has been sent
+ *
+ * Flushes the pending packet, then has each channel send a sync packet
+ * and waits for all of them.  The destination does the matching
+ * multifd_recv_sync_main() when it sees the next RAM_SAVE_FLAG_EOS, so
+ * that pages sent afterwards, on any channel, cannot be overtaken by
+ * older copies.
+ */
+static void multifd_send_sync_main(void)
+{
+    int i;
+
+    if (!migrate_use_multifd()) {
+        return;
+    }
+    if (multifd_send_state->pages->used) {
+        if (multifd_send_pages() < 0) {
+            return;
+        }
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        trace_multifd_send_sync_main_signal(p->id);
+
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            qemu_mutex_unlock(&p->mutex);
+            return;
+        }
+        p->pending_sync = true;
+        qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        qemu_sem_wait(&multifd_send_state->sem_sync);
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        multifd_account_sent(p);
+        qemu_mutex_unlock(&p->mutex);
+    }
+    trace_multifd_send_sync_main(multifd_send_state->packet_num);
+}
+
+static int multifd_send_initial_packet(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDInit_t msg = {};
+
+    msg.magic = cpu_to_be32(MULTIFD_MAGIC);
+    msg.version = cpu_to_be32(MULTIFD_VERSION);
+    msg.id = p->id;
+
+    return qio_channel_write_all(p->c, (char *)&msg, sizeof(msg), errp);
+}
+
+/*
+ * Send the header, offsets and pages of a packet; called without lock.
+ * Returns the number of bytes written, or -1 on error.
+ */
+static ssize_t multifd_send_packet(MultiFDSendParams *p, uint32_t flags,
+                                   uint64_t packet_num, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    MultiFDPacket_t *packet = &p->packet;
+    size_t data_size = (size_t)pages->used * TARGET_PAGE_SIZE;
+    unsigned int niov = pages->used + 2;
+    uint32_t i;
+
+    if (p->comp) {
+        flags |= migrate_multifd_compression() <<
+                 MULTIFD_FLAG_COMPRESSION_SHIFT;
+    }
+    if (p->comp && pages->used) {
+        ssize_t len = multifd_compress(p->comp, pages->iov, pages->used,
+                                       p->zbuf, p->zbuf_len, errp);
+        if (len < 0) {
+            return -1;
+        }
+        data_size = len;
+        p->iov[2].iov_base = p->zbuf;
+        p->iov[2].iov_len = len;
+        niov = 3;
+    } else {
+        memcpy(&p->iov[2], pages->iov, pages->used * sizeof(struct iovec));
+    }
+
+    memset(packet, 0, sizeof(*packet));
+    packet->magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet->version = cpu_to_be32(MULTIFD_VERSION);
+    packet->flags = cpu_to_be32(flags);
+    packet->used = cpu_to_be32(pages->used);
+    packet->data_size = cpu_to_be32(data_size);
+    packet->packet_num = cpu_to_be64(packet_num);
+    if (pages->block) {
+        strncpy(packet->ramblock, pages->block->idstr,
+                sizeof(packet->ramblock));
+    }
+
+    p->iov[0].iov_base = packet;
+    p->iov[0].iov_len = sizeof(*packet);
+    for (i = 0; i < pages->used; i++) {
+        p->offset[i] = cpu_to_be64(pages->offset[i]);
+    }
+    p->iov[1].iov_base = p->offset;
+    p->iov[1].iov_len = pages->used * sizeof(uint64_t);
+
+    trace_multifd_send(p->id, packet_num, pages->used, data_size, flags);
+
+    if (qio_channel_writev_all(p->c, p->iov, niov, errp) < 0) {
+        return -1;
+    }
+    return sizeof(*packet) + p->iov[1].iov_len + data_size;
+}
+
+/* Create the compression stream of a channel, if one is needed */
+static int multifd_send_compress_setup(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDCompression method = migrate_multifd_compression();
+    int level;
+
+    switch (method) {
+    case MULTIFD_COMPRESSION_NONE:
+        return 0;
+    case MULTIFD_COMPRESSION_ZSTD:
+        level = migrate_multifd_zstd_level();
+        break;
+    default:
+        level = migrate_multifd_zlib_level();
+        break;
+    }
+
+    p->comp = multifd_compressor_new(method, true, level, errp);
+    if (!p->comp) {
+        return -1;
+    }
+    p->zbuf_len = multifd_compress_bound(method, (size_t)p->pages->allocated *
+                                                 TARGET_PAGE_SIZE);
+    p->zbuf = g_malloc(p->zbuf_len);
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
+    Error *local_err = NULL;
+
+    trace_multifd_send_thread_start(p->id);
+
+    if (multifd_send_compress_setup(p, &local_err) < 0) {
+        goto out;
+    }
+    if (multifd_send_initial_packet(p, &local_err) < 0) {
+        goto out;
+    }
+
+    qemu_mutex_lock(&p->mutex);
+    p->ready = true;
+    qemu_mutex_unlock(&p->mutex);
+    qemu_sem_post(&multifd_send_state->channels_ready);
 
     while (true) {
+        qemu_sem_wait(&p->sem);
         qemu_mutex_lock(&p->mutex);
+
         if (p->quit) {
             qemu_mutex_unlock(&p->mutex);
             break;
+        } else if (p->pending_job) {
+            uint64_t packet_num = p->packet_num;
+            uint32_t used = p->pages->used;
+            ssize_t size;
+
+            qemu_mutex_unlock(&p->mutex);
+
+            size = multifd_send_packet(p, 0, packet_num, &local_err);
+            if (size < 0) {
+                break;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->bytes_sent += size;
+            p->num_packets++;
+            p->num_pages += used;
+            p->pages->used = 0;
+            p->pages->block = NULL;
+            p->pending_job = false;
+            qemu_mutex_unlock(&p->mutex);
+
+            qemu_sem_post(&multifd_send_state->channels_ready);
+        } else if (p->pending_sync) {
+            ssize_t size;
+
+            qemu_mutex_unlock(&p->mutex);
+
+            /* p->pages is empty while no job is pending */
+            size = multifd_send_packet(p, MULTIFD_FLAG_SYNC, 0, &local_err);
+            if (size < 0) {
+                break;
+            }
+
+            qemu_mutex_lock(&p->mutex);
+            p->bytes_sent += size;
+            p->num_packets++;
+            p->pending_sync = false;
+            qemu_mutex_unlock(&p->mutex);
+
+            qemu_sem_post(&multifd_send_state->sem_sync);
+        } else {
+            qemu_mutex_unlock(&p->mutex);
+            /* sometimes there are spurious wakeups */
         }
-        qemu_mutex_unlock(&p->mutex);
-        qemu_sem_wait(&p->sem);
     }
 
+out:
+    if (local_err) {
+        multifd_send_set_error(p, local_err);
+    }
+
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+
     return NULL;
 }
 
+static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
+{
+    int id = GPOINTER_TO_INT(opaque);
+    QIOChannel *sioc = QIO_CHANNEL(qio_task_get_source(task));
+    MultiFDSendParams *p;
+    Error *local_err = NULL;
+
+    if (!multifd_send_state) {
+        /* The migration was cleaned up before the channel connected */
+        object_unref(OBJECT(sioc));
+        return;
+    }
+    p = &multifd_send_state->params[id];
+
+    trace_multifd_new_send_channel_async(p->id);
+
+    if (qio_task_propagate_error(task, &local_err)) {
+        object_unref(OBJECT(sioc));
+        multifd_send_set_error(p, local_err);
+        return;
+    }
+
+    qio_channel_set_name(sioc, "multifd-send");
+    p->c = sioc;
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
+                       QEMU_THREAD_JOINABLE);
+}
+
 int multifd_save_setup(void)
 {
+    MigrationState *s = migrate_get_current();
     int thread_count;
+    uint32_t page_count = migrate_multifd_page_count();
     uint8_t i;
 
     if (!migrate_use_multifd()) {
         return 0;
     }
+    if (s->parameters.tls_creds && *s->parameters.tls_creds) {
+        error_report("multifd is not supported with TLS");
+        return -1;
+    }
+    if (!socket_send_channel_supported()) {
+        error_report("multifd requires a tcp or unix migration URI");
+        return -1;
+    }
+
     thread_count = migrate_multifd_channels();
     multifd_send_state = g_malloc0(sizeof(*multifd_send_state));
     multifd_send_state->params = g_new0(MultiFDSendParams, thread_count);
-    multifd_send_state->count = 0;
+    multifd_send_state->pages = multifd_pages_init(page_count);
+    qemu_sem_init(&multifd_send_state->channels_ready, 0);
+    qemu_sem_init(&multifd_send_state->sem_sync, 0);
+
     for (i = 0; i < thread_count; i++) {
         MultiFDSendParams *p = &multifd_send_state->params[i];
 
@@ -485,22 +1009,41 @@ int multifd_save_setup(void)
         qemu_sem_init(&p->sem, 0);
         p->quit = false;
         p->id = i;
+        p->pages = multifd_pages_init(page_count);
+        p->offset = g_new0(uint64_t, page_count);
+        p->iov = g_new0(struct iovec, page_count + 2);
         p->name = g_strdup_printf("multifdsend_%d", i);
-        qemu_thread_create(&p->thread, p->name, multifd_send_thread, p,
-                           QEMU_THREAD_JOINABLE);
-
-        multifd_send_state->count++;
+        socket_send_channel_create(multifd_new_send_channel_async,
+                                   GINT_TO_POINTER(i));
     }
     return 0;
 }
 
 struct MultiFDRecvParams {
+    /* these fields are not changed once the thread is created */
     uint8_t id;
     char *name;
     QemuThread thread;
-    QemuSemaphore sem;
+    QIOChannel *c;
+    /* packet being received */
+    MultiFDPacket_t packet;
+    uint32_t allocated;
+    uint64_t *offset;
+    struct iovec *iov;
+    /* decompression stream of the channel, NULL if pages come as is */
+    MultiFDCompressor *comp;
+    uint8_t *zbuf;
+    size_t zbuf_len;
+    /* the main thread posts it to let the channel go on after a sync */
+    QemuSemaphore sem_sync;
+    /* protects the fields below */
     QemuMutex mutex;
+    /* the thread has been created */
+    bool running;
+    /* should this thread finish */
     bool quit;
+    uint64_t num_packets;
+    uint64_t num_pages;
 };
 typedef struct MultiFDRecvParams MultiFDRecvParams;
 
@@ -508,19 +1051,27 @@ struct {
     MultiFDRecvParams *params;
     /* number of created threads */
     int count;
+    /* posted by each channel when it reaches a sync packet */
+    QemuSemaphore sem_sync;
+    /* set when a channel failed */
+    bool failed;
 } *multifd_recv_state;
 
-static void terminate_multifd_recv_threads(Error *errp)
+static void multifd_recv_terminate_threads(void)
 {
     int i;
 
-    for (i = 0; i < multifd_recv_state->count; i++) {
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
         qemu_mutex_lock(&p->mutex);
         p->quit = true;
-        qemu_sem_post(&p->sem);
+        if (p->c) {
+            /* Unblock the thread if it waits for data */
+            qio_channel_shutdown(p->c, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+        }
         qemu_mutex_unlock(&p->mutex);
+        qemu_sem_post(&p->sem_sync);
     }
 }
 
@@ -529,19 +1080,38 @@ int multifd_load_cleanup(Error **errp)
     int i;
     int ret = 0;
 
-    if (!migrate_use_multifd()) {
+    if (!migrate_use_multifd() || !multifd_recv_state) {
         return 0;
     }
-    terminate_multifd_recv_threads(NULL);
-    for (i = 0; i < multifd_recv_state->count; i++) {
+    multifd_recv_terminate_threads();
+    for (i = 0; i < migrate_multifd_channels(); i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
-        qemu_thread_join(&p->thread);
+        if (p->running) {
+            qemu_thread_join(&p->thread);
+        }
+        if (p->c) {
+            object_unref(OBJECT(p->c));
+            p->c = NULL;
+        }
         qemu_mutex_destroy(&p->mutex);
-        qemu_sem_destroy(&p->sem);
+        qemu_sem_destroy(&p->sem_sync);
         g_free(p->name);
         p->name = NULL;
+        g_free(p->offset);
+        p->offset = NULL;
+        g_free(p->iov);
+        p->iov = NULL;
+        multifd_compressor_free(p->comp);
+        p->comp = NULL;
+        g_free(p->zbuf);
+        p->zbuf = NULL;
     }
+    if (atomic_read(&multifd_recv_state->failed)) {
+        error_setg(errp, "multifd: a channel failed");
+        ret = -1;
+    }
+    qemu_sem_destroy(&multifd_recv_state->sem_sync);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state);
@@ -550,20 +1120,246 @@ int multifd_load_cleanup(Error **errp)
     return ret;
 }
 
+/**
+ * multifd_recv_sync_main: wait until every channel reached its sync packet
+ *
+ * Called when the main stream has a RAM_SAVE_FLAG_EOS: all pages the
+ * source queued before it are then in guest memory.  The channels are
+ * let go on afterwards.
+ *
+ * Returns 0 on success, -1 if a channel failed.
+ */
+static int multifd_recv_sync_main(void)
+{
+    int i;
+
+    if (!migrate_use_multifd()) {
+        return 0;
+    }
+    if (atomic_read(&multifd_recv_state->count) <
+        migrate_multifd_channels()) {
+        error_report("multifd: not all channels are connected");
+        return -1;
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        trace_multifd_recv_sync_main_wait(i);
+        qemu_sem_wait(&multifd_recv_state->sem_sync);
+    }
+    if (atomic_read(&multifd_recv_state->failed)) {
+        return -1;
+    }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDRecvParams *p = &multifd_recv_state->params[i];
+
+        trace_multifd_recv_sync_main_signal(p->id);
+        qemu_sem_post(&p->sem_sync);
+    }
+    trace_multifd_recv_sync_main();
+    return 0;
+}
+
+/*
+ * Read the offsets that follow the packet header, and point p->iov at the
+ * guest pages they designate.  Returns the number of pages, or -1.
+ */
+static int multifd_recv_unfill_packet(MultiFDRecvParams *p, uint32_t *flags,
+                                      Error **errp)
+{
+    MultiFDPacket_t *packet = &p->packet;
+    uint32_t magic = be32_to_cpu(packet->magic);
+    uint32_t version = be32_to_cpu(packet->version);
+    uint32_t used = be32_to_cpu(packet->used);
+    uint32_t data_size = be32_to_cpu(packet->data_size);
+    MultiFDCompression method = migrate_multifd_compression();
+    RAMBlock *block;
+    bool invalid;
+    uint32_t i;
+
+    if (magic != MULTIFD_MAGIC) {
+        error_setg(errp, "multifd: received packet magic %x "
+                   "and expected magic %x", magic, MULTIFD_MAGIC);
+        return -1;
+    }
+    if (version != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: received packet version %d "
+                   "and expected version %d", version, MULTIFD_VERSION);
+        return -1;
+    }
+    if (used > MULTIFD_MAX_PAGES) {
+        error_setg(errp, "multifd: received packet with %d pages "
+                   "and maximum is %d", used, MULTIFD_MAX_PAGES);
+        return -1;
+    }
+    *flags = be32_to_cpu(packet->flags);
+    if ((*flags & MULTIFD_FLAG_COMPRESSION_MASK) >>
+        MULTIFD_FLAG_COMPRESSION_SHIFT != method) {
+        error_setg(errp, "multifd: received packet with compression "
+                   "method %d and expected %s",
+                   (*flags & MULTIFD_FLAG_COMPRESSION_MASK) >>
+                   MULTIFD_FLAG_COMPRESSION_SHIFT,
+                   MultiFDCompression_str(method));
+        return -1;
+    }
+    if (method == MULTIFD_COMPRESSION_NONE || !used) {
+        invalid = data_size != used * TARGET_PAGE_SIZE;
+    } else {
+        invalid = data_size > multifd_compress_bound(method,
+                                                     used * TARGET_PAGE_SIZE);
+    }
+    if (invalid) {
+        error_setg(errp, "multifd: received packet with %d pages "
+                   "and invalid data size %d", used, data_size);
+        return -1;
+    }
+    if (!used) {
+        return 0;
+    }
+
+    packet->ramblock[sizeof(packet->ramblock) - 1] = 0;
+    block = qemu_ram_block_by_name(packet->ramblock);
+    if (!block) {
+        error_setg(errp, "multifd: unknown ram block %s", packet->ramblock);
+        return -1;
+    }
+
+    if (used > p->allocated) {
+        p->allocated = used;
+        p->offset = g_renew(uint64_t, p->offset, used);
+        p->iov = g_renew(struct iovec, p->iov, used);
+    }
+    if (qio_channel_read_all(p->c, (char *)p->offset,
+                             used * sizeof(uint64_t), errp) < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < used; i++) {
+        uint64_t offset = be64_to_cpu(p->offset[i]);
+
+        if (offset > block->used_length - TARGET_PAGE_SIZE ||
+            offset & ~TARGET_PAGE_MASK) {
+            error_setg(errp, "multifd: invalid offset 0x%" PRIx64
+                       " in ram block %s", offset, block->idstr);
+            return -1;
+        }
+        p->iov[i].iov_base = block->host + offset;
+        p->iov[i].iov_len = TARGET_PAGE_SIZE;
+        ramblock_recv_bitmap_set(block, p->iov[i].iov_base);
+    }
+
+    return used;
+}
+
+static void multifd_recv_set_error(MultiFDRecvParams *p, Error *err)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    int i;
+
+    error_prepend(&err, "multifd channel %d: ", p->id);
+    error_report_err(err);
+
+    atomic_set(&multifd_recv_state->failed, true);
+    /* Make the main stream fail too, and wake it up if it waits for us */
+    if (mis->from_src_file) {
+        qemu_file_shutdown(mis->from_src_file);
+    }
+    /* The other channels may never reach their sync packet either */
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        qemu_sem_post(&multifd_recv_state->sem_sync);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
+    Error *local_err = NULL;
+    int ret;
+
+    trace_multifd_recv_thread_start(p->id);
+
+    if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE) {
+        p->comp = multifd_compressor_new(migrate_multifd_compression(),
+                                         false, 0, &local_err);
+        if (!p->comp) {
+            goto out;
+        }
+    }
 
     while (true) {
+        uint32_t flags = 0;
+        int used;
+
+        ret = qio_channel_read_all_eof(p->c, (char *)&p->packet,
+                                       sizeof(p->packet), &local_err);
+        if (ret <= 0) {
+            /* EOF is how the source ends the migration */
+            break;
+        }
+
+        used = multifd_recv_unfill_packet(p, &flags, &local_err);
+        if (used < 0) {
+            break;
+        }
+        trace_multifd_recv(p->id, be64_to_cpu(p->packet.packet_num),
+                           used, flags);
+
+        if (used && p->comp) {
+            uint32_t data_size = be32_to_cpu(p->packet.data_size);
+
+            if (data_size > p->zbuf_len) {
+                p->zbuf_len = data_size;
+                p->zbuf = g_realloc(p->zbuf, data_size);
+            }
+            ret = qio_channel_read_all(p->c, (char *)p->zbuf, data_size,
+                                       &local_err);
+            if (ret < 0) {
+                break;
+            }
+            ret = multifd_decompress(p->comp, p->zbuf, data_size, p->iov,
+                                     used, &local_err);
+            if (ret < 0) {
+                break;
+            }
+        } else if (used) {
+            ret = qio_channel_readv_all(p->c, p->iov, used, &local_err);
+            if (ret < 0) {
+                break;
+            }
+        }
+
+        qemu_mutex_lock(&p->mutex);
+        p->num_packets++;
+        p->num_pages += used;
+        qemu_mutex_unlock(&p->mutex);
+
+        if (flags & MULTIFD_FLAG_SYNC) {
+            qemu_sem_post(&multifd_recv_state->sem_sync);
+            qemu_sem_wait(&p->sem_sync);
+        }
+
         qemu_mutex_lock(&p->mutex);
         if (p->quit) {
             qemu_mutex_unlock(&p->mutex);
             break;
         }
         qemu_mutex_unlock(&p->mutex);
-        qemu_sem_wait(&p->sem);
     }
 
+out:
+    if (local_err) {
+        qemu_mutex_lock(&p->mutex);
+        if (p->quit) {
+            /* We shut the channel down ourselves */
+            error_free(local_err);
+            local_err = NULL;
+        }
+        qemu_mutex_unlock(&p->mutex);
+    }
+    if (local_err) {
+        multifd_recv_set_error(p, local_err);
+    }
+
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+
     return NULL;
 }
 
@@ -575,25 +1371,93 @@ int multifd_load_setup(void)
     if (!migrate_use_multifd()) {
         return 0;
     }
+
     thread_count = migrate_multifd_channels();
     multifd_recv_state = g_malloc0(sizeof(*multifd_recv_state));
     multifd_recv_state->params = g_new0(MultiFDRecvParams, thread_count);
-    multifd_recv_state->count = 0;
+    atomic_set(&multifd_recv_state->count, 0);
+    qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+
     for (i = 0; i < thread_count; i++) {
         MultiFDRecvParams *p = &multifd_recv_state->params[i];
 
         qemu_mutex_init(&p->mutex);
-        qemu_sem_init(&p->sem, 0);
+        qemu_sem_init(&p->sem_sync, 0);
         p->quit = false;
         p->id = i;
         p->name = g_strdup_printf("multifdrecv_%d", i);
-        qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
-                           QEMU_THREAD_JOINABLE);
-        multifd_recv_state->count++;
     }
     return 0;
 }
 
+bool multifd_recv_all_channels_created(void)
+{
+    if (!migrate_use_multifd()) {
+        return true;
+    }
+    if (!multifd_recv_state) {
+        /* The main channel has not arrived yet */
+        return false;
+    }
+    return atomic_read(&multifd_recv_state->count) ==
+           migrate_multifd_channels();
+}
+
+/**
+ * multifd_recv_new_channel: start receiving on a new multifd channel
+ *
+ * Reads the initial packet to find out which channel @ioc is.  A
+ * connection that does not look like a multifd channel is dropped.
+ *
+ * Returns true once all channels are connected.
+ */
+bool multifd_recv_new_channel(QIOChannel *ioc)
+{
+    MultiFDRecvParams *p;
+    MultiFDInit_t msg;
+    Error *local_err = NULL;
+
+    if (qio_channel_read_all(ioc, (char *)&msg, sizeof(msg),
+                             &local_err) < 0) {
+        goto err;
+    }
+    if (be32_to_cpu(msg.magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(msg.version) != MULTIFD_VERSION) {
+        error_setg(&local_err, "multifd: bad initial packet, magic %x "
+                   "version %d", be32_to_cpu(msg.magic),
+                   be32_to_cpu(msg.version));
+        goto err;
+    }
+    if (msg.id >= migrate_multifd_channels()) {
+        error_setg(&local_err, "multifd: received channel id %d, "
+                   "but only %d channels are expected", msg.id,
+                   migrate_multifd_channels());
+        goto err;
+    }
+
+    p = &multifd_recv_state->params[msg.id];
+    if (p->c) {
+        error_setg(&local_err, "multifd: channel %d is already set up",
+                   msg.id);
+        goto err;
+    }
+
+    trace_multifd_recv_new_channel(msg.id);
+
+    object_ref(OBJECT(ioc));
+    p->c = ioc;
+    p->running = true;
+    qemu_thread_create(&p->thread, p->name, multifd_recv_thread, p,
+                       QEMU_THREAD_JOINABLE);
+    atomic_inc(&multifd_recv_state->count);
+
+    return multifd_recv_all_channels_created();
+
+err:
+    error_report_err(local_err);
+    return false;
+}
+
 /**
  * save_page_header: write page header to wire
  *
@@ -713,6 +1577,7 @@ static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
         }
         return -1;
     }
+    xbzrle_counters.cache_hit++;
 
     prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
 
@@ -827,11 +1692,27 @@ uint64_t ram_pagesize_summary(void)
     return summary;
 }
 
-static void migration_bitmap_sync(RAMState *rs)
+/*
+ * Pages whose dirty bits are merged into the migration bitmap at once.
+ * The dirty bitmap of a large guest is synced in chunks of this size,
+ * interleaved with sending pages, instead of in one go.
+ */
+#define MIGRATION_BITMAP_SYNC_CHUNK (256 * 1024)
+
+/**
+ * migration_bitmap_sync_start: start a pass of the dirty bitmap sync
+ *
+ * Fetches the dirty log from the accelerator; the dirty bits are then
+ * merged into the migration bitmap by migration_bitmap_sync_step().
+ *
+ * Called with iothread lock
+ *
+ * @rs: current RAM state
+ */
+static void migration_bitmap_sync_start(RAMState *rs)
 {
     RAMBlock *block;
-    int64_t end_time;
-    uint64_t bytes_xfer_now;
+    int64_t start_time;
 
     ram_counters.dirty_sync_count++;
 
@@ -840,16 +1721,176 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 
     trace_migration_bitmap_sync_start();
+    start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     memory_global_dirty_log_sync();
+    ram_counters.dirty_sync_log_time =
+        (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time) / 1000;
 
-    qemu_mutex_lock(&rs->bitmap_mutex);
     rcu_read_lock();
+    rs->bitmap_sync_version = ram_list.version;
+    /* Read version before ram_list.blocks */
+    smp_rmb();
+    rs->bitmap_sync_block = QLIST_FIRST_RCU(&ram_list.blocks);
+    rs->bitmap_sync_total_pages = 0;
     RAMBLOCK_FOREACH(block) {
-        migration_bitmap_sync_range(rs, block, 0, block->used_length);
+        rs->bitmap_sync_total_pages += block->used_length >> TARGET_PAGE_BITS;
+    }
+    rcu_read_unlock();
+
+    rs->bitmap_sync_active = true;
+    rs->bitmap_sync_offset = 0;
+    rs->bitmap_sync_pages = 0;
+    rs->bitmap_sync_new_dirty = 0;
+    rs->bitmap_sync_real_dirty = 0;
+    rs->bitmap_sync_prev_start_time = rs->bitmap_sync_start_time;
+    rs->bitmap_sync_start_time = start_time;
+    rs->bitmap_sync_time = 0;
+    rs->bitmap_sync_max_chunk_time = 0;
+}
+
+/*
+ * Guest dirty rate as seen by the current pass: the dirty bits found so
+ * far cover the time since the previous pass went over the same pages,
+ * extrapolated to all of RAM.  Unlike a per-pass average, it follows
+ * changes of the rate within a long pass.
+ */
+static void migration_bitmap_sync_update_rate(RAMState *rs)
+{
+    int64_t interval;
+
+    interval = rs->bitmap_sync_start_time - rs->bitmap_sync_prev_start_time;
+    if (!rs->bitmap_sync_prev_start_time || interval <= 0 ||
+        !rs->bitmap_sync_pages) {
+        return;
+    }
+
+    ram_counters.dirty_pages_rate =
+        (double)rs->bitmap_sync_real_dirty * rs->bitmap_sync_total_pages /
+        rs->bitmap_sync_pages * NANOSECONDS_PER_SECOND / interval;
+}
+
+/**
+ * migration_bitmap_sync_pending: estimate the rest of the current pass
+ *
+ * Returns the number of new dirty pages that the part of RAM not yet
+ * synced by the current pass is expected to hold, based on what the
+ * chunks synced so far found.
+ *
+ * @rs: current RAM state
+ */
+static uint64_t migration_bitmap_sync_pending(RAMState *rs)
+{
+    uint64_t left;
+
+    if (!rs->bitmap_sync_active) {
+        return 0;
+    }
+    if (!rs->bitmap_sync_pages) {
+        return rs->bitmap_sync_prev_new_dirty;
+    }
+
+    left = rs->bitmap_sync_total_pages -
+           MIN(rs->bitmap_sync_pages, rs->bitmap_sync_total_pages);
+    return rs->bitmap_sync_new_dirty * left / rs->bitmap_sync_pages;
+}
+
+static void migration_bitmap_sync_finish(RAMState *rs);
+
+/*
+ * Whether the chunks of a pass may be merged while a round of pages is
+ * being sent.  Merging a chunk can dirty a page that was already sent in
+ * the same round, so that it is sent twice before RAM_SAVE_FLAG_EOS.  On
+ * the main stream the second copy always lands last.  Multifd channels
+ * and compression threads are only ordered with it at the end of a
+ * round, so the stale copy could land last instead; with them, the pass
+ * is finished before the round starts.
+ */
+static bool migration_bitmap_sync_interleaved(void)
+{
+    return !migrate_use_multifd() && !migrate_use_compression();
+}
+
+/**
+ * migration_bitmap_sync_step: sync the next chunks of the dirty bitmap
+ *
+ * Returns true if the pass is complete, false if there is more to sync
+ *
+ * Does not need the iothread lock
+ *
+ * @rs: current RAM state
+ * @max_pages: stop once this many pages have been synced
+ */
+static bool migration_bitmap_sync_step(RAMState *rs, uint64_t max_pages)
+{
+    uint64_t pages = 0, new_dirty, real_dirty;
+    int64_t start_time, time;
+
+    if (!rs->bitmap_sync_active) {
+        return true;
+    }
+
+    start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    qemu_mutex_lock(&rs->bitmap_mutex);
+    rcu_read_lock();
+
+    if (ram_list.version != rs->bitmap_sync_version) {
+        /* bitmap_sync_block may be gone, start over from the first block */
+        rs->bitmap_sync_version = ram_list.version;
+        smp_rmb();
+        rs->bitmap_sync_block = QLIST_FIRST_RCU(&ram_list.blocks);
+        rs->bitmap_sync_offset = 0;
+    }
+
+    new_dirty = rs->migration_dirty_pages;
+    real_dirty = rs->num_dirty_pages_period;
+    while (rs->bitmap_sync_block && pages < max_pages) {
+        RAMBlock *block = rs->bitmap_sync_block;
+        ram_addr_t length = MIN(block->used_length - rs->bitmap_sync_offset,
+                                (ram_addr_t)MIGRATION_BITMAP_SYNC_CHUNK <<
+                                TARGET_PAGE_BITS);
+
+        migration_bitmap_sync_range(rs, block, rs->bitmap_sync_offset, length);
+        pages += length >> TARGET_PAGE_BITS;
+        rs->bitmap_sync_offset += length;
+        if (rs->bitmap_sync_offset >= block->used_length) {
+            rs->bitmap_sync_block = QLIST_NEXT_RCU(block, next);
+            rs->bitmap_sync_offset = 0;
+        }
     }
+    new_dirty = rs->migration_dirty_pages - new_dirty;
+    real_dirty = rs->num_dirty_pages_period - real_dirty;
+
     rcu_read_unlock();
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
+    time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
+    trace_migration_bitmap_sync_step(pages, new_dirty, time);
+
+    rs->bitmap_sync_pages += pages;
+    rs->bitmap_sync_new_dirty += new_dirty;
+    rs->bitmap_sync_real_dirty += real_dirty;
+    rs->bitmap_sync_time += time;
+    rs->bitmap_sync_max_chunk_time = MAX(rs->bitmap_sync_max_chunk_time, time);
+    migration_bitmap_sync_update_rate(rs);
+
+    if (rs->bitmap_sync_block) {
+        return false;
+    }
+    migration_bitmap_sync_finish(rs);
+    return true;
+}
+
+static void migration_bitmap_sync_finish(RAMState *rs)
+{
+    int64_t end_time;
+    uint64_t bytes_xfer_now;
+
+    rs->bitmap_sync_active = false;
+    rs->bitmap_sync_prev_new_dirty = rs->bitmap_sync_new_dirty;
+    ram_counters.dirty_sync_bitmap_time = rs->bitmap_sync_time / 1000;
+    ram_counters.dirty_sync_chunk_max_time =
+        rs->bitmap_sync_max_chunk_time / 1000;
+
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
@@ -857,8 +1898,6 @@ static void migration_bitmap_sync(RAMState *rs)
     /* more than 1 second = 1000 millisecons */
     if (end_time > rs->time_last_bitmap_sync + 1000) {
         /* calculate period counters */
-        ram_counters.dirty_pages_rate = rs->num_dirty_pages_period * 1000
-            / (end_time - rs->time_last_bitmap_sync);
         bytes_xfer_now = ram_counters.transferred;
 
         /* During block migration the auto-converge logic incorrectly detects
@@ -887,8 +1926,26 @@ static void migration_bitmap_sync(RAMState *rs)
                             rs->xbzrle_cache_miss_prev) /
                    (rs->iterations - rs->iterations_prev);
             }
+            if (xbzrle_counters.cache_miss != rs->xbzrle_cache_miss_prev ||
+                xbzrle_counters.cache_hit != rs->xbzrle_cache_hit_prev) {
+                uint64_t hits = xbzrle_counters.cache_hit -
+                                rs->xbzrle_cache_hit_prev;
+
+                xbzrle_counters.cache_hit_rate = (double)hits /
+                    (hits + xbzrle_counters.cache_miss -
+                     rs->xbzrle_cache_miss_prev);
+            }
+            if (xbzrle_counters.bytes != rs->xbzrle_bytes_prev) {
+                xbzrle_counters.encoding_rate =
+                    (double)(xbzrle_counters.pages - rs->xbzrle_pages_prev) *
+                    TARGET_PAGE_SIZE /
+                    (xbzrle_counters.bytes - rs->xbzrle_bytes_prev);
+            }
             rs->iterations_prev = rs->iterations;
             rs->xbzrle_cache_miss_prev = xbzrle_counters.cache_miss;
+            rs->xbzrle_cache_hit_prev = xbzrle_counters.cache_hit;
+            rs->xbzrle_pages_prev = xbzrle_counters.pages;
+            rs->xbzrle_bytes_prev = xbzrle_counters.bytes;
         }
 
         /* reset period counters */
@@ -901,6 +1958,13 @@ static void migration_bitmap_sync(RAMState *rs)
     }
 }
 
+/* Sync the whole dirty bitmap at once; called with iothread lock */
+static void migration_bitmap_sync(RAMState *rs)
+{
+    migration_bitmap_sync_start(rs);
+    migration_bitmap_sync_step(rs, UINT64_MAX);
+}
+
 /**
  * save_zero_page: send the zero page to the stream
  *
@@ -936,6 +2000,36 @@ static void ram_release_pages(const char *rbname, uint64_t offset, int pages)
     ram_discard_range(rbname, offset, pages << TARGET_PAGE_BITS);
 }
 
+/**
+ * ram_save_multifd_page: queue the given page on the multifd channels
+ *
+ * Zero pages are still sent on the main stream, which is cheaper than
+ * sending their contents.  XBZRLE is not used on this path.
+ *
+ * Returns the number of pages written, or -1 on error.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
+                                 ram_addr_t offset)
+{
+    int pages;
+
+    pages = save_zero_page(rs, block, offset);
+    if (pages > 0) {
+        return pages;
+    }
+
+    if (multifd_queue_page(block, offset) < 0) {
+        return -1;
+    }
+    ram_counters.normal++;
+
+    return 1;
+}
+
 /**
  * ram_save_page: send the given page to the stream
  *
@@ -1454,6 +2548,9 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         if (migrate_use_compression() &&
             (rs->ram_bulk_stage || !migrate_use_xbzrle())) {
             res = ram_save_compressed_page(rs, pss, last_stage);
+        } else if (migrate_use_multifd()) {
+            res = ram_save_multifd_page(rs, pss->block,
+                                        pss->page << TARGET_PAGE_BITS);
         } else {
             res = ram_save_page(rs, pss, last_stage);
         }
@@ -2236,6 +3333,7 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     ram_control_before_iterate(f, RAM_CONTROL_SETUP);
     ram_control_after_iterate(f, RAM_CONTROL_SETUP);
 
+    multifd_send_sync_main();
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
     return 0;
@@ -2275,14 +3373,28 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 
     ram_control_before_iterate(f, RAM_CONTROL_ROUND);
 
+    if (!migration_bitmap_sync_interleaved()) {
+        migration_bitmap_sync_step(rs, UINT64_MAX);
+    }
+
     t0 = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     i = 0;
     while ((ret = qemu_file_rate_limit(f)) == 0) {
         int pages;
 
+        /* Interleave the pending bitmap sync, if any, with the pages */
+        if (migration_bitmap_sync_interleaved()) {
+            migration_bitmap_sync_step(rs, MIGRATION_BITMAP_SYNC_CHUNK);
+        }
+
         pages = ram_find_and_save_block(rs, false);
         /* no more pages to sent */
         if (pages == 0) {
+            if (rs->bitmap_sync_active) {
+                /* nothing else to do, the rest of the sync may find more */
+                migration_bitmap_sync_step(rs, UINT64_MAX);
+                continue;
+            }
             done = 1;
             break;
         }
@@ -2312,6 +3424,7 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     ram_control_after_iterate(f, RAM_CONTROL_ROUND);
 
 out:
+    multifd_send_sync_main();
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     ram_counters.transferred += 8;
 
@@ -2364,6 +3477,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
     rcu_read_unlock();
 
+    multifd_send_sync_main();
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
 
     return 0;
@@ -2381,12 +3495,15 @@ static void ram_save_pending(QEMUFile *f, void *opaque, uint64_t max_size,
 
     if (!migration_in_postcopy() &&
         remaining_size < max_size) {
-        qemu_mutex_lock_iothread();
-        rcu_read_lock();
-        migration_bitmap_sync(rs);
-        rcu_read_unlock();
-        qemu_mutex_unlock_iothread();
-        remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
+        /* The bitmap itself is synced by ram_save_iterate() */
+        if (!rs->bitmap_sync_active) {
+            qemu_mutex_lock_iothread();
+            migration_bitmap_sync_start(rs);
+            qemu_mutex_unlock_iothread();
+        }
+        remaining_size = (rs->migration_dirty_pages +
+                          migration_bitmap_sync_pending(rs)) *
+                         TARGET_PAGE_SIZE;
     }
 
     if (migrate_postcopy_ram()) {
@@ -2978,6 +4095,9 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
             break;
         case RAM_SAVE_FLAG_EOS:
             /* normal exit */
+            if (multifd_recv_sync_main() < 0) {
+                ret = -EIO;
+            }
             break;
         default:
             if (flags & RAM_SAVE_FLAG_HOOK) {
@@ -55,6 +55,28 @@ static SocketAddress *unix_build_address(const char *path)
 }
 
 
+/* Address of the current outgoing migration, for the multifd channels */
+static SocketAddress *outgoing_saddr;
+
+bool socket_send_channel_supported(void)
+{
+    return outgoing_saddr != NULL;
+}
+
+void socket_send_channel_create(QIOTaskFunc f, void *data)
+{
+    QIOChannelSocket *sioc = qio_channel_socket_new();
+
+    qio_channel_socket_connect_async(sioc, outgoing_saddr,
+                                     f, data, NULL, NULL);
+}
+
+void socket_send_channel_cleanup(void)
+{
+    qapi_free_SocketAddress(outgoing_saddr);
+    outgoing_saddr = NULL;
+}
+
 struct SocketConnectData {
     MigrationState *s;
     char *hostname;
@@ -105,7 +127,9 @@ static void socket_start_outgoing_migration(MigrationState *s,
                                      data,
                                      socket_connect_data_free,
                                      NULL);
-    qapi_free_SocketAddress(saddr);
+
+    qapi_free_SocketAddress(outgoing_saddr);
+    outgoing_saddr = saddr;
 }
 
 void tcp_start_outgoing_migration(MigrationState *s,
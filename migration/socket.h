@@ -16,6 +16,14 @@
 
 #ifndef QEMU_MIGRATION_SOCKET_H
 #define QEMU_MIGRATION_SOCKET_H
+
+#include "io/channel.h"
+#include "io/task.h"
+
+bool socket_send_channel_supported(void);
+void socket_send_channel_create(QIOTaskFunc f, void *data);
+void socket_send_channel_cleanup(void);
+
 void tcp_start_incoming_migration(const char *host_port, Error **errp);
 
 void tcp_start_outgoing_migration(MigrationState *s, const char *host_port,
@@ -12,8 +12,231 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
+/*
+ * Run finding
+ *
+ * Each of these functions returns the length of the longest prefix of
+ * @a and @b whose bytes are all equal (@eq true) or all different (@eq
+ * false).  The vector versions compare a whole vector at a time and
+ * leave the tail to xbzrle_run_int.
+ */
+
+static size_t xbzrle_run_int(const uint8_t *a, const uint8_t *b,
+                             size_t len, bool eq)
+{
+    size_t i = 0;
+
+    if (eq) {
+        while (i + 8 <= len && ldq_he_p(a + i) == ldq_he_p(b + i)) {
+            i += 8;
+        }
+    } else {
+        const uint64_t mask = 0x0101010101010101ULL;
+
+        while (i + 8 <= len) {
+            uint64_t xor = ldq_he_p(a + i) ^ ldq_he_p(b + i);
+
+            /* stop at a word that contains an equal byte */
+            if ((xor - mask) & ~xor & (mask << 7)) {
+                break;
+            }
+            i += 8;
+        }
+    }
+
+    while (i < len && (a[i] == b[i]) == eq) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static size_t xbzrle_run_sse2(const uint8_t *a, const uint8_t *b,
+                              size_t len, bool eq)
+{
+    uint32_t flip = eq ? 0xffff : 0;
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        uint32_t m = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ flip;
+
+        if (m) {
+            return i + ctz32(m);
+        }
+    }
+    return i + xbzrle_run_int(a + i, b + i, len - i, eq);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+/* The includes have to be within the corresponding push_options region,
+ * see util/bufferiszero.c.
+ */
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static size_t xbzrle_run_avx2(const uint8_t *a, const uint8_t *b,
+                              size_t len, bool eq)
+{
+    uint32_t flip = eq ? 0xffffffff : 0;
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) ^ flip;
+
+        if (m) {
+            return i + ctz32(m);
+        }
+    }
+    return i + xbzrle_run_int(a + i, b + i, len - i, eq);
+}
+#pragma GCC pop_options
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+static size_t xbzrle_run_avx512bw(const uint8_t *a, const uint8_t *b,
+                                  size_t len, bool eq)
+{
+    uint64_t flip = eq ? -1ULL : 0;
+    size_t i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        uint64_t m = _mm512_cmpeq_epi8_mask(va, vb) ^ flip;
+
+        if (m) {
+            return i + ctz64(m);
+        }
+    }
+    return i + xbzrle_run_int(a + i, b + i, len - i, eq);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512BW  1
+#define CACHE_AVX2      2
+#define CACHE_SSE2      4
+
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL xbzrle_run_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL xbzrle_run_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static size_t (*xbzrle_run)(const uint8_t *, const uint8_t *,
+                            size_t, bool) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    size_t (*fn)(const uint8_t *, const uint8_t *, size_t, bool) =
+        xbzrle_run_int;
+
+    if (cache & CACHE_SSE2) {
+        fn = xbzrle_run_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_run_avx2;
+    }
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_run_avx512bw;
+    }
+#endif
+#endif
+    xbzrle_run = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (d & bit_SSE2) {
+            cache |= CACHE_SSE2;
+        }
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* AVX-512 also needs the opmask and upper ZMM state.  */
+            if ((bv & 0xe6) == 0xe6 &&
+                (b & bit_AVX512F) && (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* If no bits set, we just tested xbzrle_run_int, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#else
+#define xbzrle_run  xbzrle_run_int
+bool test_xbzrle_encode_next_accel(void)
+{
+    return false;
+}
+#endif
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -27,10 +250,9 @@
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
                          uint8_t *dst, int dlen)
 {
-    uint32_t zrun_len = 0, nzrun_len = 0;
+    uint32_t zrun_len, nzrun_len;
     int d = 0, i = 0;
-    long res;
-    uint8_t *nzrun_start = NULL;
+    uint8_t *nzrun_start;
 
     g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
                sizeof(long)));
@@ -41,28 +263,8 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
             return -1;
         }
 
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] == new_buf[i]) {
-            zrun_len++;
-            i++;
-            res--;
-        }
-
-        /* word at a time for speed */
-        if (!res) {
-            while (i < slen &&
-                   (*(long *)(old_buf + i)) == (*(long *)(new_buf + i))) {
-                i += sizeof(long);
-                zrun_len += sizeof(long);
-            }
-
-            /* go over the rest */
-            while (i < slen && old_buf[i] == new_buf[i]) {
-                zrun_len++;
-                i++;
-            }
-        }
+        zrun_len = xbzrle_run(old_buf + i, new_buf + i, slen - i, true);
+        i += zrun_len;
 
         /* buffer unchanged */
         if (zrun_len == slen) {
@@ -76,42 +278,15 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
         d += uleb128_encode_small(dst + d, zrun_len);
 
-        zrun_len = 0;
         nzrun_start = new_buf + i;
 
         /* overflow */
         if (d + 2 > dlen) {
             return -1;
         }
-        /* not aligned to sizeof(long) */
-        res = (slen - i) % sizeof(long);
-        while (res && old_buf[i] != new_buf[i]) {
-            i++;
-            nzrun_len++;
-            res--;
-        }
-
-        /* word at a time for speed, use of 32-bit long okay */
-        if (!res) {
-            /* truncation to 32-bit long okay */
-            unsigned long mask = (unsigned long)0x0101010101010101ULL;
-            while (i < slen) {
-                unsigned long xor;
-                xor = *(unsigned long *)(old_buf + i)
-                    ^ *(unsigned long *)(new_buf + i);
-                if ((xor - mask) & ~xor & (mask << 7)) {
-                    /* found the end of an nzrun within the current long */
-                    while (old_buf[i] != new_buf[i]) {
-                        nzrun_len++;
-                        i++;
-                    }
-                    break;
-                } else {
-                    i += sizeof(long);
-                    nzrun_len += sizeof(long);
-                }
-            }
-        }
+
+        nzrun_len = xbzrle_run(old_buf + i, new_buf + i, slen - i, false);
+        i += nzrun_len;
 
         d += uleb128_encode_small(dst + d, nzrun_len);
         /* overflow */
@@ -120,7 +295,6 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
         }
         memcpy(dst + d, nzrun_start, nzrun_len);
         d += nzrun_len;
-        nzrun_len = 0;
     }
 
     return d;
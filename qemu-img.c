@@ -43,6 +43,7 @@
 #include "block/block_int.h"
 #include "block/blockjob.h"
 #include "block/qapi.h"
+#include "block/thread-pool.h"
 #include "crypto/init.h"
 #include "trace/control.h"
 
@@ -177,8 +178,12 @@ static void QEMU_NORETURN help(void)
            "\n"
            "Parameters to convert subcommand:\n"
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
-           "       process (defaults to 8)\n"
+           "       process (defaults to 8, or twice the number of threads\n"
+           "       given with -j)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '-j' specifies how many worker threads do CPU-bound work such\n"
+           "       as zero detection during the convert process (defaults\n"
+           "       to 1, i.e. none)\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1156,6 +1161,35 @@ static int is_allocated_sectors_min(const uint8_t *buf, int n, int *pnum,
     return 1;
 }
 
+/*
+ * Like is_allocated_sectors, but checks whole clusters of 'cluster_sectors'
+ * sectors, as compressed clusters can only be written as a whole.  'buf'
+ * must start at a cluster boundary; the last cluster may be short.
+ */
+static int is_allocated_clusters(const uint8_t *buf, int n, int *pnum,
+                                 int cluster_sectors)
+{
+    bool is_zero;
+    int i, len;
+
+    if (n <= 0) {
+        *pnum = 0;
+        return 0;
+    }
+    i = MIN(n, cluster_sectors);
+    is_zero = buffer_is_zero(buf, i * BDRV_SECTOR_SIZE);
+    while (i < n) {
+        len = MIN(n - i, cluster_sectors);
+        if (is_zero != buffer_is_zero(buf + i * BDRV_SECTOR_SIZE,
+                                      len * BDRV_SECTOR_SIZE)) {
+            break;
+        }
+        i += len;
+    }
+    *pnum = i;
+    return !is_zero;
+}
+
 /*
  * Compares two buffers sector by sector. Returns 0 if the first
  * sector of each buffer matches, non-zero otherwise.
@@ -1526,7 +1560,8 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
+#define MAX_CONVERT_THREADS 64
 
 typedef struct ImgConvertState {
     BlockBackend **src;
@@ -1549,6 +1584,9 @@ typedef struct ImgConvertState {
     size_t buf_sectors;
     long num_coroutines;
     int running_coroutines;
+    long num_threads;
+    int running_threads;
+    CoQueue thread_queue;
     Coroutine *co[MAX_COROUTINES];
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
@@ -1669,11 +1707,85 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
 }
 
 
+/*
+ * Returns whether the first sectors of a BLK_DATA buffer must be written as
+ * data rather than as zeroes, and sets *pnum to their number.
+ */
+static int convert_is_allocated(ImgConvertState *s, const uint8_t *buf, int n,
+                                int *pnum)
+{
+    if (s->compressed) {
+        return is_allocated_clusters(buf, n, pnum, s->cluster_sectors);
+    }
+    return is_allocated_sectors_min(buf, n, pnum, s->min_sparse);
+}
+
+typedef struct ConvertScanData {
+    ImgConvertState *s;
+    const uint8_t *buf;
+    int nb_sectors;
+    int *runs;
+    int nr_runs;
+} ConvertScanData;
+
+/*
+ * Splits a buffer into the runs that convert_co_write() writes as data
+ * (positive lengths) and as zeroes (negative lengths).
+ */
+static int convert_scan_func(void *opaque)
+{
+    ConvertScanData *data = opaque;
+    const uint8_t *buf = data->buf;
+    int nb_sectors = data->nb_sectors;
+    int n;
+
+    data->nr_runs = 0;
+    while (nb_sectors > 0) {
+        if (convert_is_allocated(data->s, buf, nb_sectors, &n)) {
+            data->runs[data->nr_runs++] = n;
+        } else {
+            data->runs[data->nr_runs++] = -n;
+        }
+        buf += n * BDRV_SECTOR_SIZE;
+        nb_sectors -= n;
+    }
+    return 0;
+}
+
+/*
+ * Scans a buffer that was read from the source in a worker thread, so that
+ * the scans of several requests can run on several CPUs at once.  Returns
+ * the number of runs stored in @runs.
+ */
+static int coroutine_fn convert_co_scan(ImgConvertState *s,
+                                        const uint8_t *buf, int n, int *runs)
+{
+    ThreadPool *pool = aio_get_thread_pool(blk_get_aio_context(s->target));
+    ConvertScanData data = {
+        .s          = s,
+        .buf        = buf,
+        .nb_sectors = n,
+        .runs       = runs,
+    };
+
+    while (s->running_threads >= s->num_threads) {
+        qemu_co_queue_wait(&s->thread_queue, NULL);
+    }
+    s->running_threads++;
+    thread_pool_submit_co(pool, convert_scan_func, &data);
+    s->running_threads--;
+    qemu_co_queue_next(&s->thread_queue);
+
+    return data.nr_runs;
+}
+
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
-                                         enum ImgConvertBlockStatus status)
+                                         enum ImgConvertBlockStatus status,
+                                         const int *runs)
 {
     int ret;
+    bool alloc;
     QEMUIOVector qiov;
     struct iovec iov;
 
@@ -1694,14 +1806,17 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
-            if (!s->min_sparse ||
-                (!s->compressed &&
-                 is_allocated_sectors_min(buf, n, &n, s->min_sparse)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
-            {
+             * case we can only save the write for clusters that are
+             * completely zeroed.
+             * With -j, the buffer was already split into runs by
+             * convert_co_scan(). */
+            if (runs) {
+                alloc = *runs > 0;
+                n = abs(*runs++);
+            } else {
+                alloc = !s->min_sparse || convert_is_allocated(s, buf, n, &n);
+            }
+            if (alloc) {
                 iov.iov_base = buf;
                 iov.iov_len = n << BDRV_SECTOR_BITS;
                 qemu_iovec_init_external(&qiov, &iov, 1);
@@ -1741,6 +1856,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
     uint8_t *buf = NULL;
+    int *runs = NULL;
     int ret, i;
     int index = -1;
 
@@ -1754,11 +1870,15 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 
     s->running_coroutines++;
     buf = blk_blockalign(s->target, s->buf_sectors * BDRV_SECTOR_SIZE);
+    if (s->min_sparse && s->num_threads > 1) {
+        runs = g_new(int, s->buf_sectors);
+    }
 
     while (1) {
         int n;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
+        const int *write_runs = NULL;
 
         qemu_co_mutex_lock(&s->lock);
         if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
@@ -1794,6 +1914,15 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
                 error_report("error while reading sector %" PRId64
                              ": %s", sector_num, strerror(-ret));
                 s->ret = ret;
+            } else if (runs) {
+                /* Done before waiting for our turn to write, so that the
+                 * scan overlaps with other requests even if the output is
+                 * written in order. */
+                if (convert_co_scan(s, buf, n, runs) == 1 && runs[0] < 0) {
+                    status = BLK_ZERO;
+                } else {
+                    write_runs = runs;
+                }
             }
         } else if (!s->min_sparse && status == BLK_ZERO) {
             status = BLK_DATA;
@@ -1810,7 +1939,8 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
         if (s->ret == -EINPROGRESS) {
-            ret = convert_co_write(s, sector_num, n, buf, status);
+            ret = convert_co_write(s, sector_num, n, buf, status,
+                                   write_runs);
             if (ret < 0) {
                 error_report("error while writing sector %" PRId64
                              ": %s", sector_num, strerror(-ret));
@@ -1837,6 +1967,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
     }
 
     qemu_vfree(buf);
+    g_free(runs);
     s->co[index] = NULL;
     s->running_coroutines--;
     if (!s->running_coroutines && s->ret == -EINPROGRESS) {
@@ -1864,14 +1995,15 @@ static int convert_do_copy(ImgConvertState *s)
         }
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /* Allocate buffer for copied data. For compressed images, the buffer
+     * must hold whole clusters; the driver compresses several of them in
+     * parallel. */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors, s->cluster_sectors);
     }
 
     while (sector_num < s->total_sectors) {
@@ -1891,6 +2023,7 @@ static int convert_do_copy(ImgConvertState *s)
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->thread_queue);
     for (i = 0; i < s->num_coroutines; i++) {
         s->co[i] = qemu_coroutine_create(convert_co_do_copy, s);
         s->wait_sector_num[i] = -1;
@@ -1935,7 +2068,8 @@ static int img_convert(int argc, char **argv)
         .min_sparse         = 8,
         .buf_sectors        = IO_BUF_SIZE / BDRV_SECTOR_SIZE,
         .wr_in_order        = true,
-        .num_coroutines     = 8,
+        .num_coroutines     = 0,
+        .num_threads        = 1,
     };
 
     for(;;) {
@@ -1947,7 +2081,7 @@ static int img_convert(int argc, char **argv)
             {"target-image-opts", no_argument, 0, OPTION_TARGET_IMAGE_OPTS},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:O:B:co:s:l:S:pt:T:qnm:WU",
+        c = getopt_long(argc, argv, ":hf:O:B:co:s:l:S:pt:T:qnm:WUj:",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -2042,6 +2176,15 @@ static int img_convert(int argc, char **argv)
         case 'W':
             s.wr_in_order = false;
             break;
+        case 'j':
+            if (qemu_strtol(optarg, NULL, 0, &s.num_threads) ||
+                s.num_threads < 1 || s.num_threads > MAX_CONVERT_THREADS) {
+                error_report("Invalid number of threads. Allowed number of"
+                             " threads is between 1 and %d",
+                             MAX_CONVERT_THREADS);
+                goto fail_getopt;
+            }
+            break;
         case 'U':
             force_share = true;
             break;
@@ -2073,9 +2216,9 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
-    if (!s.wr_in_order && s.compressed) {
-        error_report("Out of order write and compress are mutually exclusive");
-        goto fail_getopt;
+    if (!s.num_coroutines) {
+        /* Keep enough requests in flight to feed the worker threads */
+        s.num_coroutines = MIN(MAX(8, 2 * s.num_threads), MAX_COROUTINES);
     }
 
     if (tgt_image_opts && !skip_create) {
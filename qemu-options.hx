@@ -35,6 +35,7 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off|split controls accelerated irqchip support (default=off)\n"
     "                vmport=on|off|auto controls emulation of vmport (default: auto)\n"
     "                kvm_shadow_mem=size of KVM shadow MMU in bytes\n"
+    "                kvm-dirty-ring-size=n entries in the KVM dirty ring of each vCPU (default=0)\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
     "                mem-merge=on|off controls memory merge support (default: on)\n"
     "                igd-passthru=on|off controls IGD GFX passthrough support (default=off)\n"
@@ -80,6 +81,15 @@ value based on accel. For accel=xen the default is off otherwise the default
 is on.
 @item kvm_shadow_mem=size
 Defines the size of the KVM shadow MMU.
+@item kvm-dirty-ring-size=@var{n}
+Track the pages dirtied by each vCPU in a ring of @var{n} entries, which
+must be a power of two, rather than in the per-memslot dirty bitmap.  The
+rings are collected incrementally, so that fetching the dirty log from KVM
+costs in proportion to the number of dirty pages rather than to the size
+of guest memory.  The pages still end up in QEMU's dirty bitmap, which
+migration walks in full on every synchronization.  If the host does not
+support dirty rings, the dirty bitmap is used.  The default is 0, which
+always uses the dirty bitmap.
 @item dump-guest-core=on|off
 Include guest memory in a core dump. The default is on.
 @item mem-merge=on|off
@@ -128,9 +138,13 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,hot-threshold=n]\n"
+    "                [,regalloc=ebb|bb][,tb-profile=n]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                hot-threshold=n (retranslate TCG blocks executed n times)\n"
+    "                regalloc=ebb|bb (keep TCG values in registers across branches)\n"
+    "                tb-profile=n (sample one in n TCG block executions)", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -144,6 +158,27 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item hot-threshold=@var{n}
+Enables two-tier translation in TCG. Blocks are first translated without
+running the TCG optimizer, and with a counter of their executions that
+includes those reached through chained jumps; once a block has been entered
+@var{n} times it is retranslated with the optimizer. Both tiers translate one
+block at a time; hot blocks are not merged into superblocks, so the gain is
+only the translation time saved on blocks that run less than @var{n} times.
+Values above 2147483647 are treated as 2147483647. The default of 0
+translates every block with the optimizer.
+@item regalloc=ebb|bb
+Selects the scope of the TCG register allocator. With @option{ebb}, the
+default, guest registers held in host registers stay there across conditional
+branches inside a translation block and are only written back to memory for
+the branch target. @option{bb} spills every value at each basic block end.
+@item tb-profile=@var{n}
+Records a sampled execution profile for each TCG translation block: one in
+@var{n} block executions on each vCPU is counted, including blocks entered
+through direct chaining, and the translation time of every block is measured.
+Counting adds a few host instructions to the start of every block. The result can be read with @code{info tb-profile}
+in the monitor or the QMP @code{query-tb-profile} command. The default of 0
+disables profiling.
 @end table
 ETEXI
 
@@ -807,7 +842,8 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name]\n"
+    "       [,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -879,7 +915,9 @@ unsafe       │ on                off            on
 The default mode is @option{cache=writeback}.
 
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread
+based disk I/O, native Linux AIO and Linux io_uring.  Unlike native AIO,
+io_uring does not require @option{cache.direct=on}.
 @item format=@var{format}
 Specify which disk @var{format} will be used rather than detecting
 the format.  Can be used to specify format=raw to avoid interpreting
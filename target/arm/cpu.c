@@ -316,6 +316,7 @@ static void arm_cpu_reset(CPUState *s)
         kvm_arm_reset_vcpu(cpu);
     }
 #endif
+    arm_tlb_update_asid(env);
 
     hw_breakpoint_update_all(cpu);
     hw_watchpoint_update_all(cpu);
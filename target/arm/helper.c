@@ -510,20 +510,47 @@ static void fcse_write(CPUARMState *env, const ARMCPRegInfo *ri, uint64_t value)
     }
 }
 
+/* MMU indexes whose TLB entries are tagged with the ASID of EL1 */
+static uint16_t arm_asid_idxmap(CPUARMState *env)
+{
+    uint16_t idxmap = ARMMMUIdxBit_S12NSE1 | ARMMMUIdxBit_S12NSE0;
+
+    if (arm_el_is_aa64(env, 3)) {
+        /* Secure EL1&0 uses the same registers as Non-secure EL1&0 */
+        idxmap |= ARMMMUIdxBit_S1SE1 | ARMMMUIdxBit_S1SE0;
+    }
+    return idxmap;
+}
+
+/* Return the TLBI operand bits that hold an ASID of EL1 */
+static uint32_t arm_asid_mask(CPUARMState *env)
+{
+    if (arm_el_is_aa64(env, 1) && extract64(env->cp15.tcr_el[1].raw_tcr,
+                                            36, 1)) {
+        /* TCR_EL1.AS selects 16 bit ASIDs */
+        return 0xffff;
+    }
+    return 0xff;
+}
+
 static void contextidr_write(CPUARMState *env, const ARMCPRegInfo *ri,
                              uint64_t value)
 {
     ARMCPU *cpu = arm_env_get_cpu(env);
 
     if (raw_read(env, ri) != value && !arm_feature(env, ARM_FEATURE_PMSA)
-        && !extended_addresses_enabled(env)) {
+        && !extended_addresses_enabled(env)
+        && (ri->secure & ARM_CP_SECSTATE_S)) {
         /* For VMSA (when not using the LPAE long descriptor page table
          * format) this register includes the ASID, so do a TLB flush.
          * For PMSA it is purely a process ID and no action is needed.
+         * The TLB entries of EL1 are tagged with their ASID instead,
+         * see arm_tlb_update_asid().
          */
         tlb_flush(CPU(cpu));
     }
     raw_write(env, ri, value);
+    arm_tlb_update_asid(env);
 }
 
 static void tlbiall_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -550,7 +577,12 @@ static void tlbiasid_write(CPUARMState *env, const ARMCPRegInfo *ri,
     /* Invalidate by ASID (TLBIASID) */
     ARMCPU *cpu = arm_env_get_cpu(env);
 
-    tlb_flush(CPU(cpu));
+    if (arm_is_secure_below_el3(env) && !arm_el_is_aa64(env, 3)) {
+        /* The Secure PL1&0 regime does not tag its TLB entries */
+        tlb_flush(CPU(cpu));
+        return;
+    }
+    tlb_flush_asid_by_mmuidx(CPU(cpu), value & 0xff, arm_asid_idxmap(env));
 }
 
 static void tlbimvaa_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -576,7 +608,12 @@ static void tlbiasid_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
 {
     CPUState *cs = ENV_GET_CPU(env);
 
-    tlb_flush_all_cpus_synced(cs);
+    if (arm_is_secure_below_el3(env) && !arm_el_is_aa64(env, 3)) {
+        tlb_flush_all_cpus_synced(cs);
+        return;
+    }
+    tlb_flush_asid_by_mmuidx_all_cpus_synced(cs, value & 0xff,
+                                             arm_asid_idxmap(env));
 }
 
 static void tlbimva_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -1217,6 +1254,8 @@ static void scr_write(CPUARMState *env, const ARMCPRegInfo *ri, uint64_t value)
     /* Clear all-context RES0 bits.  */
     value &= valid_mask;
     raw_write(env, ri, value);
+    /* SCR.NS and SCR.RW change how the ASID of EL1 is read */
+    arm_tlb_update_asid(env);
 }
 
 static uint64_t ccsidr_read(CPUARMState *env, const ARMCPRegInfo *ri)
@@ -2604,6 +2643,7 @@ static void vmsa_ttbcr_write(CPUARMState *env, const ARMCPRegInfo *ri,
         tlb_flush(CPU(cpu));
     }
     vmsa_ttbcr_raw_write(env, ri, value);
+    arm_tlb_update_asid(env);
 }
 
 static void vmsa_ttbcr_reset(CPUARMState *env, const ARMCPRegInfo *ri)
@@ -2627,20 +2667,24 @@ static void vmsa_tcr_el1_write(CPUARMState *env, const ARMCPRegInfo *ri,
     /* For AArch64 the A1 bit could result in a change of ASID, so TLB flush. */
     tlb_flush(CPU(cpu));
     tcr->raw_tcr = value;
+    arm_tlb_update_asid(env);
 }
 
 static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
                             uint64_t value)
 {
-    /* 64 bit accesses to the TTBRs can change the ASID and so we
-     * must flush the TLB.
+    /* 64 bit accesses to the TTBRs can change the ASID.  The TLB entries
+     * of EL1 are tagged with their ASID, see arm_tlb_update_asid(); the
+     * Secure PL1&0 regime of AArch32 must flush the TLB instead.
+     * TTBR0_EL3 holds no ASID.
      */
-    if (cpreg_field_is_64bit(ri)) {
+    if (cpreg_field_is_64bit(ri) && (ri->secure & ARM_CP_SECSTATE_S)) {
         ARMCPU *cpu = arm_env_get_cpu(env);
 
         tlb_flush(CPU(cpu));
     }
     raw_write(env, ri, value);
+    arm_tlb_update_asid(env);
 }
 
 static void vttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -3039,6 +3083,24 @@ static void tlbi_aa64_vmalle1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
     }
 }
 
+static void tlbi_aa64_aside1_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                                   uint64_t value)
+{
+    CPUState *cs = ENV_GET_CPU(env);
+    uint32_t asid = extract64(value, 48, 16) & arm_asid_mask(env);
+
+    tlb_flush_asid_by_mmuidx(cs, asid, arm_asid_idxmap(env));
+}
+
+static void tlbi_aa64_aside1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
+                                     uint64_t value)
+{
+    CPUState *cs = ENV_GET_CPU(env);
+    uint32_t asid = extract64(value, 48, 16) & arm_asid_mask(env);
+
+    tlb_flush_asid_by_mmuidx_all_cpus_synced(cs, asid, arm_asid_idxmap(env));
+}
+
 static void tlbi_aa64_alle1_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                   uint64_t value)
 {
@@ -3426,7 +3488,7 @@ static const ARMCPRegInfo v8_cp_reginfo[] = {
     { .name = "TLBI_ASIDE1IS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 3, .opc2 = 2,
       .access = PL1_W, .type = ARM_CP_NO_RAW,
-      .writefn = tlbi_aa64_vmalle1is_write },
+      .writefn = tlbi_aa64_aside1is_write },
     { .name = "TLBI_VAAE1IS", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 3, .opc2 = 3,
       .access = PL1_W, .type = ARM_CP_NO_RAW,
@@ -3450,7 +3512,7 @@ static const ARMCPRegInfo v8_cp_reginfo[] = {
     { .name = "TLBI_ASIDE1", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 7, .opc2 = 2,
       .access = PL1_W, .type = ARM_CP_NO_RAW,
-      .writefn = tlbi_aa64_vmalle1_write },
+      .writefn = tlbi_aa64_aside1_write },
     { .name = "TLBI_VAAE1", .state = ARM_CP_STATE_AA64,
       .opc0 = 1, .opc1 = 0, .crn = 8, .crm = 7, .opc2 = 3,
       .access = PL1_W, .type = ARM_CP_NO_RAW,
@@ -3802,6 +3864,8 @@ static void hcr_write(CPUARMState *env, const ARMCPRegInfo *ri, uint64_t value)
         tlb_flush(CPU(cpu));
     }
     raw_write(env, ri, value);
+    /* HCR.RW changes how the ASID of EL1 is read */
+    arm_tlb_update_asid(env);
 }
 
 static const ARMCPRegInfo el2_cp_reginfo[] = {
@@ -6146,6 +6210,10 @@ void aarch64_sync_64_to_32(CPUARMState *env)
     g_assert_not_reached();
 }
 
+void arm_tlb_update_asid(CPUARMState *env)
+{
+}
+
 #else
 
 void switch_mode(CPUARMState *env, int mode)
@@ -8425,6 +8493,31 @@ bool arm_s1_regime_using_lpae_format(CPUARMState *env, ARMMMUIdx mmu_idx)
     return regime_using_lpae_format(env, mmu_idx);
 }
 
+/* Return the current ASID of the EL1&0 translation regimes */
+static uint32_t arm_el1_asid(CPUARMState *env)
+{
+    ARMMMUIdx mmu_idx = ARMMMUIdx_S1NSE1;
+
+    if (regime_using_lpae_format(env, mmu_idx)) {
+        /* TTBCR.A1 selects the TTBR that holds the ASID */
+        int ttbrn = extract64(regime_tcr(env, mmu_idx)->raw_tcr, 22, 1);
+
+        return extract64(regime_ttbr(env, mmu_idx, ttbrn), 48, 16) &
+               arm_asid_mask(env);
+    }
+    return extract64(env->cp15.contextidr_el[1], 0, 8);
+}
+
+void arm_tlb_update_asid(CPUARMState *env)
+{
+    if (!tcg_enabled() || arm_feature(env, ARM_FEATURE_M) ||
+        arm_feature(env, ARM_FEATURE_PMSA)) {
+        return;
+    }
+    tlb_set_asid_for_mmuidx(ENV_GET_CPU(env), arm_el1_asid(env),
+                            arm_asid_idxmap(env));
+}
+
 static inline bool regime_is_user(CPUARMState *env, ARMMMUIdx mmu_idx)
 {
     switch (mmu_idx) {
@@ -8886,6 +8979,7 @@ static bool get_phys_addr_v6(CPUARMState *env, uint32_t address,
     hwaddr phys_addr;
     uint32_t dacr;
     bool ns;
+    bool ng;
 
     /* Pagetable walk.  */
     /* Lookup l1 descriptor.  */
@@ -8941,6 +9035,7 @@ static bool get_phys_addr_v6(CPUARMState *env, uint32_t address,
         xn = desc & (1 << 4);
         pxn = desc & 1;
         ns = extract32(desc, 19, 1);
+        ng = extract32(desc, 17, 1);
     } else {
         if (arm_feature(env, ARM_FEATURE_PXN)) {
             pxn = (desc >> 2) & 1;
@@ -8954,6 +9049,7 @@ static bool get_phys_addr_v6(CPUARMState *env, uint32_t address,
             goto do_fault;
         }
         ap = ((desc >> 4) & 3) | ((desc >> 7) & 4);
+        ng = extract32(desc, 11, 1);
         switch (desc & 3) {
         case 0: /* Page translation fault.  */
             fi->type = ARMFault_Translation;
@@ -9012,6 +9108,10 @@ static bool get_phys_addr_v6(CPUARMState *env, uint32_t address,
          */
         attrs->secure = false;
     }
+    if (!ng && regime_el(env, mmu_idx) == 1) {
+        /* Kept across ASID switches, see arm_tlb_update_asid() */
+        *prot |= PAGE_GLOBAL;
+    }
     *phys_ptr = phys_addr;
     return false;
 do_fault:
@@ -9432,6 +9532,11 @@ static bool get_phys_addr_lpae(CPUARMState *env, target_ulong address,
         goto do_fault;
     }
 
+    if (!extract32(attrs, 9, 1) && regime_el(env, mmu_idx) == 1) {
+        /* nG is clear: kept across ASID switches */
+        *prot |= PAGE_GLOBAL;
+    }
+
     if (ns) {
         /* The NS bit will (as required by the architecture) have no effect if
          * the CPU doesn't support TZ or this is a non-secure translation
@@ -10236,8 +10341,8 @@ static bool get_phys_addr(CPUARMState *env, target_ulong address,
                                      page_size, fi,
                                      cacheattrs != NULL ? &cacheattrs2 : NULL);
             fi->s2addr = ipa;
-            /* Combine the S1 and S2 perms.  */
-            *prot &= s2_prot;
+            /* Combine the S1 and S2 perms; S2 has no notion of nG.  */
+            *prot &= s2_prot | PAGE_GLOBAL;
 
             /* Combine the S1 and S2 cache attributes, if needed */
             if (!ret && cacheattrs != NULL) {
@@ -712,6 +712,13 @@ bool arm_tlb_fill(CPUState *cpu, vaddr address,
  * tables */
 bool arm_s1_regime_using_lpae_format(CPUARMState *env, ARMMMUIdx mmu_idx);
 
+/* Tell the TLB about the current ASID of EL1.  TLB entries of the EL1&0
+ * translation regimes are tagged with it, so that a context switch only
+ * drops the non-global ones.  Must be called whenever a register that
+ * holds or selects the ASID changes, including on reset and migration.
+ */
+void arm_tlb_update_asid(CPUARMState *env);
+
 /* Raise a data fault alignment exception for the specified virtual address */
 void arm_cpu_do_unaligned_access(CPUState *cs, vaddr vaddr,
                                  MMUAccessType access_type,
@@ -644,6 +644,7 @@ static int cpu_post_load(void *opaque, int version_id)
         if (!write_list_to_cpustate(cpu)) {
             return -1;
         }
+        arm_tlb_update_asid(&cpu->env);
     }
 
     hw_breakpoint_update_all(cpu);
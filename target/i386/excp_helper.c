@@ -437,6 +437,11 @@ do_check_protect_pse36:
         prot &= ~PAGE_WRITE;
     }
 
+    /* keep the translation across CR3 writes */
+    if ((pte & PG_GLOBAL_MASK) && (env->cr[4] & CR4_PGE_MASK)) {
+        prot |= PAGE_GLOBAL;
+    }
+
  do_mapping:
     pte = pte & a20_mask;
 
@@ -680,6 +680,24 @@ void cpu_x86_update_cr3(CPUX86State *env, target_ulong new_cr3)
     }
 }
 
+/* Like cpu_x86_update_cr3, but for a guest-initiated address space
+   switch (MOV to CR3, task switch), which leaves global pages alone */
+void cpu_x86_switch_cr3(CPUX86State *env, target_ulong new_cr3)
+{
+    CPUState *cs = CPU(x86_env_get_cpu(env));
+
+    env->cr[3] = new_cr3;
+    if (env->cr[0] & CR0_PG_MASK) {
+        qemu_log_mask(CPU_LOG_MMU,
+                      "CR3 switch: CR3=" TARGET_FMT_lx "\n", new_cr3);
+        if (env->cr[4] & CR4_PGE_MASK) {
+            tlb_flush_asid_by_mmuidx(cs, 0, (1 << NB_MMU_MODES) - 1);
+        } else {
+            tlb_flush(cs);
+        }
+    }
+}
+
 void cpu_x86_update_cr4(CPUX86State *env, uint32_t new_cr4)
 {
     X86CPU *cpu = x86_env_get_cpu(env);
@@ -150,7 +150,7 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         cpu_x86_update_cr0(env, t0);
         break;
     case 3:
-        cpu_x86_update_cr3(env, t0);
+        cpu_x86_switch_cr3(env, t0);
         break;
     case 4:
         cpu_x86_update_cr4(env, t0);
@@ -424,7 +424,7 @@ static void switch_tss_ra(CPUX86State *env, int tss_selector,
     env->tr.flags = e2 & ~DESC_TSS_BUSY_MASK;
 
     if ((type & 8) && (env->cr[0] & CR0_PG_MASK)) {
-        cpu_x86_update_cr3(env, new_cr3);
+        cpu_x86_switch_cr3(env, new_cr3);
     }
 
     /* load all registers without an exception, then reload them with
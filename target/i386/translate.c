@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "exec/cpu_ldst.h"
 #include "exec/translator.h"
 
@@ -3015,6 +3016,54 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Expand the common integer MMX/SSE operations inline with the generic
+   vector ops instead of calling out to the helpers.  Return false if B
+   is not one of them.  */
+static bool gen_sse_gvec(int b, int is_xmm, int op1_offset, int op2_offset)
+{
+    uint32_t sz = is_xmm ? 16 : 8;
+
+    switch (b) {
+    case 0xdb: /* pand */
+        tcg_gen_gvec_and(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        break;
+    case 0xdf: /* pandn */
+        tcg_gen_gvec_andc(MO_64, op1_offset, op2_offset, op1_offset, sz, sz);
+        break;
+    case 0xeb: /* por */
+        tcg_gen_gvec_or(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        break;
+    case 0xef: /* pxor */
+        tcg_gen_gvec_xor(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        break;
+    case 0xfc ... 0xfe: /* padd[bwd] */
+        tcg_gen_gvec_add(b - 0xfc, op1_offset, op1_offset, op2_offset,
+                         sz, sz);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_gvec_add(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        break;
+    case 0xf8 ... 0xfa: /* psub[bwd] */
+        tcg_gen_gvec_sub(b - 0xf8, op1_offset, op1_offset, op2_offset,
+                         sz, sz);
+        break;
+    case 0xfb: /* psubq */
+        tcg_gen_gvec_sub(MO_64, op1_offset, op1_offset, op2_offset, sz, sz);
+        break;
+    case 0x74 ... 0x76: /* pcmpeq[bwd] */
+        tcg_gen_gvec_cmp(TCG_COND_EQ, b - 0x74, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    case 0x64 ... 0x66: /* pcmpgt[bwd] */
+        tcg_gen_gvec_cmp(TCG_COND_GT, b - 0x64, op1_offset, op1_offset,
+                         op2_offset, sz, sz);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4441,6 +4490,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_gvec(b, is_xmm, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -135,11 +135,18 @@ static TCGContext **tcg_ctxs;
 static unsigned int n_tcg_ctxs;
 TCGv_env cpu_env = 0;
 
+/* Keep globals and local temps in host registers across conditional
+   branches, instead of spilling everything at each basic block end.  */
+bool tcg_regalloc_ebb = true;
+
 /*
  * We divide code_gen_buffer into equally-sized "regions" that TCG threads
  * dynamically allocate from as demand dictates. Given appropriate region
  * sizing, this minimizes flushes even when some TCG threads generate a lot
  * more code than others.
+ *
+ * Once every region has been handed out, the regions that filled up are
+ * recycled in FIFO order: see tcg_region_evict_oldest().
  */
 struct tcg_region_state {
     QemuMutex lock;
@@ -153,8 +160,13 @@ struct tcg_region_state {
     size_t stride; /* .size + guard size */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    size_t current; /* number of regions handed out since the last reset */
     size_t agg_size_full; /* aggregate size of full regions */
+    size_t *full; /* ring of full regions, oldest first */
+    size_t full_head;
+    size_t n_full;
+    size_t *free; /* evicted regions, ready to be handed out again */
+    size_t n_free;
 };
 
 static struct tcg_region_state region;
@@ -313,6 +325,19 @@ static void tcg_region_bounds(size_t curr_region, void **pstart, void **pend)
     *pend = end;
 }
 
+void tcg_region_get_bounds(size_t curr_region, void **pstart, void **pend)
+{
+    tcg_region_bounds(curr_region, pstart, pend);
+}
+
+static size_t tcg_region_index(const void *p)
+{
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    return MIN((p - region.start_aligned) / region.stride, region.n - 1);
+}
+
 static void tcg_region_assign(TCGContext *s, size_t curr_region)
 {
     void *start, *end;
@@ -327,6 +352,10 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
+    if (region.n_free) {
+        tcg_region_assign(s, region.free[--region.n_free]);
+        return false;
+    }
     if (region.current == region.n) {
         return true;
     }
@@ -342,18 +371,49 @@ static bool tcg_region_alloc__locked(TCGContext *s)
 static bool tcg_region_alloc(TCGContext *s)
 {
     bool err;
-    /* read the region size now; alloc__locked will overwrite it on success */
+    /* read the region now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
+    size_t full = tcg_region_index(s->code_gen_buffer);
 
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
         region.agg_size_full += size_full - TCG_HIGHWATER;
+        region.full[(region.full_head + region.n_full) % region.n] = full;
+        region.n_full++;
     }
     qemu_mutex_unlock(&region.lock);
     return err;
 }
 
+/*
+ * Take the region that filled up first away from the code cache, so that
+ * it can be handed out again.  Returns false if there is no such region,
+ * i.e. every region is held by a TCG context and only a full flush helps.
+ *
+ * On success, the caller must invalidate every TB within [*pstart, *pend)
+ * before any vCPU runs again, so call from a safe-work context.
+ */
+bool tcg_region_evict_oldest(void **pstart, void **pend)
+{
+    size_t evict;
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_full == 0) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    evict = region.full[region.full_head];
+    region.full_head = (region.full_head + 1) % region.n;
+    region.n_full--;
+    region.free[region.n_free++] = evict;
+
+    tcg_region_bounds(evict, pstart, pend);
+    region.agg_size_full -= *pend - *pstart - TCG_HIGHWATER;
+    qemu_mutex_unlock(&region.lock);
+    return true;
+}
+
 /*
  * Perform a context's first region allocation.
  * This function does _not_ increment region.agg_size_full.
@@ -372,6 +432,9 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.full_head = 0;
+    region.n_full = 0;
+    region.n_free = 0;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = atomic_read(&tcg_ctxs[i]);
@@ -382,10 +445,28 @@ void tcg_region_reset_all(void)
     qemu_mutex_unlock(&region.lock);
 }
 
+/*
+ * With a single TCG thread we still split the buffer, so that filling it
+ * up recycles only its oldest part instead of flushing everything.
+ */
+#define TCG_MIN_REGION_SIZE (1024u * 1024)
+#define TCG_EVICT_REGIONS 8
+
+static size_t tcg_n_regions_single(void)
+{
+    size_t size = tcg_init_ctx.code_gen_buffer_size;
+    size_t n = TCG_EVICT_REGIONS;
+
+    while (n > 1 && size / n < TCG_MIN_REGION_SIZE) {
+        n /= 2;
+    }
+    return n;
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
-    return 1;
+    return tcg_n_regions_single();
 }
 #else
 /*
@@ -398,9 +479,9 @@ static size_t tcg_n_regions(void)
 {
     size_t i;
 
-    /* Use a single region if all we have is one vCPU thread */
+    /* Only one vCPU thread translates; it cycles through the regions */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+        return tcg_n_regions_single();
     }
 
     /* Try to have more regions than max_cpus, with each region being >= 2 MB */
@@ -436,14 +517,19 @@ static size_t tcg_n_regions(void)
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
  *
- * In user-mode we use a single region.  Having multiple regions in user-mode
- * is not supported, because the number of vCPU threads (recall that each thread
- * spawned by the guest corresponds to a vCPU thread) is only bounded by the
- * OS, and usually this number is huge (tens of thousands is not uncommon).
+ * In user-mode all threads share a single TCG context.  Having one region
+ * per thread in user-mode is not supported, because the number of vCPU
+ * threads (recall that each thread spawned by the guest corresponds to a
+ * vCPU thread) is only bounded by the OS, and usually this number is huge
+ * (tens of thousands is not uncommon).
  * Thus, given this large bound on the number of vCPU threads and the fact
  * that code_gen_buffer is allocated at compile-time, we cannot guarantee
  * that the availability of at least one region per vCPU thread.
  *
+ * Without MTTCG, and in user-mode, the buffer is still split into a few
+ * regions that the one TCG context uses in turn, so that the oldest can be
+ * recycled when the buffer fills up.
+ *
  * However, this user-mode limitation is unlikely to be a significant problem
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in softmmu.
@@ -485,6 +571,8 @@ void tcg_region_init(void)
     region.end = QEMU_ALIGN_PTR_DOWN(buf + size, page_size);
     /* account for that last guard page */
     region.end -= page_size;
+    region.full = g_new(size_t, region.n);
+    region.free = g_new(size_t, region.n);
 
     /* set guard pages */
     for (i = 0; i < region.n; i++) {
@@ -2069,6 +2157,26 @@ static void tcg_la_bb_end(TCGContext *s)
     }
 }
 
+/* liveness analysis: conditional branch: the fall-through path continues
+   with the current register state, so globals and local temps only need
+   to be synced to memory for the benefit of the branch target.  Normal
+   temps are dead.  */
+static void tcg_la_bb_sync(TCGContext *s)
+{
+    int ng = s->nb_globals;
+    int nt = s->nb_temps;
+    int i;
+
+    for (i = 0; i < ng; ++i) {
+        s->temps[i].state |= TS_MEM;
+    }
+    for (i = ng; i < nt; ++i) {
+        s->temps[i].state = (s->temps[i].temp_local
+                             ? s->temps[i].state | TS_MEM
+                             : TS_DEAD);
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -2267,7 +2375,9 @@ static void liveness_pass_1(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if ((def->flags & TCG_OPF_COND_BRANCH) && tcg_regalloc_ebb) {
+                    tcg_la_bb_sync(s);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -2338,7 +2448,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if ((def->flags & TCG_OPF_COND_BRANCH) && tcg_regalloc_ebb) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2442,6 +2555,17 @@ static bool liveness_pass_2(TCGContext *s)
                 arg_ts->state = TS_DEAD;
             }
         }
+
+        /* The direct temps are not local temps and do not survive the
+           branch: reload the indirect globals on the fall-through path.  */
+        if ((def->flags & TCG_OPF_COND_BRANCH) && tcg_regalloc_ebb) {
+            for (i = 0; i < nb_globals; ++i) {
+                arg_ts = &s->temps[i];
+                if (arg_ts->state_ptr) {
+                    arg_ts->state = TS_DEAD;
+                }
+            }
+        }
     }
 
     return changes;
@@ -2521,20 +2645,38 @@ static void check_regs(TCGContext *s)
 
 static void temp_allocate_frame(TCGContext *s, TCGTemp *ts)
 {
+    intptr_t size, align;
+
+    /* Vector temps need a slot as large as the vector, aligned so that
+       the backend can use its natural vector load and store.  */
+    switch (ts->type) {
+    case TCG_TYPE_V64:
+        size = align = 8;
+        break;
+    case TCG_TYPE_V128:
+        size = align = 16;
+        break;
+    case TCG_TYPE_V256:
+        /* Do not assume the stack is aligned beyond 16 bytes.  */
+        size = 32, align = 16;
+        break;
+    default:
+        size = align = sizeof(tcg_target_long);
+        break;
+    }
+    align = MIN(align, TCG_TARGET_STACK_ALIGN);
+
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
-    s->current_frame_offset = (s->current_frame_offset +
-                               (tcg_target_long)sizeof(tcg_target_long) - 1) &
-        ~(sizeof(tcg_target_long) - 1);
+    s->current_frame_offset = ROUND_UP(s->current_frame_offset, align);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_base = s->frame_temp;
     ts->mem_allocated = 1;
-    s->current_frame_offset += sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
 static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet);
@@ -2601,6 +2743,9 @@ static void temp_sync(TCGContext *s, TCGTemp *ts,
         default:
             tcg_abort();
         }
+#ifdef CONFIG_PROFILER
+        atomic_set(&s->prof.spill_count, s->prof.spill_count + 1);
+#endif
         ts->mem_coherent = 1;
     }
     if (free_or_dead) {
@@ -2667,6 +2812,9 @@ static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
         reg = tcg_reg_alloc(s, desired_regs, allocated_regs, ts->indirect_base);
         tcg_out_ld(s, ts->type, reg, ts->mem_base->reg, ts->mem_offset);
         ts->mem_coherent = 1;
+#ifdef CONFIG_PROFILER
+        atomic_set(&s->prof.reload_count, s->prof.reload_count + 1);
+#endif
         break;
     case TEMP_VAL_DEAD:
     default:
@@ -2733,6 +2881,36 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* at a conditional branch, globals and local temps are synced to their
+   canonical location for the branch target, but may stay in registers
+   for the fall-through path.  Normal temps are dead. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = 0; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        /* The liveness analysis already ensures that temps are synced
+           or dead.  Keep tcg_debug_asserts for safety. */
+        if (ts->temp_global || ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->fixed_reg
+                             || ts->mem_coherent);
+#ifdef CONFIG_PROFILER
+            if (ts->val_type == TEMP_VAL_REG && !ts->fixed_reg) {
+                atomic_set(&s->prof.cbranch_live_count,
+                           s->prof.cbranch_live_count + 1);
+            }
+#endif
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 static void tcg_reg_alloc_do_movi(TCGContext *s, TCGTemp *ots,
                                   tcg_target_ulong val, TCGLifeData arg_life)
 {
@@ -2928,7 +3106,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if ((def->flags & TCG_OPF_COND_BRANCH) && tcg_regalloc_ebb) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -3188,6 +3368,9 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
             PROF_ADD(prof, orig, opt_time);
             PROF_ADD(prof, orig, restore_count);
             PROF_ADD(prof, orig, restore_time);
+            PROF_ADD(prof, orig, spill_count);
+            PROF_ADD(prof, orig, reload_count);
+            PROF_ADD(prof, orig, cbranch_live_count);
         }
         if (table) {
             int i;
@@ -3275,7 +3458,11 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
-    tcg_optimize(s);
+    /* Cold TBs are cheap to translate; they get the optimizer once
+       they are retranslated into the hot tier.  */
+    if (!(tb_cflags(tb) & CF_COLD)) {
+        tcg_optimize(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
@@ -3471,6 +3658,14 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 s->restore_count);
     cpu_fprintf(f, "  avg cycles        %0.1f\n",
                 s->restore_count ? (double)s->restore_time / s->restore_count : 0);
+    cpu_fprintf(f, "register allocator  %s\n",
+                tcg_regalloc_ebb ? "ebb" : "bb");
+    cpu_fprintf(f, "spills/TB           %0.2f\n",
+                (double)s->spill_count / tb_div_count);
+    cpu_fprintf(f, "reloads/TB          %0.2f\n",
+                (double)s->reload_count / tb_div_count);
+    cpu_fprintf(f, "reloads saved/TB    %0.2f (kept live across brcond)\n",
+                (double)s->cbranch_live_count / tb_div_count);
 }
 #else
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
@@ -645,6 +645,9 @@ typedef struct TCGProfile {
     int64_t opt_time;
     int64_t restore_count;
     int64_t restore_time;
+    int64_t spill_count;   /* register to memory stores */
+    int64_t reload_count;  /* memory to register loads */
+    int64_t cbranch_live_count; /* temps kept in regs across a brcond */
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
@@ -722,6 +725,7 @@ struct TCGContext {
 
 extern TCGContext tcg_init_ctx;
 extern __thread TCGContext *tcg_ctx;
+extern bool tcg_regalloc_ebb;
 extern TCGv_env cpu_env;
 
 static inline size_t temp_idx(TCGTemp *ts)
@@ -846,6 +850,8 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_init(void);
 void tcg_region_reset_all(void);
+bool tcg_region_evict_oldest(void **pstart, void **pend);
+void tcg_region_get_bounds(size_t curr_region, void **pstart, void **pend);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -972,6 +978,9 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x10,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x20,
+    /* Instruction is a conditional branch; the fall-through path
+       continues the same extended basic block.  */
+    TCG_OPF_COND_BRANCH  = 0x40,
 };
 
 typedef struct TCGOpDef {
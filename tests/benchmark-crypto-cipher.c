@@ -11,20 +11,37 @@
  * top-level directory.
  */
 #include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/buffer.h"
+#include "qemu/thread.h"
 #include "crypto/init.h"
 #include "crypto/cipher.h"
+#include "crypto/block.h"
+#include "crypto/pbkdf.h"
+#include "crypto/secret.h"
 
-static void test_cipher_speed(const void *opaque)
+static void test_cipher_speed(size_t chunk_size,
+                              QCryptoCipherMode mode,
+                              QCryptoCipherAlgorithm alg)
 {
     QCryptoCipher *cipher;
     Error *err = NULL;
     double total = 0.0;
-    size_t chunk_size = (size_t)opaque;
     uint8_t *key = NULL, *iv = NULL;
     uint8_t *plaintext = NULL, *ciphertext = NULL;
-    size_t nkey = qcrypto_cipher_get_key_len(QCRYPTO_CIPHER_ALG_AES_128);
-    size_t niv = qcrypto_cipher_get_iv_len(QCRYPTO_CIPHER_ALG_AES_128,
-                                           QCRYPTO_CIPHER_MODE_CBC);
+    size_t nkey;
+    size_t niv;
+
+    if (!qcrypto_cipher_supports(alg, mode)) {
+        return;
+    }
+
+    nkey = qcrypto_cipher_get_key_len(alg);
+    niv = qcrypto_cipher_get_iv_len(alg, mode);
+    if (mode == QCRYPTO_CIPHER_MODE_XTS) {
+        nkey *= 2;
+    }
 
     key = g_new0(uint8_t, nkey);
     memset(key, g_test_rand_int(), nkey);
@@ -37,8 +54,7 @@ static void test_cipher_speed(const void *opaque)
     plaintext = g_new0(uint8_t, chunk_size);
     memset(plaintext, g_test_rand_int(), chunk_size);
 
-    cipher = qcrypto_cipher_new(QCRYPTO_CIPHER_ALG_AES_128,
-                                QCRYPTO_CIPHER_MODE_CBC,
+    cipher = qcrypto_cipher_new(alg, mode,
                                 key, nkey, &err);
     g_assert(cipher != NULL);
 
@@ -58,7 +74,8 @@ static void test_cipher_speed(const void *opaque)
 
     total /= 1024 * 1024; /* to MB */
 
-    g_print("cbc(aes128): ");
+    g_print("%s(%s): ", QCryptoCipherMode_str(mode),
+            QCryptoCipherAlgorithm_str(alg));
     g_print("Testing chunk_size %zu bytes ", chunk_size);
     g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
     g_print("%.2f MB/sec\n", total / g_test_timer_last());
@@ -70,18 +87,200 @@ static void test_cipher_speed(const void *opaque)
     g_free(key);
 }
 
+static void test_cipher_speed_cbc_aes128(const void *opaque)
+{
+    size_t chunk_size = (size_t)opaque;
+    test_cipher_speed(chunk_size,
+                      QCRYPTO_CIPHER_MODE_CBC,
+                      QCRYPTO_CIPHER_ALG_AES_128);
+}
+
+static void test_cipher_speed_xts_aes256(const void *opaque)
+{
+    size_t chunk_size = (size_t)opaque;
+    test_cipher_speed(chunk_size,
+                      QCRYPTO_CIPHER_MODE_XTS,
+                      QCRYPTO_CIPHER_ALG_AES_256);
+}
+
+/*
+ * LUKS payload encryption as done by the block layer: requests of
+ * chunk_size bytes are encrypted in 512 byte sectors, from one or more
+ * threads sharing the same QCryptoBlock.
+ */
+
+#define LUKS_BENCH_MAX_THREADS 8
+
+typedef struct {
+    size_t chunk_size;
+    int n_threads;
+} LUKSBenchCase;
+
+typedef struct {
+    QCryptoBlock *blk;
+    size_t chunk_size;
+    uint64_t offset;
+    uint64_t bytes;
+} LUKSBenchThread;
+
+static bool luks_bench_stop;
+
+static ssize_t luks_bench_read_func(QCryptoBlock *block, size_t offset,
+                                    uint8_t *buf, size_t buflen,
+                                    void *opaque, Error **errp)
+{
+    Buffer *header = opaque;
+
+    memcpy(buf, header->buffer + offset, buflen);
+    return buflen;
+}
+
+static ssize_t luks_bench_init_func(QCryptoBlock *block, size_t headerlen,
+                                    void *opaque, Error **errp)
+{
+    Buffer *header = opaque;
+
+    buffer_reserve(header, headerlen);
+    return headerlen;
+}
+
+static ssize_t luks_bench_write_func(QCryptoBlock *block, size_t offset,
+                                     const uint8_t *buf, size_t buflen,
+                                     void *opaque, Error **errp)
+{
+    Buffer *header = opaque;
+
+    memcpy(header->buffer + offset, buf, buflen);
+    header->offset = MAX(header->offset, offset + buflen);
+    return buflen;
+}
+
+static void *luks_bench_thread(void *opaque)
+{
+    LUKSBenchThread *t = opaque;
+    uint8_t *buf = g_malloc(t->chunk_size);
+
+    memset(buf, g_test_rand_int(), t->chunk_size);
+    while (!atomic_read(&luks_bench_stop)) {
+        g_assert(qcrypto_block_encrypt(t->blk, t->offset, buf,
+                                       t->chunk_size, &error_abort) == 0);
+        t->bytes += t->chunk_size;
+    }
+
+    g_free(buf);
+    return NULL;
+}
+
+static void test_luks_speed(const void *opaque)
+{
+    const LUKSBenchCase *bc = opaque;
+    QCryptoBlockCreateOptions create_opts = {
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .u.luks = {
+            .has_key_secret = true,
+            .key_secret = (char *)"sec0",
+            .has_iter_time = true,
+            .iter_time = 10,
+        },
+    };
+    QCryptoBlockOpenOptions open_opts = {
+        .format = Q_CRYPTO_BLOCK_FORMAT_LUKS,
+        .u.luks = {
+            .has_key_secret = true,
+            .key_secret = (char *)"sec0",
+        },
+    };
+    QemuThread threads[LUKS_BENCH_MAX_THREADS];
+    LUKSBenchThread data[LUKS_BENCH_MAX_THREADS];
+    QCryptoBlock *blk;
+    Buffer header;
+    Object *sec;
+    double total = 0.0;
+    int i;
+
+    sec = object_new_with_props(TYPE_QCRYPTO_SECRET,
+                                object_get_objects_root(),
+                                "sec0", &error_abort,
+                                "data", "123456",
+                                NULL);
+
+    memset(&header, 0, sizeof(header));
+    buffer_init(&header, "header");
+
+    blk = qcrypto_block_create(&create_opts, NULL,
+                               luks_bench_init_func, luks_bench_write_func,
+                               &header, &error_abort);
+    qcrypto_block_free(blk);
+
+    blk = qcrypto_block_open(&open_opts, NULL, luks_bench_read_func,
+                             &header, 0, bc->n_threads, &error_abort);
+
+    atomic_set(&luks_bench_stop, false);
+    g_test_timer_start();
+    for (i = 0; i < bc->n_threads; i++) {
+        data[i] = (LUKSBenchThread) {
+            .blk = blk,
+            .chunk_size = bc->chunk_size,
+            .offset = i * bc->chunk_size,
+        };
+        qemu_thread_create(&threads[i], "luks-bench", luks_bench_thread,
+                           &data[i], QEMU_THREAD_JOINABLE);
+    }
+
+    g_usleep(5 * G_USEC_PER_SEC);
+    atomic_set(&luks_bench_stop, true);
+
+    for (i = 0; i < bc->n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+        total += data[i].bytes;
+    }
+    g_test_timer_elapsed();
+
+    total /= 1024 * 1024; /* to MB */
+
+    g_print("luks: Testing chunk_size %zu bytes, %d threads ",
+            bc->chunk_size, bc->n_threads);
+    g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
+    g_print("%.2f MB/sec\n", total / g_test_timer_last());
+
+    qcrypto_block_free(blk);
+    buffer_free(&header);
+    object_unparent(sec);
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
+    int n;
     char name[64];
 
+    module_call_init(MODULE_INIT_QOM);
     g_test_init(&argc, &argv, NULL);
     g_assert(qcrypto_init(NULL) == 0);
 
     for (i = 512; i <= (64 * 1204); i *= 2) {
         memset(name, 0 , sizeof(name));
         snprintf(name, sizeof(name), "/crypto/cipher/speed-%zu", i);
-        g_test_add_data_func(name, (void *)i, test_cipher_speed);
+        g_test_add_data_func(name, (void *)i, test_cipher_speed_cbc_aes128);
+    }
+
+    for (i = 512; i <= (64 * 1204); i *= 2) {
+        snprintf(name, sizeof(name), "/crypto/cipher/xts-aes256/speed-%zu", i);
+        g_test_add_data_func(name, (void *)i, test_cipher_speed_xts_aes256);
+    }
+
+    if (qcrypto_pbkdf2_supports(QCRYPTO_HASH_ALG_SHA256)) {
+        for (i = 4096; i <= 1024 * 1024; i *= 16) {
+            for (n = 1; n <= LUKS_BENCH_MAX_THREADS; n *= 2) {
+                LUKSBenchCase *bc = g_new(LUKSBenchCase, 1);
+
+                bc->chunk_size = i;
+                bc->n_threads = n;
+                snprintf(name, sizeof(name),
+                         "/crypto/block/luks/speed-%zu/threads-%d", i, n);
+                g_test_add_data_func(name, bc, test_luks_speed);
+            }
+        }
     }
 
     return g_test_run();
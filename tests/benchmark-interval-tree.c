@@ -0,0 +1,142 @@
+/*
+ * Interval tree speed benchmark
+ *
+ * Models the tracked requests of a BlockDriverState: at a given queue
+ * depth, one request completes and a new one is submitted, which first
+ * looks for overlapping requests in flight.  The lookup is done both with
+ * the interval tree and with a linear walk of a list, which is what the
+ * block layer used before.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+#include "qemu/queue.h"
+
+#define DISK_SIZE   (1ULL << 30)
+#define ALIGN       4096
+#define MAX_BYTES   (64 * 1024)
+
+typedef struct BenchReq {
+    IntervalTreeNode node;
+    QLIST_ENTRY(BenchReq) list;
+} BenchReq;
+
+typedef struct {
+    int qd;
+    bool tree;
+} BenchCase;
+
+static IntervalTree tree;
+static QLIST_HEAD(, BenchReq) list;
+
+static void random_range(BenchReq *req)
+{
+    req->node.start = (uint64_t)g_test_rand_int_range(0, DISK_SIZE / ALIGN)
+                      * ALIGN;
+    req->node.end = req->node.start +
+                    g_test_rand_int_range(1, MAX_BYTES / ALIGN + 1) * ALIGN;
+}
+
+static bool count_overlap(IntervalTreeNode *node, void *opaque)
+{
+    unsigned *count = opaque;
+
+    (*count)++;
+    return false;
+}
+
+static unsigned tree_overlaps(BenchReq *self)
+{
+    unsigned count = 0;
+
+    interval_tree_find_overlap(&tree, self->node.start, self->node.end,
+                               count_overlap, &count);
+    return count;
+}
+
+static unsigned list_overlaps(BenchReq *self)
+{
+    BenchReq *req;
+    unsigned count = 0;
+
+    QLIST_FOREACH(req, &list, list) {
+        if (self->node.start < req->node.end &&
+            req->node.start < self->node.end) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void test_interval_tree_speed(const void *opaque)
+{
+    const BenchCase *bc = opaque;
+    BenchReq *reqs = g_new0(BenchReq, bc->qd);
+    BenchReq probe;
+    uint64_t total = 0;
+    int i;
+
+    interval_tree_init(&tree);
+    QLIST_INIT(&list);
+    for (i = 0; i < bc->qd; i++) {
+        random_range(&reqs[i]);
+        interval_tree_insert(&tree, &reqs[i].node);
+        QLIST_INSERT_HEAD(&list, &reqs[i], list);
+    }
+
+    /* Both lookups must find the same requests.  */
+    for (i = 0; i < 1000; i++) {
+        random_range(&probe);
+        g_assert_cmpuint(tree_overlaps(&probe), ==, list_overlaps(&probe));
+    }
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < bc->qd; i++) {
+            BenchReq *req = &reqs[i];
+
+            if (bc->tree) {
+                interval_tree_remove(&tree, &req->node);
+                random_range(req);
+                tree_overlaps(req);
+                interval_tree_insert(&tree, &req->node);
+            } else {
+                QLIST_REMOVE(req, list);
+                random_range(req);
+                list_overlaps(req);
+                QLIST_INSERT_HEAD(&list, req, list);
+            }
+        }
+        total += bc->qd;
+    } while (g_test_timer_elapsed() < 0.5);
+
+    g_print("qd %4d (%s): ", bc->qd, bc->tree ? "tree" : "list");
+    g_print("%.2f Mreqs/sec\n", total / g_test_timer_last() / 1e6);
+
+    g_free(reqs);
+}
+
+int main(int argc, char **argv)
+{
+    BenchCase *bc;
+    char *name;
+    int qd, use_tree;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (qd = 1; qd <= 1024; qd *= 2) {
+        for (use_tree = 0; use_tree <= 1; use_tree++) {
+            bc = g_new(BenchCase, 1);
+            bc->qd = qd;
+            bc->tree = use_tree;
+            name = g_strdup_printf("/interval-tree/qd%d/%s", qd,
+                                   use_tree ? "tree" : "list");
+            g_test_add_data_func(name, bc, test_interval_tree_speed);
+            g_free(name);
+        }
+    }
+
+    return g_test_run();
+}
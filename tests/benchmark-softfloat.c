@@ -0,0 +1,278 @@
+/*
+ * softfloat speed benchmark
+ *
+ * Measures the throughput of the basic float32/float64 operations, both
+ * through the integer emulation and through the host FPU fast path,
+ * which is used only while the inexact flag is already raised.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <math.h>
+#include <float.h>
+#include "fpu/softfloat.h"
+
+#define N_INPUTS 1024
+
+typedef enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SQRT,
+    OP_FMA,
+    OP_MAX,
+} BenchOp;
+
+static const char * const op_names[OP_MAX] = {
+    [OP_ADD] = "add",
+    [OP_SUB] = "sub",
+    [OP_MUL] = "mul",
+    [OP_DIV] = "div",
+    [OP_SQRT] = "sqrt",
+    [OP_FMA] = "fma",
+};
+
+typedef struct {
+    BenchOp op;
+    bool is_f64;
+    bool hard;
+} BenchCase;
+
+static float32 f32_in[3][N_INPUTS];
+static float64 f64_in[3][N_INPUTS];
+
+static double random_normal(BenchOp op)
+{
+    double d = 1.0 + g_test_rand_double_range(0.0, 1.0);
+
+    d = ldexp(d, g_test_rand_int_range(-20, 20));
+    if (op != OP_SQRT && g_test_rand_bit()) {
+        d = -d;
+    }
+    return d;
+}
+
+static void fill_inputs(BenchOp op)
+{
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < N_INPUTS; j++) {
+            union {
+                float h;
+                uint32_t i;
+            } u32;
+            union {
+                double h;
+                uint64_t i;
+            } u64;
+
+            u64.h = random_normal(op);
+            u32.h = u64.h;
+            f32_in[i][j] = make_float32(u32.i);
+            f64_in[i][j] = make_float64(u64.i);
+        }
+    }
+}
+
+/*
+ * Operands whose result lands within a few ulps of the minimum normal,
+ * on either side, so that some results round up to exactly FLT_MIN or
+ * DBL_MIN.  MIN is the minimum normal and EPS the unit roundoff of the
+ * type; the caller rounds the operands to it.
+ */
+static void boundary_operands(BenchOp op, double min, double eps,
+                              double *a, double *b, double *c)
+{
+    double t = min * (1.0 + g_test_rand_int_range(-4, 5) * eps);
+    double d = ldexp(1.0 + g_test_rand_double_range(0.0, 1.0),
+                     g_test_rand_int_range(0, 20));
+
+    *c = 0;
+    switch (op) {
+    case OP_ADD:
+        *a = t + min * d;
+        *b = -min * d;
+        break;
+    case OP_SUB:
+        *a = t + min * d;
+        *b = min * d;
+        break;
+    case OP_DIV:
+        *a = t * d;
+        *b = d;
+        break;
+    default:
+        /* mul and fma; sqrt of a normal cannot get there */
+        *a = ldexp(d, -40);
+        *b = t / *a;
+        break;
+    }
+}
+
+static void fill_boundary_inputs(BenchOp op)
+{
+    int j;
+
+    for (j = 0; j < N_INPUTS; j++) {
+        union {
+            float h;
+            uint32_t i;
+        } u32[3];
+        union {
+            double h;
+            uint64_t i;
+        } u64[3];
+        double a, b, c;
+
+        boundary_operands(op, FLT_MIN, FLT_EPSILON / 2, &a, &b, &c);
+        u32[0].h = a;
+        u32[1].h = b;
+        u32[2].h = c;
+        boundary_operands(op, DBL_MIN, DBL_EPSILON / 2, &a, &b, &c);
+        u64[0].h = a;
+        u64[1].h = b;
+        u64[2].h = c;
+
+        f32_in[0][j] = make_float32(u32[0].i);
+        f32_in[1][j] = make_float32(u32[1].i);
+        f32_in[2][j] = make_float32(u32[2].i);
+        f64_in[0][j] = make_float64(u64[0].i);
+        f64_in[1][j] = make_float64(u64[1].i);
+        f64_in[2][j] = make_float64(u64[2].i);
+    }
+}
+
+static float32 do_f32(BenchOp op, int i, float_status *s)
+{
+    float32 a = f32_in[0][i], b = f32_in[1][i], c = f32_in[2][i];
+
+    switch (op) {
+    case OP_ADD:
+        return float32_add(a, b, s);
+    case OP_SUB:
+        return float32_sub(a, b, s);
+    case OP_MUL:
+        return float32_mul(a, b, s);
+    case OP_DIV:
+        return float32_div(a, b, s);
+    case OP_SQRT:
+        return float32_sqrt(a, s);
+    case OP_FMA:
+        return float32_muladd(a, b, c, 0, s);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static float64 do_f64(BenchOp op, int i, float_status *s)
+{
+    float64 a = f64_in[0][i], b = f64_in[1][i], c = f64_in[2][i];
+
+    switch (op) {
+    case OP_ADD:
+        return float64_add(a, b, s);
+    case OP_SUB:
+        return float64_sub(a, b, s);
+    case OP_MUL:
+        return float64_mul(a, b, s);
+    case OP_DIV:
+        return float64_div(a, b, s);
+    case OP_SQRT:
+        return float64_sqrt(a, s);
+    case OP_FMA:
+        return float64_muladd(a, b, c, 0, s);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/* The two paths must agree bit for bit, flags included.  */
+static void check_paths_agree(BenchOp op, int tininess)
+{
+    float_status soft = { 0 }, hard = { 0 };
+    int i;
+
+    set_float_detect_tininess(tininess, &soft);
+    set_float_detect_tininess(tininess, &hard);
+    for (i = 0; i < N_INPUTS; i++) {
+        set_float_exception_flags(0, &soft);
+        set_float_exception_flags(float_flag_inexact, &hard);
+        g_assert_cmphex(float32_val(do_f32(op, i, &soft)), ==,
+                        float32_val(do_f32(op, i, &hard)));
+        g_assert_cmphex(get_float_exception_flags(&soft) | float_flag_inexact,
+                        ==, get_float_exception_flags(&hard));
+
+        set_float_exception_flags(0, &soft);
+        set_float_exception_flags(float_flag_inexact, &hard);
+        g_assert_cmphex(float64_val(do_f64(op, i, &soft)), ==,
+                        float64_val(do_f64(op, i, &hard)));
+        g_assert_cmphex(get_float_exception_flags(&soft) | float_flag_inexact,
+                        ==, get_float_exception_flags(&hard));
+    }
+}
+
+static void test_softfloat_speed(const void *opaque)
+{
+    const BenchCase *bc = opaque;
+    float_status status = { 0 };
+    uint8_t flags = bc->hard ? float_flag_inexact : 0;
+    uint64_t total = 0;
+    int i;
+
+    fill_boundary_inputs(bc->op);
+    check_paths_agree(bc->op, float_tininess_after_rounding);
+    check_paths_agree(bc->op, float_tininess_before_rounding);
+
+    fill_inputs(bc->op);
+    check_paths_agree(bc->op, float_tininess_after_rounding);
+    check_paths_agree(bc->op, float_tininess_before_rounding);
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < N_INPUTS; i++) {
+            /* Keep the soft runs off the fast path.  */
+            set_float_exception_flags(flags, &status);
+            if (bc->is_f64) {
+                do_f64(bc->op, i, &status);
+            } else {
+                do_f32(bc->op, i, &status);
+            }
+        }
+        total += N_INPUTS;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    g_print("%s %s (%s): ", bc->is_f64 ? "float64" : "float32",
+            op_names[bc->op], bc->hard ? "host fpu" : "softfloat");
+    g_print("%.2f Mops/sec\n", total / g_test_timer_last() / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    BenchCase *bc;
+    char *name;
+    int op, is_f64, hard;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (op = 0; op < OP_MAX; op++) {
+        for (is_f64 = 0; is_f64 <= 1; is_f64++) {
+            for (hard = 0; hard <= 1; hard++) {
+                bc = g_new(BenchCase, 1);
+                bc->op = op;
+                bc->is_f64 = is_f64;
+                bc->hard = hard;
+                name = g_strdup_printf("/softfloat/%s/%s/%s",
+                                       is_f64 ? "float64" : "float32",
+                                       op_names[op], hard ? "hard" : "soft");
+                g_test_add_data_func(name, bc, test_softfloat_speed);
+                g_free(name);
+            }
+        }
+    }
+
+    return g_test_run();
+}
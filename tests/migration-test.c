@@ -223,6 +223,24 @@ static uint64_t get_migration_pass(QTestState *who)
     return result;
 }
 
+static uint64_t get_migration_transferred(QTestState *who)
+{
+    QDict *rsp, *rsp_return, *rsp_ram;
+    uint64_t result;
+
+    rsp = wait_command(who, "{ 'execute': 'query-migrate' }");
+    rsp_return = qdict_get_qdict(rsp, "return");
+    if (!qdict_haskey(rsp_return, "ram")) {
+        /* Still in setup */
+        result = 0;
+    } else {
+        rsp_ram = qdict_get_qdict(rsp_return, "ram");
+        result = qdict_get_try_int(rsp_ram, "transferred", 0);
+    }
+    QDECREF(rsp);
+    return result;
+}
+
 static void wait_for_migration_complete(QTestState *who)
 {
     while (true) {
@@ -564,6 +582,108 @@ static void test_migrate(void)
     test_migrate_end(from, to, true);
 }
 
+/*
+ * The pages go over the multifd channels rather than the main stream,
+ * but they still have to count against max-bandwidth.
+ */
+static void test_multifd_bandwidth(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    uint64_t start_bytes, end_bytes;
+    int64_t start_time, end_time;
+    double rate;
+
+    test_migrate_start(&from, &to, uri, false);
+
+    migrate_set_capability(from, "x-multifd", "true");
+    migrate_set_capability(to, "x-multifd", "true");
+    migrate_set_parameter(from, "x-multifd-channels", "4");
+    migrate_set_parameter(to, "x-multifd-channels", "4");
+
+    /* Slow enough for the first pass to take several seconds */
+    migrate_set_parameter(from, "max-bandwidth", "20000000");
+    migrate_set_parameter(from, "downtime-limit", "1");
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri);
+
+    while (!get_migration_transferred(from)) {
+        usleep(1000);
+    }
+
+    start_time = g_get_monotonic_time();
+    start_bytes = get_migration_transferred(from);
+    g_usleep(2 * G_USEC_PER_SEC);
+    end_time = g_get_monotonic_time();
+    end_bytes = get_migration_transferred(from);
+
+    /* Allow for the packets that were in flight at either end */
+    rate = (double)(end_bytes - start_bytes) * G_USEC_PER_SEC /
+           (end_time - start_time);
+    g_assert_cmpfloat(rate, <, 20000000 * 1.25);
+    g_assert_cmpfloat(rate, >, 20000000 * 0.5);
+
+    /* Now let it complete */
+    migrate_set_parameter(from, "max-bandwidth", "1000000000");
+    migrate_set_parameter(from, "downtime-limit", "10000");
+
+    wait_for_migration_complete(from);
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    g_free(uri);
+
+    test_migrate_end(from, to, true);
+}
+
+/*
+ * Several passes over RAM that the guest keeps dirtying, with the pages on
+ * multifd channels: a page must never be left with an older copy on the
+ * destination.
+ */
+static void test_multifd_precopy(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+
+    test_migrate_start(&from, &to, uri, false);
+
+    migrate_set_capability(from, "x-multifd", "true");
+    migrate_set_capability(to, "x-multifd", "true");
+    migrate_set_parameter(from, "x-multifd-channels", "4");
+    migrate_set_parameter(to, "x-multifd-channels", "4");
+
+    /* Slow enough that precopy does not converge on its own */
+    migrate_set_parameter(from, "max-bandwidth", "100000000");
+    migrate_set_parameter(from, "downtime-limit", "1");
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri);
+
+    wait_for_migration_pass(from);
+    wait_for_migration_pass(from);
+
+    /* Now let it complete */
+    migrate_set_parameter(from, "max-bandwidth", "1000000000");
+    migrate_set_parameter(from, "downtime-limit", "10000");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    g_free(uri);
+
+    test_migrate_end(from, to, true);
+}
+
 static void test_baddest(void)
 {
     QTestState *from, *to;
@@ -617,6 +737,8 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/postcopy/unix", test_migrate);
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
+    qtest_add_func("/migration/multifd/bandwidth", test_multifd_bandwidth);
+    qtest_add_func("/migration/multifd/precopy", test_multifd_precopy);
 
     ret = g_test_run();
 
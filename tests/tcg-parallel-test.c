@@ -0,0 +1,110 @@
+/*
+ * QTest testcase for concurrent translation with MTTCG
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2
+ * or later. See the COPYING file in the top-level directory.
+ *
+ * All vCPUs of an ARM virt machine start at the same time in a firmware
+ * made of a long chain of small blocks, so that they translate the same
+ * blocks concurrently.  Each vCPU sums the immediates of the chain and
+ * stores the result in RAM; they must all get the right sum, and "info
+ * jit" must show that translation ran outside tb_lock.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+
+#define NR_CPUS         4
+#define NR_BLOCKS       8192
+
+#define RESULT_ADDR     0x40000000
+#define DONE_MAGIC      0x5454
+
+/* Runs on every vCPU: r3 = its index, r0 = 0 */
+static const uint8_t prologue[] = {
+    0xb0, 0x3f, 0x10, 0xee,     /* mrc   p15, 0, r3, c0, c0, 5 */
+    0xff, 0x30, 0x03, 0xe2,     /* and   r3, r3, #0xff */
+    0x00, 0x00, 0xa0, 0xe3,     /* mov   r0, #0 */
+};
+
+/* Then NR_BLOCKS times, with a different immediate each time */
+#define INSN_ADD_R0     0xe2800000  /* add   r0, r0, #imm */
+#define INSN_B_NEXT     0xeaffffff  /* b     .+4 */
+
+/* Store r0 and DONE_MAGIC in the slot of the vCPU, and stop */
+static const uint8_t epilogue[] = {
+    0x00, 0x20, 0x00, 0xe3,     /* movw  r2, #0 */
+    0x00, 0x20, 0x44, 0xe3,     /* movt  r2, #0x4000 */
+    0x83, 0x21, 0x82, 0xe0,     /* add   r2, r2, r3, lsl #3 */
+    0x00, 0x00, 0x82, 0xe5,     /* str   r0, [r2] */
+    0x54, 0x14, 0x05, 0xe3,     /* movw  r1, #0x5454 */
+    0x04, 0x10, 0x82, 0xe5,     /* str   r1, [r2, #4] */
+    0x03, 0xf0, 0x20, 0xe3,     /* 1: wfi */
+    0xfd, 0xff, 0xff, 0xea,     /* b     1b */
+};
+
+static void test_parallel_translation(void)
+{
+    char biostmp[] = "/tmp/qtest-tcg-parallel-XXXXXX";
+    size_t size = sizeof(prologue) + NR_BLOCKS * 8 + sizeof(epilogue);
+    uint32_t expected = 0;
+    uint8_t *bios, *p;
+    char *info;
+    const char *line;
+    unsigned races;
+    int fd, i, cpu;
+
+    p = bios = g_malloc0(size);
+    memcpy(p, prologue, sizeof(prologue));
+    p += sizeof(prologue);
+    for (i = 0; i < NR_BLOCKS; i++) {
+        stl_le_p(p, INSN_ADD_R0 | (i & 0xff));
+        stl_le_p(p + 4, INSN_B_NEXT);
+        p += 8;
+        expected += i & 0xff;
+    }
+    memcpy(p, epilogue, sizeof(epilogue));
+
+    fd = mkstemp(biostmp);
+    g_assert(fd != -1);
+    g_assert(write(fd, bios, size) == size);
+    close(fd);
+    g_free(bios);
+
+    /* With an EL3 firmware, all vCPUs start running at the reset vector */
+    global_qtest = qtest_startf("-M virt,secure=on -cpu cortex-a15 -smp %d "
+                                "-bios %s -accel tcg,thread=multi",
+                                NR_CPUS, biostmp);
+    unlink(biostmp);
+
+    for (cpu = 0; cpu < NR_CPUS; cpu++) {
+        uint64_t slot = RESULT_ADDR + cpu * 8;
+
+        /* Wait at most 60 seconds for the vCPU to finish */
+        for (i = 0; i < 6000 && readl(slot + 4) != DONE_MAGIC; i++) {
+            g_usleep(10000);
+        }
+        g_assert_cmphex(readl(slot + 4), ==, DONE_MAGIC);
+        g_assert_cmphex(readl(slot), ==, expected);
+    }
+
+    /* How many blocks were translated twice depends on the host */
+    info = hmp("info jit");
+    line = strstr(info, "TB translation races");
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "TB translation races %u", &races), ==, 1);
+    g_assert_cmpuint(races, <, NR_CPUS * (NR_BLOCKS + 2));
+    g_free(info);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/tcg/parallel-translation", test_parallel_translation);
+
+    return g_test_run();
+}
@@ -0,0 +1,103 @@
+/*
+ * QTest testcase for the TCG hot tier (-accel tcg,hot-threshold=n)
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2
+ * or later. See the COPYING file in the top-level directory.
+ *
+ * A tiny real-mode BIOS runs a loop made of several chained blocks, so
+ * that they are entered well over the threshold mostly through goto_tb,
+ * and stores its result in RAM.  The result must be the same as without
+ * tiering, and "info jit" must report that blocks were retranslated.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define BIOS_SIZE       0x10000
+#define CODE_OFFSET     0xff80
+#define RESET_OFFSET    0xfff0
+
+#define RESULT_ADDR     0x1000
+#define DONE_ADDR       0x1004
+#define DONE_MAGIC      0x5454
+
+static const uint8_t loop_code[] = {
+    0x31, 0xc0,                             /* xor  %ax,%ax */
+    0xb9, 0xe8, 0x03,                       /* mov  $1000,%cx */
+    0x01, 0xc8,                             /* 1: add  %cx,%ax */
+    0xf6, 0xc1, 0x01,                       /* test $1,%cl */
+    0x74, 0x02,                             /* jz   2f */
+    0x01, 0xc8,                             /* add  %cx,%ax */
+    0xe2, 0xf5,                             /* 2: loop 1b */
+    0xa3, 0x00, 0x10,                       /* mov  %ax,0x1000 */
+    0xc7, 0x06, 0x04, 0x10, 0x54, 0x54,     /* movw $0x5454,0x1004 */
+    0xfa,                                   /* cli */
+    0xf4,                                   /* 3: hlt */
+    0xeb, 0xfd,                             /* jmp  3b */
+};
+
+static const uint8_t reset_code[] = {
+    0xeb, 0x8e,                             /* jmp  0xff80 */
+};
+
+/* Sum of 1..1000, plus the odd numbers once more, modulo 2^16 */
+static uint16_t expected_result(void)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 1; i <= 1000; i++) {
+        sum += i & 1 ? 2 * i : i;
+    }
+    return sum;
+}
+
+static void test_tier_up(void)
+{
+    char biostmp[] = "/tmp/qtest-tcg-tier-XXXXXX";
+    uint8_t *bios;
+    char *info;
+    const char *line;
+    unsigned count, threshold;
+    int fd, i;
+
+    bios = g_malloc0(BIOS_SIZE);
+    memcpy(bios + CODE_OFFSET, loop_code, sizeof(loop_code));
+    memcpy(bios + RESET_OFFSET, reset_code, sizeof(reset_code));
+    fd = mkstemp(biostmp);
+    g_assert(fd != -1);
+    g_assert(write(fd, bios, BIOS_SIZE) == BIOS_SIZE);
+    close(fd);
+    g_free(bios);
+
+    global_qtest = qtest_startf("-M isapc -cpu qemu32 -bios %s "
+                                "-accel tcg,hot-threshold=16", biostmp);
+    unlink(biostmp);
+
+    /* Wait at most 60 seconds for the loop to finish */
+    for (i = 0; i < 6000 && readw(DONE_ADDR) != DONE_MAGIC; i++) {
+        g_usleep(10000);
+    }
+    g_assert_cmphex(readw(DONE_ADDR), ==, DONE_MAGIC);
+    g_assert_cmphex(readw(RESULT_ADDR), ==, expected_result());
+
+    info = hmp("info jit");
+    line = strstr(info, "TB tier-up count");
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "TB tier-up count %u (threshold %u)",
+                           &count, &threshold), ==, 2);
+    g_assert_cmpuint(threshold, ==, 16);
+    g_assert_cmpuint(count, >, 0);
+    g_free(info);
+
+    qtest_quit(global_qtest);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/tcg/tier-up", test_tier_up);
+
+    return g_test_run();
+}
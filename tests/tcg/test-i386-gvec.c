@@ -0,0 +1,280 @@
+/*
+ * Check the MMX/SSE integer instructions that target/i386 expands with
+ * the generic vector ops against the semantics of their helpers in
+ * ops_sse.h.  Each instruction is run with two registers, with a memory
+ * operand and with the same register twice, on random and boundary
+ * values.  Exits with status 1 on the first mismatch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NR_RANDOM   1000
+
+typedef union {
+    uint8_t b[16];
+    uint64_t q[2];
+} __attribute__((aligned(16))) Vec;
+
+typedef enum {
+    OP_AND,
+    OP_ANDN,
+    OP_OR,
+    OP_XOR,
+    OP_ADD,
+    OP_SUB,
+    OP_CMPEQ,
+    OP_CMPGT,
+} Op;
+
+typedef void RunFn(Vec *r, const Vec *a, const Vec *b);
+
+typedef struct {
+    const char *name;
+    Op op;
+    int esize;
+    RunFn *xmm_reg, *xmm_mem, *xmm_same;
+    RunFn *mmx_reg, *mmx_mem, *mmx_same;
+} Insn;
+
+#define RUN_XMM(insn, src)                                          \
+    asm volatile("movdqa %1, %%xmm0\n\t"                            \
+                 "movdqa %2, %%xmm1\n\t"                            \
+                 #insn " " src ", %%xmm0\n\t"                       \
+                 "movdqa %%xmm0, %0"                                \
+                 : "=m" (*r) : "m" (*a), "m" (*b) : "xmm0", "xmm1")
+
+#define RUN_MMX(insn, src)                                          \
+    asm volatile("movq %1, %%mm0\n\t"                               \
+                 "movq %2, %%mm1\n\t"                               \
+                 #insn " " src ", %%mm0\n\t"                        \
+                 "movq %%mm0, %0\n\t"                               \
+                 "emms"                                             \
+                 : "=m" (r->q[0]) : "m" (a->q[0]), "m" (b->q[0])    \
+                 : "mm0", "mm1")
+
+#define DEF_INSN(insn)                                              \
+static void xmm_reg_##insn(Vec *r, const Vec *a, const Vec *b)      \
+{                                                                   \
+    RUN_XMM(insn, "%%xmm1");                                        \
+}                                                                   \
+static void xmm_mem_##insn(Vec *r, const Vec *a, const Vec *b)      \
+{                                                                   \
+    RUN_XMM(insn, "%2");                                            \
+}                                                                   \
+static void xmm_same_##insn(Vec *r, const Vec *a, const Vec *b)     \
+{                                                                   \
+    RUN_XMM(insn, "%%xmm0");                                        \
+}                                                                   \
+static void mmx_reg_##insn(Vec *r, const Vec *a, const Vec *b)      \
+{                                                                   \
+    RUN_MMX(insn, "%%mm1");                                         \
+}                                                                   \
+static void mmx_mem_##insn(Vec *r, const Vec *a, const Vec *b)      \
+{                                                                   \
+    RUN_MMX(insn, "%2");                                            \
+}                                                                   \
+static void mmx_same_##insn(Vec *r, const Vec *a, const Vec *b)     \
+{                                                                   \
+    RUN_MMX(insn, "%%mm0");                                         \
+}
+
+#define INSN(insn, op, esize)                                       \
+    { #insn, op, esize,                                             \
+      xmm_reg_##insn, xmm_mem_##insn, xmm_same_##insn,              \
+      mmx_reg_##insn, mmx_mem_##insn, mmx_same_##insn }
+
+DEF_INSN(pand)
+DEF_INSN(pandn)
+DEF_INSN(por)
+DEF_INSN(pxor)
+DEF_INSN(paddb)
+DEF_INSN(paddw)
+DEF_INSN(paddd)
+DEF_INSN(paddq)
+DEF_INSN(psubb)
+DEF_INSN(psubw)
+DEF_INSN(psubd)
+DEF_INSN(psubq)
+DEF_INSN(pcmpeqb)
+DEF_INSN(pcmpeqw)
+DEF_INSN(pcmpeqd)
+DEF_INSN(pcmpgtb)
+DEF_INSN(pcmpgtw)
+DEF_INSN(pcmpgtd)
+
+static const Insn insns[] = {
+    INSN(pand, OP_AND, 8),
+    INSN(pandn, OP_ANDN, 8),
+    INSN(por, OP_OR, 8),
+    INSN(pxor, OP_XOR, 8),
+    INSN(paddb, OP_ADD, 1),
+    INSN(paddw, OP_ADD, 2),
+    INSN(paddd, OP_ADD, 4),
+    INSN(paddq, OP_ADD, 8),
+    INSN(psubb, OP_SUB, 1),
+    INSN(psubw, OP_SUB, 2),
+    INSN(psubd, OP_SUB, 4),
+    INSN(psubq, OP_SUB, 8),
+    INSN(pcmpeqb, OP_CMPEQ, 1),
+    INSN(pcmpeqw, OP_CMPEQ, 2),
+    INSN(pcmpeqd, OP_CMPEQ, 4),
+    INSN(pcmpgtb, OP_CMPGT, 1),
+    INSN(pcmpgtw, OP_CMPGT, 2),
+    INSN(pcmpgtd, OP_CMPGT, 4),
+};
+
+static uint64_t get_elem(const Vec *v, int i, int esize)
+{
+    uint64_t x = 0;
+
+    memcpy(&x, &v->b[i * esize], esize);
+    return x;
+}
+
+static void set_elem(Vec *v, int i, int esize, uint64_t x)
+{
+    memcpy(&v->b[i * esize], &x, esize);
+}
+
+static int64_t sext(uint64_t x, int esize)
+{
+    int shift = 64 - esize * 8;
+
+    return (int64_t)(x << shift) >> shift;
+}
+
+/* What the helper computes for the first @size bytes: d = d op s */
+static void reference(const Insn *insn, Vec *r, const Vec *d, const Vec *s,
+                      int size)
+{
+    uint64_t mask = insn->esize == 8 ? -1ULL : (1ULL << insn->esize * 8) - 1;
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    for (i = 0; i < size / insn->esize; i++) {
+        uint64_t x = get_elem(d, i, insn->esize);
+        uint64_t y = get_elem(s, i, insn->esize);
+        uint64_t z = 0;
+
+        switch (insn->op) {
+        case OP_AND:
+            z = x & y;
+            break;
+        case OP_ANDN:
+            z = ~x & y;
+            break;
+        case OP_OR:
+            z = x | y;
+            break;
+        case OP_XOR:
+            z = x ^ y;
+            break;
+        case OP_ADD:
+            z = x + y;
+            break;
+        case OP_SUB:
+            z = x - y;
+            break;
+        case OP_CMPEQ:
+            z = x == y ? -1 : 0;
+            break;
+        case OP_CMPGT:
+            z = sext(x, insn->esize) > sext(y, insn->esize) ? -1 : 0;
+            break;
+        }
+        set_elem(r, i, insn->esize, z & mask);
+    }
+}
+
+static int check(const Insn *insn, const char *form, RunFn *run,
+                 const Vec *a, const Vec *b, int size, int same)
+{
+    Vec r, expected;
+
+    memset(&r, 0, sizeof(r));
+    run(&r, a, b);
+    reference(insn, &expected, a, same ? a : b, size);
+    if (memcmp(&r, &expected, size)) {
+        printf("%s %s: a=%016llx%016llx b=%016llx%016llx\n"
+               "  got %016llx%016llx expected %016llx%016llx\n",
+               insn->name, form,
+               (unsigned long long)a->q[1], (unsigned long long)a->q[0],
+               (unsigned long long)b->q[1], (unsigned long long)b->q[0],
+               (unsigned long long)r.q[1], (unsigned long long)r.q[0],
+               (unsigned long long)expected.q[1],
+               (unsigned long long)expected.q[0]);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_all(const Vec *a, const Vec *b)
+{
+    int i, err = 0;
+
+    for (i = 0; i < sizeof(insns) / sizeof(insns[0]); i++) {
+        const Insn *insn = &insns[i];
+
+        err |= check(insn, "xmm, xmm", insn->xmm_reg, a, b, 16, 0);
+        err |= check(insn, "m128, xmm", insn->xmm_mem, a, b, 16, 0);
+        err |= check(insn, "xmm, same xmm", insn->xmm_same, a, b, 16, 1);
+        err |= check(insn, "mm, mm", insn->mmx_reg, a, b, 8, 0);
+        err |= check(insn, "m64, mm", insn->mmx_mem, a, b, 8, 0);
+        err |= check(insn, "mm, same mm", insn->mmx_same, a, b, 8, 1);
+    }
+    return err;
+}
+
+static uint64_t rand64(void)
+{
+    static uint64_t state = 0x2545f4914f6cdd1dULL;
+
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+int main(void)
+{
+    /* Carries, sign changes and equal elements of every size */
+    static const uint64_t boundary[] = {
+        0, -1ULL, 0x8080808080808080ULL, 0x7f7f7f7f7f7f7f7fULL,
+        0x8000800080008000ULL, 0x7fff7fff7fff7fffULL,
+        0x8000000080000000ULL, 0x7fffffff7fffffffULL,
+        0x0001000100010001ULL, 0x0100ff0080017ffeULL,
+    };
+    int n = sizeof(boundary) / sizeof(boundary[0]);
+    Vec a, b;
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            a.q[0] = boundary[i];
+            a.q[1] = boundary[j];
+            b.q[0] = boundary[j];
+            b.q[1] = boundary[i];
+            if (check_all(&a, &b)) {
+                return 1;
+            }
+        }
+    }
+    for (i = 0; i < NR_RANDOM; i++) {
+        a.q[0] = rand64();
+        a.q[1] = rand64();
+        b.q[0] = rand64();
+        b.q[1] = rand64();
+        /* Make some of the elements equal for the comparisons */
+        if (i & 1) {
+            b.q[i & 2 ? 1 : 0] = a.q[i & 2 ? 1 : 0] ^
+                                 (rand64() & 0xff00ff00ff00ff00ULL);
+        }
+        if (check_all(&a, &b)) {
+            return 1;
+        }
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -827,6 +827,29 @@ static void test_source_timer_schedule(void)
     timer_del(&data.timer);
 }
 
+static void test_bounce_buf(void)
+{
+    void *buf, *buf2;
+
+    /* Freed buffers of a pooled size are reused */
+    buf = aio_bounce_buf_get(ctx, 4096, 4096);
+    g_assert(QEMU_PTR_IS_ALIGNED(buf, 4096));
+    aio_bounce_buf_put(ctx, buf, 4096, 4096);
+    buf2 = aio_bounce_buf_get(ctx, 3000, 512);
+    g_assert(buf2 == buf);
+    aio_bounce_buf_put(ctx, buf2, 3000, 512);
+
+    /* Small buffers are aligned to their size */
+    buf = aio_bounce_buf_get(ctx, 512, 512);
+    g_assert(QEMU_PTR_IS_ALIGNED(buf, 512));
+    aio_bounce_buf_put(ctx, buf, 512, 512);
+
+    /* Large buffers are not pooled */
+    buf = aio_bounce_buf_try_get(ctx, AIO_BOUNCE_MAX_SIZE + 1, 4096);
+    g_assert(buf);
+    g_assert(QEMU_PTR_IS_ALIGNED(buf, 4096));
+    aio_bounce_buf_put(ctx, buf, AIO_BOUNCE_MAX_SIZE + 1, 4096);
+}
 
 /* End of tests.  */
 
@@ -863,6 +886,7 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+    g_test_add_func("/aio/bounce-buf",              test_bounce_buf);
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
     g_test_add_func("/aio-gsource/bh/schedule",             test_source_bh_schedule);
@@ -0,0 +1,215 @@
+/*
+ * Bitmap counting and dirty bitmap sync unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * slow_bitmap_count_one() and bitmap_sync_blocks_atomic() are compared
+ * with the word-by-word loops that they replaced.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/host-utils.h"
+
+#define NWORDS      300
+#define N_BLOCKS    16
+
+typedef enum {
+    FILL_RANDOM,
+    FILL_SPARSE,
+    FILL_ONES,
+} FillMode;
+
+static void fill(GRand *rand, unsigned long *map, long nwords, FillMode mode)
+{
+    long i;
+
+    for (i = 0; i < nwords; i++) {
+        unsigned long w = (unsigned long)g_rand_int(rand) << 31 << 1 |
+                          g_rand_int(rand);
+
+        switch (mode) {
+        case FILL_RANDOM:
+            map[i] = w;
+            break;
+        case FILL_SPARSE:
+            /* Mostly clean, so that whole batches are skipped */
+            map[i] = g_rand_int_range(rand, 0, 100) < 3 ? w : 0;
+            break;
+        case FILL_ONES:
+            map[i] = ~0UL;
+            break;
+        }
+    }
+}
+
+static long ref_count_one(const unsigned long *map, long nbits)
+{
+    long k, lim = nbits / BITS_PER_LONG, result = 0;
+
+    for (k = 0; k < lim; k++) {
+        result += ctpopl(map[k]);
+    }
+    if (nbits % BITS_PER_LONG) {
+        result += ctpopl(map[k] & BITMAP_LAST_WORD_MASK(nbits));
+    }
+    return result;
+}
+
+static void check_count_one(const unsigned long *map, long nbits)
+{
+    long expected = ref_count_one(map, nbits);
+
+    g_assert_cmpint(bitmap_count_one(map, nbits), ==, expected);
+    g_assert_cmpint(slow_bitmap_count_one(map, nbits), ==, expected);
+}
+
+static void test_count_one(void)
+{
+    GRand *rand = g_rand_new_with_seed(g_test_rand_int());
+    unsigned long map[NWORDS];
+    FillMode mode;
+    long start, nbits, w;
+
+    for (mode = FILL_RANDOM; mode <= FILL_ONES; mode++) {
+        fill(rand, map, NWORDS, mode);
+
+        /* Bitmaps that do not start at an aligned group of words */
+        for (start = 0; start < 5; start++) {
+            long max_words = NWORDS - start;
+
+            /* Like the other inline operations, nbits must not be 0 */
+            for (nbits = 1; nbits <= 3 * BITS_PER_LONG + 1; nbits++) {
+                check_count_one(map + start, nbits);
+            }
+
+            /* Partial final words, and lengths around multiples of 4 */
+            for (w = 0; w < max_words; w++) {
+                check_count_one(map + start, (w + 1) * BITS_PER_LONG);
+                check_count_one(map + start, w * BITS_PER_LONG + 1);
+                check_count_one(map + start,
+                                w * BITS_PER_LONG + g_rand_int_range(
+                                    rand, 1, BITS_PER_LONG));
+                check_count_one(map + start, (w + 1) * BITS_PER_LONG - 1);
+            }
+        }
+    }
+    g_rand_free(rand);
+}
+
+/*
+ * The loop in cpu_physical_memory_sync_dirty_bitmap() before
+ * bitmap_sync_blocks_atomic() was introduced.
+ */
+static uint64_t ref_sync(unsigned long *dst, unsigned long *const *src,
+                         unsigned long block_words, unsigned long start,
+                         long nwords, uint64_t *src_count)
+{
+    unsigned long idx = start / block_words;
+    unsigned long offset = start % block_words;
+    uint64_t num_dirty = 0;
+    long k;
+
+    for (k = 0; k < nwords; k++) {
+        if (src[idx][offset]) {
+            unsigned long bits = src[idx][offset];
+            unsigned long new_dirty;
+
+            src[idx][offset] = 0;
+            *src_count += ctpopl(bits);
+            new_dirty = ~dst[k];
+            dst[k] |= bits;
+            new_dirty &= bits;
+            num_dirty += ctpopl(new_dirty);
+        }
+        if (++offset >= block_words) {
+            offset = 0;
+            idx++;
+        }
+    }
+    return num_dirty;
+}
+
+static void check_sync(GRand *rand, unsigned long block_words,
+                       unsigned long start, long nwords, FillMode mode)
+{
+    unsigned long *src[N_BLOCKS], *ref_src[N_BLOCKS];
+    unsigned long dst[NWORDS + 1], ref_dst[NWORDS + 1];
+    uint64_t count = 0, ref_count = 0, dirty, ref_dirty;
+    int i;
+
+    g_assert_cmpuint(start + nwords, <=, block_words * N_BLOCKS);
+    g_assert_cmpint(nwords, <=, NWORDS);
+
+    for (i = 0; i < N_BLOCKS; i++) {
+        src[i] = g_new(unsigned long, block_words);
+        fill(rand, src[i], block_words, mode);
+        ref_src[i] = g_memdup(src[i], block_words * sizeof(unsigned long));
+    }
+    fill(rand, dst, NWORDS + 1, FILL_RANDOM);
+    memcpy(ref_dst, dst, sizeof(dst));
+
+    dirty = bitmap_sync_blocks_atomic(dst, src, block_words, start, nwords,
+                                      &count);
+    ref_dirty = ref_sync(ref_dst, ref_src, block_words, start, nwords,
+                         &ref_count);
+
+    g_assert_cmpuint(dirty, ==, ref_dirty);
+    g_assert_cmpuint(count, ==, ref_count);
+
+    /* Nothing is touched past the requested words */
+    g_assert(memcmp(dst, ref_dst, sizeof(dst)) == 0);
+    for (i = 0; i < N_BLOCKS; i++) {
+        g_assert(memcmp(src[i], ref_src[i],
+                        block_words * sizeof(unsigned long)) == 0);
+        g_free(src[i]);
+        g_free(ref_src[i]);
+    }
+}
+
+static void test_sync_blocks(void)
+{
+    static const unsigned long block_words[] = { 1, 3, 63, 64, 65, 200 };
+    static const long nwords[] = { 0, 1, 2, 63, 64, 65, 127, 129, 300 };
+    GRand *rand = g_rand_new_with_seed(g_test_rand_int());
+    FillMode mode;
+    int b, n;
+
+    for (mode = FILL_RANDOM; mode <= FILL_ONES; mode++) {
+        for (b = 0; b < ARRAY_SIZE(block_words); b++) {
+            unsigned long bw = block_words[b];
+
+            for (n = 0; n < ARRAY_SIZE(nwords); n++) {
+                unsigned long max_start, starts[7];
+                int s;
+
+                if (bw * N_BLOCKS < nwords[n]) {
+                    continue;
+                }
+                max_start = bw * N_BLOCKS - nwords[n];
+                starts[0] = 0;
+                starts[1] = 1;
+                starts[2] = bw - 1;
+                starts[3] = bw;
+                starts[4] = bw + 1;
+                starts[5] = 2 * bw - 1;
+                starts[6] = g_rand_int_range(rand, 0, max_start + 1);
+                for (s = 0; s < ARRAY_SIZE(starts); s++) {
+                    if (starts[s] <= max_start) {
+                        check_sync(rand, bw, starts[s], nwords[n], mode);
+                    }
+                }
+            }
+        }
+    }
+    g_rand_free(rand);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/bitmap/count-one", test_count_one);
+    g_test_add_func("/bitmap/sync-blocks", test_sync_blocks);
+    return g_test_run();
+}
@@ -24,6 +24,7 @@
 #include "crypto/block.h"
 #include "qemu/buffer.h"
 #include "crypto/secret.h"
+#include "qemu/thread.h"
 #ifndef _WIN32
 #include <sys/resource.h>
 #endif
@@ -272,6 +273,81 @@ static void test_block_assert_setup(const struct QCryptoBlockTestData *data,
 }
 
 
+#define TEST_BLOCK_THREADS 4
+#define TEST_BLOCK_THREAD_BYTES (64 * 1024)
+
+typedef struct TestBlockThread {
+    QCryptoBlock *blk;
+    uint64_t offset;
+    const uint8_t *plain;
+    const uint8_t *cipher;
+    bool ok;
+} TestBlockThread;
+
+static void *test_block_thread(void *opaque)
+{
+    TestBlockThread *t = opaque;
+    uint8_t *buf = g_malloc(TEST_BLOCK_THREAD_BYTES);
+    int i;
+
+    t->ok = true;
+    for (i = 0; i < 16 && t->ok; i++) {
+        memcpy(buf, t->plain, TEST_BLOCK_THREAD_BYTES);
+        if (qcrypto_block_encrypt(t->blk, t->offset, buf,
+                                  TEST_BLOCK_THREAD_BYTES, NULL) < 0 ||
+            memcmp(buf, t->cipher, TEST_BLOCK_THREAD_BYTES) != 0 ||
+            qcrypto_block_decrypt(t->blk, t->offset, buf,
+                                  TEST_BLOCK_THREAD_BYTES, NULL) < 0 ||
+            memcmp(buf, t->plain, TEST_BLOCK_THREAD_BYTES) != 0) {
+            t->ok = false;
+        }
+    }
+
+    g_free(buf);
+    return NULL;
+}
+
+/*
+ * Encrypt and decrypt from several threads at once, each of them working
+ * on its own part of the volume, and compare with the single-threaded
+ * result.
+ */
+static void test_block_concurrent(QCryptoBlock *blk)
+{
+    size_t len = TEST_BLOCK_THREADS * TEST_BLOCK_THREAD_BYTES;
+    uint8_t *plain = g_malloc(len);
+    uint8_t *cipher = g_malloc(len);
+    QemuThread threads[TEST_BLOCK_THREADS];
+    TestBlockThread data[TEST_BLOCK_THREADS];
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        plain[i] = i * 7;
+    }
+    memcpy(cipher, plain, len);
+    g_assert(qcrypto_block_encrypt(blk, 0, cipher, len, &error_abort) == 0);
+
+    for (i = 0; i < TEST_BLOCK_THREADS; i++) {
+        data[i] = (TestBlockThread) {
+            .blk = blk,
+            .offset = i * TEST_BLOCK_THREAD_BYTES,
+            .plain = plain + i * TEST_BLOCK_THREAD_BYTES,
+            .cipher = cipher + i * TEST_BLOCK_THREAD_BYTES,
+        };
+        qemu_thread_create(&threads[i], "test-crypto-block",
+                           test_block_thread, &data[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < TEST_BLOCK_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+        g_assert(data[i].ok);
+    }
+
+    g_free(plain);
+    g_free(cipher);
+}
+
+
 static void test_block(gconstpointer opaque)
 {
     const struct QCryptoBlockTestData *data = opaque;
@@ -305,6 +381,7 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              0,
+                             1,
                              NULL);
     g_assert(blk == NULL);
 
@@ -313,6 +390,7 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              QCRYPTO_BLOCK_OPEN_NO_IO,
+                             1,
                              &error_abort);
 
     g_assert(qcrypto_block_get_cipher(blk) == NULL);
@@ -327,10 +405,12 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              0,
+                             TEST_BLOCK_THREADS,
                              &error_abort);
     g_assert(blk);
 
     test_block_assert_setup(data, blk);
+    test_block_concurrent(blk);
 
     qcrypto_block_free(blk);
 
@@ -0,0 +1,307 @@
+/*
+ * Interval tree unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define N_NODES   256
+#define N_OPS     20000
+#define N_QUERIES 8
+#define MAX_START 4096
+#define MAX_LEN   256
+
+typedef struct TestNode {
+    IntervalTreeNode node;
+    bool in_tree;
+    bool seen;
+} TestNode;
+
+static IntervalTree tree;
+static TestNode nodes[N_NODES];
+
+/* Check the AVL and augmentation invariants; returns the subtree height */
+static int check_subtree(IntervalTreeNode *n, IntervalTreeNode *lo,
+                         IntervalTreeNode *hi, size_t *count)
+{
+    int lh, rh;
+    uint64_t end;
+
+    if (!n) {
+        return 0;
+    }
+    g_assert(!lo || lo->start <= n->start);
+    g_assert(!hi || n->start <= hi->start);
+
+    lh = check_subtree(n->left, lo, n, count);
+    rh = check_subtree(n->right, n, hi, count);
+    g_assert_cmpint(abs(lh - rh), <=, 1);
+    g_assert_cmpint(n->height, ==, 1 + MAX(lh, rh));
+
+    end = n->end;
+    if (n->left) {
+        end = MAX(end, n->left->subtree_end);
+    }
+    if (n->right) {
+        end = MAX(end, n->right->subtree_end);
+    }
+    g_assert_cmpuint(n->subtree_end, ==, end);
+
+    (*count)++;
+    return n->height;
+}
+
+static void check_tree(void)
+{
+    size_t count = 0, expected = 0;
+    int i;
+
+    check_subtree(tree.root, NULL, NULL, &count);
+    for (i = 0; i < N_NODES; i++) {
+        expected += nodes[i].in_tree;
+    }
+    g_assert_cmpuint(count, ==, expected);
+    g_assert(interval_tree_is_empty(&tree) == !expected);
+}
+
+static void insert(TestNode *t, uint64_t start, uint64_t end)
+{
+    g_assert(!t->in_tree);
+    t->node.start = start;
+    t->node.end = end;
+    t->in_tree = true;
+    interval_tree_insert(&tree, &t->node);
+}
+
+static void remove_node(TestNode *t)
+{
+    g_assert(t->in_tree);
+    t->in_tree = false;
+    interval_tree_remove(&tree, &t->node);
+}
+
+static void reset(void)
+{
+    interval_tree_init(&tree);
+    memset(nodes, 0, sizeof(nodes));
+}
+
+typedef struct QueryState {
+    uint64_t last_start;
+    size_t count;
+    IntervalTreeNode *stop_at;
+} QueryState;
+
+static bool visit(IntervalTreeNode *node, void *opaque)
+{
+    TestNode *t = container_of(node, TestNode, node);
+    QueryState *qs = opaque;
+
+    g_assert(t->in_tree);
+    g_assert(!t->seen);
+    g_assert_cmpuint(node->start, >=, qs->last_start);
+    t->seen = true;
+    qs->last_start = node->start;
+    qs->count++;
+    return node == qs->stop_at;
+}
+
+/* Look up [start, end) and compare the result with a linear scan */
+static size_t query(uint64_t start, uint64_t end)
+{
+    QueryState qs = { 0 };
+    size_t expected = 0;
+    int i;
+
+    g_assert(interval_tree_find_overlap(&tree, start, end, visit, &qs) ==
+             NULL);
+    for (i = 0; i < N_NODES; i++) {
+        TestNode *t = &nodes[i];
+        bool overlaps = t->in_tree &&
+                        t->node.start < end && start < t->node.end;
+
+        g_assert(t->seen == overlaps);
+        t->seen = false;
+        expected += overlaps;
+    }
+    g_assert_cmpuint(qs.count, ==, expected);
+    return expected;
+}
+
+static void test_empty(void)
+{
+    reset();
+    g_assert(interval_tree_is_empty(&tree));
+    g_assert_cmpuint(query(0, UINT64_MAX), ==, 0);
+}
+
+static void test_edges(void)
+{
+    reset();
+    insert(&nodes[0], 10, 20);
+    insert(&nodes[1], 20, 30);
+    insert(&nodes[2], 40, 41);
+    check_tree();
+
+    /* Half-open intervals: touching ranges do not overlap */
+    g_assert_cmpuint(query(0, 10), ==, 0);
+    g_assert_cmpuint(query(30, 40), ==, 0);
+    g_assert_cmpuint(query(41, 100), ==, 0);
+    g_assert_cmpuint(query(9, 10), ==, 0);
+
+    g_assert_cmpuint(query(9, 11), ==, 1);
+    g_assert_cmpuint(query(10, 11), ==, 1);
+    g_assert_cmpuint(query(19, 20), ==, 1);
+    g_assert_cmpuint(query(19, 21), ==, 2);
+    g_assert_cmpuint(query(29, 40), ==, 1);
+    g_assert_cmpuint(query(40, 41), ==, 1);
+    g_assert_cmpuint(query(0, UINT64_MAX), ==, 3);
+
+    /* Identical intervals are all reported */
+    insert(&nodes[3], 10, 20);
+    insert(&nodes[4], 10, 20);
+    check_tree();
+    g_assert_cmpuint(query(15, 16), ==, 3);
+}
+
+static void test_stop(void)
+{
+    QueryState qs = { 0 };
+    int i;
+
+    reset();
+    for (i = 0; i < 16; i++) {
+        insert(&nodes[i], i * 10, i * 10 + 15);
+    }
+    check_tree();
+
+    /* The search ends at the node for which the callback returns true */
+    qs.stop_at = &nodes[5].node;
+    g_assert(interval_tree_find_overlap(&tree, 0, UINT64_MAX, visit, &qs) ==
+             &nodes[5].node);
+    g_assert_cmpuint(qs.count, ==, 6);
+    for (i = 0; i < 16; i++) {
+        g_assert(nodes[i].seen == (i <= 5));
+        nodes[i].seen = false;
+    }
+}
+
+/*
+ * Build the tree 20 (10 (5), 30) and check its shape, so that the removal
+ * tests below really hit the case they are named after.
+ */
+static void build_small_tree(void)
+{
+    reset();
+    insert(&nodes[0], 20, 25);
+    insert(&nodes[1], 10, 15);
+    insert(&nodes[2], 30, 35);
+    insert(&nodes[3], 5, 50);
+    check_tree();
+
+    g_assert(tree.root == &nodes[0].node);
+    g_assert(nodes[0].node.left == &nodes[1].node);
+    g_assert(nodes[0].node.right == &nodes[2].node);
+    g_assert(nodes[1].node.left == &nodes[3].node);
+    g_assert(!nodes[1].node.right);
+    g_assert(!nodes[2].node.left && !nodes[2].node.right);
+}
+
+static void check_small_tree(void)
+{
+    check_tree();
+    g_assert_cmpuint(query(0, 5), ==, 0);
+    g_assert_cmpuint(query(5, 6), ==, nodes[3].in_tree);
+    g_assert_cmpuint(query(12, 13), ==, nodes[1].in_tree + nodes[3].in_tree);
+    g_assert_cmpuint(query(22, 23), ==, nodes[0].in_tree + nodes[3].in_tree);
+    g_assert_cmpuint(query(32, 33), ==, nodes[2].in_tree + nodes[3].in_tree);
+    g_assert_cmpuint(query(40, 60), ==, nodes[3].in_tree);
+}
+
+static void test_remove_leaf(void)
+{
+    build_small_tree();
+    remove_node(&nodes[2]);
+    check_small_tree();
+
+    /* Removing the leaf that holds the largest end shrinks subtree_end */
+    remove_node(&nodes[3]);
+    check_small_tree();
+    g_assert_cmpuint(tree.root->subtree_end, ==, 25);
+}
+
+static void test_remove_one_child(void)
+{
+    build_small_tree();
+    remove_node(&nodes[1]);
+    check_small_tree();
+    g_assert(nodes[0].node.left == &nodes[3].node);
+}
+
+static void test_remove_two_children(void)
+{
+    build_small_tree();
+    remove_node(&nodes[0]);
+    check_small_tree();
+    g_assert(tree.root != &nodes[0].node);
+
+    remove_node(&nodes[3]);
+    remove_node(&nodes[1]);
+    remove_node(&nodes[2]);
+    check_small_tree();
+    g_assert(interval_tree_is_empty(&tree));
+}
+
+static void test_random(void)
+{
+    GRand *rand = g_rand_new_with_seed(g_test_rand_int());
+    int op, q;
+
+    reset();
+    for (op = 0; op < N_OPS; op++) {
+        TestNode *t = &nodes[g_rand_int_range(rand, 0, N_NODES)];
+
+        if (t->in_tree) {
+            remove_node(t);
+        } else {
+            uint64_t start = g_rand_int_range(rand, 0, MAX_START);
+
+            /* Lengths include 0, for empty intervals */
+            insert(t, start, start + g_rand_int_range(rand, 0, MAX_LEN));
+        }
+
+        if (op % 16 == 0) {
+            check_tree();
+        }
+        for (q = 0; q < N_QUERIES; q++) {
+            uint64_t start = g_rand_int_range(rand, 0, MAX_START + MAX_LEN);
+
+            query(start, start + g_rand_int_range(rand, 1, 2 * MAX_LEN));
+        }
+    }
+
+    for (op = 0; op < N_NODES; op++) {
+        if (nodes[op].in_tree) {
+            remove_node(&nodes[op]);
+        }
+    }
+    check_tree();
+    g_rand_free(rand);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/empty", test_empty);
+    g_test_add_func("/interval-tree/edges", test_edges);
+    g_test_add_func("/interval-tree/stop", test_stop);
+    g_test_add_func("/interval-tree/remove/leaf", test_remove_leaf);
+    g_test_add_func("/interval-tree/remove/one-child", test_remove_one_child);
+    g_test_add_func("/interval-tree/remove/two-children",
+                    test_remove_two_children);
+    g_test_add_func("/interval-tree/random", test_random);
+    return g_test_run();
+}
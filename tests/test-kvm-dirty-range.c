@@ -0,0 +1,141 @@
+/*
+ * KVM dirty ring range coalescing unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "sysemu/kvm_dirty_range.h"
+
+#define NR_AS       2
+#define NR_SLOTS    4
+
+typedef struct DirtyCall {
+    uint32_t as_id;
+    uint32_t slot_id;
+    uint64_t start;
+    uint64_t npages;
+} DirtyCall;
+
+typedef struct TestRings {
+    /* Pages per memslot; 0 if it does not exist */
+    uint64_t pages[NR_AS][NR_SLOTS];
+    DirtyCall calls[16];
+    int nr_calls;
+} TestRings;
+
+static uint64_t test_slot_pages(void *opaque, uint32_t as_id,
+                                uint32_t slot_id)
+{
+    TestRings *t = opaque;
+
+    g_assert_cmpuint(as_id, <, NR_AS);
+    g_assert_cmpuint(slot_id, <, NR_SLOTS);
+    return t->pages[as_id][slot_id];
+}
+
+static void test_set_dirty(void *opaque, uint32_t as_id, uint32_t slot_id,
+                           uint64_t start, uint64_t npages)
+{
+    TestRings *t = opaque;
+
+    g_assert_cmpint(t->nr_calls, <, ARRAY_SIZE(t->calls));
+    g_assert_cmpuint(npages, >, 0);
+    t->calls[t->nr_calls++] = (DirtyCall) { as_id, slot_id, start, npages };
+}
+
+static const KVMDirtyRangeOps test_ops = {
+    .slot_pages = test_slot_pages,
+    .set_dirty = test_set_dirty,
+};
+
+static void test_init(TestRings *t, KVMDirtyRange *range)
+{
+    memset(t, 0, sizeof(*t));
+    t->pages[0][0] = 16;
+    t->pages[0][1] = 8;
+    t->pages[1][0] = 4;
+    kvm_dirty_range_init(range, &test_ops, t, NR_AS, NR_SLOTS);
+}
+
+static void check_call(TestRings *t, int i, uint32_t as_id, uint32_t slot_id,
+                       uint64_t start, uint64_t npages)
+{
+    g_assert_cmpint(i, <, t->nr_calls);
+    g_assert_cmpuint(t->calls[i].as_id, ==, as_id);
+    g_assert_cmpuint(t->calls[i].slot_id, ==, slot_id);
+    g_assert_cmpuint(t->calls[i].start, ==, start);
+    g_assert_cmpuint(t->calls[i].npages, ==, npages);
+}
+
+static void test_merge(void)
+{
+    TestRings t;
+    KVMDirtyRange range;
+
+    test_init(&t, &range);
+
+    /* Consecutive pages of a memslot are one range */
+    kvm_dirty_range_add(&range, 0, 3);
+    kvm_dirty_range_add(&range, 0, 4);
+    kvm_dirty_range_add(&range, 0, 5);
+    g_assert_cmpint(t.nr_calls, ==, 0);
+
+    /* A gap, or going backwards, starts a new range */
+    kvm_dirty_range_add(&range, 0, 7);
+    check_call(&t, 0, 0, 0, 3, 3);
+    kvm_dirty_range_add(&range, 0, 6);
+    check_call(&t, 1, 0, 0, 7, 1);
+
+    /* So does the same offset in another memslot or address space */
+    kvm_dirty_range_add(&range, 1, 7);
+    check_call(&t, 2, 0, 0, 6, 1);
+    kvm_dirty_range_add(&range, 1 << 16, 2);
+    check_call(&t, 3, 0, 1, 7, 1);
+    kvm_dirty_range_add(&range, 1 << 16, 3);
+    g_assert_cmpint(t.nr_calls, ==, 4);
+
+    kvm_dirty_range_flush(&range);
+    check_call(&t, 4, 1, 0, 2, 2);
+
+    /* Flushing twice, or an empty range, does nothing */
+    kvm_dirty_range_flush(&range);
+    g_assert_cmpint(t.nr_calls, ==, 5);
+}
+
+static void test_bounds(void)
+{
+    TestRings t;
+    KVMDirtyRange range;
+
+    test_init(&t, &range);
+    kvm_dirty_range_add(&range, 0, 14);
+
+    /* Past the end of the memslot */
+    kvm_dirty_range_add(&range, 0, 16);
+    kvm_dirty_range_add(&range, 0, UINT64_MAX);
+    kvm_dirty_range_add(&range, 1 << 16, 4);
+
+    /* Memslots and address spaces that do not exist */
+    kvm_dirty_range_add(&range, 2, 0);
+    kvm_dirty_range_add(&range, NR_SLOTS, 0);
+    kvm_dirty_range_add(&range, 0xffff, 0);
+    kvm_dirty_range_add(&range, NR_AS << 16, 0);
+    kvm_dirty_range_add(&range, 0xffff0000, 0);
+    g_assert_cmpint(t.nr_calls, ==, 0);
+
+    /* Dropped entries do not split the pending range */
+    kvm_dirty_range_add(&range, 0, 15);
+    kvm_dirty_range_flush(&range);
+    g_assert_cmpint(t.nr_calls, ==, 1);
+    check_call(&t, 0, 0, 0, 14, 2);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/kvm/dirty-range/merge", test_merge);
+    g_test_add_func("/kvm/dirty-range/bounds", test_bounds);
+    return g_test_run();
+}
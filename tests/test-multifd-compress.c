@@ -0,0 +1,146 @@
+/*
+ * Multifd stream compression unit tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "../migration/multifd-compress.h"
+
+#define PAGE_SIZE 4096
+#define MAX_PAGES 64
+
+/* Pages that look alike, so that the stream history helps */
+static void fill_pages(uint8_t *buf, int npages, int seed)
+{
+    int i;
+
+    for (i = 0; i < npages * PAGE_SIZE; i++) {
+        if (i % PAGE_SIZE < 256) {
+            buf[i] = g_test_rand_int();
+        } else {
+            buf[i] = (i % PAGE_SIZE) * 7 + seed;
+        }
+    }
+}
+
+static void setup_iov(struct iovec *iov, uint8_t *buf, int npages)
+{
+    int i;
+
+    for (i = 0; i < npages; i++) {
+        iov[i].iov_base = buf + i * PAGE_SIZE;
+        iov[i].iov_len = PAGE_SIZE;
+    }
+}
+
+/* Several packets of one stream, as a channel would send them */
+static void test_roundtrip(const void *opaque)
+{
+    MultiFDCompression method = GPOINTER_TO_INT(opaque);
+    MultiFDCompressor *c, *d;
+    size_t bound = multifd_compress_bound(method, MAX_PAGES * PAGE_SIZE);
+    uint8_t *src = g_malloc(MAX_PAGES * PAGE_SIZE);
+    uint8_t *dst = g_malloc(MAX_PAGES * PAGE_SIZE);
+    uint8_t *zbuf = g_malloc(bound);
+    struct iovec siov[MAX_PAGES], diov[MAX_PAGES];
+    size_t in = 0, out = 0;
+    int i;
+
+    c = multifd_compressor_new(method, true, 1, &error_abort);
+    d = multifd_compressor_new(method, false, 0, &error_abort);
+
+    for (i = 0; i < 100; i++) {
+        int npages = g_test_rand_int_range(1, MAX_PAGES + 1);
+        ssize_t len;
+
+        if (i % 10 == 9) {
+            /* incompressible data must fit too */
+            int j;
+
+            for (j = 0; j < npages * PAGE_SIZE; j++) {
+                src[j] = g_test_rand_int();
+            }
+        } else {
+            fill_pages(src, npages, i);
+        }
+        setup_iov(siov, src, npages);
+        setup_iov(diov, dst, npages);
+
+        len = multifd_compress(c, siov, npages, zbuf, bound, &error_abort);
+        g_assert_cmpint(len, >, 0);
+        g_assert_cmpuint(len, <=, bound);
+
+        memset(dst, 0xaa, npages * PAGE_SIZE);
+        g_assert_cmpint(multifd_decompress(d, zbuf, len, diov, npages,
+                                           &error_abort), ==, 0);
+        g_assert(memcmp(src, dst, npages * PAGE_SIZE) == 0);
+
+        in += npages * PAGE_SIZE;
+        out += len;
+    }
+    g_assert_cmpuint(out, <, in);
+
+    multifd_compressor_free(c);
+    multifd_compressor_free(d);
+    g_free(src);
+    g_free(dst);
+    g_free(zbuf);
+}
+
+/* A packet that does not decompress to exactly the expected pages */
+static void test_size_mismatch(const void *opaque)
+{
+    MultiFDCompression method = GPOINTER_TO_INT(opaque);
+    MultiFDCompressor *c, *d;
+    size_t bound = multifd_compress_bound(method, 2 * PAGE_SIZE);
+    uint8_t *src = g_malloc(2 * PAGE_SIZE);
+    uint8_t *dst = g_malloc(2 * PAGE_SIZE);
+    uint8_t *zbuf = g_malloc(bound);
+    struct iovec siov[2], diov[2];
+    Error *err = NULL;
+    ssize_t len;
+
+    c = multifd_compressor_new(method, true, 1, &error_abort);
+    d = multifd_compressor_new(method, false, 0, &error_abort);
+
+    fill_pages(src, 2, 0);
+    setup_iov(siov, src, 2);
+    setup_iov(diov, dst, 2);
+
+    /* one page sent, two expected */
+    len = multifd_compress(c, siov, 1, zbuf, bound, &error_abort);
+    g_assert_cmpint(len, >, 0);
+    g_assert_cmpint(multifd_decompress(d, zbuf, len, diov, 2, &err), ==, -1);
+    g_assert(err);
+    error_free(err);
+
+    multifd_compressor_free(c);
+    multifd_compressor_free(d);
+    g_free(src);
+    g_free(dst);
+    g_free(zbuf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/multifd-compress/zlib/roundtrip",
+                         GINT_TO_POINTER(MULTIFD_COMPRESSION_ZLIB),
+                         test_roundtrip);
+    g_test_add_data_func("/multifd-compress/zlib/size_mismatch",
+                         GINT_TO_POINTER(MULTIFD_COMPRESSION_ZLIB),
+                         test_size_mismatch);
+#ifdef CONFIG_ZSTD
+    g_test_add_data_func("/multifd-compress/zstd/roundtrip",
+                         GINT_TO_POINTER(MULTIFD_COMPRESSION_ZSTD),
+                         test_roundtrip);
+    g_test_add_data_func("/multifd-compress/zstd/size_mismatch",
+                         GINT_TO_POINTER(MULTIFD_COMPRESSION_ZSTD),
+                         test_size_mismatch);
+#endif
+
+    return g_test_run();
+}
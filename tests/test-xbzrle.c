@@ -13,7 +13,9 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qemu/cutils.h"
+#include "qapi/error.h"
 #include "../migration/xbzrle.h"
+#include "../migration/page_cache.h"
 
 #define PAGE_SIZE 4096
 
@@ -174,6 +176,117 @@ static void test_encode_decode(void)
     }
 }
 
+/* Byte at a time encoder, to check the vectorized run finding against */
+static int reference_encode(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                            uint8_t *dst, int dlen)
+{
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        for (start = i; i < slen && old_buf[i] == new_buf[i]; i++) {
+            /* nothing */
+        }
+        if (i - start == slen) {
+            return 0;
+        }
+        if (i == slen) {
+            return d;
+        }
+        d += uleb128_encode_small(dst + d, i - start);
+        if (d + 2 > dlen) {
+            return -1;
+        }
+        for (start = i; i < slen && old_buf[i] != new_buf[i]; i++) {
+            /* nothing */
+        }
+        d += uleb128_encode_small(dst + d, i - start);
+        if (d + i - start > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, i - start);
+        d += i - start;
+    }
+    return d;
+}
+
+static void encode_accel_range(uint8_t *old_buf, uint8_t *new_buf,
+                               uint8_t *compressed, uint8_t *expected)
+{
+    int i, n, len, pos, dlen, rc;
+
+    for (i = 0; i < PAGE_SIZE; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, PAGE_SIZE);
+
+    /* runs of all lengths, so that they end anywhere in a vector */
+    n = g_test_rand_int_range(1, 200);
+    for (i = 0; i < n; i++) {
+        pos = g_test_rand_int_range(0, PAGE_SIZE);
+        len = g_test_rand_int_range(1, 130);
+        for (; len && pos < PAGE_SIZE; len--, pos++) {
+            new_buf[pos] = old_buf[pos] + g_test_rand_int_range(1, 256);
+        }
+    }
+
+    dlen = g_test_rand_bit() ? PAGE_SIZE : g_test_rand_int_range(0, PAGE_SIZE);
+    rc = xbzrle_encode_buffer(old_buf, new_buf, PAGE_SIZE, compressed, dlen);
+    g_assert_cmpint(rc, ==,
+                    reference_encode(old_buf, new_buf, PAGE_SIZE, expected,
+                                     dlen));
+    if (rc > 0) {
+        g_assert(memcmp(compressed, expected, rc) == 0);
+    }
+}
+
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(PAGE_SIZE);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *expected = g_malloc(PAGE_SIZE);
+    int i;
+
+    do {
+        for (i = 0; i < 1000; i++) {
+            encode_accel_range(old_buf, new_buf, compressed, expected);
+        }
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+    g_free(expected);
+}
+
+static void test_page_cache_conflict(void)
+{
+    PageCache *cache = cache_init(64 * PAGE_SIZE, PAGE_SIZE, &error_abort);
+    uint8_t *page = g_malloc0(PAGE_SIZE);
+    uint64_t addr;
+    int i;
+
+    /* These addresses collide in a direct-mapped cache of 64 pages */
+    for (i = 0; i < 4; i++) {
+        addr = (uint64_t)i * 64 * PAGE_SIZE;
+        page[0] = i;
+        g_assert_cmpint(cache_insert(cache, addr, page, 1), ==, 0);
+    }
+    for (i = 0; i < 4; i++) {
+        addr = (uint64_t)i * 64 * PAGE_SIZE;
+        g_assert(cache_is_cached(cache, addr, 1));
+        g_assert_cmpint(get_cached_data(cache, addr)[0], ==, i);
+    }
+    g_assert(!cache_is_cached(cache, 4 * 64 * PAGE_SIZE, 1));
+    g_assert(get_cached_data(cache, 4 * 64 * PAGE_SIZE) == NULL);
+
+    cache_fini(cache);
+    g_free(page);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +299,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
+    g_test_add_func("/xbzrle/page_cache_conflict", test_page_cache_conflict);
 
     return g_test_run();
 }
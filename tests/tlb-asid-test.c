@@ -0,0 +1,149 @@
+/*
+ * QTest testcase for address space identifiers in the TCG TLB
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2
+ * or later. See the COPYING file in the top-level directory.
+ *
+ * A tiny ARMv7 firmware maps the same virtual page to a different
+ * physical page in two address spaces, and switches between them many
+ * times through CONTEXTIDR and TTBR0.  Each address space must always see
+ * its own page, and "info jit" must report that the switches did not
+ * flush the whole TLB.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define NR_SWITCHES     0x20000
+
+static const uint8_t bios_asid[] = {
+    /* First level tables: 0x40000000 for ASID 1, 0x40004000 for ASID 2 */
+    0x00, 0x00, 0x00, 0xe3,     /* movw  r0, #0x0000 */
+    0x00, 0x00, 0x44, 0xe3,     /* movt  r0, #0x4000 */
+    0x00, 0x10, 0x04, 0xe3,     /* movw  r1, #0x4000 */
+    0x00, 0x10, 0x44, 0xe3,     /* movt  r1, #0x4000 */
+    /* Global sections for the code at 0 and the UART, in both tables */
+    0x02, 0x2c, 0x00, 0xe3,     /* movw  r2, #0x0c02 */
+    0x00, 0x20, 0x80, 0xe5,     /* str   r2, [r0] */
+    0x00, 0x20, 0x81, 0xe5,     /* str   r2, [r1] */
+    0x00, 0x29, 0x40, 0xe3,     /* movt  r2, #0x0900 */
+    0x40, 0x22, 0x80, 0xe5,     /* str   r2, [r0, #0x240] */
+    0x40, 0x22, 0x81, 0xe5,     /* str   r2, [r1, #0x240] */
+    /* Non-global 0x80000000: 0x40100000 in ASID 1, 0x40200000 in ASID 2 */
+    0x12, 0x20, 0x44, 0xe3,     /* movt  r2, #0x4012 */
+    0x02, 0x3a, 0x80, 0xe2,     /* add   r3, r0, #0x2000 */
+    0x00, 0x20, 0x83, 0xe5,     /* str   r2, [r3] */
+    0x22, 0x20, 0x44, 0xe3,     /* movt  r2, #0x4022 */
+    0x02, 0x3a, 0x81, 0xe2,     /* add   r3, r1, #0x2000 */
+    0x00, 0x20, 0x83, 0xe5,     /* str   r2, [r3] */
+    /* Tag the two pages with the number of their ASID */
+    0x01, 0x20, 0xa0, 0xe3,     /* mov   r2, #1 */
+    0x00, 0x30, 0x00, 0xe3,     /* movw  r3, #0 */
+    0x10, 0x30, 0x44, 0xe3,     /* movt  r3, #0x4010 */
+    0x00, 0x20, 0x83, 0xe5,     /* str   r2, [r3] */
+    0x02, 0x20, 0xa0, 0xe3,     /* mov   r2, #2 */
+    0x20, 0x30, 0x44, 0xe3,     /* movt  r3, #0x4020 */
+    0x00, 0x20, 0x83, 0xe5,     /* str   r2, [r3] */
+    /* Enable the MMU with ASID 1, all domains are manager */
+    0x00, 0x20, 0xa0, 0xe3,     /* mov   r2, #0 */
+    0x50, 0x2f, 0x02, 0xee,     /* mcr   p15, 0, r2, c2, c0, 2 */
+    0x00, 0x20, 0xe0, 0xe3,     /* mvn   r2, #0 */
+    0x10, 0x2f, 0x03, 0xee,     /* mcr   p15, 0, r2, c3, c0, 0 */
+    0x10, 0x0f, 0x02, 0xee,     /* mcr   p15, 0, r0, c2, c0, 0 */
+    0x01, 0x20, 0xa0, 0xe3,     /* mov   r2, #1 */
+    0x30, 0x2f, 0x0d, 0xee,     /* mcr   p15, 0, r2, c13, c0, 1 */
+    0x10, 0x2f, 0x11, 0xee,     /* mrc   p15, 0, r2, c1, c0, 0 */
+    0x01, 0x20, 0x82, 0xe3,     /* orr   r2, r2, #1 */
+    0x10, 0x2f, 0x01, 0xee,     /* mcr   p15, 0, r2, c1, c0, 0 */
+    0x6f, 0xf0, 0x7f, 0xf5,     /* isb */
+    /* 0x10000 times: switch to ASID 2, check the page, and back to 1 */
+    0x02, 0x51, 0xa0, 0xe3,     /* mov   r5, #0x80000000 */
+    0x00, 0x60, 0x00, 0xe3,     /* movw  r6, #0 */
+    0x00, 0x69, 0x40, 0xe3,     /* movt  r6, #0x0900 */
+    0x01, 0x48, 0xa0, 0xe3,     /* mov   r4, #0x10000 */
+    /* loop: */
+    0x02, 0x20, 0xa0, 0xe3,     /* mov   r2, #2 */
+    0x30, 0x2f, 0x0d, 0xee,     /* mcr   p15, 0, r2, c13, c0, 1 */
+    0x10, 0x1f, 0x02, 0xee,     /* mcr   p15, 0, r1, c2, c0, 0 */
+    0x6f, 0xf0, 0x7f, 0xf5,     /* isb */
+    0x00, 0x70, 0x95, 0xe5,     /* ldr   r7, [r5] */
+    0x02, 0x00, 0x57, 0xe3,     /* cmp   r7, #2 */
+    0x0a, 0x00, 0x00, 0x1a,     /* bne   fail */
+    0x01, 0x20, 0xa0, 0xe3,     /* mov   r2, #1 */
+    0x30, 0x2f, 0x0d, 0xee,     /* mcr   p15, 0, r2, c13, c0, 1 */
+    0x10, 0x0f, 0x02, 0xee,     /* mcr   p15, 0, r0, c2, c0, 0 */
+    0x6f, 0xf0, 0x7f, 0xf5,     /* isb */
+    0x00, 0x70, 0x95, 0xe5,     /* ldr   r7, [r5] */
+    0x01, 0x00, 0x57, 0xe3,     /* cmp   r7, #1 */
+    0x03, 0x00, 0x00, 0x1a,     /* bne   fail */
+    0x01, 0x40, 0x54, 0xe2,     /* subs  r4, r4, #1 */
+    0xef, 0xff, 0xff, 0x1a,     /* bne   loop */
+    /* Print 'T' if each ASID always saw its own page, 'F' otherwise */
+    0x54, 0x20, 0xa0, 0xe3,     /* mov   r2, #0x54 */
+    0x00, 0x00, 0x00, 0xea,     /* b     done */
+    /* fail: */
+    0x46, 0x20, 0xa0, 0xe3,     /* mov   r2, #0x46 */
+    /* done: */
+    0x00, 0x20, 0xc6, 0xe5,     /* strb  r2, [r6] */
+    0xfd, 0xff, 0xff, 0xea      /* b     done */
+};
+
+static unsigned long jit_stat(const char *info, const char *name)
+{
+    const char *p = strstr(info, name);
+
+    g_assert(p);
+    return strtoul(p + strlen(name), NULL, 10);
+}
+
+static void test_asid_switch(void)
+{
+    char serialtmp[] = "/tmp/qtest-tlb-asid-sXXXXXX";
+    char codetmp[] = "/tmp/qtest-tlb-asid-cXXXXXX";
+    int ser_fd, code_fd, i;
+    char ch = 0;
+    char *info;
+
+    ser_fd = mkstemp(serialtmp);
+    g_assert(ser_fd != -1);
+    code_fd = mkstemp(codetmp);
+    g_assert(code_fd != -1);
+    g_assert(write(code_fd, bios_asid, sizeof(bios_asid)) ==
+             sizeof(bios_asid));
+    close(code_fd);
+
+    global_qtest = qtest_startf("-bios %s -M virt,accel=tcg "
+                                "-cpu cortex-a15 "
+                                "-chardev file,id=serial0,path=%s "
+                                "-no-shutdown -serial chardev:serial0",
+                                codetmp, serialtmp);
+    unlink(serialtmp);
+    unlink(codetmp);
+
+    /* Wait at most 60 seconds for the loop to finish */
+    for (i = 0; i < 6000 && read(ser_fd, &ch, 1) != 1; i++) {
+        g_usleep(10000);
+    }
+    g_assert_cmpint(ch, ==, 'T');
+
+    /*
+     * Two switches per iteration, but only the reset and the firmware's
+     * few setup writes may flush everything.
+     */
+    info = hmp("info jit");
+    g_assert_cmpuint(jit_stat(info, "asid switches"), >=, NR_SWITCHES);
+    g_assert_cmpuint(jit_stat(info, "TLB flush count"), <, 100);
+    g_free(info);
+
+    qtest_quit(global_qtest);
+    close(ser_fd);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/tlb/asid/switch", test_asid_switch);
+
+    return g_test_run();
+}
@@ -530,6 +530,139 @@ static void pci_msix(void)
     qtest_shutdown(qs);
 }
 
+static void iothreads_write(QOSState *qs, QVirtioPCIDevice *dev,
+                            QVirtQueuePCI *vqpci, uint64_t sector)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+    uint8_t status;
+
+    req.type = VIRTIO_BLK_T_OUT;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    strcpy(req.data, "TEST");
+
+    req_addr = virtio_blk_request(qs->alloc, &dev->vdev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(&vqpci->vq, req_addr, 16, false, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 16, 512, false, true);
+    qvirtqueue_add(&vqpci->vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(&dev->vdev, &vqpci->vq, free_head);
+
+    qvirtio_wait_used_elem(&dev->vdev, &vqpci->vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+
+    status = readb(req_addr + 528);
+    g_assert_cmpint(status, ==, 0);
+
+    guest_free(qs->alloc, req_addr);
+}
+
+/* With num-iothreads, requests must be completed in the iothread of their
+ * virtqueue rather than in the one that owns the drive.  This is observed
+ * through the virtio_blk_data_plane_vq_done trace event.
+ */
+static void pci_iothreads(void)
+{
+    QVirtioPCIDevice *dev;
+    QOSState *qs;
+    QVirtQueuePCI *vqpci[2];
+    char *tmp_path;
+    char *log_path;
+    char *log;
+    char **lines;
+    void *vq_ctx[2] = { NULL, NULL };
+    void *home = NULL;
+    uint32_t features;
+    int fd, i;
+
+#ifndef CONFIG_TRACE_LOG
+    g_test_skip("needs the log trace backend");
+    return;
+#endif
+
+    tmp_path = drive_create();
+    log_path = g_strdup("/tmp/qtest-iothreads.XXXXXX");
+    fd = mkstemp(log_path);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+
+    qs = qtest_pc_boot("-object iothread,id=iothread0 "
+                       "-drive if=none,id=drive0,file=%s,format=raw "
+                       "-device virtio-blk-pci,id=drv0,drive=drive0,"
+                       "addr=%x.%x,iothread=iothread0,num-queues=2,"
+                       "num-iothreads=2 "
+                       "-trace enable=virtio_blk_data_plane_vq_done -D %s",
+                       tmp_path, PCI_SLOT, PCI_FN, log_path);
+    global_qtest = qs->qts;
+    unlink(tmp_path);
+    g_free(tmp_path);
+
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+    qpci_msix_enable(dev->pdev);
+    qvirtio_pci_set_msix_configuration_vector(dev, qs->alloc, 0);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    for (i = 0; i < 2; i++) {
+        vqpci[i] = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc,
+                                                     i);
+        qvirtqueue_pci_msix_setup(dev, vqpci[i], qs->alloc, i + 1);
+    }
+
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    for (i = 0; i < 2; i++) {
+        iothreads_write(qs, dev, vqpci[i], i);
+    }
+
+    for (i = 0; i < 2; i++) {
+        qvirtqueue_cleanup(dev->vdev.bus, &vqpci[i]->vq, qs->alloc);
+    }
+    qpci_msix_disable(dev->pdev);
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+
+    g_assert(g_file_get_contents(log_path, &log, NULL, NULL));
+    unlink(log_path);
+    g_free(log_path);
+    lines = g_strsplit(log, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        const char *ev = strstr(lines[i], "virtio_blk_data_plane_vq_done ");
+        void *dp, *ctx, *home_ctx;
+        unsigned vq, n;
+
+        if (!ev) {
+            continue;
+        }
+        g_assert_cmpint(sscanf(ev, "virtio_blk_data_plane_vq_done "
+                               "dataplane %p vq %u reqs %u ctx %p home %p",
+                               &dp, &vq, &n, &ctx, &home_ctx), ==, 5);
+        g_assert_cmpuint(vq, <, 2);
+        g_assert(ctx != home_ctx);
+        g_assert(!home || home == home_ctx);
+        g_assert(!vq_ctx[vq] || vq_ctx[vq] == ctx);
+        home = home_ctx;
+        vq_ctx[vq] = ctx;
+    }
+    g_strfreev(lines);
+    g_free(log);
+
+    /* Each virtqueue completed in an iothread of its own */
+    g_assert(vq_ctx[0] && vq_ctx[1]);
+    g_assert(vq_ctx[0] != vq_ctx[1]);
+}
+
 static void pci_idx(void)
 {
     QVirtioPCIDevice *dev;
@@ -755,6 +888,7 @@ int main(int argc, char **argv)
         if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
             qtest_add_func("/virtio/blk/pci/msix", pci_msix);
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
+            qtest_add_func("/virtio/blk/pci/iothreads", pci_iothreads);
         }
         qtest_add_func("/virtio/blk/pci/hotplug", pci_hotplug);
     } else if (strcmp(arch, "arm") == 0) {
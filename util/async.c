@@ -262,12 +262,29 @@ aio_ctx_dispatch(GSource     *source,
     return true;
 }
 
+static void aio_bounce_pool_free(AioContext *ctx)
+{
+    int i;
+
+    for (i = 0; i < AIO_BOUNCE_CLASSES; i++) {
+        while (ctx->bounce_free[i]) {
+            void *buf = ctx->bounce_free[i];
+
+            ctx->bounce_free[i] = *(void **)buf;
+            qemu_vfree(buf);
+        }
+        ctx->bounce_nr_free[i] = 0;
+    }
+    qemu_mutex_destroy(&ctx->bounce_lock);
+}
+
 static void
 aio_ctx_finalize(GSource     *source)
 {
     AioContext *ctx = (AioContext *) source;
 
     thread_pool_free(ctx->thread_pool);
+    aio_bounce_pool_free(ctx);
 
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
@@ -277,6 +294,14 @@ aio_ctx_finalize(GSource     *source)
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (ctx->linux_io_uring) {
+        luring_detach_aio_context(ctx->linux_io_uring, ctx);
+        luring_cleanup(ctx->linux_io_uring);
+        ctx->linux_io_uring = NULL;
+    }
+#endif
+
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
     qemu_bh_delete(ctx->co_schedule_bh);
 
@@ -332,6 +357,108 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+{
+    if (ctx->linux_io_uring) {
+        return ctx->linux_io_uring;
+    }
+
+    ctx->linux_io_uring = luring_init(errp);
+    if (!ctx->linux_io_uring) {
+        return NULL;
+    }
+
+    luring_attach_aio_context(ctx->linux_io_uring, ctx);
+    return ctx->linux_io_uring;
+}
+
+LuringState *aio_get_linux_io_uring(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring);
+    return ctx->linux_io_uring;
+}
+#endif
+
+/*
+ * Return the size class for a bounce buffer, or -1 if the buffer is not
+ * pooled.  Buffers of a class are aligned to their size, up to the host
+ * page size.
+ */
+static int aio_bounce_class(size_t size, size_t align)
+{
+    int shift;
+
+    if (size > AIO_BOUNCE_MAX_SIZE) {
+        return -1;
+    }
+    shift = size <= (1 << AIO_BOUNCE_MIN_SHIFT) ? AIO_BOUNCE_MIN_SHIFT
+                                                : 64 - clz64(size - 1);
+    if (align > MIN(1 << shift, qemu_real_host_page_size)) {
+        return -1;
+    }
+    return shift - AIO_BOUNCE_MIN_SHIFT;
+}
+
+static void *aio_bounce_buf_alloc(AioContext *ctx, size_t size, size_t align,
+                                  bool abort_on_failure)
+{
+    int idx = aio_bounce_class(size, align);
+    size_t class_size;
+    void *buf;
+
+    if (idx < 0) {
+        return abort_on_failure ? qemu_memalign(align, size)
+                                : qemu_try_memalign(align, size);
+    }
+
+    qemu_mutex_lock(&ctx->bounce_lock);
+    buf = ctx->bounce_free[idx];
+    if (buf) {
+        ctx->bounce_free[idx] = *(void **)buf;
+        ctx->bounce_nr_free[idx]--;
+    }
+    qemu_mutex_unlock(&ctx->bounce_lock);
+    if (buf) {
+        return buf;
+    }
+
+    class_size = 1 << (idx + AIO_BOUNCE_MIN_SHIFT);
+    align = MIN(class_size, qemu_real_host_page_size);
+    return abort_on_failure ? qemu_memalign(align, class_size)
+                            : qemu_try_memalign(align, class_size);
+}
+
+void *aio_bounce_buf_get(AioContext *ctx, size_t size, size_t align)
+{
+    return aio_bounce_buf_alloc(ctx, size, align, true);
+}
+
+void *aio_bounce_buf_try_get(AioContext *ctx, size_t size, size_t align)
+{
+    return aio_bounce_buf_alloc(ctx, size, align, false);
+}
+
+void aio_bounce_buf_put(AioContext *ctx, void *buf, size_t size, size_t align)
+{
+    int idx = aio_bounce_class(size, align);
+
+    if (!buf) {
+        return;
+    }
+    if (idx >= 0) {
+        qemu_mutex_lock(&ctx->bounce_lock);
+        if (ctx->bounce_nr_free[idx] < AIO_BOUNCE_MAX_FREE) {
+            *(void **)buf = ctx->bounce_free[idx];
+            ctx->bounce_free[idx] = buf;
+            ctx->bounce_nr_free[idx]++;
+            buf = NULL;
+        }
+        qemu_mutex_unlock(&ctx->bounce_lock);
+    }
+    qemu_vfree(buf);
+}
+
 void aio_notify(AioContext *ctx)
 {
     /* Write e.g. bh->scheduled before reading ctx->notify_me.  Pairs
@@ -423,7 +550,12 @@ AioContext *aio_context_new(Error **errp)
 #ifdef CONFIG_LINUX_AIO
     ctx->linux_aio = NULL;
 #endif
+
+#ifdef CONFIG_LINUX_IO_URING
+    ctx->linux_io_uring = NULL;
+#endif
     ctx->thread_pool = NULL;
+    qemu_mutex_init(&ctx->bounce_lock);
     qemu_rec_mutex_init(&ctx->lock);
     timerlistgroup_init(&ctx->tlg, aio_timerlist_notify, ctx);
 
@@ -13,6 +13,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/atomic.h"
+#include "qemu/cutils.h"
 
 /*
  * bitmaps provide an array of bits, implemented using an
@@ -298,6 +299,55 @@ void bitmap_copy_and_clear_atomic(unsigned long *dst, unsigned long *src,
     }
 }
 
+/* Words of the source bitmap that are scanned and counted at once */
+#define SYNC_BATCH_WORDS 64
+
+/*
+ * OR @nwords words of @src, starting at word @start, into @dst and clear
+ * them atomically.  @src is split in blocks of @block_words words, like
+ * the dirty memory bitmaps.  Returns the number of bits that were newly
+ * set in @dst, and adds the number of bits found in @src to *@src_count.
+ */
+uint64_t bitmap_sync_blocks_atomic(unsigned long *dst,
+                                   unsigned long *const *src,
+                                   unsigned long block_words,
+                                   unsigned long start, long nwords,
+                                   uint64_t *src_count)
+{
+    unsigned long idx = start / block_words;
+    unsigned long offset = start % block_words;
+    uint64_t num_dirty = 0;
+    long k, n;
+
+    for (k = 0; k < nwords; k += n) {
+        unsigned long *p = &src[idx][offset];
+        unsigned long bits[SYNC_BATCH_WORDS], new_dirty[SYNC_BATCH_WORDS];
+        long i;
+
+        /* A batch never crosses a block */
+        n = MIN(nwords - k, SYNC_BATCH_WORDS);
+        n = MIN(n, (long)(block_words - offset));
+
+        /* After the first pass, most of a dirty bitmap is clean */
+        if (!buffer_is_zero(p, n * sizeof(unsigned long))) {
+            for (i = 0; i < n; i++) {
+                bits[i] = p[i] ? atomic_xchg(&p[i], 0) : 0;
+                new_dirty[i] = bits[i] & ~dst[k + i];
+                dst[k + i] |= bits[i];
+            }
+            *src_count += bitmap_count_one(bits, n * BITS_PER_LONG);
+            num_dirty += bitmap_count_one(new_dirty, n * BITS_PER_LONG);
+        }
+
+        offset += n;
+        if (offset == block_words) {
+            offset = 0;
+            idx++;
+        }
+    }
+    return num_dirty;
+}
+
 #define ALIGN_MASK(x,mask)      (((x)+(mask))&~(mask))
 
 /**
@@ -356,13 +406,63 @@ int slow_bitmap_intersects(const unsigned long *bitmap1,
     return 0;
 }
 
-long slow_bitmap_count_one(const unsigned long *bitmap, long nbits)
+static long count_one_words(const unsigned long *bitmap, long nwords)
 {
-    long k, lim = nbits / BITS_PER_LONG, result = 0;
+    long k, result = 0;
 
-    for (k = 0; k < lim; k++) {
+    for (k = 0; k < nwords; k++) {
         result += ctpopl(bitmap[k]);
     }
+    return result;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#include "qemu/cpuid.h"
+
+#pragma GCC push_options
+#pragma GCC target("popcnt")
+
+/* Four sums, so that the additions do not wait on each POPCNT in turn */
+static long count_one_words_popcnt(const unsigned long *bitmap, long nwords)
+{
+    long k, r0 = 0, r1 = 0, r2 = 0, r3 = 0;
+
+    for (k = 0; k + 4 <= nwords; k += 4) {
+        r0 += __builtin_popcountl(bitmap[k]);
+        r1 += __builtin_popcountl(bitmap[k + 1]);
+        r2 += __builtin_popcountl(bitmap[k + 2]);
+        r3 += __builtin_popcountl(bitmap[k + 3]);
+    }
+    for (; k < nwords; k++) {
+        r0 += __builtin_popcountl(bitmap[k]);
+    }
+    return r0 + r1 + r2 + r3;
+}
+
+#pragma GCC pop_options
+
+static long (*count_one_words_accel)(const unsigned long *, long) =
+    count_one_words;
+
+static void __attribute__((constructor)) init_count_one_accel(void)
+{
+    unsigned a, b, c, d;
+
+    if (__get_cpuid_max(0, NULL) >= 1) {
+        __cpuid(1, a, b, c, d);
+        if (c & bit_POPCNT) {
+            count_one_words_accel = count_one_words_popcnt;
+        }
+    }
+}
+#else
+#define count_one_words_accel count_one_words
+#endif
+
+long slow_bitmap_count_one(const unsigned long *bitmap, long nbits)
+{
+    long k = nbits / BITS_PER_LONG;
+    long result = count_one_words_accel(bitmap, k);
 
     if (nbits % BITS_PER_LONG) {
         result += ctpopl(bitmap[k] & BITMAP_LAST_WORD_MASK(nbits));
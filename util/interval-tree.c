@@ -0,0 +1,178 @@
+/*
+ * Interval tree
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+static inline int node_height(IntervalTreeNode *n)
+{
+    return n ? n->height : 0;
+}
+
+static void node_update(IntervalTreeNode *n)
+{
+    n->height = 1 + MAX(node_height(n->left), node_height(n->right));
+    n->subtree_end = n->end;
+    if (n->left) {
+        n->subtree_end = MAX(n->subtree_end, n->left->subtree_end);
+    }
+    if (n->right) {
+        n->subtree_end = MAX(n->subtree_end, n->right->subtree_end);
+    }
+}
+
+/*
+ * Nodes are ordered by start offset; identical intervals are told apart
+ * by their address, so that a given node can always be found again.
+ */
+static inline bool node_less(IntervalTreeNode *a, IntervalTreeNode *b)
+{
+    if (a->start != b->start) {
+        return a->start < b->start;
+    }
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+static IntervalTreeNode *rotate_left(IntervalTreeNode *n)
+{
+    IntervalTreeNode *r = n->right;
+
+    n->right = r->left;
+    r->left = n;
+    node_update(n);
+    node_update(r);
+    return r;
+}
+
+static IntervalTreeNode *rotate_right(IntervalTreeNode *n)
+{
+    IntervalTreeNode *l = n->left;
+
+    n->left = l->right;
+    l->right = n;
+    node_update(n);
+    node_update(l);
+    return l;
+}
+
+static IntervalTreeNode *rebalance(IntervalTreeNode *n)
+{
+    int balance = node_height(n->left) - node_height(n->right);
+
+    if (balance > 1) {
+        if (node_height(n->left->left) < node_height(n->left->right)) {
+            n->left = rotate_left(n->left);
+        }
+        return rotate_right(n);
+    }
+    if (balance < -1) {
+        if (node_height(n->right->right) < node_height(n->right->left)) {
+            n->right = rotate_right(n->right);
+        }
+        return rotate_left(n);
+    }
+
+    node_update(n);
+    return n;
+}
+
+static IntervalTreeNode *do_insert(IntervalTreeNode *root,
+                                   IntervalTreeNode *node)
+{
+    if (!root) {
+        node->left = node->right = NULL;
+        node_update(node);
+        return node;
+    }
+
+    if (node_less(node, root)) {
+        root->left = do_insert(root->left, node);
+    } else {
+        root->right = do_insert(root->right, node);
+    }
+    return rebalance(root);
+}
+
+static IntervalTreeNode *remove_min(IntervalTreeNode *n,
+                                   IntervalTreeNode **min)
+{
+    if (!n->left) {
+        *min = n;
+        return n->right;
+    }
+    n->left = remove_min(n->left, min);
+    return rebalance(n);
+}
+
+static IntervalTreeNode *do_remove(IntervalTreeNode *root,
+                                   IntervalTreeNode *node)
+{
+    IntervalTreeNode *min, *right;
+
+    assert(root);
+    if (root == node) {
+        if (!root->right) {
+            return root->left;
+        }
+        right = remove_min(root->right, &min);
+        min->right = right;
+        min->left = root->left;
+        return rebalance(min);
+    }
+
+    if (node_less(node, root)) {
+        root->left = do_remove(root->left, node);
+    } else {
+        root->right = do_remove(root->right, node);
+    }
+    return rebalance(root);
+}
+
+static IntervalTreeNode *do_find(IntervalTreeNode *n,
+                                 uint64_t start, uint64_t end,
+                                 IntervalTreeFunc *func, void *opaque)
+{
+    IntervalTreeNode *found;
+
+    if (!n || n->subtree_end <= start) {
+        return NULL;
+    }
+
+    found = do_find(n->left, start, end, func, opaque);
+    if (found) {
+        return found;
+    }
+
+    /* Neither this node nor its right subtree start early enough */
+    if (n->start >= end) {
+        return NULL;
+    }
+    if (start < n->end && func(n, opaque)) {
+        return n;
+    }
+
+    return do_find(n->right, start, end, func, opaque);
+}
+
+void interval_tree_insert(IntervalTree *tree, IntervalTreeNode *node)
+{
+    tree->root = do_insert(tree->root, node);
+}
+
+void interval_tree_remove(IntervalTree *tree, IntervalTreeNode *node)
+{
+    tree->root = do_remove(tree->root, node);
+    node->left = node->right = NULL;
+}
+
+IntervalTreeNode *interval_tree_find_overlap(IntervalTree *tree,
+                                             uint64_t start, uint64_t end,
+                                             IntervalTreeFunc *func,
+                                             void *opaque)
+{
+    return do_find(tree->root, start, end, func, opaque);
+}
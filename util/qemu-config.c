@@ -171,6 +171,10 @@ static QemuOptsList machine_opts = {
             .name = "kvm_shadow_mem",
             .type = QEMU_OPT_SIZE,
             .help = "KVM shadow MMU size",
+        },{
+            .name = "kvm-dirty-ring-size",
+            .type = QEMU_OPT_NUMBER,
+            .help = "KVM dirty ring entries per vCPU",
         },{
             .name = "kernel",
             .type = QEMU_OPT_STRING,
@@ -334,6 +334,21 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "hot-threshold",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Retranslate TBs after this many executions",
+        },
+        {
+            .name = "tb-profile",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Sample one TB execution out of this many",
+        },
+        {
+            .name = "regalloc",
+            .type = QEMU_OPT_STRING,
+            .help = "TCG register allocation scope (ebb or bb)",
+        },
         { /* end of list */ }
     },
 };